@@ -0,0 +1,45 @@
+//////////////////////////////////////////////////////////////////////////////////////
+// HeatmapBenchmarks.cpp: Console application to benchmark HeatmapServiceLib
+// Usage: HeatmapBenchmarks [--quick] [--threads N] [filter]
+// --quick runs a small fraction of the operations, to check every benchmark still runs. Only benchmarks whose name contains filter are run
+// Written by: Pedro Engana (http://pedroengana.com)
+//////////////////////////////////////////////////////////////////////////////////////
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "HeatmapService.h"
+
+#include "BenchmarkRunner.h"
+#include "ContainerMicroBenchmarks.h"
+#include "HeatmapServiceBenchmarks.h"
+
+using namespace std;
+using namespace heatmap_service;
+
+int main(int argc, char* argv[])
+{
+  const double kQuickScale = 0.02;
+
+  double scale = 1.0;
+  string filter;
+  for (int arg = 1; arg < argc; arg++)
+  {
+    string argument = argv[arg];
+    if (argument == "--quick")
+      scale = kQuickScale;
+    else if (argument == "--threads" && arg + 1 < argc)
+      HeatmapService::SetWorkerThreadCount(atoi(argv[++arg]));
+    else
+      filter = argument;
+  }
+
+  cout << "HeatmapBenchmarks, " << HeatmapService::worker_thread_count() << " worker threads"
+    << (scale != 1.0 ? ", quick run" : "") << (filter.empty() ? "" : ", filter: " + filter) << endl << endl;
+
+  BenchmarkRunner runner(filter, scale);
+  runner.PrintHeader();
+  RunContainerMicroBenchmarks(runner);
+  RunHeatmapServiceBenchmarks(runner);
+
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,203 @@
+//////////////////////////////////////////////////////////////////////////////////////
+// BenchmarkRunner.cpp: Timing, allocation counting and memory measurements of the benchmarks
+// Written by: Pedro Engana (http://pedroengana.com)
+//////////////////////////////////////////////////////////////////////////////////////
+
+#include "BenchmarkRunner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+// -- Allocation counting
+namespace
+{
+  std::atomic<long long> g_allocation_count(0);
+  std::atomic<long long> g_allocated_bytes(0);
+
+  void* CountedAllocation(size_t size)
+  {
+    g_allocation_count.fetch_add(1, std::memory_order_relaxed);
+    g_allocated_bytes.fetch_add((long long)size, std::memory_order_relaxed);
+    return malloc(size > 0 ? size : 1);
+  }
+}
+
+void* operator new(size_t size)
+{
+  void* memory = CountedAllocation(size);
+  if (!memory)
+    throw std::bad_alloc();
+  return memory;
+}
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+void* operator new(size_t size, const std::nothrow_t&) throw()
+{
+  return CountedAllocation(size);
+}
+void* operator new[](size_t size, const std::nothrow_t&) throw()
+{
+  return CountedAllocation(size);
+}
+void operator delete(void* memory) throw()
+{
+  free(memory);
+}
+void operator delete[](void* memory) throw()
+{
+  free(memory);
+}
+void operator delete(void* memory, const std::nothrow_t&) throw()
+{
+  free(memory);
+}
+void operator delete[](void* memory, const std::nothrow_t&) throw()
+{
+  free(memory);
+}
+
+long long AllocationCount()
+{
+  return g_allocation_count.load();
+}
+
+long long AllocatedBytes()
+{
+  return g_allocated_bytes.load();
+}
+
+// -- Peak resident memory
+bool ResetPeakResidentMemory()
+{
+#if defined(__linux__)
+  // Writing 5 to clear_refs resets the peak resident memory (VmHWM) of the process to its current size
+  FILE* clear_refs = fopen("/proc/self/clear_refs", "w");
+  if (!clear_refs)
+    return false;
+  bool reset = fputs("5", clear_refs) >= 0;
+  return fclose(clear_refs) == 0 && reset;
+#else
+  return false;
+#endif
+}
+
+long long PeakResidentMemory()
+{
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return (long long)counters.PeakWorkingSetSize;
+  return 0;
+#else
+#if defined(__linux__)
+  // VmHWM honours the resets, unlike getrusage
+  FILE* status = fopen("/proc/self/status", "r");
+  if (status)
+  {
+    char line[256];
+    long long peak_kb = -1;
+    while (fgets(line, sizeof(line), status))
+    {
+      if (strncmp(line, "VmHWM:", 6) == 0)
+      {
+        peak_kb = atoll(line + 6);
+        break;
+      }
+    }
+    fclose(status);
+    if (peak_kb >= 0)
+      return peak_kb * 1024;
+  }
+#endif
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#if defined(__APPLE__)
+  return (long long)usage.ru_maxrss;
+#else
+  return (long long)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// -- BenchmarkRunner
+BenchmarkRunner::BenchmarkRunner(const std::string &filter, double scale) : filter_(filter), scale_(scale), clock_overhead_ns_(MeasureClockOverhead()) {}
+
+bool BenchmarkRunner::ShouldRun(const std::string &name) const
+{
+  return filter_.empty() || name.find(filter_) != std::string::npos;
+}
+
+bool BenchmarkRunner::ShouldRunGroup(const std::string &group) const
+{
+  return ShouldRun(group) || filter_.compare(0, group.size(), group) == 0;
+}
+
+long long BenchmarkRunner::Scaled(long long operations) const
+{
+  long long scaled = (long long)(operations * scale_);
+  return scaled > 0 ? scaled : 1;
+}
+
+void BenchmarkRunner::PrintHeader() const
+{
+  cout << left << setw(44) << "benchmark" << right << setw(10) << "ops" << setw(12) << "ns/op" << setw(12) << "p50 ns" << setw(12) << "p99 ns"
+    << setw(12) << "allocs/op" << setw(12) << "bytes/op" << setw(14) << "peak RSS MB" << endl;
+  cout << string(128, '-') << endl;
+}
+
+void BenchmarkRunner::PrintResult(const std::string &name, long long operations, double total_ns, std::vector<double> &latencies,
+                                  long long allocations, long long allocated_bytes, long long peak_resident_memory) const
+{
+  double p50 = 0;
+  double p99 = 0;
+  if (!latencies.empty())
+  {
+    size_t p50_index = latencies.size() / 2;
+    size_t p99_index = std::min(latencies.size() - 1, latencies.size() * 99 / 100);
+    std::nth_element(latencies.begin(), latencies.begin() + p50_index, latencies.end());
+    p50 = latencies[p50_index];
+    std::nth_element(latencies.begin(), latencies.begin() + p99_index, latencies.end());
+    p99 = latencies[p99_index];
+  }
+
+  cout << left << setw(44) << name << right << setw(10) << operations << fixed << setprecision(1)
+    << setw(12) << std::max(0.0, total_ns / operations)
+    << setw(12) << std::max(0.0, p50 - clock_overhead_ns_)
+    << setw(12) << std::max(0.0, p99 - clock_overhead_ns_)
+    << setprecision(2) << setw(12) << (double)allocations / operations
+    << setprecision(1) << setw(12) << (double)allocated_bytes / operations
+    << setw(14) << peak_resident_memory / (1024.0 * 1024.0) << endl;
+  cout.unsetf(ios::fixed);
+}
+
+double BenchmarkRunner::MeasureClockOverhead()
+{
+  // The cheapest of many back to back clock reads, noise only ever makes reads slower
+  double overhead = 1e9;
+  for (int i = 0; i < 1000; i++)
+  {
+    std::chrono::steady_clock::time_point first = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point second = std::chrono::steady_clock::now();
+    overhead = std::min(overhead, std::chrono::duration<double, std::nano>(second - first).count());
+  }
+  return overhead;
+}
\ No newline at end of file
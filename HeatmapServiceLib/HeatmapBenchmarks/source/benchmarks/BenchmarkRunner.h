@@ -0,0 +1,95 @@
+//////////////////////////////////////////////////////////////////////////////////////
+// BenchmarkRunner.h: Times benchmarks and reports their cost per operation
+// Written by: Pedro Engana (http://pedroengana.com)
+//////////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// -- Allocation counting
+// The benchmark executable replaces the global operator new, counting every allocation made by the process
+long long AllocationCount();
+long long AllocatedBytes();
+
+// -- Peak resident memory
+// Resets the peak resident memory of the process to its current size, where the OS allows it. Returns false if it doesn't
+bool ResetPeakResidentMemory();
+// Highest resident memory of the process, in bytes, since the last reset (or since the process started)
+long long PeakResidentMemory();
+
+// -- BenchmarkRunner runs benchmarks and prints one line for each of them, with:
+// ns/op: average wall time per operation, over the whole run
+// p50/p99: latency percentiles of single operations. One in every kLatencySampleStride operations is timed alone, minus the cost of reading the clock
+// allocs/op and bytes/op: heap allocations made during the run, divided by the amount of operations
+// peak RSS: highest resident memory of the process during the run
+class BenchmarkRunner
+{
+public:
+  static const int kLatencySampleStride = 16;
+
+  // Only benchmarks whose name contains filter are run. Scale multiplies the amount of operations of every benchmark
+  BenchmarkRunner(const std::string &filter, double scale);
+
+  // True if the benchmark with this name should be run. Lets benchmarks skip setting up the data they need when they are filtered out
+  bool ShouldRun(const std::string &name) const;
+  // True if any benchmark whose name starts with group might run, for setup shared by several benchmarks
+  bool ShouldRunGroup(const std::string &group) const;
+
+  // Amount of operations to run, scaled down on quick runs, but never below 1
+  long long Scaled(long long operations) const;
+
+  void PrintHeader() const;
+
+  // Runs operation(i) for every i in [0, operations[ and prints the results under name.
+  // Setup that shouldn't be measured must happen before calling Run
+  template <typename Operation>
+  void Run(const std::string &name, long long operations, Operation operation)
+  {
+    if (!ShouldRun(name) || operations <= 0)
+      return;
+
+    std::vector<double> latencies;
+    latencies.reserve((size_t)(operations / kLatencySampleStride + 1));
+
+    ResetPeakResidentMemory();
+    long long allocations_before = AllocationCount();
+    long long bytes_before = AllocatedBytes();
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (long long i = 0; i < operations; i++)
+    {
+      if (i % kLatencySampleStride == 0)
+      {
+        std::chrono::steady_clock::time_point operation_begin = std::chrono::steady_clock::now();
+        operation(i);
+        std::chrono::steady_clock::time_point operation_end = std::chrono::steady_clock::now();
+        latencies.push_back(std::chrono::duration<double, std::nano>(operation_end - operation_begin).count());
+      }
+      else
+      {
+        operation(i);
+      }
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    // The latencies vector was reserved up front, so the allocations counted are only the ones made by the operations
+    long long allocations = AllocationCount() - allocations_before;
+    long long allocated_bytes = AllocatedBytes() - bytes_before;
+
+    double total_ns = std::chrono::duration<double, std::nano>(end - begin).count() - clock_overhead_ns_ * 2 * latencies.size();
+    PrintResult(name, operations, total_ns, latencies, allocations, allocated_bytes, PeakResidentMemory());
+  }
+
+private:
+  void PrintResult(const std::string &name, long long operations, double total_ns, std::vector<double> &latencies,
+                   long long allocations, long long allocated_bytes, long long peak_resident_memory) const;
+
+  // Measures how long reading the clock takes, so it can be taken out of the latencies
+  static double MeasureClockOverhead();
+
+  std::string filter_;
+  double scale_;
+  double clock_overhead_ns_;
+};
\ No newline at end of file
@@ -0,0 +1,134 @@
+//////////////////////////////////////////////////////////////////////////////////////
+// ContainerMicroBenchmarks.cpp: Micro benchmarks of the custom containers the heatmap is built on
+// Written by: Pedro Engana (http://pedroengana.com)
+//////////////////////////////////////////////////////////////////////////////////////
+
+#include "ContainerMicroBenchmarks.h"
+
+#include <cstdint>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "SignedIndexVector.hpp"
+#include "LinearSearchMap.hpp"
+#include "FlatHashMap.hpp"
+#include "SimpleHashmap.hpp"
+
+using namespace std;
+using namespace heatmap_service;
+
+namespace
+{
+  // Hash function for the SimpleHashmap benchmarks. Spreads keys over a small range of buckets, as the hashmap stores its buckets
+  // in a SignedIndexVector, and so allocates every bucket between the lowest and highest hash
+  struct SmallRangeHashFunctor
+  {
+    int operator()(const std::string& key)
+    {
+      unsigned int hash = 2166136261u;
+      for (const char& c : key)
+        hash = (hash ^ (unsigned char)c) * 16777619u;
+      return (int)(hash % 1024) - 512;
+    }
+  };
+
+  std::vector<std::string> CounterKeys(int key_count)
+  {
+    std::vector<std::string> keys;
+    for (int key = 0; key < key_count; key++)
+    {
+      std::stringstream key_stream;
+      key_stream << "counter_" << key;
+      keys.push_back(key_stream.str());
+    }
+    return keys;
+  }
+
+  // -- SignedIndexVector, a column of counters
+  void RunSignedIndexVectorBenchmarks(BenchmarkRunner &runner)
+  {
+    const int kColumnHeight = 4096;
+
+    std::mt19937 generator(11);
+    std::uniform_int_distribution<int> index(-kColumnHeight / 2, kColumnHeight / 2 - 1);
+    std::vector<int> indexes((size_t)runner.Scaled(4000000));
+    for (int &random_index : indexes)
+      random_index = index(generator);
+
+    SignedIndexVector<uint32_t> column;
+    runner.Run("siv/random_write", (long long)indexes.size(), [&](long long i)
+    {
+      column[indexes[(size_t)i]] += 1;
+    });
+
+    // Grows the column from the center outwards, one index at a time on each side, as a column logged from its middle does
+    SignedIndexVector<uint32_t> growing;
+    runner.Run("siv/grow_both_ends", runner.Scaled(4000000), [&](long long i)
+    {
+      int offset = (int)(i / 2);
+      growing[(i % 2 == 0) ? offset : -offset - 1] += 1;
+    });
+
+    const SignedIndexVector<uint32_t> &const_column = column;
+    unsigned long long read_sum = 0;
+    runner.Run("siv/random_read", (long long)indexes.size(), [&](long long i)
+    {
+      read_sum += const_column.get_at(indexes[(size_t)i]);
+    });
+
+    runner.Run("siv/sequential_read", runner.Scaled(4000000), [&](long long i)
+    {
+      read_sum += const_column.get_at((int)(i % kColumnHeight) - kColumnHeight / 2);
+    });
+
+    SignedIndexVector<uint32_t> pushed;
+    runner.Run("siv/push_back", runner.Scaled(4000000), [&](long long i)
+    {
+      pushed.push_back((uint32_t)i);
+    });
+
+    volatile unsigned long long sink = read_sum;
+    (void)sink;
+  }
+
+  // -- LinearSearchMap, SimpleHashmap and FlatHashMap, the maps of counter keys to counter maps. 1024 keys stand for per item counters
+  template <typename Map>
+  void RunKeyMapBenchmarks(BenchmarkRunner &runner, const std::string &map_name)
+  {
+    const int key_counts[] = { 4, 16, 64, 1024 };
+    for (int key_count : key_counts)
+    {
+      std::stringstream name_stream;
+      name_stream << map_name << "/lookup/" << key_count << "_keys";
+      if (!runner.ShouldRun(name_stream.str()))
+        continue;
+
+      std::vector<std::string> keys = CounterKeys(key_count);
+      Map map;
+      for (const std::string &key : keys)
+        map[key] = 0;
+
+      std::mt19937 generator(13);
+      std::uniform_int_distribution<int> pick_key(0, key_count - 1);
+      std::vector<int> lookups((size_t)runner.Scaled(2000000));
+      for (int &lookup : lookups)
+        lookup = pick_key(generator);
+
+      // Looked up through the non const operator[], as the increments do
+      runner.Run(name_stream.str(), (long long)lookups.size(), [&](long long i)
+      {
+        map[keys[lookups[(size_t)i]]] += 1;
+      });
+    }
+  }
+}
+
+void RunContainerMicroBenchmarks(BenchmarkRunner &runner)
+{
+  if (runner.ShouldRunGroup("siv/"))
+    RunSignedIndexVectorBenchmarks(runner);
+  RunKeyMapBenchmarks< LinearSearchMap<std::string, int> >(runner, "linear_search_map");
+  RunKeyMapBenchmarks< SimpleHashmap<std::string, int, SmallRangeHashFunctor> >(runner, "simple_hashmap");
+  RunKeyMapBenchmarks< FlatHashMap<std::string, int> >(runner, "flat_hash_map");
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+//////////////////////////////////////////////////////////////////////////////////////
+// ContainerMicroBenchmarks.h: Micro benchmarks of the custom containers the heatmap is built on
+// Written by: Pedro Engana (http://pedroengana.com)
+//////////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "BenchmarkRunner.h"
+
+// SignedIndexVector, LinearSearchMap and SimpleHashmap, on their own
+void RunContainerMicroBenchmarks(BenchmarkRunner &runner);
\ No newline at end of file
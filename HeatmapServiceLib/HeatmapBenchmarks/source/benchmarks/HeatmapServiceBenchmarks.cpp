@@ -0,0 +1,911 @@
+//////////////////////////////////////////////////////////////////////////////////////
+// HeatmapServiceBenchmarks.cpp: Benchmarks of the public HeatmapService API
+// Written by: Pedro Engana (http://pedroengana.com)
+//////////////////////////////////////////////////////////////////////////////////////
+
+#include "HeatmapServiceBenchmarks.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "HeatmapService.h"
+#include "HeatmapEventQueue.h"
+#include "HeatmapGrid.hpp"
+#include "WorkloadGenerators.h"
+
+using namespace std;
+using namespace heatmap_service;
+
+namespace
+{
+  // The world every workload is spread over, in heatmap units. With a resolution of 1 unit per cell, a 4k by 4k heatmap at most
+  const double kWorldSize = 4096;
+  const int kIngestEvents = 2000000;
+
+  HeatmapCoordinate Coordinate(double x, double y)
+  {
+    HeatmapCoordinate coords = { x, y };
+    return coords;
+  }
+
+  void FreeHeatmapData(HeatmapData &data)
+  {
+    for (int x = 0; x < data.data_size.width; x++)
+      delete[] data.heatmap_data[x];
+    delete[] data.heatmap_data;
+    delete(data.counter_name);
+  }
+
+  void FreeHeatmapFloatData(HeatmapFloatData &data)
+  {
+    for (int x = 0; x < data.data_size.width; x++)
+      delete[] data.heatmap_data[x];
+    delete[] data.heatmap_data;
+    delete(data.counter_name);
+  }
+
+  // -- Ingestion: logging every event of a workload into an empty heatmap, one operation per event
+  void RunIngestBenchmarks(BenchmarkRunner &runner)
+  {
+    int event_count = (int)runner.Scaled(kIngestEvents);
+
+    std::vector<std::string> names;
+    names.push_back("ingest/uniform");
+    names.push_back("ingest/hotspots/32");
+    names.push_back("ingest/zipf/10000");
+    names.push_back("ingest/trajectories/64");
+    names.push_back("ingest/multi_counter/8");
+    // Per item counters, thousands of keys, found through the hash index of the map of counters
+    names.push_back("ingest/multi_counter/1024");
+
+    for (size_t workload_index = 0; workload_index < names.size(); workload_index++)
+    {
+      if (!runner.ShouldRun(names[workload_index]))
+        continue;
+
+      BenchmarkWorkload workload;
+      switch (workload_index)
+      {
+      case 0: workload = GenerateUniformWorkload(event_count, kWorldSize, 1); break;
+      case 1: workload = GenerateHotspotWorkload(event_count, kWorldSize, 32, kWorldSize / 50, 2); break;
+      case 2: workload = GenerateZipfWorkload(event_count, kWorldSize, 10000, 1.1, 3); break;
+      case 3: workload = GenerateTrajectoryWorkload(event_count, kWorldSize, 64, 2.0, 4); break;
+      case 4: workload = GenerateMultiCounterWorkload(event_count, kWorldSize, 8, 5); break;
+      default: workload = GenerateMultiCounterWorkload(event_count, kWorldSize, 1024, 6); break;
+      }
+
+      HeatmapService heatmap(1, 1);
+      runner.Run(names[workload_index], (long long)workload.events.size(), [&](long long i)
+      {
+        IngestEvent(workload, workload.events[(size_t)i], heatmap);
+      });
+    }
+  }
+
+  // -- Ingestion of integer coordinates into 4 by 4 cells, quantized at runtime by HeatmapService and at compile time by HeatmapGrid
+  void RunGridBenchmarks(BenchmarkRunner &runner)
+  {
+    if (!runner.ShouldRunGroup("grid/"))
+      return;
+
+    BenchmarkWorkload workload = GenerateHotspotWorkload((int)runner.Scaled(kIngestEvents), kWorldSize, 32, kWorldSize / 50, 2);
+    std::vector<int32_t> xs;
+    std::vector<int32_t> ys;
+    for (const BenchmarkEvent &event : workload.events)
+    {
+      xs.push_back((int32_t)event.coords.x);
+      ys.push_back((int32_t)event.coords.y);
+    }
+    const std::string &counter_key = workload.event_types[0].counter_keys[0];
+
+    if (runner.ShouldRun("grid/ingest_runtime_resolution/4x4"))
+    {
+      HeatmapService heatmap(4, 4);
+      runner.Run("grid/ingest_runtime_resolution/4x4", (long long)xs.size(), [&](long long i)
+      {
+        heatmap.IncrementMapCounter(Coordinate(xs[(size_t)i], ys[(size_t)i]), counter_key);
+      });
+    }
+
+    if (runner.ShouldRun("grid/ingest_compile_time/4x4"))
+    {
+      HeatmapGrid<4, 4> grid;
+      runner.Run("grid/ingest_compile_time/4x4", (long long)xs.size(), [&](long long i)
+      {
+        grid.IncrementMapCounter(xs[(size_t)i], ys[(size_t)i], counter_key);
+      });
+    }
+  }
+
+  // -- Three counters logged together at every event (deaths, gold, xp), as separate counters and as a counter group,
+  // then the same area queried for the three of them
+  void RunCounterGroupBenchmarks(BenchmarkRunner &runner)
+  {
+    if (!runner.ShouldRunGroup("group/"))
+      return;
+
+    const int counters_length = 3;
+    const std::string counter_keys[counters_length] = { "deaths", "gold", "xp" };
+    int amounts[counters_length] = { 1, 25, 100 };
+    BenchmarkWorkload workload = GenerateHotspotWorkload((int)runner.Scaled(kIngestEvents), kWorldSize, 32, kWorldSize / 50, 2);
+
+    HeatmapService separate_heatmap(1, 1);
+    runner.Run("group/ingest_separate_counters/3", (long long)workload.events.size(), [&](long long i)
+    {
+      separate_heatmap.IncrementMultipleMapCountersByAmount(workload.events[(size_t)i].coords, counter_keys, amounts, counters_length);
+    });
+
+    HeatmapService group_heatmap(1, 1);
+    group_heatmap.CreateCounterGroup("combat", counter_keys, counters_length);
+    runner.Run("group/ingest_counter_group/3", (long long)workload.events.size(), [&](long long i)
+    {
+      group_heatmap.IncrementCounterGroupByAmounts(workload.events[(size_t)i].coords, "combat", amounts);
+    });
+
+    // Areas around the hotspots, where the counters are
+    std::vector<HeatmapCoordinate> corners;
+    for (size_t i = 0; i < workload.events.size() && corners.size() < 64; i += workload.events.size() / 64 + 1)
+      corners.push_back(Coordinate(workload.events[i].coords.x - 256, workload.events[i].coords.y - 256));
+
+    runner.Run("group/query_separate_counters/3x512x512", runner.Scaled(200), [&](long long i)
+    {
+      const HeatmapCoordinate &corner = corners[(size_t)i % corners.size()];
+      HeatmapData data[counters_length];
+      if (separate_heatmap.getMultipleCountersDataInsideRect(corner, Coordinate(corner.x + 512, corner.y + 512), counter_keys, counters_length, data))
+      {
+        for (int counter = 0; counter < counters_length; counter++)
+          FreeHeatmapData(data[counter]);
+      }
+    });
+
+    runner.Run("group/query_counter_group/3x512x512", runner.Scaled(200), [&](long long i)
+    {
+      const HeatmapCoordinate &corner = corners[(size_t)i % corners.size()];
+      HeatmapData data[counters_length];
+      if (group_heatmap.getCounterGroupDataInsideRect(corner, Coordinate(corner.x + 512, corner.y + 512), "combat", data))
+      {
+        for (int counter = 0; counter < counters_length; counter++)
+          FreeHeatmapData(data[counter]);
+      }
+    });
+  }
+
+  // -- A kills over deaths map of a 512x512 area, combined by the client from two area queries, and evaluated by the library in one pass
+  void RunExpressionBenchmarks(BenchmarkRunner &runner)
+  {
+    if (!runner.ShouldRunGroup("expression/"))
+      return;
+
+    HeatmapService heatmap(1, 1);
+    BenchmarkWorkload workload = GenerateHotspotWorkload((int)runner.Scaled(kIngestEvents), kWorldSize, 32, kWorldSize / 50, 2);
+    for (size_t i = 0; i < workload.events.size(); i++)
+      heatmap.IncrementMapCounter(workload.events[i].coords, i % 3 == 0 ? "kills" : "deaths");
+
+    std::vector<HeatmapCoordinate> corners;
+    for (size_t i = 0; i < workload.events.size() && corners.size() < 64; i += workload.events.size() / 64 + 1)
+      corners.push_back(Coordinate(workload.events[i].coords.x - 256, workload.events[i].coords.y - 256));
+
+    runner.Run("expression/client_side/kd_512x512", runner.Scaled(200), [&](long long i)
+    {
+      const HeatmapCoordinate &corner = corners[(size_t)i % corners.size()];
+      HeatmapData kills;
+      HeatmapData deaths;
+      if (!heatmap.getCounterDataInsideRect(corner, Coordinate(corner.x + 512, corner.y + 512), "kills", kills))
+        return;
+      if (heatmap.getCounterDataInsideRect(corner, Coordinate(corner.x + 512, corner.y + 512), "deaths", deaths))
+      {
+        HeatmapFloatData ratio;
+        ratio.data_size = kills.data_size;
+        ratio.counter_name = nullptr;
+        ratio.heatmap_data = new float*[(int)kills.data_size.width];
+        for (int x = 0; x < kills.data_size.width; x++)
+        {
+          ratio.heatmap_data[x] = new float[(int)kills.data_size.height];
+          for (int y = 0; y < kills.data_size.height; y++)
+            ratio.heatmap_data[x][y] = (float)kills.heatmap_data[x][y] / (float)std::max(deaths.heatmap_data[x][y], 1u);
+        }
+        FreeHeatmapFloatData(ratio);
+        FreeHeatmapData(deaths);
+      }
+      FreeHeatmapData(kills);
+    });
+
+    runner.Run("expression/fused/kd_512x512", runner.Scaled(200), [&](long long i)
+    {
+      const HeatmapCoordinate &corner = corners[(size_t)i % corners.size()];
+      HeatmapFloatData ratio;
+      if (heatmap.getExpressionDataInsideRect("kills / max(deaths, 1)", corner, Coordinate(corner.x + 512, corner.y + 512), ratio))
+        FreeHeatmapFloatData(ratio);
+    });
+  }
+
+  // -- The column and Morton tile storage layouts compared on trajectory and uniform ingestion, and on square area queries
+  void RunLayoutBenchmarks(BenchmarkRunner &runner)
+  {
+    if (!runner.ShouldRunGroup("layout/"))
+      return;
+
+    int event_count = (int)runner.Scaled(kIngestEvents);
+    BenchmarkWorkload trajectories = GenerateTrajectoryWorkload(event_count, kWorldSize, 64, 2.0, 4);
+    BenchmarkWorkload uniform = GenerateUniformWorkload(event_count, kWorldSize, 1);
+
+    const HeatmapStorageLayout layouts[2] = { kColumnStorageLayout, kMortonTileStorageLayout };
+    const std::string layout_names[2] = { "layout/column/", "layout/morton/" };
+    for (int layout = 0; layout < 2; layout++)
+    {
+      const std::string &prefix = layout_names[layout];
+      if (!runner.ShouldRunGroup(prefix))
+        continue;
+
+      HeatmapService trajectory_heatmap(1, 1, layouts[layout]);
+      runner.Run(prefix + "ingest_trajectories/64", (long long)trajectories.events.size(), [&](long long i)
+      {
+        IngestEvent(trajectories, trajectories.events[(size_t)i], trajectory_heatmap);
+      });
+
+      HeatmapService uniform_heatmap(1, 1, layouts[layout]);
+      runner.Run(prefix + "ingest_uniform", (long long)uniform.events.size(), [&](long long i)
+      {
+        IngestEvent(uniform, uniform.events[(size_t)i], uniform_heatmap);
+      });
+
+      // Squares around the places the players walked through
+      const std::string &counter_key = trajectories.event_types[0].counter_keys[0];
+      const int sides[2] = { 64, 512 };
+      for (int side : sides)
+      {
+        std::string name = prefix + (side == 64 ? "query_area/64x64" : "query_area/512x512");
+        runner.Run(name, runner.Scaled(side == 64 ? 20000 : 200), [&](long long i)
+        {
+          const HeatmapCoordinate &center = trajectories.events[(size_t)(i * 7919) % trajectories.events.size()].coords;
+          HeatmapData data;
+          if (trajectory_heatmap.getCounterDataInsideRect(Coordinate(center.x - side / 2, center.y - side / 2), Coordinate(center.x + side / 2 - 1, center.y + side / 2 - 1),
+                                                          counter_key, data))
+            FreeHeatmapData(data);
+        });
+      }
+    }
+  }
+
+  // -- Wilderness: few events scattered over a world four times wider, so most columns only hold a few counters far apart, kept in sparse lists.
+  // Peak RSS of the ingestion shows the memory they take. Areas are read as matrices and as lists of their non zero cells
+  void RunSparseBenchmarks(BenchmarkRunner &runner)
+  {
+    if (!runner.ShouldRunGroup("sparse/"))
+      return;
+
+    const int wilderness_size = kWorldSize * 4;
+    BenchmarkWorkload wilderness = GenerateUniformWorkload((int)runner.Scaled(kIngestEvents / 10), wilderness_size, 7);
+    HeatmapService heatmap(1, 1);
+    runner.Run("sparse/ingest_wilderness", (long long)wilderness.events.size(), [&](long long i)
+    {
+      IngestEvent(wilderness, wilderness.events[(size_t)i], heatmap);
+    });
+
+    const std::string &counter_key = wilderness.event_types[0].counter_keys[0];
+    runner.Run("sparse/query_area/512x512", runner.Scaled(200), [&](long long i)
+    {
+      double x = (double)((i * 7919) % (wilderness_size - 512));
+      double y = (double)((i * 104729) % (wilderness_size - 512));
+      HeatmapData data;
+      if (heatmap.getCounterDataInsideRect(Coordinate(x, y), Coordinate(x + 511, y + 511), counter_key, data))
+        FreeHeatmapData(data);
+    });
+
+    runner.Run("sparse/query_sparse_area/512x512", runner.Scaled(200), [&](long long i)
+    {
+      double x = (double)((i * 7919) % (wilderness_size - 512));
+      double y = (double)((i * 104729) % (wilderness_size - 512));
+      HeatmapSparseData data;
+      heatmap.getSparseCounterDataInsideRect(Coordinate(x, y), Coordinate(x + 511, y + 511), counter_key, data);
+    });
+
+    // A cluster of events far from the origin, which the map limits still reach down to, read whole as a matrix and as a list of its cells
+    BenchmarkWorkload cluster = GenerateHotspotWorkload((int)runner.Scaled(kIngestEvents / 100), 512, 4, 16, 13);
+    HeatmapService cluster_heatmap(1, 1);
+    for (size_t e = 0; e < cluster.events.size(); e++)
+    {
+      BenchmarkEvent event = cluster.events[e];
+      event.coords = Coordinate(event.coords.x + kWorldSize, event.coords.y + kWorldSize);
+      IngestEvent(cluster, event, cluster_heatmap);
+    }
+    const std::string &cluster_key = cluster.event_types[0].counter_keys[0];
+    runner.Run("sparse/far_cluster/all_data", runner.Scaled(10), [&](long long i)
+    {
+      HeatmapData data;
+      if (cluster_heatmap.getAllCounterData(cluster_key, data))
+        FreeHeatmapData(data);
+    });
+
+    runner.Run("sparse/far_cluster/all_sparse_data", runner.Scaled(200), [&](long long i)
+    {
+      HeatmapSparseData data;
+      cluster_heatmap.getAllSparseCounterData(cluster_key, data);
+    });
+  }
+
+  // -- Bulk ingestion of event logs held in memory, as CSV and as binary, against logging the same events one by one from a loop.
+  // Each operation ingests the whole log, the events of a multi counter workload, a line or binary event per counter they increment
+  void RunBulkIngestBenchmarks(BenchmarkRunner &runner)
+  {
+    if (!runner.ShouldRunGroup("bulk/"))
+      return;
+
+    BenchmarkWorkload workload = GenerateMultiCounterWorkload((int)runner.Scaled(kIngestEvents / 4), kWorldSize, 8, 8);
+    std::vector<std::string> keys;
+    std::string csv_log;
+    std::string binary_log("HMEV\1\0\0\0", 8);
+    std::vector<char> binary_events;
+    char line[128];
+    for (size_t e = 0; e < workload.events.size(); e++)
+    {
+      const BenchmarkEventType &event_type = workload.event_types[workload.events[e].type];
+      for (size_t c = 0; c < event_type.counter_keys.size(); c++)
+      {
+        uint32_t key_index = (uint32_t)(std::find(keys.begin(), keys.end(), event_type.counter_keys[c]) - keys.begin());
+        if (key_index == keys.size())
+          keys.push_back(event_type.counter_keys[c]);
+
+        HeatmapCoordinate coords = workload.events[e].coords;
+        int amount = event_type.amounts[c];
+        snprintf(line, sizeof(line), "%.3f,%.3f,%s,%d\n", coords.x, coords.y, event_type.counter_keys[c].c_str(), amount);
+        csv_log += line;
+        char binary_event[24];
+        memcpy(binary_event, &coords.x, 8);
+        memcpy(binary_event + 8, &coords.y, 8);
+        memcpy(binary_event + 16, &key_index, 4);
+        memcpy(binary_event + 20, &amount, 4);
+        binary_events.insert(binary_events.end(), binary_event, binary_event + 24);
+      }
+    }
+    uint32_t key_count = (uint32_t)keys.size();
+    binary_log.append((const char*)&key_count, 4);
+    for (size_t k = 0; k < keys.size(); k++)
+    {
+      uint32_t key_length = (uint32_t)keys[k].size();
+      binary_log.append((const char*)&key_length, 4);
+      binary_log += keys[k];
+    }
+    binary_log.append(binary_events.begin(), binary_events.end());
+
+    // The heatmaps are filled once before being timed, so the runs measure reading the events rather than growing the maps
+    HeatmapService loop_heatmap(1, 1);
+    IngestWorkload(workload, loop_heatmap);
+    runner.Run("bulk/increment_loop", runner.Scaled(20), [&](long long i)
+    {
+      IngestWorkload(workload, loop_heatmap);
+    });
+
+    HeatmapService csv_heatmap(1, 1);
+    HeatmapIngestResult result;
+    csv_heatmap.IngestEventBuffer(csv_log.data(), csv_log.size(), kCsvEventFormat, result);
+    runner.Run("bulk/ingest_csv", runner.Scaled(20), [&](long long i)
+    {
+      csv_heatmap.IngestEventBuffer(csv_log.data(), csv_log.size(), kCsvEventFormat, result);
+    });
+
+    HeatmapService binary_heatmap(1, 1);
+    binary_heatmap.IngestEventBuffer(binary_log.data(), binary_log.size(), kBinaryEventFormat, result);
+    runner.Run("bulk/ingest_binary", runner.Scaled(20), [&](long long i)
+    {
+      binary_heatmap.IngestEventBuffer(binary_log.data(), binary_log.size(), kBinaryEventFormat, result);
+    });
+  }
+
+  // -- Trajectories: registering the paths walked by players, whose positions are logged every few units, against sampling points along every
+  // segment finely enough to land on most of the cells crossed, which is how callers registered movement through IncrementMapCounter before
+  void RunTrajectoryBenchmarks(BenchmarkRunner &runner)
+  {
+    if (!runner.ShouldRunGroup("trajectory/"))
+      return;
+
+    const int kPlayerCount = 1000;
+    const double kSampleStep = 0.25;
+    BenchmarkWorkload workload = GenerateTrajectoryWorkload((int)runner.Scaled(kIngestEvents / 10), kWorldSize, kPlayerCount, 6, 11);
+    std::vector<std::vector<HeatmapCoordinate>> paths(kPlayerCount);
+    for (size_t e = 0; e < workload.events.size(); e++)
+      paths[e % kPlayerCount].push_back(workload.events[e].coords);
+    std::vector<HeatmapTrajectory> trajectories;
+    for (const std::vector<HeatmapCoordinate> &path : paths)
+    {
+      HeatmapTrajectory trajectory = { path.data(), (int)path.size() };
+      trajectories.push_back(trajectory);
+    }
+
+    auto sample_paths = [&](HeatmapService &heatmap)
+    {
+      for (const std::vector<HeatmapCoordinate> &path : paths)
+      {
+        for (size_t p = 1; p < path.size(); p++)
+        {
+          double length = std::sqrt((path[p].x - path[p - 1].x) * (path[p].x - path[p - 1].x) + (path[p].y - path[p - 1].y) * (path[p].y - path[p - 1].y));
+          int samples = (int)std::ceil(length / kSampleStep);
+          for (int s = 0; s < samples; s++)
+          {
+            double t = (double)s / samples;
+            heatmap.IncrementMapCounter(Coordinate(path[p - 1].x + (path[p].x - path[p - 1].x) * t, path[p - 1].y + (path[p].y - path[p - 1].y) * t), "positions");
+          }
+        }
+      }
+    };
+
+    // The heatmaps are filled once before being timed, as with bulk ingestion
+    HeatmapService sampled_heatmap(1, 1);
+    sample_paths(sampled_heatmap);
+    runner.Run("trajectory/sampled_increments", runner.Scaled(5), [&](long long i)
+    {
+      sample_paths(sampled_heatmap);
+    });
+
+    HeatmapService every_visit_heatmap(1, 1);
+    every_visit_heatmap.IncrementTrajectories(trajectories.data(), kPlayerCount, "positions", kCountEveryVisit);
+    runner.Run("trajectory/every_visit", runner.Scaled(5), [&](long long i)
+    {
+      for (const std::vector<HeatmapCoordinate> &path : paths)
+        every_visit_heatmap.IncrementTrajectory(path.data(), (int)path.size(), "positions", kCountEveryVisit);
+    });
+
+    HeatmapService once_heatmap(1, 1);
+    once_heatmap.IncrementTrajectories(trajectories.data(), kPlayerCount, "positions", kCountOncePerTrajectory);
+    runner.Run("trajectory/once_per_trajectory", runner.Scaled(5), [&](long long i)
+    {
+      for (const std::vector<HeatmapCoordinate> &path : paths)
+        once_heatmap.IncrementTrajectory(path.data(), (int)path.size(), "positions", kCountOncePerTrajectory);
+    });
+
+    HeatmapService batch_heatmap(1, 1);
+    batch_heatmap.IncrementTrajectories(trajectories.data(), kPlayerCount, "positions", kCountEveryVisit);
+    runner.Run("trajectory/batch_every_visit", runner.Scaled(5), [&](long long i)
+    {
+      batch_heatmap.IncrementTrajectories(trajectories.data(), kPlayerCount, "positions", kCountEveryVisit);
+    });
+
+    HeatmapService tiles_heatmap(1, 1, kMortonTileStorageLayout);
+    tiles_heatmap.IncrementTrajectories(trajectories.data(), kPlayerCount, "positions", kCountEveryVisit);
+    runner.Run("trajectory/tiles/batch_every_visit", runner.Scaled(5), [&](long long i)
+    {
+      tiles_heatmap.IncrementTrajectories(trajectories.data(), kPlayerCount, "positions", kCountEveryVisit);
+    });
+  }
+
+  // -- Splats: area events, such as explosions, adding a disk or a gaussian around hotspots, against looping over the kernel calling
+  // IncrementMapCounterByAmount for every cell, which is how callers registered them before
+  void RunSplatBenchmarks(BenchmarkRunner &runner)
+  {
+    if (!runner.ShouldRunGroup("splat/"))
+      return;
+
+    BenchmarkWorkload workload = GenerateHotspotWorkload((int)runner.Scaled(kIngestEvents / 200), kWorldSize, 32, kWorldSize / 50, 5);
+    HeatmapStorageLayout layouts[2] = { kColumnStorageLayout, kMortonTileStorageLayout };
+    const char* layout_names[2] = { "columns", "tiles" };
+    for (int l = 0; l < 2; l++)
+    {
+      HeatmapService heatmap(1, 1, layouts[l]);
+      HeatmapSplatKernel kernels[2];
+      heatmap.BuildDiskSplatKernel(16, 1, kernels[0]);
+      heatmap.BuildGaussianSplatKernel(6, 100, kernels[1]);
+      const char* kernel_names[2] = { "disk_r16", "gaussian_sd6" };
+
+      for (int k = 0; k < 2; k++)
+      {
+        const HeatmapSplatKernel &kernel = kernels[k];
+        auto splat_by_cell = [&]()
+        {
+          for (size_t e = 0; e < workload.events.size(); e++)
+          {
+            HeatmapCoordinate coords = workload.events[e].coords;
+            for (int x = 0; x < kernel.width; x++)
+            {
+              for (int y = 0; y < kernel.height; y++)
+              {
+                unsigned int weight = kernel.weights[x * kernel.height + y];
+                if (weight != 0)
+                  heatmap.IncrementMapCounterByAmount(Coordinate(coords.x + x - kernel.width / 2, coords.y + y - kernel.height / 2), "explosions", (int)weight);
+              }
+            }
+          }
+        };
+
+        // Both fill the map once before being timed, so the runs measure adding the kernels rather than growing the map
+        splat_by_cell();
+        runner.Run(std::string("splat/") + layout_names[l] + "/" + kernel_names[k] + "/increment_loop", runner.Scaled(5), [&](long long i)
+        {
+          splat_by_cell();
+        });
+        runner.Run(std::string("splat/") + layout_names[l] + "/" + kernel_names[k] + "/splat", runner.Scaled(5), [&](long long i)
+        {
+          for (size_t e = 0; e < workload.events.size(); e++)
+            heatmap.SplatMapCounter(workload.events[e].coords, kernel, "explosions");
+        });
+      }
+    }
+  }
+
+  // -- Rebinning a heatmap logged at a quarter unit to coarser resolutions, and merging it into a heatmap four times coarser.
+  // Each operation rebins or merges into a fresh snapshot, which costs O(columns), so the originals stay as they were for the next one
+  void RunRebinBenchmarks(BenchmarkRunner &runner)
+  {
+    if (!runner.ShouldRunGroup("rebin/"))
+      return;
+
+    BenchmarkWorkload workload = GenerateHotspotWorkload((int)runner.Scaled(kIngestEvents / 4), kWorldSize / 4, 32, kWorldSize / 200, 11);
+    HeatmapService fine(0.25, 0.25);
+    HeatmapService coarse(1, 1);
+    for (size_t e = 0; e < workload.events.size(); e++)
+    {
+      IngestEvent(workload, workload.events[e], fine);
+      IngestEvent(workload, workload.events[(workload.events.size() - 1 - e)], coarse);
+    }
+
+    const double factors[2] = { 2, 4 };
+    for (double factor : factors)
+    {
+      runner.Run(factor == 2 ? "rebin/2x2" : "rebin/4x4", runner.Scaled(20), [&](long long i)
+      {
+        HeatmapService rebinned = fine;
+        rebinned.Rebin(0.25 * factor, 0.25 * factor);
+      });
+    }
+
+    runner.Run("rebin/merge_finer_heatmap", runner.Scaled(20), [&](long long i)
+    {
+      HeatmapService merged = coarse;
+      merged.MergeHeatmap(fine);
+    });
+  }
+
+  // -- Cost of logging through a HeatmapEventQueue, as seen by the logging thread, against incrementing the heatmap directly.
+  // The ring holds every event of the run, so the producer never waits on the aggregator, which is flushed once the run is over
+  void RunEventQueueBenchmarks(BenchmarkRunner &runner)
+  {
+    if (!runner.ShouldRunGroup("queue/"))
+      return;
+
+    BenchmarkWorkload workload = GenerateHotspotWorkload((int)runner.Scaled(kIngestEvents / 2), kWorldSize, 32, kWorldSize / 50, 5);
+
+    HeatmapService direct(1, 1);
+    runner.Run("queue/direct_increment", (long long)workload.events.size(), [&](long long i)
+    {
+      IngestEvent(workload, workload.events[(size_t)i], direct);
+    });
+
+    HeatmapService queued(1, 1);
+    HeatmapEventQueue queue(queued, (int)workload.events.size(), kBlockWhenFull);
+    std::vector<int> counter_indices;
+    for (const BenchmarkEventType &event_type : workload.event_types)
+      counter_indices.push_back(queue.RegisterCounter(event_type.counter_keys[0]));
+
+    runner.Run("queue/push", (long long)workload.events.size(), [&](long long i)
+    {
+      const BenchmarkEvent &event = workload.events[(size_t)i];
+      queue.IncrementMapCounterByAmount(event.coords, counter_indices[event.type], workload.event_types[event.type].amounts[0]);
+    });
+    queue.Flush();
+  }
+
+  // -- Cost of the latency histograms on the cheapest operation there is, incrementing a cell that already exists
+  void RunInstrumentationBenchmarks(BenchmarkRunner &runner)
+  {
+    if (!runner.ShouldRunGroup("instrumentation/") || !HeatmapService::instrumentation_available())
+      return;
+
+    HeatmapService heatmap(1, 1);
+    BenchmarkWorkload workload = GenerateHotspotWorkload((int)runner.Scaled(kIngestEvents), kWorldSize, 32, kWorldSize / 50, 2);
+    IngestWorkload(workload, heatmap);
+
+    runner.Run("instrumentation/increment_histograms_off", (long long)workload.events.size(), [&](long long i)
+    {
+      IngestEvent(workload, workload.events[(size_t)i], heatmap);
+    });
+
+    HeatmapService::EnableLatencyHistograms(true);
+    runner.Run("instrumentation/increment_histograms_on", (long long)workload.events.size(), [&](long long i)
+    {
+      IngestEvent(workload, workload.events[(size_t)i], heatmap);
+    });
+    HeatmapService::EnableLatencyHistograms(false);
+    HeatmapService::ResetLatencyHistograms();
+  }
+
+  // -- Queries on a heatmap populated with the hotspot workload, the closest to what a real game map looks like
+  void RunQueryBenchmarks(BenchmarkRunner &runner)
+  {
+    if (!runner.ShouldRunGroup("query/"))
+      return;
+
+    HeatmapService heatmap(1, 1);
+    IngestWorkload(GenerateHotspotWorkload((int)runner.Scaled(kIngestEvents), kWorldSize, 32, kWorldSize / 50, 2), heatmap);
+    IngestWorkload(GenerateUniformWorkload((int)runner.Scaled(kIngestEvents / 4), kWorldSize, 6), heatmap);
+
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<double> position(-kWorldSize / 2, kWorldSize / 2);
+
+    std::vector<HeatmapCoordinate> points((size_t)runner.Scaled(1000000));
+    for (HeatmapCoordinate &point : points)
+      point = Coordinate(position(generator), position(generator));
+
+    // The sum of the values read keeps the compiler from dropping the queries
+    const std::string counter_key = "deaths";
+    unsigned long long read_sum = 0;
+    runner.Run("query/point", (long long)points.size(), [&](long long i)
+    {
+      read_sum += heatmap.getCounterAtPosition(points[(size_t)i], counter_key);
+    });
+    volatile unsigned long long sink = read_sum;
+    (void)sink;
+
+    runner.Run("query/area/64x64", runner.Scaled(20000), [&](long long i)
+    {
+      const HeatmapCoordinate &corner = points[(size_t)i % points.size()];
+      HeatmapData data;
+      if (heatmap.getCounterDataInsideRect(corner, Coordinate(corner.x + 64, corner.y + 64), "deaths", data))
+        FreeHeatmapData(data);
+    });
+
+    runner.Run("query/area/512x512", runner.Scaled(400), [&](long long i)
+    {
+      const HeatmapCoordinate &corner = points[(size_t)i % points.size()];
+      HeatmapData data;
+      if (heatmap.getCounterDataInsideRect(corner, Coordinate(corner.x + 512, corner.y + 512), "deaths", data))
+        FreeHeatmapData(data);
+    });
+
+    // A dashboard refreshing the same few areas of a heatmap nobody writes to, read through the query result cache.
+    // Copies of cached results still cost a copy of the area, shared results only the check of the region versions
+    heatmap.SetQueryCacheCapacity(16);
+    runner.Run("query/area/512x512_cached_copy", runner.Scaled(400), [&](long long i)
+    {
+      const HeatmapCoordinate &corner = points[(size_t)i % 8];
+      HeatmapData data;
+      if (heatmap.getCounterDataInsideRect(corner, Coordinate(corner.x + 512, corner.y + 512), "deaths", data))
+        FreeHeatmapData(data);
+    });
+
+    runner.Run("query/area/512x512_cached_shared", runner.Scaled(20000), [&](long long i)
+    {
+      const HeatmapCoordinate &corner = points[(size_t)i % 8];
+      HeatmapSharedData data;
+      heatmap.getSharedCounterDataInsideRect(corner, Coordinate(corner.x + 512, corner.y + 512), "deaths", data);
+    });
+    heatmap.SetQueryCacheCapacity(0);
+
+    runner.Run("query/all_data", runner.Scaled(40), [&](long long i)
+    {
+      HeatmapData data;
+      if (heatmap.getAllCounterData("deaths", data))
+        FreeHeatmapData(data);
+    });
+
+    runner.Run("query/smoothed/512x512_box", runner.Scaled(100), [&](long long i)
+    {
+      const HeatmapCoordinate &corner = points[(size_t)i % points.size()];
+      HeatmapFloatData data;
+      if (heatmap.getSmoothedCounterDataInsideRect(corner, Coordinate(corner.x + 512, corner.y + 512), "deaths", 8.0, kBoxApproximatedGaussianKernel, data))
+        FreeHeatmapFloatData(data);
+    });
+
+    runner.Run("query/smoothed/512x512_gaussian", runner.Scaled(20), [&](long long i)
+    {
+      const HeatmapCoordinate &corner = points[(size_t)i % points.size()];
+      HeatmapFloatData data;
+      if (heatmap.getSmoothedCounterDataInsideRect(corner, Coordinate(corner.x + 512, corner.y + 512), "deaths", 8.0, kGaussianKernel, data))
+        FreeHeatmapFloatData(data);
+    });
+
+    runner.Run("query/stats", runner.Scaled(100), [&](long long i)
+    {
+      heatmap.GetStats();
+    });
+
+    // The same non zero cell count, and the aggregates colour scaling needs, kept up to date by the increments instead of walking the map
+    HeatmapCounterSummary summary;
+    runner.Run("query/counter_summary", runner.Scaled(200000), [&](long long i)
+    {
+      heatmap.getCounterSummary("deaths", summary);
+    });
+
+    if (runner.ShouldRunGroup("query/multi_counter"))
+    {
+      HeatmapService multi_counter_heatmap(1, 1);
+      BenchmarkWorkload workload = GenerateMultiCounterWorkload((int)runner.Scaled(kIngestEvents), kWorldSize, 8, 5);
+      IngestWorkload(workload, multi_counter_heatmap);
+
+      const int counters_length = 4;
+      std::string counter_keys[counters_length];
+      for (int counter = 0; counter < counters_length; counter++)
+        counter_keys[counter] = workload.event_types[counter].counter_keys[0];
+
+      runner.Run("query/multi_counter/4x512x512", runner.Scaled(200), [&](long long i)
+      {
+        const HeatmapCoordinate &corner = points[(size_t)i % points.size()];
+        HeatmapData data[counters_length];
+        if (multi_counter_heatmap.getMultipleCountersDataInsideRect(corner, Coordinate(corner.x + 512, corner.y + 512), counter_keys, counters_length, data))
+        {
+          for (int counter = 0; counter < counters_length; counter++)
+            FreeHeatmapData(data[counter]);
+        }
+      });
+    }
+  }
+
+  // -- Snapshots and serialization of a heatmap populated with the hotspot workload
+  // -- Region queries against fetching the rectangle around the region and masking it on the client, as was needed before them.
+  // The city zone is a concave polygon of 12 vertices, filling about half of its 768x768 bounding box
+  void RunRegionBenchmarks(BenchmarkRunner &runner)
+  {
+    if (!runner.ShouldRunGroup("region/"))
+      return;
+
+    BenchmarkWorkload workload = GenerateHotspotWorkload((int)runner.Scaled(kIngestEvents), kWorldSize, 32, kWorldSize / 50, 2);
+    const std::string &counter_key = workload.event_types[0].counter_keys[0];
+    HeatmapRegion circle = { kCircleRegion, Coordinate(0, 0), 256, {} };
+    HeatmapRegion city = { kPolygonRegion, Coordinate(0, 0), 0, {
+      Coordinate(-384, -384), Coordinate(-64, -384), Coordinate(-64, -128), Coordinate(128, -128), Coordinate(128, -384), Coordinate(384, -384),
+      Coordinate(384, 64), Coordinate(64, 64), Coordinate(64, 384), Coordinate(-192, 384), Coordinate(-192, 0), Coordinate(-384, 0) } };
+    HeatmapRegion whole_map = { kCircleRegion, Coordinate(0, 0), kWorldSize * 2, {} };
+
+    HeatmapStorageLayout layouts[2] = { kColumnStorageLayout, kMortonTileStorageLayout };
+    for (HeatmapStorageLayout layout : layouts)
+    {
+      std::string prefix = layout == kColumnStorageLayout ? "region/columns/" : "region/tiles/";
+      if (!runner.ShouldRunGroup(prefix))
+        continue;
+
+      HeatmapService heatmap(1, 1, layout);
+      IngestWorkload(workload, heatmap);
+
+      unsigned long long read_sum = 0;
+      runner.Run(prefix + "circle_r256/masked_rect", runner.Scaled(400), [&](long long i)
+      {
+        HeatmapData data;
+        if (!heatmap.getCounterDataInsideRect(Coordinate(-256, -256), Coordinate(255, 255), counter_key, data))
+          return;
+        for (int x = 0; x < (int)data.data_size.width; x++)
+        {
+          for (int y = 0; y < (int)data.data_size.height; y++)
+          {
+            double offset_x = x - 255.5, offset_y = y - 255.5;
+            if (offset_x * offset_x + offset_y * offset_y < 256.0 * 256.0)
+              read_sum += data.heatmap_data[x][y];
+          }
+        }
+        FreeHeatmapData(data);
+      });
+
+      runner.Run(prefix + "circle_r256/sum", runner.Scaled(400), [&](long long i)
+      {
+        unsigned long long sum;
+        if (heatmap.getCounterSumInsideRegion(circle, counter_key, sum))
+          read_sum += sum;
+      });
+
+      runner.Run(prefix + "circle_r256/extract", runner.Scaled(400), [&](long long i)
+      {
+        HeatmapSparseData data;
+        heatmap.getSparseCounterDataInsideRegion(circle, counter_key, data);
+      });
+
+      runner.Run(prefix + "city/sum", runner.Scaled(400), [&](long long i)
+      {
+        unsigned long long sum;
+        if (heatmap.getCounterSumInsideRegion(city, counter_key, sum))
+          read_sum += sum;
+      });
+
+      runner.Run(prefix + "city/summary", runner.Scaled(400), [&](long long i)
+      {
+        HeatmapCounterSummary summary;
+        if (heatmap.getCounterSummaryInsideRegion(city, counter_key, summary))
+          read_sum += summary.total;
+      });
+
+      runner.Run(prefix + "whole_map/sum", runner.Scaled(2000), [&](long long i)
+      {
+        unsigned long long sum;
+        if (heatmap.getCounterSumInsideRegion(whole_map, counter_key, sum))
+          read_sum += sum;
+      });
+      volatile unsigned long long sink = read_sum;
+      (void)sink;
+    }
+  }
+
+  void RunPersistenceBenchmarks(BenchmarkRunner &runner)
+  {
+    if (!runner.ShouldRunGroup("snapshot") && !runner.ShouldRunGroup("serialize"))
+      return;
+
+    HeatmapService heatmap(1, 1);
+    IngestWorkload(GenerateHotspotWorkload((int)runner.Scaled(kIngestEvents), kWorldSize, 32, kWorldSize / 50, 2), heatmap);
+    BenchmarkWorkload multi_counter = GenerateMultiCounterWorkload((int)runner.Scaled(kIngestEvents / 4), kWorldSize, 8, 5);
+    IngestWorkload(multi_counter, heatmap);
+
+    runner.Run("snapshot/copy", runner.Scaled(2000), [&](long long i)
+    {
+      HeatmapService snapshot(heatmap);
+    });
+
+    // A snapshot that outlives writes, each write to a shared column copies it once
+    runner.Run("snapshot/copy_then_write", runner.Scaled(200), [&](long long i)
+    {
+      HeatmapService snapshot(heatmap);
+      heatmap.IncrementMapCounter(Coordinate((double)(i % 64), 0), "deaths");
+    });
+
+    char* buffer = nullptr;
+    int buffer_length = 0;
+    runner.Run("serialize/serialize", runner.Scaled(40), [&](long long i)
+    {
+      delete[] buffer;
+      buffer = nullptr;
+      heatmap.SerializeHeatmap(buffer, buffer_length);
+    });
+
+    if (runner.ShouldRun("serialize/deserialize"))
+    {
+      if (!buffer)
+        heatmap.SerializeHeatmap(buffer, buffer_length);
+
+      runner.Run("serialize/deserialize", runner.Scaled(40), [&](long long i)
+      {
+        HeatmapService deserialized;
+        const char* read_buffer = buffer;
+        deserialized.DeserializeHeatmap(read_buffer, buffer_length);
+      });
+    }
+
+    // The whole checkpoint, most of which runs on the background thread. The calling thread only pays for the snapshot, see snapshot/copy
+    runner.Run("serialize/checkpoint", runner.Scaled(40), [&](long long i)
+    {
+      heatmap.CheckpointTo("benchmark_checkpoint.bin").get();
+    });
+    std::remove("benchmark_checkpoint.bin");
+
+    // A tool reading the summary of one of the smaller counters, loading the whole heatmap or only that counter
+    const std::string& counter_key = multi_counter.event_types[0].counter_keys[0];
+    if (runner.ShouldRunGroup("serialize/one_counter"))
+    {
+      if (!buffer)
+        heatmap.SerializeHeatmap(buffer, buffer_length);
+
+      HeatmapCounterSummary summary;
+      runner.Run("serialize/one_counter/deserialize", runner.Scaled(40), [&](long long i)
+      {
+        HeatmapService deserialized;
+        const char* read_buffer = buffer;
+        deserialized.DeserializeHeatmap(read_buffer, buffer_length);
+        deserialized.getCounterSummary(counter_key, summary);
+      });
+      runner.Run("serialize/one_counter/lazy", runner.Scaled(40), [&](long long i)
+      {
+        HeatmapService lazy;
+        lazy.LoadHeatmapLazily(buffer, buffer_length);
+        lazy.getCounterSummary(counter_key, summary);
+      });
+    }
+    delete[] buffer;
+  }
+}
+
+void RunHeatmapServiceBenchmarks(BenchmarkRunner &runner)
+{
+  RunIngestBenchmarks(runner);
+  RunGridBenchmarks(runner);
+  RunCounterGroupBenchmarks(runner);
+  RunExpressionBenchmarks(runner);
+  RunLayoutBenchmarks(runner);
+  RunSparseBenchmarks(runner);
+  RunBulkIngestBenchmarks(runner);
+  RunTrajectoryBenchmarks(runner);
+  RunSplatBenchmarks(runner);
+  RunRebinBenchmarks(runner);
+  RunEventQueueBenchmarks(runner);
+  RunInstrumentationBenchmarks(runner);
+  RunQueryBenchmarks(runner);
+  RunRegionBenchmarks(runner);
+  RunPersistenceBenchmarks(runner);
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+//////////////////////////////////////////////////////////////////////////////////////
+// HeatmapServiceBenchmarks.h: Benchmarks of the public HeatmapService API
+// Written by: Pedro Engana (http://pedroengana.com)
+//////////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "BenchmarkRunner.h"
+
+// Ingestion of every workload, point and area queries, snapshots and serialization of a populated heatmap
+void RunHeatmapServiceBenchmarks(BenchmarkRunner &runner);
\ No newline at end of file
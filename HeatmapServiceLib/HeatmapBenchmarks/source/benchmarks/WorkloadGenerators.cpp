@@ -0,0 +1,225 @@
+//////////////////////////////////////////////////////////////////////////////////////
+// WorkloadGenerators.cpp: Synthetic streams of game events to feed the benchmarks
+// Written by: Pedro Engana (http://pedroengana.com)
+//////////////////////////////////////////////////////////////////////////////////////
+
+#include "WorkloadGenerators.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <sstream>
+
+using namespace std;
+using namespace heatmap_service;
+
+namespace
+{
+  // A single counter incremented by one, the usual kills/deaths event
+  BenchmarkEventType SingleCounterEventType(const std::string &counter_key)
+  {
+    BenchmarkEventType event_type;
+    event_type.counter_keys.push_back(counter_key);
+    event_type.amounts.push_back(1);
+    return event_type;
+  }
+
+  // Keeps a coordinate inside the world, for distributions whose tails fall outside of it
+  double ClampToWorld(double value, double world_size)
+  {
+    return std::max(-world_size / 2, std::min(world_size / 2, value));
+  }
+
+  BenchmarkEvent MakeEvent(double x, double y, int type)
+  {
+    BenchmarkEvent event;
+    event.coords.x = x;
+    event.coords.y = y;
+    event.type = type;
+    return event;
+  }
+
+  std::string NameWithCount(const std::string &name, int count)
+  {
+    std::stringstream name_stream;
+    name_stream << name << "/" << count;
+    return name_stream.str();
+  }
+}
+
+BenchmarkWorkload GenerateUniformWorkload(int event_count, double world_size, unsigned int seed)
+{
+  BenchmarkWorkload workload;
+  workload.name = "uniform";
+  workload.event_types.push_back(SingleCounterEventType("deaths"));
+  workload.events.reserve(event_count);
+
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<double> position(-world_size / 2, world_size / 2);
+  for (int i = 0; i < event_count; i++)
+  {
+    double x = position(generator);
+    double y = position(generator);
+    workload.events.push_back(MakeEvent(x, y, 0));
+  }
+  return workload;
+}
+
+BenchmarkWorkload GenerateHotspotWorkload(int event_count, double world_size, int hotspot_count, double hotspot_radius, unsigned int seed)
+{
+  BenchmarkWorkload workload;
+  workload.name = NameWithCount("hotspots", hotspot_count);
+  workload.event_types.push_back(SingleCounterEventType("deaths"));
+  workload.events.reserve(event_count);
+
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<double> position(-world_size / 2, world_size / 2);
+  std::vector<HeatmapCoordinate> hotspots(hotspot_count);
+  for (HeatmapCoordinate &hotspot : hotspots)
+  {
+    hotspot.x = position(generator);
+    hotspot.y = position(generator);
+  }
+
+  std::uniform_int_distribution<int> pick_hotspot(0, hotspot_count - 1);
+  std::normal_distribution<double> spread(0.0, hotspot_radius);
+  for (int i = 0; i < event_count; i++)
+  {
+    const HeatmapCoordinate &hotspot = hotspots[pick_hotspot(generator)];
+    double x = ClampToWorld(hotspot.x + spread(generator), world_size);
+    double y = ClampToWorld(hotspot.y + spread(generator), world_size);
+    workload.events.push_back(MakeEvent(x, y, 0));
+  }
+  return workload;
+}
+
+BenchmarkWorkload GenerateZipfWorkload(int event_count, double world_size, int distinct_cells, double exponent, unsigned int seed)
+{
+  BenchmarkWorkload workload;
+  workload.name = NameWithCount("zipf", distinct_cells);
+  workload.event_types.push_back(SingleCounterEventType("deaths"));
+  workload.events.reserve(event_count);
+
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<double> position(-world_size / 2, world_size / 2);
+  std::vector<HeatmapCoordinate> cells(distinct_cells);
+  for (HeatmapCoordinate &cell : cells)
+  {
+    cell.x = position(generator);
+    cell.y = position(generator);
+  }
+
+  // The rank k cell is picked with a probability proportional to 1/k^exponent, found by binary searching the cumulative distribution
+  std::vector<double> cumulative(distinct_cells);
+  double total = 0;
+  for (int rank = 0; rank < distinct_cells; rank++)
+  {
+    total += 1.0 / std::pow(rank + 1.0, exponent);
+    cumulative[rank] = total;
+  }
+
+  std::uniform_real_distribution<double> pick(0.0, total);
+  for (int i = 0; i < event_count; i++)
+  {
+    int rank = (int)(std::lower_bound(cumulative.begin(), cumulative.end(), pick(generator)) - cumulative.begin());
+    const HeatmapCoordinate &cell = cells[std::min(rank, distinct_cells - 1)];
+    workload.events.push_back(MakeEvent(cell.x, cell.y, 0));
+  }
+  return workload;
+}
+
+BenchmarkWorkload GenerateTrajectoryWorkload(int event_count, double world_size, int player_count, double step_size, unsigned int seed)
+{
+  BenchmarkWorkload workload;
+  workload.name = NameWithCount("trajectories", player_count);
+  workload.event_types.push_back(SingleCounterEventType("positions"));
+  workload.events.reserve(event_count);
+
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<double> position(-world_size / 2, world_size / 2);
+  std::uniform_real_distribution<double> turn(-0.5, 0.5);
+  std::uniform_real_distribution<double> angle(0.0, 6.283185307179586);
+
+  // Players keep walking roughly in the direction they were heading, turning a little every step and bouncing off the world's edges
+  std::vector<HeatmapCoordinate> players(player_count);
+  std::vector<double> headings(player_count);
+  for (int player = 0; player < player_count; player++)
+  {
+    players[player].x = position(generator);
+    players[player].y = position(generator);
+    headings[player] = angle(generator);
+  }
+
+  for (int i = 0; i < event_count; i++)
+  {
+    int player = i % player_count;
+    headings[player] += turn(generator);
+
+    double x = players[player].x + std::cos(headings[player]) * step_size;
+    double y = players[player].y + std::sin(headings[player]) * step_size;
+    if (x != ClampToWorld(x, world_size) || y != ClampToWorld(y, world_size))
+    {
+      headings[player] += 3.141592653589793;
+      x = ClampToWorld(x, world_size);
+      y = ClampToWorld(y, world_size);
+    }
+
+    players[player].x = x;
+    players[player].y = y;
+    workload.events.push_back(MakeEvent(x, y, 0));
+  }
+  return workload;
+}
+
+BenchmarkWorkload GenerateMultiCounterWorkload(int event_count, double world_size, int counter_count, unsigned int seed)
+{
+  BenchmarkWorkload workload = GenerateHotspotWorkload(event_count, world_size, 16, world_size / 50, seed);
+  workload.name = NameWithCount("multi_counter", counter_count);
+
+  std::vector<std::string> counter_keys;
+  for (int counter = 0; counter < counter_count; counter++)
+    counter_keys.push_back(NameWithCount("counter", counter));
+
+  // Each kind of event increments up to three consecutive counters, by different amounts, so every counter is shared by a few kinds of event
+  std::mt19937 generator(seed + 1);
+  workload.event_types.clear();
+  for (int type = 0; type < counter_count; type++)
+  {
+    BenchmarkEventType event_type;
+    int counters_in_type = std::min(3, counter_count);
+    for (int counter = 0; counter < counters_in_type; counter++)
+    {
+      event_type.counter_keys.push_back(counter_keys[(type + counter) % counter_count]);
+      event_type.amounts.push_back(counter + 1);
+    }
+    workload.event_types.push_back(event_type);
+  }
+
+  std::uniform_int_distribution<int> pick_type(0, counter_count - 1);
+  for (BenchmarkEvent &event : workload.events)
+    event.type = pick_type(generator);
+  return workload;
+}
+
+void IngestWorkload(const BenchmarkWorkload &workload, HeatmapService &heatmap)
+{
+  for (const BenchmarkEvent &event : workload.events)
+    IngestEvent(workload, event, heatmap);
+}
+
+void IngestEvent(const BenchmarkWorkload &workload, const BenchmarkEvent &event, HeatmapService &heatmap)
+{
+  const BenchmarkEventType &event_type = workload.event_types[event.type];
+  if (event_type.counter_keys.size() == 1)
+  {
+    heatmap.IncrementMapCounterByAmount(event.coords, event_type.counter_keys[0], event_type.amounts[0]);
+  }
+  else
+  {
+    // IncrementMultipleMapCountersByAmount takes non const amounts
+    int amounts[8];
+    int counters_length = (int)std::min<size_t>(event_type.counter_keys.size(), 8);
+    std::copy(event_type.amounts.begin(), event_type.amounts.begin() + counters_length, amounts);
+    heatmap.IncrementMultipleMapCountersByAmount(event.coords, &event_type.counter_keys[0], amounts, counters_length);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+//////////////////////////////////////////////////////////////////////////////////////
+// WorkloadGenerators.h: Synthetic streams of game events to feed the benchmarks
+// Written by: Pedro Engana (http://pedroengana.com)
+//////////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "HeatmapService.h"
+
+// A kind of event a game logs, and the counters it increments every time it happens. A player death, for example,
+// might increment deaths and gold_lost at once
+struct BenchmarkEventType
+{
+  std::vector<std::string> counter_keys;
+  std::vector<int> amounts;
+};
+
+struct BenchmarkEvent
+{
+  heatmap_service::HeatmapCoordinate coords;
+  int type;
+};
+
+struct BenchmarkWorkload
+{
+  std::string name;
+  std::vector<BenchmarkEventType> event_types;
+  std::vector<BenchmarkEvent> events;
+};
+
+// Every generator spreads its events over a square world of world_size units, centered on 0,0, and is deterministic for a given seed.
+
+// Events spread evenly over the whole world, the worst case for locality
+BenchmarkWorkload GenerateUniformWorkload(int event_count, double world_size, unsigned int seed);
+
+// Events clustered in gaussian hotspots around points of interest (spawns, objectives, chokepoints), how most game maps look
+BenchmarkWorkload GenerateHotspotWorkload(int event_count, double world_size, int hotspot_count, double hotspot_radius, unsigned int seed);
+
+// Events fall on a fixed set of cells, chosen with zipf distributed popularity, a few cells get most of the events and most cells get very few
+BenchmarkWorkload GenerateZipfWorkload(int event_count, double world_size, int distinct_cells, double exponent, unsigned int seed);
+
+// Players walking around the world, each logging its position every step, so consecutive events of a player are close together.
+// Events of all the players are interleaved, as a server logging them would receive them
+BenchmarkWorkload GenerateTrajectoryWorkload(int event_count, double world_size, int player_count, double step_size, unsigned int seed);
+
+// Events of several kinds on hotspots, each kind incrementing a few of counter_count different counters at once
+BenchmarkWorkload GenerateMultiCounterWorkload(int event_count, double world_size, int counter_count, unsigned int seed);
+
+// Logs every event of the workload into the heatmap
+void IngestWorkload(const BenchmarkWorkload &workload, heatmap_service::HeatmapService &heatmap);
+
+// Logs a single event, through IncrementMapCounterByAmount for events with one counter, or IncrementMultipleMapCountersByAmount for the rest
+void IngestEvent(const BenchmarkWorkload &workload, const BenchmarkEvent &event, heatmap_service::HeatmapService &heatmap);
\ No newline at end of file
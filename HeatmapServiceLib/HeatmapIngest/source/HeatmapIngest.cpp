@@ -0,0 +1,101 @@
+//////////////////////////////////////////////////////////////////////////////////////
+// HeatmapIngest.cpp: Console application that builds a heatmap out of event logs
+// Usage: HeatmapIngest [--resolution WIDTH HEIGHT] [--morton] [--threads N] [--csv | --binary] output_file input_file...
+// Every input file is ingested into the same heatmap, which is then serialized into output_file, ready for DeserializeHeatmap.
+// Input files are read as CSV if their name ends in .csv, and as binary event logs otherwise, unless --csv or --binary says otherwise.
+// See HeatmapEventFormat for both formats
+// Written by: Pedro Engana (http://pedroengana.com)
+//////////////////////////////////////////////////////////////////////////////////////
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "HeatmapService.h"
+
+using namespace std;
+using namespace heatmap_service;
+
+namespace
+{
+  bool EndsWith(const string &text, const string &suffix)
+  {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+  }
+
+  void PrintUsage()
+  {
+    cout << "Usage: HeatmapIngest [--resolution WIDTH HEIGHT] [--morton] [--threads N] [--csv | --binary] output_file input_file..." << endl;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  double unit_width = 1, unit_height = 1;
+  HeatmapStorageLayout layout = kColumnStorageLayout;
+  // -1 picks the format from each file name
+  int forced_format = -1;
+  vector<string> files;
+  for (int arg = 1; arg < argc; arg++)
+  {
+    string argument = argv[arg];
+    if (argument == "--resolution" && arg + 2 < argc)
+    {
+      unit_width = atof(argv[++arg]);
+      unit_height = atof(argv[++arg]);
+    }
+    else if (argument == "--morton")
+      layout = kMortonTileStorageLayout;
+    else if (argument == "--threads" && arg + 1 < argc)
+      HeatmapService::SetWorkerThreadCount(atoi(argv[++arg]));
+    else if (argument == "--csv")
+      forced_format = kCsvEventFormat;
+    else if (argument == "--binary")
+      forced_format = kBinaryEventFormat;
+    else
+      files.push_back(argument);
+  }
+
+  if (files.size() < 2)
+  {
+    PrintUsage();
+    return 1;
+  }
+
+  HeatmapService heatmap(unit_width, unit_height, layout);
+  unsigned long long total_bytes = 0, total_events = 0;
+  double total_seconds = 0;
+  for (size_t file = 1; file < files.size(); file++)
+  {
+    HeatmapEventFormat format = forced_format >= 0 ? (HeatmapEventFormat)forced_format : (EndsWith(files[file], ".csv") ? kCsvEventFormat : kBinaryEventFormat);
+    HeatmapIngestResult result;
+    if (!heatmap.IngestEventFile(files[file], format, result))
+      return 1;
+
+    cout << files[file] << ": " << result.events_ingested << " events, " << result.rejected_records << " rejected, "
+      << result.bytes_read / (1024.0 * 1024.0) / result.seconds << " MB/s" << endl;
+    total_bytes += result.bytes_read;
+    total_events += result.events_ingested;
+    total_seconds += result.seconds;
+  }
+
+  char* buffer = nullptr;
+  int length = 0;
+  if (!heatmap.SerializeHeatmap(buffer, length))
+  {
+    cout << "Could not serialize the heatmap" << endl;
+    return 1;
+  }
+  ofstream output(files[0].c_str(), ios::binary);
+  output.write(buffer, length);
+  delete[] buffer;
+  if (!output)
+  {
+    cout << "Could not write " << files[0] << endl;
+    return 1;
+  }
+
+  cout << total_events << " events from " << total_bytes / (1024.0 * 1024.0) << " MB in " << total_seconds << " s, "
+    << HeatmapService::worker_thread_count() << " worker threads. Heatmap written to " << files[0] << " (" << length << " bytes)" << endl;
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,236 @@
+///////////////////////////////////////////////////////////////////////////
+// FlatHashMap.hpp: A map-like class for large amounts of keys. Stores its
+//  Key-Value pairs one after the other in a SignedIndexVector, in the order
+//  they were added, and finds them through an open addressing index using
+//  Robin Hood hashing.
+//  While it holds few keys it has no index at all, and searches its pairs
+//  linearly just like the LinearSearchMap, which is faster for those.
+//  Pairs are serialized exactly as the LinearSearchMap serializes them,
+//  so either map can load what the other saved.
+// Written by: Pedro Engana (http://pedroengana.com)
+///////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "SignedIndexVector.hpp"
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <boost/serialization/access.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+namespace heatmap_service
+{
+  template < typename KeyT, typename ValT, typename HashFunc = std::hash<KeyT> >
+  class FlatHashMap
+  {
+  public:
+    // Up to this many keys are searched linearly, and the index is only built once the map grows past it
+    static const int kLinearSearchLimit = 8;
+
+  private:
+
+    // Key-Value structure used internally to keep keys and values paired together while
+    // stored in the vector. Serializes as the one of the LinearSearchMap
+    struct KeyValPair{
+      KeyT key;
+      ValT val;
+
+      KeyValPair() {}
+      KeyValPair(const KeyT& k, const ValT& v) : key(k), val(v) {}
+      KeyValPair(const KeyValPair& copy) : key(copy.key), val(copy.val) {}
+      KeyValPair& operator=(const KeyValPair& copy){
+        if (this != &copy) {
+          key = copy.key;
+          val = copy.val;
+        }
+        return *this;
+      }
+
+      // Boost serialization methods
+      friend class boost::serialization::access;
+      template<class Archive>
+      void serialize(Archive & ar, const unsigned int version) {
+        ar & key;
+        ar & val;
+      }
+    };
+
+    // A slot of the index. Holds the position of a pair in the vector, and the hash of its key, which is compared before the keys themselves
+    // and tells how far the slot is from the one the key hashes to, without hashing the key again
+    struct Slot{
+      uint32_t hash;
+      int32_t pair_index;
+    };
+    static const int32_t kEmptySlot = -1;
+
+    SignedIndexVector< KeyValPair > map_;
+
+    // Empty while the map holds kLinearSearchLimit keys or less. Otherwise a power of two slots, at most 7/8 of them used
+    std::vector< Slot > index_;
+
+  public:
+    FlatHashMap() {}
+    FlatHashMap(const FlatHashMap& copy) : map_(copy.map_), index_(copy.index_) {}
+    FlatHashMap& operator=(const FlatHashMap& copy) {
+      if (this != &copy) {
+        map_ = copy.map_;
+        index_ = copy.index_;
+      }
+      return *this;
+    }
+
+    // Returns an editable value for a certain key. Will allocate memory if key doesn't exist yet.
+    ValT& operator[](const KeyT& key){
+      return GetOrCreateValForKey(key);
+    }
+
+    // Returns a const value for a key, but throws out_of_range exception if key is non-existant
+    const ValT& operator[] (const KeyT& key) const {
+      int pair_index = FindPair(key);
+      if (pair_index == kEmptySlot)
+        throw std::out_of_range("FlatHashMap ERROR: Key does not exist in map");
+      return map_.begin()[pair_index].val;
+    }
+
+    // Returns true if the key exists
+    bool has_key(const KeyT& key) const {
+      return FindPair(key) != kEmptySlot;
+    }
+
+    int size() const { return (int)map_.size(); }
+
+    // True once the map holds enough keys to be searched through its index
+    bool indexed() const { return !index_.empty(); }
+
+    void clear(){ map_.clear(); index_.clear(); }
+
+    void clean(){ map_.clean(); std::vector< Slot >().swap(index_); }
+
+    // Calls visit(key, value) for every key in the map, in insertion order
+    template <typename Visitor>
+    void for_each(Visitor visit) const {
+      for (const KeyValPair& key_val : map_)
+        visit(key_val.key, key_val.val);
+    }
+
+    // Same as for_each, but the values can be changed
+    template <typename Visitor>
+    void for_each(Visitor visit) {
+      for (KeyValPair& key_val : map_)
+        visit(key_val.key, key_val.val);
+    }
+  private:
+
+    static uint32_t Hash(const KeyT& key){
+      size_t hash = HashFunc()(key);
+      return (uint32_t)(hash ^ (hash >> 16 >> 16));
+    }
+
+    // How far the slot at position is from the slot its key hashes to
+    uint32_t ProbeDistance(const Slot& slot, uint32_t position) const {
+      return (position - slot.hash) & (uint32_t)(index_.size() - 1);
+    }
+
+    // Returns the position of the pair holding key in the vector, or kEmptySlot if there is none
+    int FindPair(const KeyT& key) const {
+      if (index_.empty()) {
+        for (const KeyValPair* key_val = map_.begin(); key_val != map_.end(); ++key_val){
+          if (key_val->key == key)
+            return (int)(key_val - map_.begin());
+        }
+        return kEmptySlot;
+      }
+
+      uint32_t hash = Hash(key);
+      uint32_t mask = (uint32_t)(index_.size() - 1);
+      // Keys are kept sorted by their distance to the slot they hash to, so meeting a key closer to its own slot than this one would be
+      // means this key isn't in the map
+      for (uint32_t position = hash & mask, distance = 0;; position = (position + 1) & mask, distance++){
+        const Slot& slot = index_[position];
+        if (slot.pair_index == kEmptySlot || ProbeDistance(slot, position) < distance)
+          return kEmptySlot;
+        if (slot.hash == hash && map_.begin()[slot.pair_index].key == key)
+          return slot.pair_index;
+      }
+    }
+
+    ValT& GetOrCreateValForKey(const KeyT& key){
+      int pair_index = FindPair(key);
+      if (pair_index != kEmptySlot)
+        return map_.begin()[pair_index].val;
+
+      map_.push_back(KeyValPair(key, ValT()));
+      pair_index = (int)map_.size() - 1;
+
+      if (map_.size() > (size_t)kLinearSearchLimit) {
+        // The index grows before it's more than 7/8 full, re-inserting every pair
+        if (index_.empty() || map_.size() * 8 > index_.size() * 7)
+          RebuildIndex();
+        else
+          InsertSlot(Hash(key), pair_index);
+      }
+      return map_.begin()[pair_index].val;
+    }
+
+    // Robin Hood insertion: the new slot takes the place of any slot it meets that is closer to where its key hashes to,
+    // and carries on with that one instead. Keeps the probe distances of every key even, and lookups short
+    void InsertSlot(uint32_t hash, int32_t pair_index){
+      Slot carried = { hash, pair_index };
+      uint32_t mask = (uint32_t)(index_.size() - 1);
+      for (uint32_t position = hash & mask, distance = 0;; position = (position + 1) & mask, distance++){
+        Slot& slot = index_[position];
+        if (slot.pair_index == kEmptySlot) {
+          slot = carried;
+          return;
+        }
+        uint32_t slot_distance = ProbeDistance(slot, position);
+        if (slot_distance < distance) {
+          std::swap(slot, carried);
+          distance = slot_distance;
+        }
+      }
+    }
+
+    // Sizes the index to the smallest power of two that is at most half full with every pair, and inserts them all.
+    // Small maps are left without an index
+    void RebuildIndex(){
+      index_.clear();
+      if (map_.size() <= (size_t)kLinearSearchLimit)
+        return;
+
+      size_t slot_count = 1;
+      while (slot_count < map_.size() * 2)
+        slot_count *= 2;
+      Slot empty_slot = { 0, kEmptySlot };
+      index_.assign(slot_count, empty_slot);
+
+      for (int pair_index = 0; pair_index < (int)map_.size(); pair_index++)
+        InsertSlot(Hash(map_.begin()[pair_index].key), pair_index);
+    }
+
+    // Boost serialization methods
+    // Only the pairs are serialized, the index is rebuilt from them when loading
+    friend class boost::serialization::access;
+    template<class Archive>
+    void save(Archive & ar, const unsigned int version) const
+    {
+      ar & map_;
+    }
+    template<class Archive>
+    void load(Archive & ar, const unsigned int version)
+    {
+      // Ensures the vector is cleaned and deallocated before loading the serialized values
+      clean();
+
+      // Load all basic values
+      ar & map_;
+      RebuildIndex();
+    }
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+  };
+}
\ No newline at end of file
@@ -12,9 +12,9 @@
 #include "SignedIndexVector.hpp"
 #include <exception>
 
-#include <boost\serialization\access.hpp>
-#include <boost\archive\binary_oarchive.hpp>
-#include <boost\archive\binary_iarchive.hpp>
+#include <boost/serialization/access.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
 
 namespace heatmap_service
 {
@@ -82,6 +82,20 @@ namespace heatmap_service
     void clear(){ map_.clear(); }
 
     void clean(){ map_.clean(); }
+
+    // Calls visit(key, value) for every key in the map, in insertion order
+    template <typename Visitor>
+    void for_each(Visitor visit) const {
+      for (const KeyValPair& key_val : map_)
+        visit(key_val.key, key_val.val);
+    }
+
+    // Same as for_each, but the values can be changed
+    template <typename Visitor>
+    void for_each(Visitor visit) {
+      for (KeyValPair& key_val : map_)
+        visit(key_val.key, key_val.val);
+    }
   private:
 
     ValT& GetOrCreateValForKey(const KeyT& key){
@@ -0,0 +1,109 @@
+///////////////////////////////////////////////////////////////////////////
+// MpscRingBuffer.hpp: A bounded queue for many producer threads and a
+//  single consumer thread, that never locks.
+//  Every slot of the ring carries a sequence number telling whether it's
+//  free for the producer of a given position or holds a value for the
+//  consumer. Producers claim positions with a single compare and swap,
+//  and publish their value by moving the sequence of its slot forward,
+//  so a producer that is preempted halfway only holds back the consumer,
+//  never the other producers.
+// Written by: Pedro Engana (http://pedroengana.com)
+///////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace heatmap_service
+{
+  template <typename T>
+  class MpscRingBuffer
+  {
+  private:
+    // Keeps the positions of producers and consumer on separate cache lines, so pushing doesn't invalidate the line the consumer polls
+    static const int kCacheLineSize = 64;
+
+    struct Slot{
+      std::atomic<uint64_t> sequence;
+      T value;
+    };
+
+    Slot* slots_;
+    uint64_t mask_;
+
+    char padding_before_push_[kCacheLineSize];
+    std::atomic<uint64_t> push_position_;
+    char padding_before_pop_[kCacheLineSize];
+    // Only touched by the consumer
+    uint64_t pop_position_;
+    char padding_after_pop_[kCacheLineSize];
+
+  public:
+    // The capacity is rounded up to a power of two
+    explicit MpscRingBuffer(size_t capacity) : push_position_(0), pop_position_(0) {
+      size_t slot_count = 2;
+      while (slot_count < capacity)
+        slot_count *= 2;
+      mask_ = slot_count - 1;
+
+      slots_ = new Slot[slot_count];
+      for (size_t position = 0; position < slot_count; position++)
+        slots_[position].sequence.store(position, std::memory_order_relaxed);
+    }
+
+    ~MpscRingBuffer() {
+      delete[] slots_;
+    }
+
+    size_t capacity() const { return (size_t)(mask_ + 1); }
+
+    // Positions handed to producers so far. Every value pushed before a call to push_position is popped once pop_position reaches it
+    uint64_t push_position() const { return push_position_.load(std::memory_order_acquire); }
+    uint64_t pop_position() const { return pop_position_; }
+
+    // -- Producer side, safe to call from any amount of threads at once
+    // Returns false, without waiting, if the ring is full
+    bool try_push(const T& value) {
+      uint64_t position = push_position_.load(std::memory_order_relaxed);
+      for (;;) {
+        Slot& slot = slots_[position & mask_];
+        int64_t lag = (int64_t)(slot.sequence.load(std::memory_order_acquire) - position);
+        if (lag == 0) {
+          // The slot is free for this position, claim it. On failure position is reloaded with the one another producer left
+          if (push_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+            slot.value = value;
+            slot.sequence.store(position + 1, std::memory_order_release);
+            return true;
+          }
+        }
+        else if (lag < 0) {
+          // The slot still holds the value of the previous lap, which the consumer hasn't popped
+          return false;
+        }
+        else {
+          // Another producer claimed this position already
+          position = push_position_.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    // -- Consumer side, only one thread may call these
+    // Returns false if the next value hasn't been published yet, even if later ones are
+    bool try_pop(T& out_value) {
+      Slot& slot = slots_[pop_position_ & mask_];
+      if (slot.sequence.load(std::memory_order_acquire) != pop_position_ + 1)
+        return false;
+
+      out_value = slot.value;
+      // Frees the slot for the producer of the same position on the next lap
+      slot.sequence.store(pop_position_ + mask_ + 1, std::memory_order_release);
+      pop_position_++;
+      return true;
+    }
+
+  private:
+    MpscRingBuffer(const MpscRingBuffer&);
+    MpscRingBuffer& operator=(const MpscRingBuffer&);
+  };
+}
\ No newline at end of file
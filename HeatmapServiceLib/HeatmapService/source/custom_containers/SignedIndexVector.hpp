@@ -11,11 +11,12 @@
 
 // For use of the std::allocator
 #include <memory>
+#include <algorithm>
 
 // Boost headers for Serialization
-#include <boost\serialization\access.hpp>
-#include <boost\archive\binary_oarchive.hpp>
-#include <boost\archive\binary_iarchive.hpp>
+#include <boost/serialization/access.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
 
 namespace heatmap_service
 {
@@ -79,6 +80,9 @@ namespace heatmap_service
     siv_size size() const { return end_ - begin_; }
     siv_size allocation_size() const { return mem_end_ - mem_begin_; }
 
+    // True if index lies inside the initialized range, where accessing it never allocates
+    bool has_index(int index) const { return index >= lowest_index() && index < lowest_index() + (int)size(); }
+
     // -- Operators
     T& operator[](int index){
       // If the index exceeds the allocated memory, then grow allocation size to match the required index
@@ -130,6 +134,17 @@ namespace heatmap_service
       --begin_;
     }
 
+    // Replaces the contents with count default values, the first one at lowest_index, allocated to fit them exactly as loading does.
+    // Returns the first of them, for the caller to fill
+    iterator assign_exact(int lowest_index, siv_size count){
+      clean();
+      if (count == 0)
+        return nullptr;
+      create(count);
+      index_zero_ = begin_ - lowest_index;
+      return begin_;
+    }
+
     // -- Cleaners
     // Deletes all data but maintains allocation
     void clear(){
@@ -194,6 +209,13 @@ namespace heatmap_service
     // Reallocates memory to fit a new needed size
     void grow(siv_size needed_size = 0){
       siv_size curr_size = allocation_size();
+
+      // Index zero is placed in the middle of the new allocation, so it must fit the furthest initialized index on either side of it.
+      // Vectors made by copying or loading are allocated to fit their values exactly, and aren't centered around index zero
+      siv_size furthest_index = (siv_size)std::max(-lowest_index(), (int)(end_ - index_zero_));
+      if (needed_size < (furthest_index + 1) * 2)
+        needed_size = (furthest_index + 1) * 2;
+
       siv_size new_size = (siv_size)((mem_end_ - mem_begin_)*1.5 > 2 ? (mem_end_ - mem_begin_)*1.5 : 2);
 
       // Grows "new_size" by 1.5 until we reach a size that can fit our needs
@@ -16,9 +16,9 @@
 #include <exception>
 #include <memory>
 
-#include <boost\serialization\access.hpp>
-#include <boost\archive\binary_oarchive.hpp>
-#include <boost\archive\binary_iarchive.hpp>
+#include <boost/serialization/access.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
 
 namespace heatmap_service
 {
@@ -99,6 +99,14 @@ namespace heatmap_service
     void clear(){ map_.clear(); }
 
     void clean(){ map_.clean(); }
+
+    // Calls visit(key, value) for every key in the map, in no particular order
+    template <typename Visitor>
+    void for_each(Visitor visit) const {
+      for (const SignedIndexVector<KeyValPair>& hash_box : map_)
+        for (const KeyValPair& key_val : hash_box)
+          visit(*key_val.key, *key_val.val);
+    }
   private:
 
     // Finds the value that matches the given key in the hashmap. If the key is not yet present, a new Key Value Pair is created
@@ -117,7 +125,7 @@ namespace heatmap_service
       }
       else {
         // Hashbox is not empty, one of the keys inside might match the one we're looking for
-        for (SignedIndexVector<KeyValPair>::iterator iter = hash_box.begin(); iter != hash_box.end(); ++iter){
+        for (typename SignedIndexVector<KeyValPair>::iterator iter = hash_box.begin(); iter != hash_box.end(); ++iter){
           if (*(iter->key) == key)
             return *(iter->val);
         }
@@ -133,7 +141,7 @@ namespace heatmap_service
 
       int hash_result = HashFunc()(key);
       const SignedIndexVector<KeyValPair>& hash_box = map_[hash_result];
-      for (SignedIndexVector<KeyValPair>::const_iterator iter = hash_box.begin(); iter != hash_box.end(); ++iter){
+      for (typename SignedIndexVector<KeyValPair>::const_iterator iter = hash_box.begin(); iter != hash_box.end(); ++iter){
         if (*(iter->key) == key)
           return *(iter->val);
       }
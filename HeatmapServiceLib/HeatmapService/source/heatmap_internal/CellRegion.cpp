@@ -0,0 +1,231 @@
+////////////////////////////////////////////////////////////////////////
+// CellRegion.cpp: Scanline rasterization of circles and polygons against the cell grid
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "CellRegion.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+namespace heatmap_service
+{
+  namespace
+  {
+    // Edge of a polygon, from its end with the lowest x to the one with the highest
+    struct PolygonEdge
+    {
+      double lowest_x;
+      double lowest_x_y;
+      double highest_x;
+      double highest_x_y;
+    };
+
+    bool IsFinite(HeatmapCoordinate coordinate)
+    {
+      return std::isfinite(coordinate.x) && std::isfinite(coordinate.y);
+    }
+  }
+
+  CellRegion::CellRegion() : unit_width_(1), unit_height_(1), clip_lowest_y_(0), clip_highest_y_(0), lowest_x_(0), lowest_y_(INT_MAX), highest_y_(INT_MIN) { }
+
+  bool CellRegion::Rasterize(const HeatmapRegion &region, double unit_width, double unit_height, int clip_lowest_x, int clip_lowest_y, int clip_highest_x, int clip_highest_y)
+  {
+    Clear();
+    unit_width_ = unit_width;
+    unit_height_ = unit_height;
+    clip_lowest_y_ = clip_lowest_y;
+    clip_highest_y_ = clip_highest_y;
+
+    double lowest_world_x, highest_world_x;
+    if (region.shape == kCircleRegion)
+    {
+      if (!IsFinite(region.center) || !(region.radius >= 0) || !std::isfinite(region.radius))
+        return false;
+      lowest_world_x = region.center.x - region.radius;
+      highest_world_x = region.center.x + region.radius;
+    }
+    else
+    {
+      if (region.vertices.size() < 3 || !std::all_of(region.vertices.begin(), region.vertices.end(), IsFinite))
+        return false;
+      lowest_world_x = highest_world_x = region.vertices.front().x;
+      for (const HeatmapCoordinate& vertex : region.vertices)
+      {
+        lowest_world_x = std::min(lowest_world_x, vertex.x);
+        highest_world_x = std::max(highest_world_x, vertex.x);
+      }
+    }
+
+    // Columns whose center x lies in [lowest_world_x, highest_world_x), clipped. Cells follow the same half open rule on both axes
+    double first_x = std::max(std::ceil(lowest_world_x / unit_width_ - 0.5), (double)clip_lowest_x);
+    double last_x = std::min(std::ceil(highest_world_x / unit_width_ - 0.5) - 1, (double)clip_highest_x);
+    if (first_x > last_x || clip_lowest_y > clip_highest_y)
+      return true;
+
+    lowest_x_ = (int)first_x;
+    if (region.shape == kCircleRegion)
+      RasterizeCircle(region.center, region.radius, (int)last_x);
+    else
+      RasterizePolygon(region.vertices, (int)last_x);
+    column_offsets_.push_back((int)spans_.size());
+    return true;
+  }
+
+  // -- Bounds of the region
+  bool CellRegion::empty() const
+  {
+    return spans_.empty();
+  }
+  int CellRegion::lowest_x() const
+  {
+    return lowest_x_;
+  }
+  int CellRegion::width() const
+  {
+    return column_offsets_.empty() ? 0 : (int)column_offsets_.size() - 1;
+  }
+  int CellRegion::lowest_y() const
+  {
+    return lowest_y_;
+  }
+  int CellRegion::highest_y() const
+  {
+    return highest_y_;
+  }
+
+  uint64_t CellRegion::cell_count() const
+  {
+    uint64_t cell_count = 0;
+    for (const Span& span : spans_)
+      cell_count += (uint64_t)((int64_t)span.highest_y - span.lowest_y + 1);
+    return cell_count;
+  }
+
+  const CellRegion::Span* CellRegion::column_spans(int coord_x, int &out_span_count) const
+  {
+    if (coord_x < lowest_x_ || coord_x >= lowest_x_ + width())
+    {
+      out_span_count = 0;
+      return nullptr;
+    }
+
+    out_span_count = column_offsets_[coord_x - lowest_x_ + 1] - column_offsets_[coord_x - lowest_x_];
+    return spans_.data() + column_offsets_[coord_x - lowest_x_];
+  }
+
+  // Spans that touch are joined, so a rectangle of a column is only inside the region if a single span holds it
+  bool CellRegion::ContainsRect(int lowest_coord_x, int width, int lowest_coord_y, int height) const
+  {
+    if (empty() || lowest_coord_x < lowest_x_ || lowest_coord_x + width > lowest_x_ + this->width())
+      return false;
+
+    for (int coord_x = lowest_coord_x; coord_x < lowest_coord_x + width; coord_x++)
+    {
+      int span_count;
+      const Span* spans = column_spans(coord_x, span_count);
+      bool contained = false;
+      for (int i = 0; i < span_count && !contained; i++)
+        contained = spans[i].lowest_y <= lowest_coord_y && spans[i].highest_y >= lowest_coord_y + height - 1;
+      if (!contained)
+        return false;
+    }
+    return true;
+  }
+
+  uint32_t CellRegion::CellMask(int coord_x, int lowest_coord_y, int height) const
+  {
+    int span_count;
+    const Span* spans = column_spans(coord_x, span_count);
+    uint32_t mask = 0;
+    for (int i = 0; i < span_count; i++)
+    {
+      int from = std::max(spans[i].lowest_y, lowest_coord_y) - lowest_coord_y;
+      int to = std::min(spans[i].highest_y, lowest_coord_y + height - 1) - lowest_coord_y;
+      if (from <= to)
+        mask |= (to - from == 31 ? 0xFFFFFFFFu : ((1u << (to - from + 1)) - 1)) << from;
+    }
+    return mask;
+  }
+
+  // -- Private Utility Functions
+  void CellRegion::AddSpan(double lowest_world_y, double highest_world_y)
+  {
+    double lowest = std::max(std::ceil(lowest_world_y / unit_height_ - 0.5), (double)clip_lowest_y_);
+    double highest = std::min(std::ceil(highest_world_y / unit_height_ - 0.5) - 1, (double)clip_highest_y_);
+    if (lowest > highest)
+      return;
+
+    Span span = { (int)lowest, (int)highest };
+    if ((int)spans_.size() > column_offsets_.back() && spans_.back().highest_y + 1 >= span.lowest_y)
+      spans_.back().highest_y = std::max(spans_.back().highest_y, span.highest_y);
+    else
+      spans_.push_back(span);
+    lowest_y_ = std::min(lowest_y_, span.lowest_y);
+    highest_y_ = std::max(highest_y_, span.highest_y);
+  }
+
+  void CellRegion::RasterizeCircle(HeatmapCoordinate center, double radius, int last_x)
+  {
+    for (int coord_x = lowest_x_; coord_x <= last_x; coord_x++)
+    {
+      column_offsets_.push_back((int)spans_.size());
+      double offset_x = (coord_x + 0.5) * unit_width_ - center.x;
+      if (offset_x * offset_x > radius * radius)
+        continue;
+
+      double half_height = std::sqrt(radius * radius - offset_x * offset_x);
+      AddSpan(center.y - half_height, center.y + half_height);
+    }
+  }
+
+  // Scanline rasterization with an active edge list: edges are sorted by their lowest x, join the list once the scanline reaches them and leave it once
+  // it passes them, so each column only crosses the edges it can meet. An edge is met by the columns whose center x lies in [lowest_x, highest_x),
+  // so vertical edges are never met, and a scanline through a vertex meets one of its two edges when the polygon goes on across it, and both or none otherwise
+  void CellRegion::RasterizePolygon(const std::vector<HeatmapCoordinate> &vertices, int last_x)
+  {
+    std::vector<PolygonEdge> edges;
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+      HeatmapCoordinate from = vertices[i];
+      HeatmapCoordinate to = vertices[(i + 1) % vertices.size()];
+      if (from.x == to.x)
+        continue;
+      if (from.x > to.x)
+        std::swap(from, to);
+      PolygonEdge edge = { from.x, from.y, to.x, to.y };
+      edges.push_back(edge);
+    }
+    std::sort(edges.begin(), edges.end(), [](const PolygonEdge &a, const PolygonEdge &b) { return a.lowest_x < b.lowest_x; });
+
+    std::vector<const PolygonEdge*> active_edges;
+    std::vector<double> crossings;
+    size_t next_edge = 0;
+    for (int coord_x = lowest_x_; coord_x <= last_x; coord_x++)
+    {
+      column_offsets_.push_back((int)spans_.size());
+      double center_x = (coord_x + 0.5) * unit_width_;
+      while (next_edge < edges.size() && edges[next_edge].lowest_x <= center_x)
+        active_edges.push_back(&edges[next_edge++]);
+      active_edges.erase(std::remove_if(active_edges.begin(), active_edges.end(), [&](const PolygonEdge* edge) { return edge->highest_x <= center_x; }),
+                         active_edges.end());
+
+      // Every closed polygon is crossed an even amount of times, the cells between each pair of crossings are inside it
+      crossings.clear();
+      for (const PolygonEdge* edge : active_edges)
+        crossings.push_back(edge->lowest_x_y + (center_x - edge->lowest_x) * (edge->highest_x_y - edge->lowest_x_y) / (edge->highest_x - edge->lowest_x));
+      std::sort(crossings.begin(), crossings.end());
+      for (size_t i = 0; i + 1 < crossings.size(); i += 2)
+        AddSpan(crossings[i], crossings[i + 1]);
+    }
+  }
+
+  void CellRegion::Clear()
+  {
+    lowest_x_ = 0;
+    lowest_y_ = INT_MAX;
+    highest_y_ = INT_MIN;
+    column_offsets_.clear();
+    spans_.clear();
+  }
+}
\ No newline at end of file
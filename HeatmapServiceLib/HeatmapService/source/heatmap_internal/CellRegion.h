@@ -0,0 +1,76 @@
+////////////////////////////////////////////////////////////////////////
+// CellRegion.h: Cells of the grid covered by a circle or a polygon
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "HeatmapServiceTypes.h"
+
+namespace heatmap_service
+{
+  // -- CellRegion holds the cells of a HeatmapRegion, rasterized against the cell grid one column of cells at a time, as runs of consecutive cells
+  // (spans) along each column. A cell belongs to the region when its center lies inside the shape, and polygons follow the even-odd rule,
+  // so zones sharing an edge never share a cell. Only the cells inside the clip rectangle given to Rasterize are kept, so rasterizing
+  // costs the columns of the shape inside it, plus the edges crossing each of them for polygons, and never the cells themselves
+  class CellRegion
+  {
+  public:
+    // Cells of a column from lowest_y up to highest_y, both included
+    struct Span
+    {
+      int lowest_y;
+      int highest_y;
+    };
+
+    CellRegion();
+
+    // Rasterizes region, in world coordinates, against cells of unit_width by unit_height, keeping only the cells inside the clip rectangle, in cell coordinates.
+    // Returns false, leaving the region empty, if region isn't valid: a circle needs a radius that isn't negative, a polygon needs at least 3 vertices,
+    // and every coordinate must be finite. Throws std::bad_alloc if the spans can't be allocated
+    bool Rasterize(const HeatmapRegion &region, double unit_width, double unit_height, int clip_lowest_x, int clip_lowest_y, int clip_highest_x, int clip_highest_y);
+
+    // -- Bounds of the region, only meaningful when it isn't empty
+    bool empty() const;
+    int lowest_x() const;
+    int width() const;
+    int lowest_y() const;
+    int highest_y() const;
+
+    // Amount of cells of the region
+    uint64_t cell_count() const;
+
+    // Spans of column coord_x, ordered by lowest_y and apart from each other. Columns outside the region have none
+    const Span* column_spans(int coord_x, int &out_span_count) const;
+
+    // Whether every cell of the rectangle belongs to the region
+    bool ContainsRect(int lowest_coord_x, int width, int lowest_coord_y, int height) const;
+
+    // Bit i of the mask is set when cell (coord_x, lowest_coord_y + i) belongs to the region. Height can't be above 32
+    uint32_t CellMask(int coord_x, int lowest_coord_y, int height) const;
+
+  private:
+    // Adds to the column being rasterized the cells whose center y lies in [lowest_world_y, highest_world_y), clipped, joining its last span if they touch it
+    void AddSpan(double lowest_world_y, double highest_world_y);
+
+    // Add the spans of every column from lowest_x_ up to last_x
+    void RasterizeCircle(HeatmapCoordinate center, double radius, int last_x);
+    void RasterizePolygon(const std::vector<HeatmapCoordinate> &vertices, int last_x);
+
+    void Clear();
+
+    double unit_width_;
+    double unit_height_;
+    int clip_lowest_y_;
+    int clip_highest_y_;
+
+    int lowest_x_;
+    int lowest_y_;
+    int highest_y_;
+    // Spans of column lowest_x_ + i go from spans_[column_offsets_[i]] up to spans_[column_offsets_[i + 1]], not included
+    std::vector<int> column_offsets_;
+    std::vector<Span> spans_;
+  };
+}
\ No newline at end of file
@@ -0,0 +1,437 @@
+////////////////////////////////////////////////////////////////////////
+// CounterColumn.cpp: Implementation of the CounterColumn helper class
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "CounterColumn.hpp"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+
+namespace heatmap_service
+{
+  namespace
+  {
+    // What every column that was never written to reads as
+    const SignedIndexVector<uint32_t> kEmptyValues;
+
+    bool IndexBelow(const SparseCounter &counter, int index)
+    {
+      return counter.index < index;
+    }
+  }
+
+  CounterColumn::CounterColumn() : version_(0) {}
+
+  // -- Read access
+  const SignedIndexVector<uint32_t>& CounterColumn::values() const
+  {
+    return values_ ? *values_ : kEmptyValues;
+  }
+
+  uint32_t CounterColumn::get_at(int index) const
+  {
+    if (!sparse_values_)
+      return values().get_at(index);
+
+    std::vector<SparseCounter>::const_iterator counter = std::lower_bound(sparse_values_->begin(), sparse_values_->end(), index, IndexBelow);
+    return counter != sparse_values_->end() && counter->index == index ? counter->value : 0;
+  }
+
+  void CounterColumn::CopyValues(int lowest_index, int count, uint32_t* out_values) const
+  {
+    std::fill(out_values, out_values + count, 0);
+
+    if (sparse_values_)
+    {
+      std::vector<SparseCounter>::const_iterator counter = std::lower_bound(sparse_values_->begin(), sparse_values_->end(), lowest_index, IndexBelow);
+      for (; counter != sparse_values_->end() && counter->index < lowest_index + count; ++counter)
+        out_values[counter->index - lowest_index] = counter->value;
+      return;
+    }
+
+    // Only the part of the requested range that overlaps the initialized values of the column is copied
+    const SignedIndexVector<uint32_t>& dense_values = values();
+    int copy_from = std::max(lowest_index, dense_values.lowest_index());
+    int copy_to = std::min(lowest_index + count, dense_values.lowest_index() + (int)dense_values.size());
+
+    if (copy_from < copy_to)
+      std::copy(dense_values.index_zero() + copy_from, dense_values.index_zero() + copy_to, out_values + (copy_from - lowest_index));
+  }
+
+  // -- Representation
+  bool CounterColumn::sparse() const
+  {
+    return sparse_values_ != nullptr;
+  }
+
+  bool CounterColumn::allocated() const
+  {
+    return sparse_values_ ? sparse_values_->capacity() > 0 : values().allocation_size() > 0;
+  }
+
+  // The occupancy bitmap counts as part of the dense values it describes
+  uint64_t CounterColumn::allocated_bytes() const
+  {
+    if (sparse_values_)
+      return sizeof(std::vector<SparseCounter>) + sparse_values_->capacity() * sizeof(SparseCounter);
+    return sizeof(SignedIndexVector<uint32_t>) + values().allocation_size() * sizeof(uint32_t) +
+      (occupancy_ ? occupancy_->allocation_size() * sizeof(uint64_t) : 0);
+  }
+
+  uint64_t CounterColumn::used_bytes() const
+  {
+    if (sparse_values_)
+      return sizeof(std::vector<SparseCounter>) + sparse_values_->size() * sizeof(SparseCounter);
+    return sizeof(SignedIndexVector<uint32_t>) + values().size() * sizeof(uint32_t) + (occupancy_ ? occupancy_->size() * sizeof(uint64_t) : 0);
+  }
+
+
+  // -- Write access
+  // Writes made through the vector can't be seen by the column, so it drops its occupancy bitmap and reads every block
+  SignedIndexVector<uint32_t>& CounterColumn::MutableValues()
+  {
+    SignedIndexVector<uint32_t>& dense_values = OwnedDenseValues();
+    occupancy_.reset();
+    return dense_values;
+  }
+
+  // use_count() is a relaxed load, so once it says the values are this column's own, an acquire fence orders the write after whatever the copy that was
+  // released last did with them on another thread
+  uint32_t* CounterColumn::OwnedValueAt(int index)
+  {
+    uint32_t* value = nullptr;
+    if (values_)
+    {
+      if (values_.use_count() == 1 && values_->has_index(index))
+      {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        value = values_->index_zero() + index;
+        MarkOccupied(index);
+      }
+    }
+    else if (sparse_values_ && sparse_values_.use_count() == 1)
+    {
+      std::atomic_thread_fence(std::memory_order_acquire);
+      std::vector<SparseCounter>::iterator counter = std::lower_bound(sparse_values_->begin(), sparse_values_->end(), index, IndexBelow);
+      if (counter != sparse_values_->end() && counter->index == index)
+        value = &counter->value;
+    }
+
+    // Returning a counter is a write access, the caller adds to it
+    if (value)
+      version_++;
+    return value;
+  }
+
+  // Growth of the storage is detected by its allocation size changing, and storage that grows copies what it held to its new allocation
+  void CounterColumn::AddAmountAllocatingAt(int index, uint32_t amount, uint64_t &reallocation_count, uint64_t &copy_on_write_count, uint64_t &bytes_copied)
+  {
+    version_++;
+    // Columns start sparse
+    if (!values_ && !sparse_values_)
+      sparse_values_ = std::make_shared< std::vector<SparseCounter> >();
+
+    if (sparse_values_)
+    {
+      std::vector<SparseCounter>::const_iterator position = std::lower_bound(sparse_values_->begin(), sparse_values_->end(), index, IndexBelow);
+      bool holds_index = position != sparse_values_->end() && position->index == index;
+
+      // A new counter that makes the list bigger than the dense vector promotes the column, without copying the list first if it's shared
+      if (!holds_index)
+      {
+        int counter_count = (int)sparse_values_->size() + 1;
+        int lowest_index = sparse_values_->empty() ? index : std::min(index, (int)sparse_values_->front().index);
+        int highest_index = sparse_values_->empty() ? index : std::max(index, (int)sparse_values_->back().index);
+        if (ShouldBeDense(counter_count, lowest_index, highest_index))
+          Promote(reallocation_count, bytes_copied);
+      }
+
+      if (sparse_values_)
+      {
+        size_t offset = position - sparse_values_->begin();
+        if (sparse_values_.use_count() > 1)
+        {
+          copy_on_write_count++;
+          bytes_copied += sparse_values_->size() * sizeof(SparseCounter);
+          sparse_values_ = std::make_shared< std::vector<SparseCounter> >(*sparse_values_);
+        }
+        else
+          std::atomic_thread_fence(std::memory_order_acquire);
+
+        std::vector<SparseCounter>& counters = *sparse_values_;
+        if (holds_index)
+        {
+          counters[offset].value += amount;
+          return;
+        }
+
+        size_t counters_size = counters.size();
+        size_t counters_capacity = counters.capacity();
+        SparseCounter counter = { index, amount };
+        counters.insert(counters.begin() + offset, counter);
+        if (counters.capacity() != counters_capacity)
+        {
+          reallocation_count++;
+          bytes_copied += counters_size * sizeof(SparseCounter);
+        }
+        return;
+      }
+    }
+
+    if (shared())
+    {
+      copy_on_write_count++;
+      bytes_copied += values_->size() * sizeof(uint32_t);
+    }
+    SignedIndexVector<uint32_t>& dense_values = OwnedDenseValues();
+    MarkOccupied(index);
+
+    SignedIndexVector<uint32_t>::siv_size column_size = dense_values.size();
+    SignedIndexVector<uint32_t>::siv_size column_allocation = dense_values.allocation_size();
+    dense_values[index] += amount;
+    if (dense_values.allocation_size() != column_allocation)
+    {
+      reallocation_count++;
+      bytes_copied += column_size * sizeof(uint32_t);
+    }
+  }
+
+  uint32_t* CounterColumn::DenseValuesFor(int lowest_index, int count, uint64_t &reallocation_count, uint64_t &copy_on_write_count, uint64_t &bytes_copied)
+  {
+    int highest_index = lowest_index + count - 1;
+    if (!values_)
+    {
+      int counter_count = count;
+      int lowest_held = lowest_index, highest_held = highest_index;
+      if (sparse_values_ && !sparse_values_->empty())
+      {
+        counter_count += (int)sparse_values_->size();
+        lowest_held = std::min(lowest_held, (int)sparse_values_->front().index);
+        highest_held = std::max(highest_held, (int)sparse_values_->back().index);
+      }
+      if (!ShouldBeDense(counter_count, lowest_held, highest_held))
+        return nullptr;
+    }
+
+    version_++;
+    if (sparse_values_)
+      Promote(reallocation_count, bytes_copied);
+    else if (shared())
+    {
+      copy_on_write_count++;
+      bytes_copied += values_->size() * sizeof(uint32_t);
+    }
+    SignedIndexVector<uint32_t>& dense_values = OwnedDenseValues();
+
+    // Both ends are reached at once, so the values grow a single time
+    SignedIndexVector<uint32_t>::siv_size column_size = dense_values.size();
+    SignedIndexVector<uint32_t>::siv_size column_allocation = dense_values.allocation_size();
+    dense_values[lowest_index];
+    dense_values[highest_index];
+    if (dense_values.allocation_size() != column_allocation)
+    {
+      reallocation_count++;
+      bytes_copied += column_size * sizeof(uint32_t);
+    }
+
+    MarkOccupied(lowest_index);
+    for (int64_t block_start = ((int64_t)lowest_index | (kOccupancyBlockSize - 1)) + 1; block_start <= highest_index; block_start += kOccupancyBlockSize)
+      MarkOccupied((int)block_start);
+    return dense_values.index_zero() + lowest_index;
+  }
+
+  void CounterColumn::AppendSection(std::string &out_buffer) const
+  {
+    uint32_t kind, count;
+    if (sparse_values_)
+    {
+      kind = kSparseSection;
+      count = (uint32_t)sparse_values_->size();
+      out_buffer.append((const char*)&kind, sizeof(kind));
+      out_buffer.append((const char*)&count, sizeof(count));
+      out_buffer.append((const char*)sparse_values_->data(), count * sizeof(SparseCounter));
+    }
+    else if (values_ && values_->size() > 0)
+    {
+      kind = kDenseSection;
+      count = (uint32_t)values_->size();
+      int32_t lowest_index = values_->lowest_index();
+      out_buffer.append((const char*)&kind, sizeof(kind));
+      out_buffer.append((const char*)&lowest_index, sizeof(lowest_index));
+      out_buffer.append((const char*)&count, sizeof(count));
+      out_buffer.append((const char*)values_->begin(), count * sizeof(uint32_t));
+    }
+  }
+
+  // Sections come from outside, so their sizes, the range of their indexes and the order of sparse counters are all checked before they're taken
+  bool CounterColumn::LoadSection(const char* section, size_t length)
+  {
+    values_.reset();
+    sparse_values_.reset();
+    occupancy_.reset();
+    version_++;
+    if (length == 0)
+      return true;
+
+    uint32_t kind, count;
+    if (length < sizeof(kind) + sizeof(count))
+      return false;
+    memcpy(&kind, section, sizeof(kind));
+    if (kind == kSparseSection)
+    {
+      memcpy(&count, section + sizeof(kind), sizeof(count));
+      size_t header_length = sizeof(kind) + sizeof(count);
+      if (count == 0 || (length - header_length) / sizeof(SparseCounter) != count || (length - header_length) % sizeof(SparseCounter) != 0)
+        return false;
+
+      std::shared_ptr< std::vector<SparseCounter> > sparse_values = std::make_shared< std::vector<SparseCounter> >(count);
+      memcpy(sparse_values->data(), section + header_length, count * sizeof(SparseCounter));
+      for (uint32_t i = 1; i < count; i++)
+      {
+        if ((*sparse_values)[i - 1].index >= (*sparse_values)[i].index)
+          return false;
+      }
+      sparse_values_ = sparse_values;
+      return true;
+    }
+
+    int32_t lowest_index;
+    size_t header_length = sizeof(kind) + sizeof(lowest_index) + sizeof(count);
+    if (kind != kDenseSection || length < header_length)
+      return false;
+    memcpy(&lowest_index, section + sizeof(kind), sizeof(lowest_index));
+    memcpy(&count, section + sizeof(kind) + sizeof(lowest_index), sizeof(count));
+    if (count == 0 || (length - header_length) / sizeof(uint32_t) != count || (length - header_length) % sizeof(uint32_t) != 0 ||
+        (int64_t)lowest_index + count - 1 > INT_MAX)
+      return false;
+
+    std::shared_ptr< SignedIndexVector<uint32_t> > dense_values = std::make_shared< SignedIndexVector<uint32_t> >();
+    memcpy(dense_values->assign_exact(lowest_index, count), section + header_length, count * sizeof(uint32_t));
+    values_ = dense_values;
+    RebuildOccupancy();
+    return true;
+  }
+
+  // Only the counters that aren't 0 are kept, so the demoted column is at most half the size of what would promote it again
+  void CounterColumn::Compact()
+  {
+    if (!values_)
+      return;
+
+    const SignedIndexVector<uint32_t>& dense_values = *values_;
+    int nonzero_count = 0;
+    for (const uint32_t* value = dense_values.begin(); value != dense_values.end(); ++value)
+    {
+      if (*value != 0)
+        nonzero_count++;
+    }
+    if (nonzero_count > kMaxSparseCounters || 2 * nonzero_count * sizeof(SparseCounter) > dense_values.size() * sizeof(uint32_t))
+      return;
+
+    std::shared_ptr< std::vector<SparseCounter> > sparse_values = std::make_shared< std::vector<SparseCounter> >();
+    sparse_values->reserve(nonzero_count);
+    for (int index = dense_values.lowest_index(); index < dense_values.lowest_index() + (int)dense_values.size(); index++)
+    {
+      if (dense_values[index] != 0)
+      {
+        SparseCounter counter = { index, dense_values[index] };
+        sparse_values->push_back(counter);
+      }
+    }
+    values_.reset();
+    occupancy_.reset();
+    sparse_values_ = sparse_values;
+  }
+
+  // Callers may write to values that aren't shared, so those are fenced as in OwnedValueAt
+  bool CounterColumn::shared() const
+  {
+    bool is_shared = sparse_values_ ? sparse_values_.use_count() > 1 : values_ && values_.use_count() > 1;
+    if (!is_shared)
+      std::atomic_thread_fence(std::memory_order_acquire);
+    return is_shared;
+  }
+
+  bool CounterColumn::CanWriteInPlace(int index) const
+  {
+    if (!values_ || values_.use_count() != 1 || !values_->has_index(index))
+      return false;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+  }
+
+  // -- Private Utility Functions
+  // The dense vector grows from index 0, so it holds every counter between 0 and the furthest index on either side of it
+  bool CounterColumn::ShouldBeDense(int counter_count, int lowest_index, int highest_index)
+  {
+    uint64_t dense_count = (uint64_t)std::max(highest_index, 0) - std::min(lowest_index, 0) + 1;
+    return counter_count > kMaxSparseCounters || counter_count * sizeof(SparseCounter) > dense_count * sizeof(uint32_t);
+  }
+
+  void CounterColumn::Promote(uint64_t &reallocation_count, uint64_t &bytes_copied)
+  {
+    std::shared_ptr< SignedIndexVector<uint32_t> > dense_values = std::make_shared< SignedIndexVector<uint32_t> >();
+    for (const SparseCounter& counter : *sparse_values_)
+      (*dense_values)[counter.index] = counter.value;
+
+    reallocation_count++;
+    bytes_copied += sparse_values_->size() * sizeof(SparseCounter);
+    sparse_values_.reset();
+    values_ = dense_values;
+    RebuildOccupancy();
+  }
+
+  SignedIndexVector<uint32_t>& CounterColumn::OwnedDenseValues()
+  {
+    version_++;
+    if (sparse_values_)
+    {
+      uint64_t reallocation_count = 0, bytes_copied = 0;
+      Promote(reallocation_count, bytes_copied);
+    }
+    else if (!values_)
+    {
+      values_ = std::make_shared< SignedIndexVector<uint32_t> >();
+      occupancy_ = std::make_shared< SignedIndexVector<uint64_t> >();
+    }
+    // Another map still reads these values, so this column moves to a copy of its own before it's changed
+    else if (values_.use_count() > 1)
+    {
+      values_ = std::make_shared< SignedIndexVector<uint32_t> >(*values_);
+      if (occupancy_)
+        occupancy_ = std::make_shared< SignedIndexVector<uint64_t> >(*occupancy_);
+    }
+    else
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+    return *values_;
+  }
+
+  // The bitmap grows along with the values, so once the allocating write marked an index, the word of any index the values hold is already there,
+  // and marking a counter returned by OwnedValueAt never allocates
+  void CounterColumn::MarkOccupied(int index)
+  {
+    if (occupancy_)
+      (*occupancy_)[index >> kOccupancyWordBits] |= (uint64_t)1 << ((index >> kOccupancyBlockBits) & 63);
+  }
+
+  // Both ends of the values get their word, even if they hold zeros, so the bitmap covers every index the values hold
+  void CounterColumn::RebuildOccupancy()
+  {
+    occupancy_ = std::make_shared< SignedIndexVector<uint64_t> >();
+    const SignedIndexVector<uint32_t>& dense_values = *values_;
+    if (dense_values.size() == 0)
+      return;
+
+    SignedIndexVector<uint64_t>& occupancy = *occupancy_;
+    occupancy[dense_values.lowest_index() >> kOccupancyWordBits];
+    occupancy[(dense_values.lowest_index() + (int)dense_values.size() - 1) >> kOccupancyWordBits];
+    for (int index = dense_values.lowest_index(); index < dense_values.lowest_index() + (int)dense_values.size(); index++)
+    {
+      if (dense_values[index] != 0)
+        MarkOccupied(index);
+    }
+  }
+}
\ No newline at end of file
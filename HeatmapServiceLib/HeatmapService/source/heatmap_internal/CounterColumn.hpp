@@ -0,0 +1,257 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// CounterColumn.h: Declaration of CounterColumn helper class.
+// Holds the counters of a single column of a CounterMap, shared between copies of the map until one of them writes to it
+// Includes Boost libraries to serialize itself, these require an hpp header with implementation
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// for uint_32
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Boost headers for Serialization
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/level.hpp>
+#include <boost/serialization/tracking.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+#include "SignedIndexVector.hpp"
+
+namespace heatmap_service
+{
+  // -- Division rounding towards negative infinity, so negative indexes land in the cell below them.
+  // Used wherever consecutive indexes are grouped into cells, such as the cells of a CounterGroupMap column, or the cells merged by a rebin
+  inline int FloorDivide(int value, int divisor)
+  {
+    int quotient = value / divisor;
+    return value % divisor < 0 ? quotient - 1 : quotient;
+  }
+
+  // -- A counter of a sparse column, at index of the column
+  struct SparseCounter
+  {
+    int32_t index;
+    uint32_t value;
+  };
+
+  // -- CounterColumn is the region of storage copy on write works with. Copying a column only copies a pointer to its values,
+  // so copying a CounterMap costs one pointer per column instead of all of its counters.
+  // The values are only copied when a column that is shared with another map is written to, leaving the other map's view untouched.
+  // Columns that were never written to don't allocate anything.
+  // A column is either dense, a SignedIndexVector holding every counter from its lowest to its highest index (and index 0, which the vector grows from),
+  // or sparse, a list of the counters written to sorted by index. Columns written to through AddAmountAllocatingAt start sparse, so a column
+  // crossing the wilderness with a couple of events costs a few bytes instead of four per cell between them, and are promoted to dense once the list
+  // would cost more than the vector, or grows past kMaxSparseCounters and takes too long to search. Compact demotes them back.
+  // Columns written to through MutableValues are always dense.
+  // Dense columns written to through OwnedValueAt and AddAmountAllocatingAt also keep an occupancy bitmap, one bit for each block of kOccupancyBlockSize
+  // counters, set once any counter of the block is written to. Blocks whose bit isn't set are known to hold only zeros, so reading the non zero counters
+  // of a column that grew from 0 to a few events far away skips most of it
+  class CounterColumn
+  {
+  private:
+    std::shared_ptr< SignedIndexVector<uint32_t> > values_;
+    std::shared_ptr< std::vector<SparseCounter> > sparse_values_;
+    // Word w holds the bits of the blocks w * 64 to w * 64 + 63. Shared and copied together with values_, and null when the column
+    // isn't dense or was written to through MutableValues, which can't see what's written
+    std::shared_ptr< SignedIndexVector<uint64_t> > occupancy_;
+
+    // Write accesses given by this column, see version()
+    uint64_t version_;
+
+  public:
+    // Most counters a sparse column holds before it's promoted to dense
+    static const int kMaxSparseCounters = 64;
+    // Kinds of column sections
+    static const uint32_t kDenseSection = 0;
+    static const uint32_t kSparseSection = 1;
+    // Counters covered by each bit of the occupancy bitmap, and by each word of it
+    static const int kOccupancyBlockBits = 6;
+    static const int kOccupancyBlockSize = 1 << kOccupancyBlockBits;
+    static const int kOccupancyWordBits = kOccupancyBlockBits + 6;
+
+    CounterColumn();
+
+    // -- Read access
+    // The values of a dense column. Sparse columns, and columns that were never written to, read as an empty vector
+    const SignedIndexVector<uint32_t>& values() const;
+
+    // Returns the counter at index, 0 if the column doesn't hold it
+    uint32_t get_at(int index) const;
+
+    // Copies the counters from lowest_index up to (lowest_index + count - 1) into out_values, writing 0 for the ones the column doesn't hold
+    void CopyValues(int lowest_index, int count, uint32_t* out_values) const;
+
+    // Calls function(index, value) for every counter the column holds, by increasing index. Dense columns include the counters that are 0
+    template<typename Function>
+    void for_each_value(Function function) const
+    {
+      if (sparse_values_)
+      {
+        for (const SparseCounter& counter : *sparse_values_)
+          function((int)counter.index, counter.value);
+        return;
+      }
+
+      const SignedIndexVector<uint32_t>& dense_values = values();
+      for (int index = dense_values.lowest_index(); index < dense_values.lowest_index() + (int)dense_values.size(); index++)
+        function(index, dense_values[index]);
+    }
+
+    // Calls function(index, value) for every counter of the column that isn't 0, from lowest_index up to (lowest_index + count - 1), by increasing index.
+    // Sparse columns walk their list, dense ones only read the blocks of counters their occupancy bitmap marks
+    template<typename Function>
+    void for_each_nonzero_value(int lowest_index, int count, Function function) const
+    {
+      if (sparse_values_)
+      {
+        // The list is sorted, so only the counters from the first one of the range on are read
+        std::vector<SparseCounter>::const_iterator counter = std::lower_bound(sparse_values_->begin(), sparse_values_->end(), lowest_index,
+          [](const SparseCounter &sparse_counter, int index) { return sparse_counter.index < index; });
+        for (; counter != sparse_values_->end() && counter->index < lowest_index + count; ++counter)
+        {
+          if (counter->value != 0)
+            function((int)counter->index, counter->value);
+        }
+        return;
+      }
+
+      const SignedIndexVector<uint32_t>& dense_values = values();
+      int first_index = std::max(lowest_index, dense_values.lowest_index());
+      int end_index = std::min(lowest_index + count, dense_values.lowest_index() + (int)dense_values.size());
+      if (first_index >= end_index)
+        return;
+
+      const uint32_t* index_zero = dense_values.index_zero();
+      if (!occupancy_)
+      {
+        for (int index = first_index; index < end_index; index++)
+        {
+          if (index_zero[index] != 0)
+            function(index, index_zero[index]);
+        }
+        return;
+      }
+
+      const SignedIndexVector<uint64_t>& occupancy = *occupancy_;
+      for (int word_index = first_index >> kOccupancyWordBits; word_index <= (end_index - 1) >> kOccupancyWordBits; word_index++)
+      {
+        uint64_t word = occupancy.get_at(word_index);
+        for (int bit = 0; word != 0; bit++, word >>= 1)
+        {
+          if (!(word & 1))
+            continue;
+
+          // Words below index 0 are negative, and shifting those left is undefined, so the start is multiplied out instead
+          int block_start = word_index * (1 << kOccupancyWordBits) + bit * kOccupancyBlockSize;
+          int from = std::max(first_index, block_start);
+          int to = std::min(end_index, block_start + kOccupancyBlockSize);
+          for (int index = from; index < to; index++)
+          {
+            if (index_zero[index] != 0)
+              function(index, index_zero[index]);
+          }
+        }
+      }
+    }
+
+    // -- Representation
+    bool sparse() const;
+    // True if the column holds any storage
+    bool allocated() const;
+    // Bytes of the storage of the column, allocated and holding counters
+    uint64_t allocated_bytes() const;
+    uint64_t used_bytes() const;
+
+    // -- Version. Grows with every write access the column gives, so readers can tell whether the column changed since they last read it
+    // by comparing versions instead of counters. Copies of a column start from the version of the original
+    uint64_t version() const { return version_; }
+
+    // -- Write access. Gives this column a dense values vector of its own first, if it's shared with another map, sparse or doesn't exist yet.
+    // Throws std::bad_alloc if the copy can't be allocated
+    SignedIndexVector<uint32_t>& MutableValues();
+
+    // Returns the counter at index if it can be written to without allocating or copying anything: the column owns its storage and already holds index.
+    // Returns nullptr otherwise
+    uint32_t* OwnedValueAt(int index);
+
+    // Adds amount to the counter at index, allocating, copying or promoting the storage of the column as needed.
+    // What was allocated and copied is added to the counters passed. Throws std::bad_alloc if the memory can't be allocated
+    void AddAmountAllocatingAt(int index, uint32_t amount, uint64_t &reallocation_count, uint64_t &copy_on_write_count, uint64_t &bytes_copied);
+
+    // Returns the count counters from lowest_index on, one after the other, for a caller adding to many consecutive counters at once. The values grow once
+    // to hold all of them, copied first if they're shared, and every block of the range is marked in the occupancy bitmap.
+    // Sparse columns are promoted first, if holding the whole range would promote them anyway. Otherwise returns nullptr, leaving the column as it was,
+    // and its counters are better added one at a time through AddAmountAllocatingAt. Throws std::bad_alloc if the memory can't be allocated
+    uint32_t* DenseValuesFor(int lowest_index, int count, uint64_t &reallocation_count, uint64_t &copy_on_write_count, uint64_t &bytes_copied);
+
+    // -- Sections. The column written on its own, so the columns of a map can be read back independently of each other, on any thread.
+    // A dense column is the uint32 kind 0, its int32 lowest index, a uint32 count and that many uint32 counters. A sparse one is the kind 1,
+    // a uint32 count and that many pairs of an int32 index and a uint32 counter, by increasing index. Columns holding nothing write nothing.
+    // Numbers are in the byte order of the host, as in the rest of a serialized heatmap
+    void AppendSection(std::string &out_buffer) const;
+    // Replaces the counters of the column with those of section, as it was when written. Returns false, leaving the column empty, if section isn't valid.
+    // Throws std::bad_alloc if the counters can't be allocated
+    bool LoadSection(const char* section, size_t length);
+
+    // Demotes a dense column to sparse if its non zero counters fit in a list of under half the memory, dropping the counters that are 0
+    void Compact();
+
+    // True if the values of this column are also seen by another copy of the map
+    bool shared() const;
+
+    // True if index can be written to without allocating or copying anything: the column owns its dense values and index is already initialized
+    bool CanWriteInPlace(int index) const;
+
+  private:
+    // True if a sparse list of counter_count counters, between lowest_index and highest_index, is bigger than the dense vector holding them
+    static bool ShouldBeDense(int counter_count, int lowest_index, int highest_index);
+    // Moves the counters of the sparse list to a dense vector. Throws std::bad_alloc if it can't be allocated
+    void Promote(uint64_t &reallocation_count, uint64_t &bytes_copied);
+
+    // Gives this column dense values of its own, as MutableValues does, keeping the occupancy bitmap
+    SignedIndexVector<uint32_t>& OwnedDenseValues();
+    // Sets the occupancy bit of the block holding index, growing the bitmap if needed. Does nothing if the column keeps no bitmap
+    void MarkOccupied(int index);
+    // Builds the occupancy bitmap of the dense values from scratch
+    void RebuildOccupancy();
+
+  private:
+    // Boost serialization methods
+    // A column serializes exactly as the vector of values it holds, so maps serialized before columns were shared still load.
+    // Sparse columns are written as the dense vector they stand for, and load dense
+    friend class boost::serialization::access;
+    template<class Archive>
+    void save(Archive & ar, const unsigned int version) const
+    {
+      if (!sparse_values_)
+      {
+        ar & values();
+        return;
+      }
+
+      SignedIndexVector<uint32_t> dense_values;
+      for (const SparseCounter& counter : *sparse_values_)
+        dense_values[counter.index] = counter.value;
+      ar & dense_values;
+    }
+    template<class Archive>
+    void load(Archive & ar, const unsigned int version)
+    {
+      sparse_values_.reset();
+      values_ = std::make_shared< SignedIndexVector<uint32_t> >();
+      ar & *values_;
+      RebuildOccupancy();
+    }
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+  };
+}
+
+// Columns are written without class information of their own, keeping the archive layout of the values vector they wrap
+BOOST_CLASS_IMPLEMENTATION(heatmap_service::CounterColumn, boost::serialization::object_serializable)
+BOOST_CLASS_TRACKING(heatmap_service::CounterColumn, boost::serialization::track_never)
\ No newline at end of file
@@ -0,0 +1,273 @@
+////////////////////////////////////////////////////////////////////////
+// CounterGroupMap.cpp: Implementation of the CounterGroupMap helper class
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "CounterGroupMap.hpp"
+#include <iostream>
+#include <algorithm>
+
+namespace heatmap_service
+{
+  CounterGroupMap::CounterGroupMap() : lowest_coord_x_(0), highest_coord_x_(0), lowest_coord_y_(0), highest_coord_y_(0) { }
+  CounterGroupMap::CounterGroupMap(const std::vector<std::string> &counter_keys) : counter_keys_(counter_keys),
+    lowest_coord_x_(0), highest_coord_x_(0), lowest_coord_y_(0), highest_coord_y_(0) { }
+  CounterGroupMap::CounterGroupMap(const CounterGroupMap& copy) : counter_keys_(copy.counter_keys_), coord_matrix_(copy.coord_matrix_),
+    lowest_coord_x_(copy.lowest_coord_x_), highest_coord_x_(copy.highest_coord_x_), lowest_coord_y_(copy.lowest_coord_y_), highest_coord_y_(copy.highest_coord_y_) { }
+  CounterGroupMap& CounterGroupMap::operator=(const CounterGroupMap& copy)
+  {
+    if (this != &copy)
+    {
+      counter_keys_ = copy.counter_keys_;
+      coord_matrix_ = copy.coord_matrix_;
+      lowest_coord_x_ = copy.lowest_coord_x_;
+      highest_coord_x_ = copy.highest_coord_x_;
+      lowest_coord_y_ = copy.lowest_coord_y_;
+      highest_coord_y_ = copy.highest_coord_y_;
+    }
+    return *this;
+  }
+  CounterGroupMap::~CounterGroupMap() { }
+
+  // -- Getters of the counters of the group
+  const std::vector<std::string>& CounterGroupMap::counter_keys() const
+  {
+    return counter_keys_;
+  }
+
+  int CounterGroupMap::counter_count() const
+  {
+    return (int)counter_keys_.size();
+  }
+
+  int CounterGroupMap::CounterIndex(const std::string &counter_key) const
+  {
+    for (int i = 0; i < counter_count(); i++)
+    {
+      if (counter_keys_[i] == counter_key)
+        return i;
+    }
+    return -1;
+  }
+
+  // -- Getters of current map limits
+  int CounterGroupMap::lowest_coord_x() const
+  {
+    return lowest_coord_x_;
+  }
+  int CounterGroupMap::highest_coord_x() const
+  {
+    return highest_coord_x_;
+  }
+  int CounterGroupMap::lowest_coord_y() const
+  {
+    return lowest_coord_y_;
+  }
+  int CounterGroupMap::highest_coord_y() const
+  {
+    return highest_coord_y_;
+  }
+
+  // -- Map registering methods
+  bool CounterGroupMap::AddAmountsAt(int coord_x, int coord_y, const int amounts[])
+  {
+    if (counter_keys_.empty())
+      return false;
+
+    try {
+      uint32_t* cell = MutableCellAt(coord_x, coord_y);
+      for (int c = 0; c < counter_count(); c++)
+      {
+        if (amounts[c] > 0)
+          cell[c] += amounts[c];
+      }
+    }
+    catch (const std::bad_alloc& e) {
+      std::cout << "[HEATMAP_SERVICE] ERROR: Could not register counter group for coordinate { " << coord_x << " , " << coord_y << " }. Reason: \"" << e.what() << "\". Map may be too big to maintain" << std::endl;
+      return false;
+    }
+    CheckIfNewBoundary(coord_x, coord_y);
+    return true;
+  }
+
+  bool CounterGroupMap::AddAmountAt(int coord_x, int coord_y, int counter_index, int amount)
+  {
+    if (counter_index < 0 || counter_index >= counter_count())
+      return false;
+
+    //If the amount is 0 or lesser, we don't need to do anything
+    if (amount <= 0)
+      return true;
+
+    try {
+      MutableCellAt(coord_x, coord_y)[counter_index] += amount;
+    }
+    catch (const std::bad_alloc& e) {
+      std::cout << "[HEATMAP_SERVICE] ERROR: Could not register counter group for coordinate { " << coord_x << " , " << coord_y << " }. Reason: \"" << e.what() << "\". Map may be too big to maintain" << std::endl;
+      return false;
+    }
+    CheckIfNewBoundary(coord_x, coord_y);
+    return true;
+  }
+
+  // Only whole cells are added, and cells whose counters are all 0 are skipped so they don't grow this map
+  bool CounterGroupMap::AddMap(const CounterGroupMap& other)
+  {
+    if (counter_keys_ != other.counter_keys_)
+      return false;
+
+    if (this == &other)
+    {
+      CounterGroupMap copy(other);
+      return AddMap(copy);
+    }
+
+    if (coord_matrix_.size() == 0)
+    {
+      coord_matrix_ = other.coord_matrix_;
+    }
+    else
+    {
+      int count = counter_count();
+      try {
+        for (int x = other.coord_matrix_.lowest_index(); x < other.coord_matrix_.lowest_index() + (int)other.coord_matrix_.size(); x++)
+        {
+          const SignedIndexVector<uint32_t>& column = other.coord_matrix_[x].values();
+          int first_cell = FloorDivide(column.lowest_index() + count - 1, count);
+          int end_cell = FloorDivide(column.lowest_index() + (int)column.size(), count);
+          for (int y = first_cell; y < end_cell; y++)
+          {
+            const uint32_t* other_cell = column.index_zero() + y * count;
+            if (std::all_of(other_cell, other_cell + count, [](uint32_t value) { return value == 0; }))
+              continue;
+
+            uint32_t* cell = MutableCellAt(x, y);
+            for (int c = 0; c < count; c++)
+              cell[c] += other_cell[c];
+          }
+        }
+      }
+      catch (const std::bad_alloc& e) {
+        std::cout << "[HEATMAP_SERVICE] ERROR: Could not merge counter group. Reason: \"" << e.what() << "\". Map may be too big to maintain" << std::endl;
+        return false;
+      }
+    }
+
+    CheckIfNewBoundary(other.lowest_coord_x_, other.lowest_coord_y_);
+    CheckIfNewBoundary(other.highest_coord_x_, other.highest_coord_y_);
+    return true;
+  }
+
+  bool CounterGroupMap::Rebin(int factor_x, int factor_y)
+  {
+    if (factor_x < 1 || factor_y < 1)
+      return false;
+    if (factor_x == 1 && factor_y == 1)
+      return true;
+
+    CounterGroupMap rebinned(counter_keys_);
+    int count = counter_count();
+    try {
+      for (int x = coord_matrix_.lowest_index(); x < coord_matrix_.lowest_index() + (int)coord_matrix_.size(); x++)
+      {
+        const SignedIndexVector<uint32_t>& column = coord_matrix_[x].values();
+        int first_cell = FloorDivide(column.lowest_index() + count - 1, count);
+        int end_cell = FloorDivide(column.lowest_index() + (int)column.size(), count);
+        for (int y = first_cell; y < end_cell; y++)
+        {
+          const uint32_t* old_cell = column.index_zero() + y * count;
+          if (std::all_of(old_cell, old_cell + count, [](uint32_t value) { return value == 0; }))
+            continue;
+
+          uint32_t* cell = rebinned.MutableCellAt(FloorDivide(x, factor_x), FloorDivide(y, factor_y));
+          for (int c = 0; c < count; c++)
+            cell[c] += old_cell[c];
+        }
+      }
+    }
+    catch (const std::bad_alloc& e) {
+      std::cout << "[HEATMAP_SERVICE] ERROR: Could not rebin counter group. Reason: \"" << e.what() << "\". Map may be too big to maintain" << std::endl;
+      return false;
+    }
+
+    // Assigning the columns frees the old ones, unless copies of the map still share them
+    coord_matrix_ = rebinned.coord_matrix_;
+    lowest_coord_x_ = FloorDivide(lowest_coord_x_, factor_x);
+    highest_coord_x_ = FloorDivide(highest_coord_x_, factor_x);
+    lowest_coord_y_ = FloorDivide(lowest_coord_y_, factor_y);
+    highest_coord_y_ = FloorDivide(highest_coord_y_, factor_y);
+    return true;
+  }
+
+  // -- Map query methods
+  uint32_t CounterGroupMap::getValueAt(int coord_x, int coord_y, int counter_index) const
+  {
+    if (counter_index < 0 || counter_index >= counter_count() || !coord_matrix_.has_index(coord_x))
+      return 0;
+
+    return coord_matrix_[coord_x].values().get_at(coord_y * counter_count() + counter_index);
+  }
+
+  void CounterGroupMap::getColumnValues(int coord_x, int lowest_coord_y, int height, uint32_t* const out_values[]) const
+  {
+    int count = counter_count();
+    for (int c = 0; c < count; c++)
+      std::fill(out_values[c], out_values[c] + height, 0);
+
+    // Columns outside the current scope of the map have no values to copy
+    if (!coord_matrix_.has_index(coord_x))
+      return;
+
+    // Only the cells of the requested range whose counters are all initialized in the column are read, one cell after the other
+    const SignedIndexVector<uint32_t>& column = coord_matrix_[coord_x].values();
+    int copy_from = std::max(lowest_coord_y, FloorDivide(column.lowest_index() + count - 1, count));
+    int copy_to = std::min(lowest_coord_y + height, FloorDivide(column.lowest_index() + (int)column.size(), count));
+
+    for (int y = copy_from; y < copy_to; y++)
+    {
+      const uint32_t* cell = column.index_zero() + y * count;
+      for (int c = 0; c < count; c++)
+        out_values[c][y - lowest_coord_y] = cell[c];
+    }
+  }
+
+  // -- Map Clear
+  void CounterGroupMap::ClearMap()
+  {
+    coord_matrix_.clear();
+  }
+
+  // -- Private Utility Functions
+  // -- Checks if coordinate is a new boundary for the Map. If so, replace previous highest/lowest values
+  void CounterGroupMap::CheckIfNewBoundary(int coord_x, int coord_y)
+  {
+    if (coord_x < lowest_coord_x_)
+      lowest_coord_x_ = coord_x;
+
+    if (coord_y < lowest_coord_y_)
+      lowest_coord_y_ = coord_y;
+
+    if (coord_x > highest_coord_x_)
+      highest_coord_x_ = coord_x;
+
+    if (coord_y > highest_coord_y_)
+      highest_coord_y_ = coord_y;
+  }
+
+  uint32_t* CounterGroupMap::MutableCellAt(int coord_x, int coord_y)
+  {
+    int first_index = coord_y * counter_count();
+    int last_index = first_index + counter_count() - 1;
+
+    // Most writes land on a cell already initialized in a column this map owns, where nothing can be allocated
+    CounterColumn* column = coord_matrix_.has_index(coord_x) ? &coord_matrix_[coord_x] : nullptr;
+    if (column && column->CanWriteInPlace(first_index) && column->CanWriteInPlace(last_index))
+      return &column->MutableValues()[first_index];
+
+    // Initializing the last counter of the cell, then the first, initializes every counter in between,
+    // so the initialized range of a column always starts and ends on whole cells
+    SignedIndexVector<uint32_t>& values = coord_matrix_[coord_x].MutableValues();
+    values[last_index];
+    return &values[first_index];
+  }
+}
\ No newline at end of file
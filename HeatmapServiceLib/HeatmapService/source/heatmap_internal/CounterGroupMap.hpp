@@ -0,0 +1,129 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// CounterGroupMap.h: Declaration of CounterGroupMap helper class.
+// Contains the data of a group of counters, stored together cell by cell
+// Includes Boost libraries to serialize itself, these require an hpp header with implementation
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// for uint_32
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Boost headers for Serialization
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+#include "SignedIndexVector.hpp"
+#include "CounterColumn.hpp"
+
+namespace heatmap_service
+{
+  // -- CounterGroupMap holds several counters (deaths, gold, xp...) that are usually logged and queried together, like CounterMap holds one.
+  // Instead of one map per counter, the counters of a cell sit next to each other in the same column: the counter c of the cell y
+  // is found at index y * counter_count + c of column x. So logging every counter of a group at a position is one lookup and a write
+  // to a few contiguous values, and an area query reads the columns once for all the counters.
+  // Columns are CounterColumns, so copies of the map share them until written to, as with CounterMap
+  class CounterGroupMap
+  {
+  private:
+    // Names of the counters of the group, in the order their values are stored in each cell
+    std::vector<std::string> counter_keys_;
+
+    SignedIndexVector<CounterColumn> coord_matrix_;
+
+    // Highest and lowest cells currently present in the map
+    int lowest_coord_x_;
+    int highest_coord_x_;
+    int lowest_coord_y_;
+    int highest_coord_y_;
+
+  public:
+    CounterGroupMap();
+    explicit CounterGroupMap(const std::vector<std::string> &counter_keys);
+    CounterGroupMap(const CounterGroupMap& copy);
+    CounterGroupMap& operator=(const CounterGroupMap& copy);
+    ~CounterGroupMap();
+
+    // -- Getters of the counters of the group
+    const std::vector<std::string>& counter_keys() const;
+    int counter_count() const;
+    // Position of counter_key in the group, -1 if it isn't part of it
+    int CounterIndex(const std::string &counter_key) const;
+
+    // -- Getters of current map limits
+    int lowest_coord_x() const;
+    int highest_coord_x() const;
+    int lowest_coord_y() const;
+    int highest_coord_y() const;
+
+    // -- Map registering methods
+    // Adds amounts[c] to counter c of the cell, for every counter of the group. Amounts of 0 or less leave their counter untouched.
+    // Map will grow horizontally and vertically as necessessary to accomodate new data
+    bool AddAmountsAt(int coord_x, int coord_y, const int amounts[]);
+    bool AddAmountAt(int coord_x, int coord_y, int counter_index, int amount);
+
+    // Adds every counter of other, a group of the same counters, to this map, and widens the map limits to hold those of other.
+    // A map that holds no counters yet takes the storage of other instead, shared until either writes to it.
+    // Returns false if the groups don't have the same counters, or if the memory can't be allocated, with only part of the counters added
+    bool AddMap(const CounterGroupMap& other);
+
+    // Coarsens the map, merging every factor_x by factor_y block of cells into one cell holding their sums, as CounterMap::Rebin does.
+    // Returns false if the factors aren't positive or the memory can't be allocated, leaving the map as it was
+    bool Rebin(int factor_x, int factor_y);
+
+    // -- Map query methods
+    // Returns the value of a counter of the group at given coordinate, 0 if the coordinate lies outside the current scope of the map
+    uint32_t getValueAt(int coord_x, int coord_y, int counter_index) const;
+
+    // Copies the values of column coord_x, from coord_y lowest_coord_y up to (lowest_coord_y + height - 1), into out_values[c] for every counter c.
+    // Each out_values[c] must be able to hold height values. Positions outside the current scope of the map are written as 0.
+    // The column is read once, cell after cell, for all the counters
+    void getColumnValues(int coord_x, int lowest_coord_y, int height, uint32_t* const out_values[]) const;
+
+    // -- Map Clear
+    void ClearMap();
+
+  private:
+    // -- Private Utility Functions
+    // -- Checks if coordinate is a new boundary for the Map. If so, replace previous highest/lowest values
+    void CheckIfNewBoundary(int coord_x, int coord_y);
+
+    // Gives the counters of the cell storage this map owns, allocating or copying the column as needed, and returns the first of them.
+    // Throws std::bad_alloc if the memory can't be allocated
+    uint32_t* MutableCellAt(int coord_x, int coord_y);
+
+    // Boost serialization methods
+    // Implement functionality on how to serialize and deserialize a CounterGroupMap into a boost Archive
+    friend class boost::serialization::access;
+    template<class Archive>
+    void save(Archive & ar, const unsigned int version) const
+    {
+      ar & counter_keys_;
+      ar & lowest_coord_x_;
+      ar & lowest_coord_y_;
+      ar & highest_coord_x_;
+      ar & highest_coord_y_;
+      ar & coord_matrix_;
+    }
+    template<class Archive>
+    void load(Archive & ar, const unsigned int version)
+    {
+      // Ensures map is cleaned and deallocated before loading the serialized values
+      ClearMap();
+
+      ar & counter_keys_;
+      ar & lowest_coord_x_;
+      ar & lowest_coord_y_;
+      ar & highest_coord_x_;
+      ar & highest_coord_y_;
+      ar & coord_matrix_;
+    }
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+  };
+}
\ No newline at end of file
@@ -5,20 +5,140 @@
 
 #include "CounterMap.hpp"
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
+
+#include "ParallelFor.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HEATMAP_KERNEL_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace heatmap_service
 {
-  CounterMap::CounterMap() : lowest_coord_x_(0), highest_coord_x_(0), lowest_coord_y_(0), highest_coord_y_(0) { }
-  CounterMap::CounterMap(const CounterMap& copy) : lowest_coord_x_(copy.lowest_coord_x_), highest_coord_x_(copy.highest_coord_x_),
-    lowest_coord_y_(copy.lowest_coord_y_), highest_coord_y_(copy.highest_coord_y_), coord_matrix_(copy.coord_matrix_) { }
+  namespace
+  {
+    // Generations are unique across every map of the process, so a map that was cleared can't be mistaken for another one with the same versions
+    std::atomic<uint64_t> g_next_generation(1);
+
+    uint64_t NextGeneration()
+    {
+      return g_next_generation.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Calls visit(cell_x, cell_y) for every cell the segment between two points in cell units passes through, in order, from the cell of the first point
+    // to the cell of the second (Amanatides and Woo's grid traversal). Every step crosses into the neighbouring cell whose border the segment meets first,
+    // crossing the x border first when it goes through a corner. The steps are counted beforehand, so rounding can't walk past the last cell.
+    // Stops as soon as visit returns false, and returns false then
+    template<typename Visit>
+    bool TraverseSegment(double from_x, double from_y, double to_x, double to_y, Visit visit)
+    {
+      int cell_x = (int)std::floor(from_x), cell_y = (int)std::floor(from_y);
+      int last_x = (int)std::floor(to_x), last_y = (int)std::floor(to_y);
+      int step_x = last_x > cell_x ? 1 : -1;
+      int step_y = last_y > cell_y ? 1 : -1;
+
+      // Fraction of the segment covered when the next x and y borders are reached, and the fraction covered crossing a whole cell
+      double delta_x = to_x - from_x, delta_y = to_y - from_y;
+      double border_x = delta_x > 0 ? (cell_x + 1 - from_x) / delta_x : delta_x < 0 ? (cell_x - from_x) / delta_x : HUGE_VAL;
+      double border_y = delta_y > 0 ? (cell_y + 1 - from_y) / delta_y : delta_y < 0 ? (cell_y - from_y) / delta_y : HUGE_VAL;
+      double cell_step_x = delta_x != 0 ? std::abs(1 / delta_x) : HUGE_VAL;
+      double cell_step_y = delta_y != 0 ? std::abs(1 / delta_y) : HUGE_VAL;
+
+      if (!visit(cell_x, cell_y))
+        return false;
+      for (int64_t steps = std::abs((int64_t)last_x - cell_x) + std::abs((int64_t)last_y - cell_y); steps > 0; steps--)
+      {
+        if (cell_y == last_y || (cell_x != last_x && border_x <= border_y))
+        {
+          cell_x += step_x;
+          border_x += cell_step_x;
+        }
+        else
+        {
+          cell_y += step_y;
+          border_y += cell_step_y;
+        }
+        if (!visit(cell_x, cell_y))
+          return false;
+      }
+      return true;
+    }
+
+    // Shifted unsigned, as shifting a negative x left is undefined. The key keeps the bits, and the order, of the signed x above y
+    int64_t CellKey(int cell_x, int cell_y)
+    {
+      return (int64_t)((uint64_t)(uint32_t)cell_x << 32 | (uint32_t)cell_y);
+    }
+  }
+
+  CounterMap::CounterMap() : layout_(kColumnStorageLayout), lowest_coord_x_(0), highest_coord_x_(0), lowest_coord_y_(0), highest_coord_y_(0),
+    reallocation_count_(0), copy_on_write_count_(0), bytes_copied_(0), generation_(NextGeneration()), summary_() { }
+  CounterMap::CounterMap(const CounterMap& copy) : layout_(copy.layout_), coord_matrix_(copy.coord_matrix_), tile_grid_(copy.tile_grid_),
+    lowest_coord_x_(copy.lowest_coord_x_), highest_coord_x_(copy.highest_coord_x_),
+    lowest_coord_y_(copy.lowest_coord_y_), highest_coord_y_(copy.highest_coord_y_),
+    reallocation_count_(copy.reallocation_count_), copy_on_write_count_(copy.copy_on_write_count_), bytes_copied_(copy.bytes_copied_), generation_(copy.generation_),
+    summary_(copy.summary_) { }
   CounterMap& CounterMap::operator=(const CounterMap& copy)
   {
     if (this != &copy)
+    {
+      layout_ = copy.layout_;
       coord_matrix_ = copy.coord_matrix_;
+      tile_grid_ = copy.tile_grid_;
+      lowest_coord_x_ = copy.lowest_coord_x_;
+      highest_coord_x_ = copy.highest_coord_x_;
+      lowest_coord_y_ = copy.lowest_coord_y_;
+      highest_coord_y_ = copy.highest_coord_y_;
+      reallocation_count_ = copy.reallocation_count_;
+      copy_on_write_count_ = copy.copy_on_write_count_;
+      bytes_copied_ = copy.bytes_copied_;
+      generation_ = copy.generation_;
+      summary_ = copy.summary_;
+    }
     return *this;
   }
   CounterMap::~CounterMap(){ }
 
+  // -- Storage layout
+  HeatmapStorageLayout CounterMap::layout() const
+  {
+    return layout_;
+  }
+
+  // Only the counters that aren't 0 are moved, the map limits stay as they were
+  void CounterMap::SetLayout(HeatmapStorageLayout layout)
+  {
+    if (layout == layout_)
+      return;
+
+    if (layout == kMortonTileStorageLayout)
+    {
+      // Moving the counters isn't allocation activity of the map, so it's recorded apart and dropped
+      uint64_t reallocation_count = 0, copy_on_write_count = 0, bytes_copied = 0;
+      for (int x = coord_matrix_.lowest_index(); x < coord_matrix_.lowest_index() + (int)coord_matrix_.size(); x++)
+      {
+        coord_matrix_[x].for_each_value([&](int y, uint32_t value) {
+          if (value != 0)
+            tile_grid_.AllocatingValueAt(x, y, reallocation_count, copy_on_write_count, bytes_copied) = value;
+        });
+      }
+      coord_matrix_.clean();
+    }
+    else
+    {
+      CopyTilesToColumns(tile_grid_, coord_matrix_);
+      tile_grid_.clear();
+    }
+    layout_ = layout;
+    generation_ = NextGeneration();
+  }
+
   // -- Getters of current map limits
   int CounterMap::lowest_coord_x() const
   {
@@ -37,6 +157,20 @@ namespace heatmap_service
     return highest_coord_y_;
   }
 
+  // -- Getters of the allocation activity since the map was created
+  uint64_t CounterMap::reallocation_count() const
+  {
+    return reallocation_count_;
+  }
+  uint64_t CounterMap::copy_on_write_count() const
+  {
+    return copy_on_write_count_;
+  }
+  uint64_t CounterMap::bytes_copied() const
+  {
+    return bytes_copied_;
+  }
+
   // -- Map registering methods
   bool CounterMap::IncrementValueAt(int coord_x, int coord_y)
   {
@@ -50,7 +184,34 @@ namespace heatmap_service
       return true;
 
     try {
-      coord_matrix_[coord_x][coord_y] += amount;
+      if (layout_ == kMortonTileStorageLayout)
+      {
+        // As with columns, most increments land on a counter of a tile this map owns
+        uint32_t* value = tile_grid_.OwnedValueAt(coord_x, coord_y);
+        if (!value)
+          value = &tile_grid_.AllocatingValueAt(coord_x, coord_y, reallocation_count_, copy_on_write_count_, bytes_copied_);
+        uint32_t old_value = *value;
+        *value += amount;
+        RecordWrite(old_value, *value);
+        CheckIfNewBoundary(coord_x, coord_y);
+        return true;
+      }
+
+      // Most increments land on a counter a column this map owns already holds, where nothing can be allocated, so nothing needs to be recorded
+      uint32_t* value = coord_matrix_.has_index(coord_x) ? coord_matrix_[coord_x].OwnedValueAt(coord_y) : nullptr;
+      if (value)
+      {
+        uint32_t old_value = *value;
+        *value += amount;
+        RecordWrite(old_value, *value);
+      }
+      else
+      {
+        // Counters wrap around as uint32_t, so the new value is that of the counter once incremented
+        uint32_t old_value = getValueAt(coord_x, coord_y);
+        AddAmountAllocatingAt(coord_x, coord_y, amount);
+        RecordWrite(old_value, old_value + (uint32_t)amount);
+      }
     }
     catch (const std::bad_alloc& e) {
       std::cout << "[HEATMAP_SERVICE] ERROR: Could not register counter for coordinate { " << coord_x << " , " << coord_y << " }. Reason: \"" << e.what() << "\". Map may be too big to maintain" << std::endl;
@@ -60,23 +221,599 @@ namespace heatmap_service
     return true;
   }
 
+  // Consecutive cells of a segment are always different, so only the cell shared by two segments, or segments inside one cell, repeat the last cell entered
+  bool CounterMap::AddAmountAlongPolyline(const HeatmapCoordinate points[], int point_count, double unit_width, double unit_height, int amount,
+                                          HeatmapRevisitPolicy revisit_policy, std::vector<int64_t> &scratch_cells)
+  {
+    if (point_count < 1 || amount <= 0)
+      return true;
+
+    bool count_once = revisit_policy == kCountOncePerTrajectory;
+    bool has_last_cell = false;
+    int last_cell_x = 0, last_cell_y = 0;
+    auto enter_cell = [&](int cell_x, int cell_y) {
+      if (has_last_cell && cell_x == last_cell_x && cell_y == last_cell_y)
+        return true;
+      has_last_cell = true;
+      last_cell_x = cell_x;
+      last_cell_y = cell_y;
+      if (!count_once)
+        return AddAmountAt(cell_x, cell_y, amount);
+      scratch_cells.push_back(CellKey(cell_x, cell_y));
+      return true;
+    };
+
+    scratch_cells.clear();
+    try {
+      double from_x = points[0].x / unit_width, from_y = points[0].y / unit_height;
+      if (point_count == 1 && !enter_cell((int)std::floor(from_x), (int)std::floor(from_y)))
+        return false;
+      for (int i = 1; i < point_count; i++)
+      {
+        double to_x = points[i].x / unit_width, to_y = points[i].y / unit_height;
+        if (!TraverseSegment(from_x, from_y, to_x, to_y, enter_cell))
+          return false;
+        from_x = to_x;
+        from_y = to_y;
+      }
+    }
+    catch (const std::bad_alloc& e) {
+      std::cout << "[HEATMAP_SERVICE] ERROR: Could not register trajectory. Reason: \"" << e.what() << "\". Map may be too big to maintain" << std::endl;
+      return false;
+    }
+    if (!count_once)
+      return true;
+
+    // Sorted cells come out column by column, so the increments walk the storage in order
+    std::sort(scratch_cells.begin(), scratch_cells.end());
+    std::vector<int64_t>::iterator last = std::unique(scratch_cells.begin(), scratch_cells.end());
+    for (std::vector<int64_t>::iterator cell = scratch_cells.begin(); cell != last; ++cell)
+    {
+      if (!AddAmountAt((int)(*cell >> 32), (int)(uint32_t)*cell, amount))
+        return false;
+    }
+    return true;
+  }
+
+  bool CounterMap::AddKernelAt(int lowest_coord_x, int lowest_coord_y, const uint32_t weights[], int width, int height)
+  {
+    if (width <= 0 || height <= 0)
+      return true;
+
+    try {
+      if (layout_ == kColumnStorageLayout)
+      {
+        SignedIndexVector<CounterColumn>::siv_size matrix_size = coord_matrix_.size();
+        SignedIndexVector<CounterColumn>::siv_size matrix_allocation = coord_matrix_.allocation_size();
+        coord_matrix_[lowest_coord_x];
+        coord_matrix_[lowest_coord_x + width - 1];
+        if (coord_matrix_.allocation_size() != matrix_allocation)
+        {
+          reallocation_count_++;
+          bytes_copied_ += matrix_size * sizeof(CounterColumn);
+        }
+      }
+
+      for (int x = 0; x < width; x++)
+      {
+        // Only the run between the first and the last weight that isn't 0 is added, so the zeros around a disk never grow a column
+        const uint32_t* column_weights = weights + (size_t)x * height;
+        int first = 0, last = height - 1;
+        while (first <= last && column_weights[first] == 0)
+          first++;
+        while (last > first && column_weights[last] == 0)
+          last--;
+        if (first > last)
+          continue;
+
+        int coord_x = lowest_coord_x + x;
+        uint32_t* values = nullptr;
+        if (layout_ == kColumnStorageLayout)
+          values = coord_matrix_[coord_x].DenseValuesFor(lowest_coord_y + first, last - first + 1, reallocation_count_, copy_on_write_count_, bytes_copied_);
+        if (!values)
+        {
+          for (int y = first; y <= last; y++)
+          {
+            if (!AddCounterAt(coord_x, lowest_coord_y + y, column_weights[y]))
+              return false;
+          }
+          continue;
+        }
+
+        uint64_t weight_sum = 0;
+        for (int y = first; y <= last; y++)
+          weight_sum += column_weights[y];
+        AddKernelRun(values, column_weights + first, last - first + 1, weight_sum);
+        CheckIfNewBoundary(coord_x, lowest_coord_y + first);
+        CheckIfNewBoundary(coord_x, lowest_coord_y + last);
+      }
+    }
+    catch (const std::bad_alloc& e) {
+      std::cout << "[HEATMAP_SERVICE] ERROR: Could not register kernel at coordinate { " << lowest_coord_x << " , " << lowest_coord_y << " }. Reason: \"" << e.what() << "\". Map may be too big to maintain" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // -- Sections
+  int CounterMap::AppendColumnSections(std::string &out_sections, std::vector<uint64_t> &out_section_ends) const
+  {
+    SignedIndexVector<CounterColumn> tile_columns;
+    if (layout_ == kMortonTileStorageLayout)
+      CopyTilesToColumns(tile_grid_, tile_columns);
+    const SignedIndexVector<CounterColumn>& columns = layout_ == kColumnStorageLayout ? coord_matrix_ : tile_columns;
+
+    for (const CounterColumn* column = columns.begin(); column != columns.end(); ++column)
+    {
+      column->AppendSection(out_sections);
+      out_section_ends.push_back(out_sections.size());
+    }
+    return columns.lowest_index();
+  }
+
+  // Every column is there before any is loaded, so loading one never moves the others
+  void CounterMap::BeginSectionLoad(int lowest_coord_x, int lowest_coord_y, int highest_coord_x, int highest_coord_y, int lowest_column, int column_count)
+  {
+    ClearMap();
+    layout_ = kColumnStorageLayout;
+    lowest_coord_x_ = lowest_coord_x;
+    lowest_coord_y_ = lowest_coord_y;
+    highest_coord_x_ = highest_coord_x;
+    highest_coord_y_ = highest_coord_y;
+    if (column_count > 0)
+      coord_matrix_.assign_exact(lowest_column, column_count);
+  }
+
+  bool CounterMap::LoadColumnSection(int coord_x, const char* section, size_t length, CounterMapSummary &out_summary)
+  {
+    CounterColumn& column = coord_matrix_[coord_x];
+    if (!column.LoadSection(section, length))
+      return false;
+
+    column.for_each_value([&](int y, uint32_t value) {
+      if (value != 0)
+        out_summary.AddCounter(value);
+    });
+    return true;
+  }
+
+  void CounterMap::EndSectionLoad(const CounterMapSummary &summary)
+  {
+    summary_ = summary;
+  }
+
+  bool CounterMap::AddMap(const CounterMap& other)
+  {
+    if (this == &other)
+    {
+      CounterMap copy(other);
+      return AddMap(copy);
+    }
+
+    if (coord_matrix_.size() == 0 && tile_grid_.tile_column_count() == 0 && layout_ == other.layout_)
+    {
+      coord_matrix_ = other.coord_matrix_;
+      tile_grid_ = other.tile_grid_;
+      // The columns taken carry the versions of other, and its counters
+      generation_ = NextGeneration();
+      summary_ = other.summary_;
+    }
+    else
+    {
+      bool result = true;
+      other.for_each_value([&](int x, int y, uint32_t value) {
+        result = result && AddCounterAt(x, y, value);
+      });
+      if (!result)
+        return false;
+    }
+
+    CheckIfNewBoundary(other.lowest_coord_x_, other.lowest_coord_y_);
+    CheckIfNewBoundary(other.highest_coord_x_, other.highest_coord_y_);
+    return true;
+  }
+
+  // The coarse counters are gathered in a map of their own, so a failed allocation leaves this one untouched.
+  // Rebinning isn't allocation activity of the map, as with moving to another layout
+  bool CounterMap::Rebin(int factor_x, int factor_y)
+  {
+    if (factor_x < 1 || factor_y < 1)
+      return false;
+    if (factor_x == 1 && factor_y == 1)
+      return true;
+
+    CounterMap rebinned;
+    rebinned.layout_ = layout_;
+    bool result = true;
+    for_each_value([&](int x, int y, uint32_t value) {
+      result = result && rebinned.AddCounterAt(FloorDivide(x, factor_x), FloorDivide(y, factor_y), value);
+    });
+    if (!result)
+      return false;
+
+    // Assigning the storage frees the old one, unless copies of the map still share it
+    coord_matrix_ = rebinned.coord_matrix_;
+    tile_grid_ = rebinned.tile_grid_;
+    lowest_coord_x_ = FloorDivide(lowest_coord_x_, factor_x);
+    highest_coord_x_ = FloorDivide(highest_coord_x_, factor_x);
+    lowest_coord_y_ = FloorDivide(lowest_coord_y_, factor_y);
+    highest_coord_y_ = FloorDivide(highest_coord_y_, factor_y);
+    generation_ = NextGeneration();
+    // Summing cells keeps the total, but not the other aggregates, which rebinned gathered as it was built
+    summary_ = rebinned.summary_;
+    return true;
+  }
+
+  // -- Region versions
+  uint64_t CounterMap::generation() const
+  {
+    return generation_;
+  }
+
+  uint64_t CounterMap::AreaVersionSum(int lowest_coord_x, int width, int lowest_coord_y, int height) const
+  {
+    if (layout_ == kMortonTileStorageLayout)
+      return tile_grid_.AreaVersionSum(lowest_coord_x, width, lowest_coord_y, height);
+
+    uint64_t version_sum = 0;
+    int first_x = std::max(lowest_coord_x, coord_matrix_.lowest_index());
+    int last_x = std::min(lowest_coord_x + width, coord_matrix_.lowest_index() + (int)coord_matrix_.size());
+    for (int x = first_x; x < last_x; x++)
+      version_sum += coord_matrix_[x].version();
+    return version_sum;
+  }
+
   // -- Map query methods
   uint32_t CounterMap::getValueAt(int coord_x, int coord_y) const
   {
-    // Get_at ensures that if coordinates fall outside the current scope of the vectors, 
-    // then 0 will be returned as the default value of class uint_32_t, and no extra memory will be allocated
-    return coord_matrix_.get_at(coord_x).get_at(coord_y);
+    if (layout_ == kMortonTileStorageLayout)
+      return tile_grid_.getValueAt(coord_x, coord_y);
+
+    // Columns outside the current scope of the map hold no counters. Inside it, get_at ensures that if the column doesn't hold coord_y,
+    // 0 will be returned as the default value of class uint_32_t, and no extra memory will be allocated
+    if (coord_x < coord_matrix_.lowest_index() || coord_x >= coord_matrix_.lowest_index() + (int)coord_matrix_.size())
+      return 0;
+
+    return coord_matrix_[coord_x].get_at(coord_y);
+  }
+
+  void CounterMap::getColumnValues(int coord_x, int lowest_coord_y, int height, uint32_t* out_values) const
+  {
+    if (layout_ == kMortonTileStorageLayout)
+    {
+      tile_grid_.getColumnValues(coord_x, lowest_coord_y, height, out_values);
+      return;
+    }
+
+    // Columns outside the current scope of the map have no values to copy
+    if (coord_x < coord_matrix_.lowest_index() || coord_x >= coord_matrix_.lowest_index() + (int)coord_matrix_.size())
+    {
+      std::fill(out_values, out_values + height, 0);
+      return;
+    }
+
+    coord_matrix_[coord_x].CopyValues(lowest_coord_y, height, out_values);
+  }
+
+  void CounterMap::getColumnsValues(int lowest_coord_x, int width, int lowest_coord_y, int height, uint32_t* const out_columns[]) const
+  {
+    if (layout_ == kMortonTileStorageLayout)
+    {
+      tile_grid_.getColumnsValues(lowest_coord_x, width, lowest_coord_y, height, out_columns);
+      return;
+    }
+
+    for (int x = 0; x < width; x++)
+      getColumnValues(lowest_coord_x + x, lowest_coord_y, height, out_columns[x]);
+  }
+
+  // -- Map summary
+  const CounterMapSummary& CounterMap::summary() const
+  {
+    return summary_;
+  }
+
+  // -- Map statistics
+  void CounterMap::CollectStats(CounterMapStats &out_stats) const
+  {
+    if (layout_ == kMortonTileStorageLayout)
+    {
+      CollectTileStats(out_stats);
+      return;
+    }
+
+    out_stats = CounterMapStats();
+    out_stats.allocated_bytes = coord_matrix_.allocation_size() * sizeof(CounterColumn);
+    out_stats.used_bytes = coord_matrix_.size() * sizeof(CounterColumn);
+    out_stats.reallocation_count = reallocation_count_;
+    out_stats.copy_on_write_count = copy_on_write_count_;
+    out_stats.bytes_copied = bytes_copied_;
+    out_stats.lowest_nonzero_x = out_stats.lowest_nonzero_y = INT_MAX;
+    out_stats.highest_nonzero_x = out_stats.highest_nonzero_y = INT_MIN;
+
+    // Strips of columns are counted on the worker pool, each into stats of its own, and merged once done
+    std::mutex merge_mutex;
+    ParallelFor(coord_matrix_.lowest_index(), coord_matrix_.lowest_index() + (int)coord_matrix_.size(), kMinColumnsPerStatsStrip,
+      [&](int column_begin, int column_end) {
+      CounterMapStats strip_stats = CounterMapStats();
+      strip_stats.lowest_nonzero_x = strip_stats.lowest_nonzero_y = INT_MAX;
+      strip_stats.highest_nonzero_x = strip_stats.highest_nonzero_y = INT_MIN;
+
+      for (int x = column_begin; x < column_end; x++)
+      {
+        const CounterColumn& column = coord_matrix_[x];
+        if (!column.allocated())
+          continue;
+
+        uint64_t column_bytes = column.allocated_bytes();
+        strip_stats.region_count++;
+        if (column.sparse())
+          strip_stats.sparse_region_count++;
+        strip_stats.allocated_bytes += column_bytes;
+        strip_stats.used_bytes += column.used_bytes();
+        if (column.shared())
+          strip_stats.shared_bytes += column_bytes;
+
+        column.for_each_value([&](int y, uint32_t value) {
+          if (value == 0)
+            return;
+          strip_stats.nonzero_cell_count++;
+          strip_stats.lowest_nonzero_x = std::min(strip_stats.lowest_nonzero_x, x);
+          strip_stats.highest_nonzero_x = std::max(strip_stats.highest_nonzero_x, x);
+          strip_stats.lowest_nonzero_y = std::min(strip_stats.lowest_nonzero_y, y);
+          strip_stats.highest_nonzero_y = std::max(strip_stats.highest_nonzero_y, y);
+        });
+      }
+
+      std::lock_guard<std::mutex> lock(merge_mutex);
+      out_stats.region_count += strip_stats.region_count;
+      out_stats.sparse_region_count += strip_stats.sparse_region_count;
+      out_stats.allocated_bytes += strip_stats.allocated_bytes;
+      out_stats.used_bytes += strip_stats.used_bytes;
+      out_stats.shared_bytes += strip_stats.shared_bytes;
+      out_stats.nonzero_cell_count += strip_stats.nonzero_cell_count;
+      out_stats.lowest_nonzero_x = std::min(out_stats.lowest_nonzero_x, strip_stats.lowest_nonzero_x);
+      out_stats.highest_nonzero_x = std::max(out_stats.highest_nonzero_x, strip_stats.highest_nonzero_x);
+      out_stats.lowest_nonzero_y = std::min(out_stats.lowest_nonzero_y, strip_stats.lowest_nonzero_y);
+      out_stats.highest_nonzero_y = std::max(out_stats.highest_nonzero_y, strip_stats.highest_nonzero_y);
+    });
+
+    if (out_stats.nonzero_cell_count == 0)
+      out_stats.lowest_nonzero_x = out_stats.highest_nonzero_x = out_stats.lowest_nonzero_y = out_stats.highest_nonzero_y = 0;
   }
 
   // -- Map Clear
   void CounterMap::ClearMap()
   {
     coord_matrix_.clear();
+    tile_grid_.clear();
+    generation_ = NextGeneration();
+    summary_ = CounterMapSummary();
   }
 
   // -- Private Utility Functions
 
+  // Only the increments that set a new highest bit move the counter to another bucket, and those are found without finding the bucket:
+  // old_value ^ new_value is only greater than old_value when new_value has a higher highest bit
+  void CounterMap::RecordWrite(uint32_t old_value, uint32_t new_value)
+  {
+    // A counter that wrapped around may have been the highest one, which can only be found again from every counter
+    if (new_value < old_value)
+    {
+      RecomputeSummary();
+      return;
+    }
+
+    summary_.total += new_value - old_value;
+    if (new_value > summary_.max_value)
+      summary_.max_value = new_value;
+
+    if (old_value == 0)
+    {
+      summary_.nonzero_cell_count++;
+      summary_.histogram[CounterMapSummary::HistogramBucket(new_value)]++;
+    }
+    else if ((old_value ^ new_value) > old_value)
+    {
+      summary_.histogram[CounterMapSummary::HistogramBucket(old_value)]--;
+      summary_.histogram[CounterMapSummary::HistogramBucket(new_value)]++;
+    }
+  }
+
+  // Most counters a kernel lands on already hold a value, stay below the highest counter and in their histogram bucket, so all that changes in the summary
+  // for them is the total, by the sum of the weights. The SSE2 loop adds four counters at a time, and only records one by one those that were 0, moved
+  // to another bucket, passed the highest counter or wrapped around. SSE2 only compares signed integers, so the sign bits are flipped to compare unsigned ones
+  void CounterMap::AddKernelRun(uint32_t* values, const uint32_t* weights, int count, uint64_t weight_sum)
+  {
+    bool wrapped = false;
+    auto record = [&](uint32_t old_value, uint32_t weight) {
+      weight_sum -= weight;
+      if (weight == 0 || wrapped)
+        return;
+      // A counter that wrapped around may have been the highest one, which is found again once the whole run is added
+      if ((uint32_t)(old_value + weight) < old_value)
+        wrapped = true;
+      else
+        RecordWrite(old_value, old_value + weight);
+    };
+
+    int i = 0;
+#ifdef HEATMAP_KERNEL_SSE2
+    const __m128i sign_4 = _mm_set1_epi32(INT_MIN);
+    const __m128i zero_4 = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4)
+    {
+      __m128i old_4 = _mm_loadu_si128((const __m128i*)(values + i));
+      __m128i new_4 = _mm_add_epi32(old_4, _mm_loadu_si128((const __m128i*)(weights + i)));
+      _mm_storeu_si128((__m128i*)(values + i), new_4);
+
+      __m128i old_flipped_4 = _mm_xor_si128(old_4, sign_4);
+      __m128i new_flipped_4 = _mm_xor_si128(new_4, sign_4);
+      __m128i changed_bits_flipped_4 = _mm_xor_si128(_mm_xor_si128(old_4, new_4), sign_4);
+      __m128i max_flipped_4 = _mm_set1_epi32((int)(summary_.max_value ^ 0x80000000u));
+      __m128i record_4 = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi32(old_4, zero_4), _mm_cmpgt_epi32(changed_bits_flipped_4, old_flipped_4)),
+                                      _mm_or_si128(_mm_cmpgt_epi32(new_flipped_4, max_flipped_4), _mm_cmpgt_epi32(old_flipped_4, new_flipped_4)));
+      for (int lanes = _mm_movemask_ps(_mm_castsi128_ps(record_4)), lane = 0; lanes != 0; lanes >>= 1, lane++)
+      {
+        if (lanes & 1)
+          record(values[i + lane] - weights[i + lane], weights[i + lane]);
+      }
+    }
+#endif
+    for (; i < count; i++)
+    {
+      uint32_t old_value = values[i];
+      values[i] += weights[i];
+      record(old_value, weights[i]);
+    }
+
+    if (wrapped)
+      RecomputeSummary();
+    else
+      summary_.total += weight_sum;
+  }
+
+  void CounterMap::RecomputeSummary()
+  {
+    summary_ = CounterMapSummary();
+    for_each_value([&](int x, int y, uint32_t value) {
+      if (value != 0)
+        summary_.AddCounter(value);
+    });
+  }
+
+  // -- Increments a counter that may need to allocate. Growth is detected by the allocation size of the matrix changing,
+  // and a matrix that grows copies the columns it had initialized to its new allocation. The column records its own growth
+  void CounterMap::AddAmountAllocatingAt(int coord_x, int coord_y, int amount)
+  {
+    SignedIndexVector<CounterColumn>::siv_size matrix_size = coord_matrix_.size();
+    SignedIndexVector<CounterColumn>::siv_size matrix_allocation = coord_matrix_.allocation_size();
+    CounterColumn& column = coord_matrix_[coord_x];
+    if (coord_matrix_.allocation_size() != matrix_allocation)
+    {
+      reallocation_count_++;
+      bytes_copied_ += matrix_size * sizeof(CounterColumn);
+    }
+
+    // The column copies itself first if it's shared with a copy of this map
+    column.AddAmountAllocatingAt(coord_y, amount, reallocation_count_, copy_on_write_count_, bytes_copied_);
+  }
+
+  // Each tile counts as a region. Bytes are those of the tiles and of the directory finding them
+  void CounterMap::CollectTileStats(CounterMapStats &out_stats) const
+  {
+    out_stats = CounterMapStats();
+    out_stats.allocated_bytes = tile_grid_.directory_allocated_bytes();
+    out_stats.used_bytes = tile_grid_.directory_used_bytes();
+    out_stats.reallocation_count = reallocation_count_;
+    out_stats.copy_on_write_count = copy_on_write_count_;
+    out_stats.bytes_copied = bytes_copied_;
+    out_stats.lowest_nonzero_x = out_stats.lowest_nonzero_y = INT_MAX;
+    out_stats.highest_nonzero_x = out_stats.highest_nonzero_y = INT_MIN;
+
+    // Columns of tiles are counted on the worker pool, each strip into stats of its own, and merged once done
+    std::mutex merge_mutex;
+    int lowest_tile_x = tile_grid_.lowest_tile_x();
+    ParallelFor(lowest_tile_x, lowest_tile_x + tile_grid_.tile_column_count(), kMinColumnsPerStatsStrip / CounterTile::kTileSide,
+      [&](int tile_x_begin, int tile_x_end) {
+      CounterMapStats strip_stats = CounterMapStats();
+      strip_stats.lowest_nonzero_x = strip_stats.lowest_nonzero_y = INT_MAX;
+      strip_stats.highest_nonzero_x = strip_stats.highest_nonzero_y = INT_MIN;
+
+      for (int tile_x = tile_x_begin; tile_x < tile_x_end; tile_x++)
+      {
+        const CounterTileGrid::TileColumn& tiles = tile_grid_.tile_column(tile_x);
+        for (int tile_y = tiles.lowest_index(); tile_y < tiles.lowest_index() + (int)tiles.size(); tile_y++)
+        {
+          const std::shared_ptr<CounterTile>& tile = tiles[tile_y];
+          if (!tile)
+            continue;
+
+          strip_stats.region_count++;
+          strip_stats.allocated_bytes += sizeof(CounterTile);
+          strip_stats.used_bytes += sizeof(CounterTile);
+          if (tile.use_count() > 1)
+            strip_stats.shared_bytes += sizeof(CounterTile);
+          else
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+          for (int local_x = 0; local_x < CounterTile::kTileSide; local_x++)
+          {
+            for (int local_y = 0; local_y < CounterTile::kTileSide; local_y++)
+            {
+              if (tile->values[CounterTile::MortonIndex(local_x, local_y)] == 0)
+                continue;
+              int x = tile_x * CounterTile::kTileSide + local_x;
+              int y = tile_y * CounterTile::kTileSide + local_y;
+              strip_stats.nonzero_cell_count++;
+              strip_stats.lowest_nonzero_x = std::min(strip_stats.lowest_nonzero_x, x);
+              strip_stats.highest_nonzero_x = std::max(strip_stats.highest_nonzero_x, x);
+              strip_stats.lowest_nonzero_y = std::min(strip_stats.lowest_nonzero_y, y);
+              strip_stats.highest_nonzero_y = std::max(strip_stats.highest_nonzero_y, y);
+            }
+          }
+        }
+      }
+
+      std::lock_guard<std::mutex> lock(merge_mutex);
+      out_stats.region_count += strip_stats.region_count;
+      out_stats.allocated_bytes += strip_stats.allocated_bytes;
+      out_stats.used_bytes += strip_stats.used_bytes;
+      out_stats.shared_bytes += strip_stats.shared_bytes;
+      out_stats.nonzero_cell_count += strip_stats.nonzero_cell_count;
+      out_stats.lowest_nonzero_x = std::min(out_stats.lowest_nonzero_x, strip_stats.lowest_nonzero_x);
+      out_stats.highest_nonzero_x = std::max(out_stats.highest_nonzero_x, strip_stats.highest_nonzero_x);
+      out_stats.lowest_nonzero_y = std::min(out_stats.lowest_nonzero_y, strip_stats.lowest_nonzero_y);
+      out_stats.highest_nonzero_y = std::max(out_stats.highest_nonzero_y, strip_stats.highest_nonzero_y);
+    });
+
+    if (out_stats.nonzero_cell_count == 0)
+      out_stats.lowest_nonzero_x = out_stats.highest_nonzero_x = out_stats.lowest_nonzero_y = out_stats.highest_nonzero_y = 0;
+  }
+
+  // Columns are given the counters that aren't 0, in order, so each column only grows up from its first counter, and sparse columns only append
+  void CounterMap::CopyTilesToColumns(const CounterTileGrid &tile_grid, SignedIndexVector<CounterColumn> &out_columns)
+  {
+    // Copying the counters isn't allocation activity of the map, so it's recorded apart and dropped
+    uint64_t reallocation_count = 0, copy_on_write_count = 0, bytes_copied = 0;
+    out_columns.clean();
+    for (int tile_x = tile_grid.lowest_tile_x(); tile_x < tile_grid.lowest_tile_x() + tile_grid.tile_column_count(); tile_x++)
+    {
+      const CounterTileGrid::TileColumn& tiles = tile_grid.tile_column(tile_x);
+      for (int tile_y = tiles.lowest_index(); tile_y < tiles.lowest_index() + (int)tiles.size(); tile_y++)
+      {
+        const CounterTile* tile = tiles[tile_y].get();
+        if (!tile)
+          continue;
+
+        for (int local_x = 0; local_x < CounterTile::kTileSide; local_x++)
+        {
+          for (int local_y = 0; local_y < CounterTile::kTileSide; local_y++)
+          {
+            uint32_t value = tile->values[CounterTile::MortonIndex(local_x, local_y)];
+            if (value != 0)
+              out_columns[tile_x * CounterTile::kTileSide + local_x].AddAmountAllocatingAt(tile_y * CounterTile::kTileSide + local_y, value,
+                                                                                           reallocation_count, copy_on_write_count, bytes_copied);
+          }
+        }
+      }
+    }
+  }
+
   // -- Checks if coordinate is a new boundary for the Map. If so, replace previous highest/lowest values
+  // Counters are added in int sized amounts, so counters above INT_MAX take more than one
+  bool CounterMap::AddCounterAt(int coord_x, int coord_y, uint32_t value)
+  {
+    while (value > 0)
+    {
+      int amount = (int)std::min(value, (uint32_t)INT_MAX);
+      if (!AddAmountAt(coord_x, coord_y, amount))
+        return false;
+      value -= amount;
+    }
+    return true;
+  }
+
   void CounterMap::CheckIfNewBoundary(int coord_x, int coord_y)
   {
     if (coord_x < lowest_coord_x_)
@@ -9,67 +9,336 @@
 
 // for uint_32
 #include <cstdint>
+#include <algorithm>
+#include <vector>
 
 // Boost headers for Serialization
-#include <boost\serialization\access.hpp>
-#include <boost\archive\binary_oarchive.hpp>
-#include <boost\archive\binary_iarchive.hpp>
+#include <boost/serialization/access.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
 
+#include "HeatmapServiceTypes.h"
 #include "SignedIndexVector.hpp"
+#include "CounterColumn.hpp"
+#include "CounterTileGrid.hpp"
+#include "CellRegion.h"
 
 namespace heatmap_service
 {
+  // -- Memory and activity of a CounterMap, gathered by CollectStats. All bytes are of the counter storage, the columns and the matrix holding them.
+  // The non zero bounds are in map coordinates, and are only meaningful when nonzero_cell_count isn't 0
+  struct CounterMapStats
+  {
+    uint64_t allocated_bytes;
+    uint64_t used_bytes;
+    uint64_t shared_bytes;
+    int region_count;
+    int sparse_region_count;
+
+    uint64_t reallocation_count;
+    uint64_t copy_on_write_count;
+    uint64_t bytes_copied;
+
+    uint64_t nonzero_cell_count;
+    int lowest_nonzero_x;
+    int highest_nonzero_x;
+    int lowest_nonzero_y;
+    int highest_nonzero_y;
+  };
+
+  // -- Aggregates of the counters of a CounterMap, kept up to date by every write to the map so they can be read in O(1).
+  // histogram[b] counts the counters holding a value from 2^b up to 2^(b+1) - 1, so the buckets cover every counter that isn't 0
+  struct CounterMapSummary
+  {
+    static const int kHistogramBuckets = 32;
+
+    uint64_t total;
+    uint32_t max_value;
+    uint64_t nonzero_cell_count;
+    uint64_t histogram[kHistogramBuckets];
+
+    // Histogram bucket of a counter that isn't 0, the position of its highest set bit, found by halving the bits left to search
+    static int HistogramBucket(uint32_t value)
+    {
+      int bucket = 0;
+      for (int shift = 16; shift > 0; shift >>= 1)
+      {
+        if (value >= (1u << shift))
+        {
+          bucket += shift;
+          value >>= shift;
+        }
+      }
+      return bucket;
+    }
+
+    // Adds a counter that isn't 0 to the summary
+    void AddCounter(uint32_t value)
+    {
+      total += value;
+      max_value = std::max(max_value, value);
+      nonzero_cell_count++;
+      histogram[HistogramBucket(value)]++;
+    }
+
+    // Adds the counters of other, a summary of other cells, to the summary
+    void Merge(const CounterMapSummary &other)
+    {
+      total += other.total;
+      max_value = std::max(max_value, other.max_value);
+      nonzero_cell_count += other.nonzero_cell_count;
+      for (int bucket = 0; bucket < kHistogramBuckets; bucket++)
+        histogram[bucket] += other.histogram[bucket];
+    }
+  };
+
   // -- CounterMap Class is a helper class for the Heatmap, capable of holding the spatial counter data for the Heatmap it's part of.
   // It doesn't need to know map size at instantiation, instead using the dinamically resizeable SignedIndexVector container to fit the needs of the Heatmap.
   // All accesses to the map are O(1) complexity. Incrementing is also O(1) except on situations where a resize is needed.
+  // Copies of a CounterMap share the storage of its columns, copying a column only when one of the maps writes to it (see CounterColumn).
+  // So a copy costs O(columns) and, once made, can be read from other threads while the original keeps being written to.
+  // Making the copy itself must not happen during a write to the original.
+  // With the Morton tile layout the counters are kept in a CounterTileGrid instead of columns, everything else works the same
   class CounterMap
   {
   private:
-    // Signed index vector deals with most of our dynamic resizing needs as well as both positive and negative indexing
-    SignedIndexVector< SignedIndexVector<uint32_t> > coord_matrix_;
+    // Statistics are gathered in strips of at least this many columns across the worker pool
+    static const int kMinColumnsPerStatsStrip = 64;
+
+    HeatmapStorageLayout layout_;
+
+    // Signed index vector deals with most of our dynamic resizing needs as well as both positive and negative indexing.
+    // Holds the counters with the column layout, and is empty with the Morton tile layout
+    SignedIndexVector<CounterColumn> coord_matrix_;
+    // Holds the counters with the Morton tile layout, and is empty with the column layout
+    CounterTileGrid tile_grid_;
 
     // Highest and lowest values currently present in the map. Usefull when querying about full size
     int lowest_coord_x_;
     int highest_coord_x_;
     int lowest_coord_y_;
     int highest_coord_y_;
+
+    // Allocation activity since the map was created. Only updated when an increment allocates or copies, and not serialized
+    uint64_t reallocation_count_;
+    uint64_t copy_on_write_count_;
+    uint64_t bytes_copied_;
+
+    // Identifies the storage the map holds, see generation()
+    uint64_t generation_;
+
+    // Aggregates of the counters, see summary()
+    CounterMapSummary summary_;
   public:
     CounterMap();
     CounterMap(const CounterMap& copy);
     CounterMap& operator=(const CounterMap& copy);
     ~CounterMap();
 
+    // -- Storage layout. Changing it moves every counter to the new layout, O(n) where n is the amount of counters stored
+    HeatmapStorageLayout layout() const;
+    void SetLayout(HeatmapStorageLayout layout);
+
     // -- Getters of current map limits
     int lowest_coord_x() const;
     int highest_coord_x() const;
     int lowest_coord_y() const;
     int highest_coord_y() const;
 
+    // -- Getters of the allocation activity since the map was created
+    uint64_t reallocation_count() const;
+    uint64_t copy_on_write_count() const;
+    uint64_t bytes_copied() const;
+
     // -- Map registering methods
     // Increment the counters at the specified coordinates
     // Map will grow horizontally and vertically as necessessary to accomodate new data
     bool IncrementValueAt(int coord_x, int coord_y);
     bool AddAmountAt(int coord_x, int coord_y, int amount);
 
+    // Adds amount to every cell crossed by the polyline through points, given in world coordinates and divided by unit_width and unit_height into cell units.
+    // The grid is walked from cell to cell along each segment (Amanatides and Woo), the cells counted as revisit_policy says. Points must be finite and inside
+    // the range of cell coordinates. Cells counted once per trajectory are gathered in scratch_cells first, which callers keep to reuse its memory across trajectories.
+    // Returns false if the memory can't be allocated, with only part of the cells incremented
+    bool AddAmountAlongPolyline(const HeatmapCoordinate points[], int point_count, double unit_width, double unit_height, int amount,
+                                HeatmapRevisitPolicy revisit_policy, std::vector<int64_t> &scratch_cells);
+
+    // Adds a kernel of width by height weights to the cells from { lowest_coord_x, lowest_coord_y } on, the weight of cell { lowest_coord_x + x, lowest_coord_y + y }
+    // being weights[x * height + y]. With columns, the matrix grows once for the whole kernel and each column once for its run of weights, which are then added
+    // in a single pass. Tiles, and sparse columns that stay sparse, get their weights one cell at a time.
+    // Returns false if the memory can't be allocated, with only part of the weights added
+    bool AddKernelAt(int lowest_coord_x, int lowest_coord_y, const uint32_t weights[], int width, int height);
+
+    // Adds every counter of other to this map, growing it as needed, and widens the map limits to hold those of other.
+    // A map that holds no counters yet takes the storage of other instead, shared until either writes to it, as copies of a map do.
+    // Returns false if the memory can't be allocated, with only part of the counters added
+    bool AddMap(const CounterMap& other);
+
+    // -- Coarsens the map, merging every factor_x by factor_y block of cells into one cell holding their sum. Cell (x, y) goes to
+    // (FloorDivide(x, factor_x), FloorDivide(y, factor_y)), so the cells line up with those of a map factor times coarser. The counters are summed
+    // into new storage, O(n) where n is the amount of counters stored, and the old storage is freed once no copy of the map shares it.
+    // Returns false if the factors aren't positive or the memory can't be allocated, leaving the map as it was
+    bool Rebin(int factor_x, int factor_y);
+
+    // -- Region versions
+    // Every column (every tile, with the Morton tile layout) counts the writes made to it in a version, so a copy of an area can be checked against the map
+    // without reading its counters again: while the generation of the map stays the same, the versions only grow, and the sum of the versions of the regions
+    // holding an area only stays the same if none of them was written to. The generation changes whenever the map replaces its storage instead of writing to it,
+    // by being cleared, loaded, moved to another layout or taking the storage of another map. Copies of a map keep its generation
+    uint64_t generation() const;
+    // Sum of the versions of every region holding a cell of the area. Regions that hold no storage count as 0
+    uint64_t AreaVersionSum(int lowest_coord_x, int width, int lowest_coord_y, int height) const;
+
     // -- Map query methods
     // Returns counter value at given coordinate
     // If coordinate lies outside the current scope of the map, 0 is returned.
     uint32_t getValueAt(int coord_x, int coord_y) const;
 
+    // Copies the values of column coord_x, from coord_y lowest_coord_y up to (lowest_coord_y + height - 1), into out_values.
+    // Out_values must be able to hold height values. Positions outside the current scope of the map are written as 0.
+    // Copies the stored range of the column in one go, so it should be preferred over getValueAt when reading areas
+    void getColumnValues(int coord_x, int lowest_coord_y, int height, uint32_t* out_values) const;
+
+    // Copies width consecutive columns, starting at lowest_coord_x, as getColumnValues does for each of them into out_columns[0] to out_columns[width - 1].
+    // The same as reading each column on its own with the column layout, but reads each tile once with the Morton tile layout
+    void getColumnsValues(int lowest_coord_x, int width, int lowest_coord_y, int height, uint32_t* const out_columns[]) const;
+
+    // Calls function(coord_x, coord_y, value) for every counter the map holds storage for, column by column with the column layout
+    // and tile by tile with the Morton tile layout. Counters that are 0 may be visited too
+    template<typename Function>
+    void for_each_value(Function function) const
+    {
+      if (layout_ == kColumnStorageLayout)
+      {
+        for (int x = coord_matrix_.lowest_index(); x < coord_matrix_.lowest_index() + (int)coord_matrix_.size(); x++)
+          coord_matrix_[x].for_each_value([&](int y, uint32_t value) { function(x, y, value); });
+        return;
+      }
+
+      for (int tile_x = tile_grid_.lowest_tile_x(); tile_x < tile_grid_.lowest_tile_x() + tile_grid_.tile_column_count(); tile_x++)
+      {
+        const CounterTileGrid::TileColumn& tiles = tile_grid_.tile_column(tile_x);
+        for (int tile_y = tiles.lowest_index(); tile_y < tiles.lowest_index() + (int)tiles.size(); tile_y++)
+        {
+          const CounterTile* tile = tiles[tile_y].get();
+          if (!tile)
+            continue;
+
+          for (int local_x = 0; local_x < CounterTile::kTileSide; local_x++)
+          {
+            for (int local_y = 0; local_y < CounterTile::kTileSide; local_y++)
+              function(tile_x * CounterTile::kTileSide + local_x, tile_y * CounterTile::kTileSide + local_y,
+                       tile->values[CounterTile::MortonIndex(local_x, local_y)]);
+          }
+        }
+      }
+    }
+
+    // Calls function(coord_x, coord_y, value) for every counter of the area that isn't 0, by increasing coord_x and then coord_y.
+    // Regions that don't exist, and the parts of them their occupancy bitmaps mark as empty, aren't read (see CounterColumn and CounterTile)
+    template<typename Function>
+    void for_each_nonzero_value(int lowest_coord_x, int width, int lowest_coord_y, int height, Function function) const
+    {
+      if (layout_ == kMortonTileStorageLayout)
+      {
+        tile_grid_.for_each_nonzero_value(lowest_coord_x, width, lowest_coord_y, height, function);
+        return;
+      }
+
+      int first_x = std::max(lowest_coord_x, coord_matrix_.lowest_index());
+      int end_x = std::min(lowest_coord_x + width, coord_matrix_.lowest_index() + (int)coord_matrix_.size());
+      for (int x = first_x; x < end_x; x++)
+        coord_matrix_[x].for_each_nonzero_value(lowest_coord_y, height, [&](int y, uint32_t value) { function(x, y, value); });
+    }
+
+    // Calls function(coord_x, coord_y, value) for every counter of the cells of region that isn't 0, by increasing coord_x and then coord_y.
+    // Each span of the region is read as for_each_nonzero_value reads an area, and tiles entirely inside the region are read without looking at its spans
+    template<typename Function>
+    void for_each_nonzero_value_in_region(const CellRegion &region, Function function) const
+    {
+      if (region.empty())
+        return;
+      if (layout_ == kMortonTileStorageLayout)
+      {
+        tile_grid_.for_each_nonzero_value_in_region(region, function);
+        return;
+      }
+
+      int first_x = std::max(region.lowest_x(), coord_matrix_.lowest_index());
+      int end_x = std::min(region.lowest_x() + region.width(), coord_matrix_.lowest_index() + (int)coord_matrix_.size());
+      for (int x = first_x; x < end_x; x++)
+      {
+        int span_count;
+        const CellRegion::Span* spans = region.column_spans(x, span_count);
+        for (int i = 0; i < span_count; i++)
+        {
+          coord_matrix_[x].for_each_nonzero_value(spans[i].lowest_y, spans[i].highest_y - spans[i].lowest_y + 1,
+                                                  [&](int y, uint32_t value) { function(x, y, value); });
+        }
+      }
+    }
+
+    // -- Map summary
+    // Total, highest counter, non zero counters and histogram of the counters, updated on every increment instead of gathered from the map.
+    // Merging, rebinning, clearing and loading the map bring it up to date along with the counters
+    const CounterMapSummary& summary() const;
+
+    // -- Map statistics
+    // Walks every column of the map, O(n) where n is the amount of counters stored. Columns shared with copies of the map count in full for each of them
+    void CollectStats(CounterMapStats &out_stats) const;
+
     // -- Map Clear
     void ClearMap();
 
+    // -- Sections, the serialized form HeatmapPrivate keeps an offset table for (see CounterColumn::AppendSection). As with save, maps are written as columns
+    // whatever their layout. Appends the section of every column to out_sections, and where each of them ends in out_sections to out_section_ends,
+    // returning the first column
+    int AppendColumnSections(std::string &out_sections, std::vector<uint64_t> &out_section_ends) const;
+
+    // Clears the map, moving it to the column layout with the given limits and room for column_count columns from lowest_column on,
+    // for LoadColumnSection to fill. Throws std::bad_alloc if the columns can't be allocated
+    void BeginSectionLoad(int lowest_coord_x, int lowest_coord_y, int highest_coord_x, int highest_coord_y, int lowest_column, int column_count);
+    // Loads column coord_x, one of those BeginSectionLoad made room for, adding its counters to out_summary. Different columns can be loaded
+    // from different threads at once. Returns false if the section isn't valid. Throws std::bad_alloc if the counters can't be allocated
+    bool LoadColumnSection(int coord_x, const char* section, size_t length, CounterMapSummary &out_summary);
+    // Takes the summary of every column loaded
+    void EndSectionLoad(const CounterMapSummary &summary);
+
   private:
     // -- Private Utility Functions
 
     // -- Checks if coordinate is a new boundary for the Map. If so, replace previous highest/lowest values
     void CheckIfNewBoundary(int coord_x, int coord_y);
 
+    // -- Increments a counter that may need the matrix or its column to allocate, or its column to be copied, recording what was allocated and copied.
+    // Throws std::bad_alloc if the memory can't be allocated
+    void AddAmountAllocatingAt(int coord_x, int coord_y, int amount);
+
+    // Adds a whole counter, which may not fit in an int, to the cell
+    bool AddCounterAt(int coord_x, int coord_y, uint32_t value);
+
+    // Updates the summary with a counter that went from old_value to new_value
+    void RecordWrite(uint32_t old_value, uint32_t new_value);
+
+    // Adds count weights to the consecutive counters at values, recording the writes in the summary. weight_sum is the sum of the weights
+    void AddKernelRun(uint32_t* values, const uint32_t* weights, int count, uint64_t weight_sum);
+
+    // Gathers the summary again from every counter of the map, O(n) where n is the amount of counters stored
+    void RecomputeSummary();
+
+    // Gathers the statistics of the Morton tile layout
+    void CollectTileStats(CounterMapStats &out_stats) const;
+
+    // Copies the counters held by the tile grid into columns
+    static void CopyTilesToColumns(const CounterTileGrid &tile_grid, SignedIndexVector<CounterColumn> &out_columns);
+
     // Boost serialization methods
     // Implement functionality on how to serialize and deserialize a CounterMap into a boost Archive
     // Used by master Heatmap class to serialize all it's instances of CounterMap
     // Versioning can be used in case implementation changes after deployment
     friend class boost::serialization::access;
+    // Maps are always serialized as columns, whatever their layout, so the serialized data doesn't depend on it.
+    // Maps load with the column layout, and are moved to another with SetLayout
     template<class Archive>
     void save(Archive & ar, const unsigned int version) const
     {
@@ -78,13 +347,23 @@ namespace heatmap_service
       ar & lowest_coord_y_;
       ar & highest_coord_x_;
       ar & highest_coord_y_;
-      ar & coord_matrix_;
+      if (layout_ == kColumnStorageLayout)
+      {
+        ar & coord_matrix_;
+      }
+      else
+      {
+        SignedIndexVector<CounterColumn> columns;
+        CopyTilesToColumns(tile_grid_, columns);
+        ar & columns;
+      }
     }
     template<class Archive>
     void load(Archive & ar, const unsigned int version)
     {
       // Ensures map is cleaned and deallocated before loading the serialized values
       ClearMap();
+      layout_ = kColumnStorageLayout;
 
       // Load all basic values
       ar & lowest_coord_x_;
@@ -92,6 +371,13 @@ namespace heatmap_service
       ar & highest_coord_x_;
       ar & highest_coord_y_;
       ar & coord_matrix_;
+
+      // Columns load dense, the ones with few counters go back to sparse
+      for (int x = coord_matrix_.lowest_index(); x < coord_matrix_.lowest_index() + (int)coord_matrix_.size(); x++)
+        coord_matrix_[x].Compact();
+
+      // The summary isn't serialized, it's gathered from the counters loaded
+      RecomputeSummary();
     }
     BOOST_SERIALIZATION_SPLIT_MEMBER()
   };
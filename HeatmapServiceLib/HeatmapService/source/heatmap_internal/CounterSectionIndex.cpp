@@ -0,0 +1,153 @@
+////////////////////////////////////////////////////////////////////////
+// CounterSectionIndex.cpp: Implementation of the CounterSectionIndex class
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "CounterSectionIndex.h"
+#include <climits>
+#include <cstring>
+
+namespace heatmap_service
+{
+  namespace
+  {
+    // Reads a buffer from the start, failing any read that goes past its end
+    class BufferReader
+    {
+    public:
+      BufferReader(const char* buffer, size_t length) : buffer_(buffer), length_(length), offset_(0) {}
+
+      size_t offset() const { return offset_; }
+
+      bool ReadBytes(size_t count, const char* &out_bytes)
+      {
+        if (length_ - offset_ < count)
+          return false;
+        out_bytes = buffer_ + offset_;
+        offset_ += count;
+        return true;
+      }
+
+      template<typename Number>
+      bool Read(Number &out_number)
+      {
+        const char* bytes;
+        if (!ReadBytes(sizeof(out_number), bytes))
+          return false;
+        memcpy(&out_number, bytes, sizeof(out_number));
+        return true;
+      }
+
+    private:
+      const char* buffer_;
+      size_t length_;
+      size_t offset_;
+    };
+  }
+
+  const char CounterSectionIndex::kMagic[4] = { 'H', 'M', 'S', 'F' };
+
+  CounterSectionIndex::CounterSectionIndex() : unit_width_(0), unit_height_(0), sections_(nullptr), groups_(nullptr), groups_length_(0) {}
+
+  bool CounterSectionIndex::IsSectioned(const char* buffer, size_t length)
+  {
+    return length >= sizeof(kMagic) && memcmp(buffer, kMagic, sizeof(kMagic)) == 0;
+  }
+
+  bool CounterSectionIndex::Parse(const char* buffer, size_t length, std::string &out_error)
+  {
+    counters_.clear();
+    counter_indexes_.clean();
+
+    BufferReader reader(buffer, length);
+    const char* magic;
+    uint32_t version, counter_count;
+    if (!reader.ReadBytes(sizeof(kMagic), magic) || memcmp(magic, kMagic, sizeof(kMagic)) != 0 || !reader.Read(version) || version != kVersion ||
+        !reader.Read(unit_width_) || !reader.Read(unit_height_) || !(unit_width_ > 0) || !(unit_height_ > 0) || !reader.Read(counter_count))
+    {
+      out_error = "Malformed header";
+      return false;
+    }
+
+    for (uint32_t c = 0; c < counter_count; c++)
+    {
+      Counter counter;
+      uint32_t key_length;
+      const char* key;
+      if (!reader.Read(key_length) || !reader.ReadBytes(key_length, key) || !reader.Read(counter.lowest_coord_x) || !reader.Read(counter.lowest_coord_y) ||
+          !reader.Read(counter.highest_coord_x) || !reader.Read(counter.highest_coord_y) || !reader.Read(counter.lowest_column) || !reader.Read(counter.column_count) ||
+          (int64_t)counter.lowest_column + counter.column_count - 1 > INT_MAX ||
+          !reader.ReadBytes((size_t)counter.column_count * sizeof(uint64_t), counter.section_ends))
+      {
+        out_error = "Malformed counter table";
+        return false;
+      }
+
+      counter.key.assign(key, key_length);
+      if (counter_indexes_.has_key(counter.key))
+      {
+        out_error = "Counter saved twice";
+        return false;
+      }
+      counter_indexes_[counter.key] = (int)counters_.size();
+      counters_.push_back(counter);
+    }
+
+    // Sections follow each other, so their ends only grow, and the counter groups start where the last one ends
+    sections_ = buffer + reader.offset();
+    size_t sections_length = length - reader.offset();
+    uint64_t section_end = 0;
+    for (Counter& counter : counters_)
+    {
+      counter.first_section = section_end;
+      for (uint32_t column = 0; column < counter.column_count; column++)
+      {
+        uint64_t end = SectionEnd(counter, column);
+        if (end < section_end || end > sections_length)
+        {
+          out_error = "Malformed section table";
+          return false;
+        }
+        section_end = end;
+      }
+    }
+
+    groups_ = sections_ + section_end;
+    groups_length_ = sections_length - (size_t)section_end;
+    return true;
+  }
+
+  int CounterSectionIndex::find(const std::string &counter_key) const
+  {
+    return counter_indexes_.has_key(counter_key) ? counter_indexes_[counter_key] : -1;
+  }
+
+  uint64_t CounterSectionIndex::SectionBegin(const Counter &counter, uint32_t column) const
+  {
+    return column == 0 ? counter.first_section : SectionEnd(counter, column - 1);
+  }
+
+  uint64_t CounterSectionIndex::SectionEnd(const Counter &counter, uint32_t column) const
+  {
+    uint64_t end;
+    memcpy(&end, counter.section_ends + column * sizeof(uint64_t), sizeof(end));
+    return end;
+  }
+
+  bool CounterSectionIndex::LoadCounter(int counter_index, CounterMap &out_map) const
+  {
+    const Counter& counter = counters_[counter_index];
+    out_map.BeginSectionLoad(counter.lowest_coord_x, counter.lowest_coord_y, counter.highest_coord_x, counter.highest_coord_y,
+                             counter.lowest_column, (int)counter.column_count);
+
+    CounterMapSummary summary = CounterMapSummary();
+    bool result = true;
+    for (uint32_t column = 0; column < counter.column_count && result; column++)
+    {
+      uint64_t begin = SectionBegin(counter, column);
+      result = out_map.LoadColumnSection(counter.lowest_column + (int)column, sections_ + begin, (size_t)(SectionEnd(counter, column) - begin), summary);
+    }
+    out_map.EndSectionLoad(summary);
+    return result;
+  }
+}
@@ -0,0 +1,81 @@
+////////////////////////////////////////////////////////////////////////
+// CounterSectionIndex.h: Table of the counters and column sections of a serialized heatmap
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "CounterMap.hpp"
+#include "FlatHashMap.hpp"
+
+namespace heatmap_service
+{
+  // -- CounterSectionIndex reads the header and counter table of a buffer written by HeatmapPrivate::SerializeHeatmap, without reading any column.
+  // It tells where the section of every column starts and ends, so counters can be loaded on their own, and their columns on any thread.
+  // The index points into the buffer, which must outlive it
+  class CounterSectionIndex
+  {
+  public:
+    // Sectioned buffers start with these characters and their version. Those written as a single boost archive start with its signature
+    static const char kMagic[4];
+    static const uint32_t kVersion = 1;
+
+    // A counter of the table, with the offsets of its columns still in the buffer
+    struct Counter
+    {
+      std::string key;
+      int32_t lowest_coord_x;
+      int32_t lowest_coord_y;
+      int32_t highest_coord_x;
+      int32_t highest_coord_y;
+      int32_t lowest_column;
+      uint32_t column_count;
+      const char* section_ends;
+      // Offset where the section of the first column starts
+      uint64_t first_section;
+    };
+
+    CounterSectionIndex();
+
+    // True if buffer starts as a sectioned buffer does
+    static bool IsSectioned(const char* buffer, size_t length);
+
+    // Reads the table of buffer. Returns false, with the reason in out_error, if the header or table are malformed, a counter is saved twice,
+    // or a section would end past the buffer. Sections themselves are only checked when loaded
+    bool Parse(const char* buffer, size_t length, std::string &out_error);
+
+    double unit_width() const { return unit_width_; }
+    double unit_height() const { return unit_height_; }
+
+    int counter_count() const { return (int)counters_.size(); }
+    const Counter& counter(int counter_index) const { return counters_[counter_index]; }
+    // Index of the counter of counter_key in the table, -1 if the buffer doesn't hold it
+    int find(const std::string &counter_key) const;
+
+    // The sections of every column, one after the other. The section of column i of a counter spans [SectionBegin, SectionEnd[ of them
+    const char* sections() const { return sections_; }
+    uint64_t SectionBegin(const Counter &counter, uint32_t column) const;
+    uint64_t SectionEnd(const Counter &counter, uint32_t column) const;
+
+    // The boost archive of the counter groups following the sections, empty for buffers written without one
+    const char* groups() const { return groups_; }
+    size_t groups_length() const { return groups_length_; }
+
+    // Loads every column of the counter into out_map, one after the other, in the column layout. Returns false if a section is malformed.
+    // Throws std::bad_alloc if the counters can't be allocated
+    bool LoadCounter(int counter_index, CounterMap &out_map) const;
+
+  private:
+    double unit_width_;
+    double unit_height_;
+    std::vector<Counter> counters_;
+    FlatHashMap<std::string, int> counter_indexes_;
+    const char* sections_;
+    const char* groups_;
+    size_t groups_length_;
+  };
+}
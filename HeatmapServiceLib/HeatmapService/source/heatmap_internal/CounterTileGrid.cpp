@@ -0,0 +1,240 @@
+////////////////////////////////////////////////////////////////////////
+// CounterTileGrid.cpp: Implementation of the CounterTileGrid helper class
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "CounterTileGrid.hpp"
+#include <algorithm>
+#include <atomic>
+
+namespace heatmap_service
+{
+  // Bit i of the index moves to bit 2i
+  const int CounterTile::kMortonSpread[CounterTile::kTileSide] = { 0x00, 0x01, 0x04, 0x05, 0x10, 0x11, 0x14, 0x15,
+                                                                   0x40, 0x41, 0x44, 0x45, 0x50, 0x51, 0x54, 0x55 };
+
+  namespace
+  {
+    // Copies a tile into kTileSide columns, starting at row first_row of each, writing each column of the tile in one go.
+    // Inside a 4 by 4 block of the tile the 4 cells of column x are at offsets spread(x) + { 0, 2, 8, 10 }, so there's no table lookup per cell
+    void CopyWholeTile(const CounterTile &tile, uint32_t* const out_columns[], int first_row)
+    {
+      for (int x = 0; x < CounterTile::kTileSide; x++)
+      {
+        uint32_t* out_values = out_columns[x] + first_row;
+        for (int block_y = 0; block_y < CounterTile::kTileSide; block_y += 4)
+        {
+          const uint32_t* cells = tile.values + CounterTile::MortonIndex(x, block_y);
+          out_values[block_y] = cells[0];
+          out_values[block_y + 1] = cells[2];
+          out_values[block_y + 2] = cells[8];
+          out_values[block_y + 3] = cells[10];
+        }
+      }
+    }
+  }
+
+  CounterTileGrid::CounterTileGrid() {}
+
+  // -- Write access
+  uint32_t* CounterTileGrid::OwnedValueAt(int coord_x, int coord_y)
+  {
+    int tile_x = TileOf(coord_x);
+    int tile_y = TileOf(coord_y);
+    if (!tiles_.has_index(tile_x))
+      return nullptr;
+
+    TileColumn& column = tiles_[tile_x];
+    if (!column.has_index(tile_y))
+      return nullptr;
+
+    std::shared_ptr<CounterTile>& tile = column[tile_y];
+    if (!tile || tile.use_count() > 1)
+      return nullptr;
+    // The tile is this grid's own, ordered after whatever the copy that was released last did with it, as CounterColumn::OwnedValueAt does
+    std::atomic_thread_fence(std::memory_order_acquire);
+    tile->version++;
+    tile->occupancy[LocalOf(coord_x)] |= (uint16_t)(1 << LocalOf(coord_y));
+    return &tile->values[CounterTile::MortonIndex(LocalOf(coord_x), LocalOf(coord_y))];
+  }
+
+  // Growth of the directory is detected by the allocation size of its vectors changing, as in CounterMap
+  uint32_t& CounterTileGrid::AllocatingValueAt(int coord_x, int coord_y, uint64_t &reallocation_count, uint64_t &copy_on_write_count, uint64_t &bytes_copied)
+  {
+    int tile_x = TileOf(coord_x);
+    int tile_y = TileOf(coord_y);
+
+    SignedIndexVector<TileColumn>::siv_size directory_size = tiles_.size();
+    SignedIndexVector<TileColumn>::siv_size directory_allocation = tiles_.allocation_size();
+    TileColumn& column = tiles_[tile_x];
+    if (tiles_.allocation_size() != directory_allocation)
+    {
+      reallocation_count++;
+      bytes_copied += directory_size * sizeof(TileColumn);
+    }
+
+    TileColumn::siv_size column_size = column.size();
+    TileColumn::siv_size column_allocation = column.allocation_size();
+    std::shared_ptr<CounterTile>& tile = column[tile_y];
+    if (column.allocation_size() != column_allocation)
+    {
+      reallocation_count++;
+      bytes_copied += column_size * sizeof(std::shared_ptr<CounterTile>);
+    }
+
+    // New tiles start zeroed, and tiles another map still reads are copied before they're changed
+    if (!tile)
+    {
+      tile = std::make_shared<CounterTile>();
+    }
+    else if (tile.use_count() > 1)
+    {
+      copy_on_write_count++;
+      bytes_copied += sizeof(CounterTile);
+      tile = std::make_shared<CounterTile>(*tile);
+    }
+    else
+      std::atomic_thread_fence(std::memory_order_acquire);
+    tile->version++;
+    tile->occupancy[LocalOf(coord_x)] |= (uint16_t)(1 << LocalOf(coord_y));
+    return tile->values[CounterTile::MortonIndex(LocalOf(coord_x), LocalOf(coord_y))];
+  }
+
+  // -- Read access
+  uint32_t CounterTileGrid::getValueAt(int coord_x, int coord_y) const
+  {
+    int tile_x = TileOf(coord_x);
+    if (!tiles_.has_index(tile_x))
+      return 0;
+
+    const TileColumn& column = tiles_[tile_x];
+    int tile_y = TileOf(coord_y);
+    if (!column.has_index(tile_y) || !column[tile_y])
+      return 0;
+    return column[tile_y]->values[CounterTile::MortonIndex(LocalOf(coord_x), LocalOf(coord_y))];
+  }
+
+  // Walks the tiles the column crosses, reading the column's cells out of each. Neighbouring columns read the same tiles,
+  // so an area query reading its columns in order finds them in cache
+  void CounterTileGrid::getColumnValues(int coord_x, int lowest_coord_y, int height, uint32_t* out_values) const
+  {
+    std::fill(out_values, out_values + height, 0);
+
+    int tile_x = TileOf(coord_x);
+    if (!tiles_.has_index(tile_x))
+      return;
+
+    const TileColumn& column = tiles_[tile_x];
+    int x_bits = CounterTile::kMortonSpread[LocalOf(coord_x)];
+    int first_tile = std::max(TileOf(lowest_coord_y), column.lowest_index());
+    int last_tile = std::min(TileOf(lowest_coord_y + height - 1), column.lowest_index() + (int)column.size() - 1);
+
+    for (int tile_y = first_tile; tile_y <= last_tile; tile_y++)
+    {
+      const CounterTile* tile = column[tile_y].get();
+      if (!tile)
+        continue;
+
+      int copy_from = std::max(lowest_coord_y, tile_y * CounterTile::kTileSide);
+      int copy_to = std::min(lowest_coord_y + height, (tile_y + 1) * CounterTile::kTileSide);
+      for (int y = copy_from; y < copy_to; y++)
+        out_values[y - lowest_coord_y] = tile->values[x_bits | (CounterTile::kMortonSpread[LocalOf(y)] << 1)];
+    }
+  }
+
+  // Reads the area tile by tile, each tile once for all the columns crossing it. Every output cell is written exactly once,
+  // cells of tiles that don't exist are filled with 0 as their tile comes up, instead of clearing the whole output first
+  void CounterTileGrid::getColumnsValues(int lowest_coord_x, int width, int lowest_coord_y, int height, uint32_t* const out_columns[]) const
+  {
+    for (int tile_x = TileOf(lowest_coord_x); tile_x <= TileOf(lowest_coord_x + width - 1); tile_x++)
+    {
+      const TileColumn* column = tiles_.has_index(tile_x) ? &tiles_[tile_x] : nullptr;
+      int copy_from_x = std::max(lowest_coord_x, tile_x * CounterTile::kTileSide);
+      int copy_to_x = std::min(lowest_coord_x + width, (tile_x + 1) * CounterTile::kTileSide);
+
+      for (int tile_y = TileOf(lowest_coord_y); tile_y <= TileOf(lowest_coord_y + height - 1); tile_y++)
+      {
+        const CounterTile* tile = column && column->has_index(tile_y) ? (*column)[tile_y].get() : nullptr;
+        int copy_from_y = std::max(lowest_coord_y, tile_y * CounterTile::kTileSide);
+        int copy_to_y = std::min(lowest_coord_y + height, (tile_y + 1) * CounterTile::kTileSide);
+
+        if (!tile)
+        {
+          for (int x = copy_from_x; x < copy_to_x; x++)
+            std::fill(out_columns[x - lowest_coord_x] + (copy_from_y - lowest_coord_y), out_columns[x - lowest_coord_x] + (copy_to_y - lowest_coord_y), 0);
+          continue;
+        }
+
+        if (copy_to_x - copy_from_x == CounterTile::kTileSide && copy_to_y - copy_from_y == CounterTile::kTileSide)
+        {
+          CopyWholeTile(*tile, out_columns + (copy_from_x - lowest_coord_x), copy_from_y - lowest_coord_y);
+          continue;
+        }
+
+        for (int x = copy_from_x; x < copy_to_x; x++)
+        {
+          uint32_t* out_values = out_columns[x - lowest_coord_x] - lowest_coord_y;
+          int x_bits = CounterTile::kMortonSpread[LocalOf(x)];
+          for (int y = copy_from_y; y < copy_to_y; y++)
+            out_values[y] = tile->values[x_bits | (CounterTile::kMortonSpread[LocalOf(y)] << 1)];
+        }
+      }
+    }
+  }
+
+  // -- Tile directory
+  int CounterTileGrid::lowest_tile_x() const
+  {
+    return tiles_.lowest_index();
+  }
+
+  int CounterTileGrid::tile_column_count() const
+  {
+    return (int)tiles_.size();
+  }
+
+  const CounterTileGrid::TileColumn& CounterTileGrid::tile_column(int tile_x) const
+  {
+    return tiles_[tile_x];
+  }
+
+  uint64_t CounterTileGrid::directory_allocated_bytes() const
+  {
+    uint64_t bytes = tiles_.allocation_size() * sizeof(TileColumn);
+    for (int tile_x = lowest_tile_x(); tile_x < lowest_tile_x() + tile_column_count(); tile_x++)
+      bytes += tiles_[tile_x].allocation_size() * sizeof(std::shared_ptr<CounterTile>);
+    return bytes;
+  }
+
+  uint64_t CounterTileGrid::directory_used_bytes() const
+  {
+    uint64_t bytes = tiles_.size() * sizeof(TileColumn);
+    for (int tile_x = lowest_tile_x(); tile_x < lowest_tile_x() + tile_column_count(); tile_x++)
+      bytes += tiles_[tile_x].size() * sizeof(std::shared_ptr<CounterTile>);
+    return bytes;
+  }
+
+  uint64_t CounterTileGrid::AreaVersionSum(int lowest_coord_x, int width, int lowest_coord_y, int height) const
+  {
+    uint64_t version_sum = 0;
+    int first_tile_x = std::max(TileOf(lowest_coord_x), tiles_.lowest_index());
+    int last_tile_x = std::min(TileOf(lowest_coord_x + width - 1), tiles_.lowest_index() + (int)tiles_.size() - 1);
+    for (int tile_x = first_tile_x; tile_x <= last_tile_x; tile_x++)
+    {
+      const TileColumn& column = tiles_[tile_x];
+      int first_tile_y = std::max(TileOf(lowest_coord_y), column.lowest_index());
+      int last_tile_y = std::min(TileOf(lowest_coord_y + height - 1), column.lowest_index() + (int)column.size() - 1);
+      for (int tile_y = first_tile_y; tile_y <= last_tile_y; tile_y++)
+      {
+        if (column[tile_y])
+          version_sum += column[tile_y]->version;
+      }
+    }
+    return version_sum;
+  }
+
+  void CounterTileGrid::clear()
+  {
+    tiles_.clean();
+  }
+}
\ No newline at end of file
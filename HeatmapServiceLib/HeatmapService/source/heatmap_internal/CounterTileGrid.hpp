@@ -0,0 +1,194 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// CounterTileGrid.h: Declaration of CounterTileGrid helper class.
+// Holds the counters of a CounterMap in square tiles, with the cells of each tile ordered along a Morton (Z-order) curve
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// for uint_32
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "SignedIndexVector.hpp"
+#include "CellRegion.h"
+
+namespace heatmap_service
+{
+  // -- CounterTile is kTileSide by kTileSide counters. The cell { x, y } of the tile is found at MortonIndex(x, y), interleaving the bits of x and y,
+  // so any 4 by 4 block of cells fills exactly one 64 byte cache line, and the whole tile, 1KB, sits in L1 while it's being worked on.
+  struct CounterTile
+  {
+    static const int kTileBits = 4;
+    static const int kTileSide = 1 << kTileBits;
+    static const int kTileCells = kTileSide * kTileSide;
+
+    uint32_t values[kTileCells];
+    // Grows with every write access to the tile, as the version of a CounterColumn. Copies of a tile start from the version of the original
+    uint64_t version;
+    // Occupancy bitmap of the tile, bit local_y of occupancy[local_x] set once the cell { local_x, local_y } was written to.
+    // Cells whose bit isn't set are known to be 0, so reading the non zero counters of a tile only visits the cells written to
+    uint16_t occupancy[kTileSide];
+
+    // Interleaves the bits of the cell coordinates inside the tile, x in the even bits and y in the odd ones
+    static int MortonIndex(int local_x, int local_y) { return kMortonSpread[local_x] | (kMortonSpread[local_y] << 1); }
+
+    static const int kMortonSpread[kTileSide];
+  };
+
+  // -- CounterTileGrid is the storage of a CounterMap using the Morton tile layout. Where the column layout keeps one vector per column,
+  // so cells that are neighbours vertically are neighbours in memory but horizontal neighbours are in unrelated allocations,
+  // tiles keep square neighbourhoods together: a player walking diagonally, or a square area query, stays within a few cache lines of the same tile.
+  // Tiles are found through a directory of tile columns, and are shared between copies of the map until written to, as CounterColumns are.
+  // Tiles that were never written to aren't allocated
+  class CounterTileGrid
+  {
+  public:
+    using TileColumn = SignedIndexVector< std::shared_ptr<CounterTile> >;
+
+    CounterTileGrid();
+
+    // -- Write access. Every counter returned counts as a write to the version of its tile, and marks its cell in the occupancy bitmap of the tile
+    // Returns the counter at the coordinates if it can be written without allocating or copying anything, nullptr otherwise
+    uint32_t* OwnedValueAt(int coord_x, int coord_y);
+
+    // Returns the counter at the coordinates, allocating its tile, or copying it if it's shared with another map.
+    // What was allocated and copied is added to the counters passed. Throws std::bad_alloc if the memory can't be allocated
+    uint32_t& AllocatingValueAt(int coord_x, int coord_y, uint64_t &reallocation_count, uint64_t &copy_on_write_count, uint64_t &bytes_copied);
+
+    // -- Read access
+    // Counters of tiles that were never written to read as 0
+    uint32_t getValueAt(int coord_x, int coord_y) const;
+
+    // Same contract as CounterMap::getColumnValues
+    void getColumnValues(int coord_x, int lowest_coord_y, int height, uint32_t* out_values) const;
+
+    // Same contract as CounterMap::getColumnsValues
+    void getColumnsValues(int lowest_coord_x, int width, int lowest_coord_y, int height, uint32_t* const out_columns[]) const;
+
+    // -- Tile directory, for walking the tiles
+    int lowest_tile_x() const;
+    int tile_column_count() const;
+    // The column of tiles tile_x. Tile_x must be inside [lowest_tile_x, lowest_tile_x + tile_column_count[
+    const TileColumn& tile_column(int tile_x) const;
+    // Bytes of the directory itself, allocated and in use
+    uint64_t directory_allocated_bytes() const;
+    uint64_t directory_used_bytes() const;
+
+    // Calls function(coord_x, coord_y, value) for every counter of the area that isn't 0, by increasing coord_x and then coord_y.
+    // Tiles that don't exist are skipped, and inside the others only the cells their occupancy bitmap marks are read
+    template<typename Function>
+    void for_each_nonzero_value(int lowest_coord_x, int width, int lowest_coord_y, int height, Function function) const
+    {
+      int first_tile_x = std::max(TileOf(lowest_coord_x), tiles_.lowest_index());
+      int last_tile_x = std::min(TileOf(lowest_coord_x + width - 1), tiles_.lowest_index() + (int)tiles_.size() - 1);
+      for (int tile_x = first_tile_x; tile_x <= last_tile_x; tile_x++)
+      {
+        const TileColumn& column = tiles_[tile_x];
+        int first_tile_y = std::max(TileOf(lowest_coord_y), column.lowest_index());
+        int last_tile_y = std::min(TileOf(lowest_coord_y + height - 1), column.lowest_index() + (int)column.size() - 1);
+        int from_x = std::max(lowest_coord_x, tile_x * CounterTile::kTileSide);
+        int to_x = std::min(lowest_coord_x + width, (tile_x + 1) * CounterTile::kTileSide);
+
+        // Each column of cells crosses the whole column of tiles before the next one starts, so the cells come out ordered
+        for (int coord_x = from_x; coord_x < to_x; coord_x++)
+        {
+          int local_x = LocalOf(coord_x);
+          for (int tile_y = first_tile_y; tile_y <= last_tile_y; tile_y++)
+          {
+            const CounterTile* tile = column[tile_y].get();
+            if (!tile || !tile->occupancy[local_x])
+              continue;
+
+            // Drops the cells of the tile outside the area
+            int from_y = std::max(lowest_coord_y - tile_y * CounterTile::kTileSide, 0);
+            int to_y = std::min(lowest_coord_y + height - tile_y * CounterTile::kTileSide, (int)CounterTile::kTileSide);
+            uint32_t bits = tile->occupancy[local_x] & (((1u << to_y) - 1) & ~((1u << from_y) - 1));
+            for (int local_y = from_y; bits != 0 && local_y < to_y; local_y++)
+            {
+              if (!(bits & (1u << local_y)))
+                continue;
+              bits &= ~(1u << local_y);
+
+              uint32_t value = tile->values[CounterTile::MortonIndex(local_x, local_y)];
+              if (value != 0)
+                function(coord_x, tile_y * CounterTile::kTileSide + local_y, value);
+            }
+          }
+        }
+      }
+    }
+
+    // Same contract as CounterMap::for_each_nonzero_value_in_region. Tiles entirely inside the region read every cell their occupancy bitmap marks,
+    // and the others only those the spans of each column also mark
+    template<typename Function>
+    void for_each_nonzero_value_in_region(const CellRegion &region, Function function) const
+    {
+      int first_tile_x = std::max(TileOf(region.lowest_x()), tiles_.lowest_index());
+      int last_tile_x = std::min(TileOf(region.lowest_x() + region.width() - 1), tiles_.lowest_index() + (int)tiles_.size() - 1);
+      std::vector<bool> tile_inside;
+      for (int tile_x = first_tile_x; tile_x <= last_tile_x; tile_x++)
+      {
+        const TileColumn& column = tiles_[tile_x];
+        int first_tile_y = std::max(TileOf(region.lowest_y()), column.lowest_index());
+        int last_tile_y = std::min(TileOf(region.highest_y()), column.lowest_index() + (int)column.size() - 1);
+        if (first_tile_y > last_tile_y)
+          continue;
+
+        tile_inside.assign(last_tile_y - first_tile_y + 1, false);
+        for (int tile_y = first_tile_y; tile_y <= last_tile_y; tile_y++)
+        {
+          tile_inside[tile_y - first_tile_y] = column[tile_y] &&
+            region.ContainsRect(tile_x * CounterTile::kTileSide, CounterTile::kTileSide, tile_y * CounterTile::kTileSide, CounterTile::kTileSide);
+        }
+
+        int from_x = std::max(region.lowest_x(), tile_x * CounterTile::kTileSide);
+        int to_x = std::min(region.lowest_x() + region.width(), (tile_x + 1) * CounterTile::kTileSide);
+        for (int coord_x = from_x; coord_x < to_x; coord_x++)
+        {
+          int span_count;
+          const CellRegion::Span* spans = region.column_spans(coord_x, span_count);
+          if (span_count == 0)
+            continue;
+
+          int local_x = LocalOf(coord_x);
+          int column_first_tile_y = std::max(TileOf(spans[0].lowest_y), first_tile_y);
+          int column_last_tile_y = std::min(TileOf(spans[span_count - 1].highest_y), last_tile_y);
+          for (int tile_y = column_first_tile_y; tile_y <= column_last_tile_y; tile_y++)
+          {
+            const CounterTile* tile = column[tile_y].get();
+            if (!tile || !tile->occupancy[local_x])
+              continue;
+
+            uint32_t bits = tile->occupancy[local_x];
+            if (!tile_inside[tile_y - first_tile_y])
+              bits &= region.CellMask(coord_x, tile_y * CounterTile::kTileSide, CounterTile::kTileSide);
+            for (int local_y = 0; bits != 0; local_y++, bits >>= 1)
+            {
+              if (!(bits & 1))
+                continue;
+
+              uint32_t value = tile->values[CounterTile::MortonIndex(local_x, local_y)];
+              if (value != 0)
+                function(coord_x, tile_y * CounterTile::kTileSide + local_y, value);
+            }
+          }
+        }
+      }
+    }
+
+    // Sum of the versions of every tile holding a cell of the area, tiles that don't exist counting as 0
+    uint64_t AreaVersionSum(int lowest_coord_x, int width, int lowest_coord_y, int height) const;
+
+    void clear();
+
+    // Tile coordinates of a cell, rounding negative coordinates down
+    static int TileOf(int coord) { return coord >> CounterTile::kTileBits; }
+    static int LocalOf(int coord) { return coord & (CounterTile::kTileSide - 1); }
+
+  private:
+    SignedIndexVector<TileColumn> tiles_;
+  };
+}
\ No newline at end of file
@@ -0,0 +1,139 @@
+////////////////////////////////////////////////////////////////////////
+// EventAggregator.cpp: Implementation of the background event aggregator
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "EventAggregator.h"
+#include "HeatmapService.h"
+
+namespace heatmap_service
+{
+  // Passed by reference to std::chrono::microseconds, so it needs a definition of its own
+  const int EventAggregator::kIdleWaitMicroseconds;
+
+  EventAggregator::EventAggregator(HeatmapService &heatmap, int capacity, HeatmapQueueBackpressure backpressure) : heatmap_(heatmap),
+    backpressure_(backpressure), ring_(capacity > 0 ? (size_t)capacity : 1), dropped_events_(0), registered_counter_count_(0), applied_position_(0),
+    flush_waiters_(0), stopping_(false)
+  {
+    thread_ = std::thread(&EventAggregator::AggregatorLoop, this);
+  }
+
+  EventAggregator::~EventAggregator()
+  {
+    {
+      std::lock_guard<std::mutex> lock(wake_mutex_);
+      stopping_ = true;
+    }
+    work_available_.notify_one();
+    thread_.join();
+  }
+
+  // -- Counter registration
+  int EventAggregator::RegisterCounter(const std::string &counter_key)
+  {
+    std::lock_guard<std::mutex> lock(counters_mutex_);
+    for (int counter_index = 0; counter_index < (int)counter_keys_.size(); counter_index++)
+    {
+      if (counter_keys_[counter_index] == counter_key)
+        return counter_index;
+    }
+    counter_keys_.push_back(counter_key);
+    registered_counter_count_.store((int)counter_keys_.size(), std::memory_order_release);
+    return (int)counter_keys_.size() - 1;
+  }
+
+  // -- Producer side
+  bool EventAggregator::PushWhenFull(const QueuedEvent &event)
+  {
+    if (backpressure_ == kDropWhenFull)
+      return false;
+    if (backpressure_ == kCountDropsWhenFull)
+    {
+      dropped_events_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    // Blocking: the thread may be sleeping on an empty ring it hasn't looked at again, wake it and give it the core until there's room
+    work_available_.notify_one();
+    while (!ring_.try_push(event))
+      std::this_thread::yield();
+    return true;
+  }
+
+  // -- Consistent reads
+  void EventAggregator::Flush()
+  {
+    // Every event pushed before this point has a position below target, whether or not its producer has finished writing it
+    uint64_t target = ring_.push_position();
+
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    flush_waiters_++;
+    work_available_.notify_one();
+    events_applied_.wait(lock, [&]() { return applied_position_.load() >= target; });
+    flush_waiters_--;
+  }
+
+  void EventAggregator::Snapshot(HeatmapService &out_snapshot)
+  {
+    Flush();
+    std::lock_guard<std::mutex> lock(heatmap_mutex_);
+    out_snapshot = heatmap_;
+  }
+
+  // -- Aggregator thread
+  void EventAggregator::AggregatorLoop()
+  {
+    std::vector<QueuedEvent> batch;
+    batch.reserve(kBatchSize);
+    // The thread's own copy of the counter keys, so it doesn't lock counters_mutex_ for every batch
+    std::vector<std::string> counter_keys;
+
+    for (;;)
+    {
+      batch.clear();
+      QueuedEvent event;
+      while ((int)batch.size() < kBatchSize && ring_.try_pop(event))
+        batch.push_back(event);
+
+      if (!batch.empty())
+      {
+        ApplyBatch(batch, counter_keys);
+        applied_position_.store(ring_.pop_position());
+        if (flush_waiters_.load() > 0)
+        {
+          std::lock_guard<std::mutex> lock(wake_mutex_);
+          events_applied_.notify_all();
+        }
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(wake_mutex_);
+      // Positions claimed but not yet published will be, so the thread only stops once the ring is truly empty
+      if (stopping_ && ring_.push_position() == ring_.pop_position())
+        break;
+      // While a flush waits on a producer that is still writing its event, there's no point in sleeping
+      if (flush_waiters_.load() > 0 || stopping_)
+      {
+        lock.unlock();
+        std::this_thread::yield();
+        continue;
+      }
+      work_available_.wait_for(lock, std::chrono::microseconds(kIdleWaitMicroseconds));
+    }
+  }
+
+  void EventAggregator::ApplyBatch(const std::vector<QueuedEvent> &batch, std::vector<std::string> &counter_keys)
+  {
+    std::lock_guard<std::mutex> lock(heatmap_mutex_);
+    for (const QueuedEvent &event : batch)
+    {
+      // Producers only push indices already registered, so a refresh always finds the counter
+      if (event.counter_index >= (int)counter_keys.size())
+      {
+        std::lock_guard<std::mutex> counters_lock(counters_mutex_);
+        counter_keys = counter_keys_;
+      }
+      heatmap_.IncrementMapCounterByAmount(event.coords, counter_keys[event.counter_index], event.add_amount);
+    }
+  }
+}
\ No newline at end of file
@@ -0,0 +1,106 @@
+////////////////////////////////////////////////////////////////////////
+// EventAggregator.h: Background thread draining queued events into a heatmap
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HeatmapServiceTypes.h"
+#include "MpscRingBuffer.hpp"
+
+namespace heatmap_service
+{
+  class HeatmapService;
+
+  // -- EventAggregator is the inner implementation of HeatmapEventQueue. Producers push events into a MpscRingBuffer, which costs a compare and swap
+  // and a write to the ring when it has room, and a thread of its own pops them in batches and adds them to the heatmap, so only that thread ever
+  // touches the counters. The heatmap is locked for each batch, which lets other threads take consistent snapshots of it between batches
+  class EventAggregator
+  {
+  public:
+    // An event as it sits in the ring. The counter is the index given by RegisterCounter
+    struct QueuedEvent
+    {
+      HeatmapCoordinate coords;
+      int32_t counter_index;
+      int32_t add_amount;
+    };
+
+    EventAggregator(HeatmapService &heatmap, int capacity, HeatmapQueueBackpressure backpressure);
+    // Adds every event still in the ring to the heatmap before stopping the thread
+    ~EventAggregator();
+
+    // -- Counter registration. Thread safe, and returns the same index for the same key
+    int RegisterCounter(const std::string &counter_key);
+    bool IsRegisteredCounter(int counter_index) const
+    {
+      return counter_index >= 0 && counter_index < registered_counter_count_.load(std::memory_order_acquire);
+    }
+
+    // -- Producer side, callable from any thread
+    bool Push(const QueuedEvent &event)
+    {
+      if (ring_.try_push(event))
+        return true;
+      return PushWhenFull(event);
+    }
+
+    // -- Consistent reads
+    // Returns once every event pushed before the call is in the heatmap
+    void Flush();
+    // Flushes, then copies the heatmap into out_snapshot between two batches
+    void Snapshot(HeatmapService &out_snapshot);
+
+    uint64_t dropped_event_count() const { return dropped_events_.load(std::memory_order_relaxed); }
+    int capacity() const { return (int)ring_.capacity(); }
+
+  private:
+    // Events popped from the ring before the heatmap is locked to add them
+    static const int kBatchSize = 4096;
+    // How long the thread sleeps while the ring is empty before looking again. Producers never wake it, that would cost them a system call
+    static const int kIdleWaitMicroseconds = 500;
+
+    EventAggregator(const EventAggregator&);
+    EventAggregator& operator=(const EventAggregator&);
+
+    // Slow path of Push, taken when the ring is full
+    bool PushWhenFull(const QueuedEvent &event);
+
+    void AggregatorLoop();
+    // Adds a batch of events to the heatmap, resolving counter indices through counter_keys, which is refreshed when it misses a counter
+    void ApplyBatch(const std::vector<QueuedEvent> &batch, std::vector<std::string> &counter_keys);
+
+    HeatmapService &heatmap_;
+    HeatmapQueueBackpressure backpressure_;
+    MpscRingBuffer<QueuedEvent> ring_;
+    std::atomic<uint64_t> dropped_events_;
+
+    // Keys of the registered counters, in registration order
+    std::mutex counters_mutex_;
+    std::vector<std::string> counter_keys_;
+    std::atomic<int> registered_counter_count_;
+
+    // Held by the thread while it adds a batch to the heatmap
+    std::mutex heatmap_mutex_;
+
+    // Ring position up to which every event has been added to the heatmap
+    std::atomic<uint64_t> applied_position_;
+
+    // The thread sleeps on work_available_ while idle, threads flushing sleep on events_applied_
+    std::mutex wake_mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable events_applied_;
+    std::atomic<int> flush_waiters_;
+    bool stopping_;
+
+    std::thread thread_;
+  };
+}
\ No newline at end of file
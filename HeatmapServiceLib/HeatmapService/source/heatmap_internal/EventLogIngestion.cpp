@@ -0,0 +1,395 @@
+////////////////////////////////////////////////////////////////////////
+// EventLogIngestion.cpp: Implementation of the parallel event log parsing
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "EventLogIngestion.h"
+#include "HeatmapPrivate.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace heatmap_service
+{
+  namespace
+  {
+    // Logs are handed to the threads in chunks of about this many bytes, small enough for threads that finish early to take the chunks left,
+    // big enough that taking a chunk costs nothing next to parsing it
+    const size_t kIngestChunkBytes = 4 * 1024 * 1024;
+
+    const char kBinaryEventMagic[4] = { 'H', 'M', 'E', 'V' };
+    const uint32_t kBinaryEventVersion = 1;
+
+    // Layout of a binary event, 24 bytes without padding
+    struct BinaryEvent
+    {
+      double x;
+      double y;
+      uint32_t counter_index;
+      int32_t amount;
+    };
+    const size_t kBinaryEventSize = 24;
+
+    // Events read by a thread, added to the result once it finishes
+    struct ChunkCounts
+    {
+      uint64_t events_ingested;
+      uint64_t rejected_records;
+    };
+
+    // Every power of ten a double holds exactly
+    const double kExactPowersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                         1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    const int kMaxExactPowerOfTen = 22;
+    // Mantissas of up to this many digits are held exactly by a double
+    const int kMaxExactDigits = 15;
+
+    // Events whose cell can't be held by an int, as trajectories are checked
+    bool IsInCellRange(const HeatmapPrivate &heatmap, double x, double y)
+    {
+      double cell_x = floor(x / heatmap.single_unit_width()), cell_y = floor(y / heatmap.single_unit_height());
+      return cell_x >= INT_MIN && cell_x <= INT_MAX && cell_y >= INT_MIN && cell_y <= INT_MAX;
+    }
+
+    bool IsDigit(char character)
+    {
+      return character >= '0' && character <= '9';
+    }
+
+    void SkipSpaces(const char* &cursor, const char* end)
+    {
+      while (cursor < end && (*cursor == ' ' || *cursor == '\t'))
+        cursor++;
+    }
+
+    // Reads a decimal number, such as -12, 3.25 or 1.5e3, moving cursor past it and the spaces around it. Numbers of up to 15 significant digits, whose exponent
+    // is a power of ten a double holds exactly, are converted with a single multiplication or division, which rounds exactly as strtod does.
+    // Longer numbers are handed to strtod
+    bool ParseDouble(const char* &cursor, const char* end, double &out_value)
+    {
+      SkipSpaces(cursor, end);
+      const char* number_begin = cursor;
+
+      bool negative = false;
+      if (cursor < end && (*cursor == '-' || *cursor == '+'))
+        negative = *cursor++ == '-';
+
+      uint64_t mantissa = 0;
+      int digits = 0;
+      int exponent = 0;
+      bool any_digit = false;
+      for (; cursor < end && IsDigit(*cursor); cursor++)
+      {
+        any_digit = true;
+        if (digits <= kMaxExactDigits)
+        {
+          mantissa = mantissa * 10 + (*cursor - '0');
+          digits += mantissa != 0;
+        }
+        else
+        {
+          exponent++;
+        }
+      }
+      if (cursor < end && *cursor == '.')
+      {
+        for (cursor++; cursor < end && IsDigit(*cursor); cursor++)
+        {
+          any_digit = true;
+          if (digits <= kMaxExactDigits)
+          {
+            mantissa = mantissa * 10 + (*cursor - '0');
+            digits += mantissa != 0;
+            exponent--;
+          }
+        }
+      }
+      if (!any_digit)
+        return false;
+
+      if (cursor < end && (*cursor == 'e' || *cursor == 'E'))
+      {
+        cursor++;
+        bool negative_exponent = false;
+        if (cursor < end && (*cursor == '-' || *cursor == '+'))
+          negative_exponent = *cursor++ == '-';
+        if (cursor == end || !IsDigit(*cursor))
+          return false;
+
+        int written_exponent = 0;
+        for (; cursor < end && IsDigit(*cursor); cursor++)
+          written_exponent = std::min(written_exponent * 10 + (*cursor - '0'), 100000);
+        exponent += negative_exponent ? -written_exponent : written_exponent;
+      }
+
+      const char* number_end = cursor;
+      SkipSpaces(cursor, end);
+      if (digits <= kMaxExactDigits && exponent >= -kMaxExactPowerOfTen && exponent <= kMaxExactPowerOfTen)
+      {
+        double value = (double)mantissa;
+        value = exponent < 0 ? value / kExactPowersOfTen[-exponent] : value * kExactPowersOfTen[exponent];
+        out_value = negative ? -value : value;
+        return true;
+      }
+
+      // The log isn't null terminated, so the number is copied out for strtod
+      char number[128];
+      size_t number_length = number_end - number_begin;
+      if (number_length >= sizeof(number))
+        return false;
+      memcpy(number, number_begin, number_length);
+      number[number_length] = '\0';
+      out_value = strtod(number, nullptr);
+      return std::isfinite(out_value) != 0;
+    }
+
+    // Reads a whole number, moving cursor past it and the spaces around it
+    bool ParseInt(const char* &cursor, const char* end, int &out_value)
+    {
+      SkipSpaces(cursor, end);
+      bool negative = false;
+      if (cursor < end && (*cursor == '-' || *cursor == '+'))
+        negative = *cursor++ == '-';
+      if (cursor == end || !IsDigit(*cursor))
+        return false;
+
+      long long value = 0;
+      for (; cursor < end && IsDigit(*cursor); cursor++)
+      {
+        value = value * 10 + (*cursor - '0');
+        if (value > INT_MAX)
+          return false;
+      }
+      SkipSpaces(cursor, end);
+      out_value = (int)(negative ? -value : value);
+      return true;
+    }
+
+    // Parses the lines that start inside [chunk_begin, chunk_end[ of the log. A line crossing the end of the chunk is parsed whole by it,
+    // and skipped by the next chunk, which starts at the first line that begins inside it.
+    // Lines are "x,y,counter_key" or "x,y,counter_key,amount", anything else, or a position outside the cell range, is counted as rejected. Blank lines are skipped
+    bool IngestCsvChunk(HeatmapPrivate &heatmap, const char* buffer, size_t length, size_t chunk_begin, size_t chunk_end, std::string &key, ChunkCounts &counts)
+    {
+      const char* log_end = buffer + length;
+      const char* line = buffer + chunk_begin;
+      if (chunk_begin > 0 && line[-1] != '\n')
+      {
+        line = (const char*)memchr(line, '\n', log_end - line);
+        line = line ? line + 1 : log_end;
+      }
+
+      while (line < buffer + chunk_end)
+      {
+        const char* line_end = (const char*)memchr(line, '\n', log_end - line);
+        if (!line_end)
+          line_end = log_end;
+        const char* next_line = line_end < log_end ? line_end + 1 : log_end;
+        if (line_end > line && line_end[-1] == '\r')
+          line_end--;
+
+        const char* cursor = line;
+        line = next_line;
+        SkipSpaces(cursor, line_end);
+        if (cursor == line_end)
+          continue;
+
+        double x, y;
+        int amount = 1;
+        if (!ParseDouble(cursor, line_end, x) || cursor == line_end || *cursor++ != ',' ||
+            !ParseDouble(cursor, line_end, y) || cursor == line_end || *cursor++ != ',')
+        {
+          counts.rejected_records++;
+          continue;
+        }
+
+        // The key runs up to the next comma, without the spaces around it
+        const char* key_begin = cursor;
+        const char* key_end = (const char*)memchr(cursor, ',', line_end - cursor);
+        if (!key_end)
+          key_end = line_end;
+        cursor = key_end;
+        while (key_begin < key_end && (*key_begin == ' ' || *key_begin == '\t'))
+          key_begin++;
+        while (key_end > key_begin && (key_end[-1] == ' ' || key_end[-1] == '\t'))
+          key_end--;
+
+        bool valid = key_begin < key_end && IsInCellRange(heatmap, x, y);
+        if (valid && cursor < line_end)
+        {
+          cursor++;
+          valid = ParseInt(cursor, line_end, amount) && cursor == line_end;
+        }
+        if (!valid)
+        {
+          counts.rejected_records++;
+          continue;
+        }
+
+        // The key is assigned to the same string for every line, so it only allocates while it grows
+        key.assign(key_begin, key_end - key_begin);
+        if (!heatmap.IncrementMapCounterByAmount({ x, y }, key, amount))
+          return false;
+        counts.events_ingested++;
+      }
+      return true;
+    }
+
+    // Parses the events [first_event, end_event[ of a binary log. Events whose key index doesn't exist or whose coordinates aren't finite, or are outside the cell range,
+    // are rejected
+    bool IngestBinaryChunk(HeatmapPrivate &heatmap, const char* events, size_t first_event, size_t end_event, const std::vector<std::string> &keys, ChunkCounts &counts)
+    {
+      for (size_t event_index = first_event; event_index < end_event; event_index++)
+      {
+        // Events aren't aligned in the log, so they're copied out instead of read in place
+        BinaryEvent event;
+        memcpy(&event, events + event_index * kBinaryEventSize, kBinaryEventSize);
+        if (event.counter_index >= keys.size() || !std::isfinite(event.x) || !std::isfinite(event.y) || !IsInCellRange(heatmap, event.x, event.y))
+        {
+          counts.rejected_records++;
+          continue;
+        }
+
+        if (!heatmap.IncrementMapCounterByAmount({ event.x, event.y }, keys[event.counter_index], event.amount))
+          return false;
+        counts.events_ingested++;
+      }
+      return true;
+    }
+
+    // Reads the header of a binary log and its counter keys, returning where its events start. Returns false if it isn't a binary log
+    bool ReadBinaryHeader(const char* buffer, size_t length, std::vector<std::string> &out_keys, size_t &out_events_offset)
+    {
+      uint32_t version, key_count;
+      size_t offset = sizeof(kBinaryEventMagic) + sizeof(version) + sizeof(key_count);
+      if (length < offset || memcmp(buffer, kBinaryEventMagic, sizeof(kBinaryEventMagic)) != 0)
+        return false;
+      memcpy(&version, buffer + sizeof(kBinaryEventMagic), sizeof(version));
+      memcpy(&key_count, buffer + sizeof(kBinaryEventMagic) + sizeof(version), sizeof(key_count));
+      if (version != kBinaryEventVersion)
+        return false;
+
+      for (uint32_t key = 0; key < key_count; key++)
+      {
+        uint32_t key_length;
+        if (length - offset < sizeof(key_length))
+          return false;
+        memcpy(&key_length, buffer + offset, sizeof(key_length));
+        offset += sizeof(key_length);
+        if (length - offset < key_length)
+          return false;
+        out_keys.push_back(std::string(buffer + offset, key_length));
+        offset += key_length;
+      }
+      out_events_offset = offset;
+      return true;
+    }
+  }
+
+  // A single thread parses straight into heatmap, as there would be nothing to merge. Otherwise each task parses into a heatmap of its own,
+  // taking chunks until none are left, so the heatmaps that are merged are as many as the threads rather than the chunks.
+  // Those are only merged once every task succeeded, so a log that fails while parsing on several threads leaves heatmap as it was
+  bool IngestEventLog(HeatmapPrivate &heatmap, const char* buffer, size_t length, HeatmapEventFormat format, HeatmapIngestResult &out_result)
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    out_result = HeatmapIngestResult();
+
+    std::vector<std::string> keys;
+    const char* events = buffer;
+    size_t unit_count = length;
+    size_t units_per_chunk = kIngestChunkBytes;
+    if (format == kBinaryEventFormat)
+    {
+      size_t events_offset = 0;
+      if (!ReadBinaryHeader(buffer, length, keys, events_offset))
+      {
+        std::cout << "[HEATMAP] ERROR: Could not ingest event log. Reason: \"Not a binary event log of version " << kBinaryEventVersion << "\"" << std::endl;
+        return false;
+      }
+      events = buffer + events_offset;
+      unit_count = (length - events_offset) / kBinaryEventSize;
+      units_per_chunk = kIngestChunkBytes / kBinaryEventSize;
+      // A log cut short in the middle of its last event
+      if ((length - events_offset) % kBinaryEventSize != 0)
+        out_result.rejected_records++;
+    }
+
+    size_t chunk_count = (unit_count + units_per_chunk - 1) / units_per_chunk;
+    WorkerPool& pool = WorkerPool::Instance();
+    int task_count = (int)std::min<size_t>(pool.concurrency(), chunk_count);
+
+    std::atomic<size_t> next_chunk(0);
+    std::atomic<bool> failed(false);
+    std::mutex result_mutex;
+    // Reason of the first failure, written once failed is set
+    const char* failure_reason = nullptr;
+    std::vector< std::unique_ptr<HeatmapPrivate> > task_heatmaps(task_count > 1 ? task_count : 0);
+    std::vector<ChunkCounts> task_counts(task_count, ChunkCounts());
+    auto fail = [&](const char* reason) {
+      std::lock_guard<std::mutex> lock(result_mutex);
+      if (!failure_reason)
+        failure_reason = reason;
+      failed = true;
+    };
+
+    pool.RunTasks(task_count, [&](int task) {
+      try {
+        if (task_count > 1)
+          task_heatmaps[task].reset(new HeatmapPrivate(heatmap.single_unit_width(), heatmap.single_unit_height(), heatmap.storage_layout()));
+        HeatmapPrivate& into = task_count > 1 ? *task_heatmaps[task] : heatmap;
+        std::string key;
+
+        for (size_t chunk = next_chunk++; chunk < chunk_count && !failed; chunk = next_chunk++)
+        {
+          size_t chunk_begin = chunk * units_per_chunk;
+          size_t chunk_end = std::min(chunk_begin + units_per_chunk, unit_count);
+          bool chunk_ingested = format == kBinaryEventFormat ? IngestBinaryChunk(into, events, chunk_begin, chunk_end, keys, task_counts[task])
+                                                             : IngestCsvChunk(into, buffer, length, chunk_begin, chunk_end, key, task_counts[task]);
+          if (!chunk_ingested)
+            fail("Events could not be added to the heatmap");
+        }
+      }
+      catch (const std::bad_alloc&) {
+        fail("Out of memory");
+      }
+    });
+
+    // A merge that runs out of memory may still leave the events of the heatmaps merged before it
+    try {
+      for (size_t task = 0; task < task_heatmaps.size() && !failed; task++)
+      {
+        if (!heatmap.MergeHeatmap(*task_heatmaps[task]))
+          fail("Heatmaps of the threads could not be merged");
+      }
+    }
+    catch (const std::bad_alloc&) {
+      fail("Out of memory");
+    }
+    for (const ChunkCounts& counts : task_counts)
+    {
+      out_result.events_ingested += counts.events_ingested;
+      out_result.rejected_records += counts.rejected_records;
+    }
+
+    out_result.bytes_read = length;
+    out_result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (failed)
+    {
+      std::cout << "[HEATMAP] ERROR: Could not ingest event log. Reason: \"" << failure_reason << "\"" << std::endl;
+      return false;
+    }
+    return true;
+  }
+}
\ No newline at end of file
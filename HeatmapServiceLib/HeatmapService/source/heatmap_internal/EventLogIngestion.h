@@ -0,0 +1,22 @@
+////////////////////////////////////////////////////////////////////////
+// EventLogIngestion.h: Parallel parsing of event logs into a heatmap
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstddef>
+
+#include "HeatmapServiceTypes.h"
+
+namespace heatmap_service
+{
+  class HeatmapPrivate;
+
+  // Parses the event log held in buffer, in the given format (see HeatmapEventFormat), adding every event to heatmap.
+  // The log is cut in chunks that the worker pool parses, each thread into a heatmap of its own with the resolution and layout of heatmap,
+  // merged into heatmap once every thread ran out of chunks, so threads never contend on the same counters while parsing.
+  // Events whose position falls outside the cell range are counted as rejected.
+  // Returns false, writing the reason to cout, if the log isn't in the given format or the counters can't be allocated. A log parsed on a single thread,
+  // or failing while the heatmaps of the threads are merged, leaves the events added before the failure in heatmap
+  bool IngestEventLog(HeatmapPrivate &heatmap, const char* buffer, size_t length, HeatmapEventFormat format, HeatmapIngestResult &out_result);
+}
\ No newline at end of file
@@ -0,0 +1,349 @@
+////////////////////////////////////////////////////////////////////////
+// HeatmapExpression.cpp: Parsing and evaluation of counter expressions
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "HeatmapExpression.h"
+#include "ParallelFor.hpp"
+
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+
+namespace heatmap_service
+{
+  namespace
+  {
+    // Expression areas are split into strips of at least this many cells, as with area queries
+    const int kMinCellsPerExpressionStrip = 64 * 1024;
+
+    bool IsKeyStart(char c)
+    {
+      return std::isalpha((unsigned char)c) || c == '_';
+    }
+
+    bool IsKeyCharacter(char c)
+    {
+      return std::isalnum((unsigned char)c) || c == '_';
+    }
+  }
+
+  HeatmapExpression::HeatmapExpression() : stack_depth_(0), position_(0), current_depth_(0), nesting_(0) {}
+
+  bool HeatmapExpression::Parse(const std::string &expression, std::string &out_error)
+  {
+    program_.clear();
+    counter_keys_.clear();
+    stack_depth_ = 0;
+    text_ = expression;
+    position_ = 0;
+    current_depth_ = 0;
+    nesting_ = 0;
+    error_.clear();
+
+    bool parsed = ParseExpression();
+    SkipSpaces();
+    if (parsed && position_ != text_.size())
+      parsed = Fail("Unexpected character");
+
+    if (!parsed)
+    {
+      program_.clear();
+      counter_keys_.clear();
+      out_error = error_;
+    }
+    text_.clear();
+    return parsed;
+  }
+
+  const std::vector<std::string>& HeatmapExpression::counter_keys() const
+  {
+    return counter_keys_;
+  }
+
+  // -- Evaluation
+  // The bottom of the stack is out_values itself, so the result ends up there without a final copy
+  void HeatmapExpression::EvaluateColumn(const uint32_t* const counter_columns[], int height, std::vector<float> &scratch, float* out_values) const
+  {
+    if (stack_depth_ > 1 && scratch.size() < (size_t)(stack_depth_ - 1) * height)
+      scratch.resize((size_t)(stack_depth_ - 1) * height);
+
+    int top = 0;
+    auto slot = [&](int index) { return index == 0 ? out_values : &scratch[(size_t)(index - 1) * height]; };
+
+    for (const Instruction &instruction : program_)
+    {
+      switch (instruction.code)
+      {
+      case kPushCounter:
+      {
+        float* destination = slot(top++);
+        const uint32_t* source = counter_columns[instruction.counter_index];
+        for (int y = 0; y < height; y++)
+          destination[y] = (float)source[y];
+        break;
+      }
+      case kPushConstant:
+      {
+        float* destination = slot(top++);
+        for (int y = 0; y < height; y++)
+          destination[y] = instruction.constant;
+        break;
+      }
+      case kNegate:
+      {
+        float* operand = slot(top - 1);
+        for (int y = 0; y < height; y++)
+          operand[y] = -operand[y];
+        break;
+      }
+      case kAbsolute:
+      {
+        float* operand = slot(top - 1);
+        for (int y = 0; y < height; y++)
+          operand[y] = std::fabs(operand[y]);
+        break;
+      }
+      default:
+      {
+        // Binary operations write over their left operand
+        float* left = slot(top - 2);
+        const float* right = slot(top - 1);
+        top--;
+        switch (instruction.code)
+        {
+        case kAdd:
+          for (int y = 0; y < height; y++)
+            left[y] += right[y];
+          break;
+        case kSubtract:
+          for (int y = 0; y < height; y++)
+            left[y] -= right[y];
+          break;
+        case kMultiply:
+          for (int y = 0; y < height; y++)
+            left[y] *= right[y];
+          break;
+        case kDivide:
+          for (int y = 0; y < height; y++)
+            left[y] /= right[y];
+          break;
+        case kMinimum:
+          for (int y = 0; y < height; y++)
+            left[y] = right[y] < left[y] ? right[y] : left[y];
+          break;
+        case kMaximum:
+          for (int y = 0; y < height; y++)
+            left[y] = right[y] > left[y] ? right[y] : left[y];
+          break;
+        default:
+          break;
+        }
+        break;
+      }
+      }
+    }
+  }
+
+  // -- Parsing
+  bool HeatmapExpression::ParseExpression()
+  {
+    if (!ParseTerm())
+      return false;
+
+    for (;;)
+    {
+      SkipSpaces();
+      if (position_ >= text_.size() || (text_[position_] != '+' && text_[position_] != '-'))
+        return true;
+
+      OperationCode code = text_[position_] == '+' ? kAdd : kSubtract;
+      position_++;
+      if (!ParseTerm())
+        return false;
+      Emit(code);
+    }
+  }
+
+  bool HeatmapExpression::ParseTerm()
+  {
+    if (!ParseFactor())
+      return false;
+
+    for (;;)
+    {
+      SkipSpaces();
+      if (position_ >= text_.size() || (text_[position_] != '*' && text_[position_] != '/'))
+        return true;
+
+      OperationCode code = text_[position_] == '*' ? kMultiply : kDivide;
+      position_++;
+      if (!ParseFactor())
+        return false;
+      Emit(code);
+    }
+  }
+
+  bool HeatmapExpression::ParseFactor()
+  {
+    SkipSpaces();
+    if (position_ >= text_.size())
+      return Fail("Unexpected end of expression");
+
+    char c = text_[position_];
+    if (c == '-')
+    {
+      position_++;
+      if (!EnterNesting() || !ParseFactor())
+        return false;
+      LeaveNesting();
+      Emit(kNegate);
+      return true;
+    }
+
+    if (c == '(')
+    {
+      position_++;
+      if (!EnterNesting() || !ParseExpression())
+        return false;
+      SkipSpaces();
+      if (position_ >= text_.size() || text_[position_] != ')')
+        return Fail("Expected ')'");
+      position_++;
+      LeaveNesting();
+      return true;
+    }
+
+    if (std::isdigit((unsigned char)c) || c == '.')
+    {
+      const char* begin = text_.c_str() + position_;
+      char* end = nullptr;
+      float constant = std::strtof(begin, &end);
+      if (end == begin)
+        return Fail("Invalid number");
+      position_ += end - begin;
+      Emit(kPushConstant, -1, constant);
+      return true;
+    }
+
+    if (!IsKeyStart(c))
+      return Fail("Unexpected character");
+
+    size_t key_begin = position_;
+    while (position_ < text_.size() && IsKeyCharacter(text_[position_]))
+      position_++;
+    std::string key = text_.substr(key_begin, position_ - key_begin);
+
+    // A name followed by '(' is a function, anything else is a counter
+    SkipSpaces();
+    if (position_ < text_.size() && text_[position_] == '(')
+    {
+      int argument_count;
+      OperationCode code;
+      if (key == "min") { code = kMinimum; argument_count = 2; }
+      else if (key == "max") { code = kMaximum; argument_count = 2; }
+      else if (key == "abs") { code = kAbsolute; argument_count = 1; }
+      else
+        return Fail("Unknown function \"" + key + "\"");
+
+      position_++;
+      if (!EnterNesting())
+        return false;
+      for (int argument = 0; argument < argument_count; argument++)
+      {
+        if (!ParseExpression())
+          return false;
+        SkipSpaces();
+        char expected = argument + 1 < argument_count ? ',' : ')';
+        if (position_ >= text_.size() || text_[position_] != expected)
+          return Fail(std::string("Expected '") + expected + "' in call to \"" + key + "\"");
+        position_++;
+      }
+      LeaveNesting();
+      Emit(code);
+      return true;
+    }
+
+    int counter_index = 0;
+    while (counter_index < (int)counter_keys_.size() && counter_keys_[counter_index] != key)
+      counter_index++;
+    if (counter_index == (int)counter_keys_.size())
+      counter_keys_.push_back(key);
+    Emit(kPushCounter, counter_index);
+    return true;
+  }
+
+  bool HeatmapExpression::Fail(const std::string &reason)
+  {
+    std::string position = std::to_string(position_ < text_.size() ? position_ : text_.size());
+    error_ = reason + " at position " + position;
+    return false;
+  }
+
+  bool HeatmapExpression::EnterNesting()
+  {
+    if (++nesting_ > kMaxExpressionNesting)
+      return Fail("Expression nested too deeply");
+    return true;
+  }
+
+  void HeatmapExpression::LeaveNesting()
+  {
+    nesting_--;
+  }
+
+  void HeatmapExpression::SkipSpaces()
+  {
+    while (position_ < text_.size() && std::isspace((unsigned char)text_[position_]))
+      position_++;
+  }
+
+  // Keeps track of how deep the stack gets while the program runs
+  void HeatmapExpression::Emit(OperationCode code, int counter_index, float constant)
+  {
+    Instruction instruction = { code, counter_index, constant };
+    program_.push_back(instruction);
+
+    if (code == kPushCounter || code == kPushConstant)
+      current_depth_++;
+    else if (code != kNegate && code != kAbsolute)
+      current_depth_--;
+
+    if (current_depth_ > stack_depth_)
+      stack_depth_ = current_depth_;
+  }
+
+  // -- Area evaluation
+  bool EvaluateExpressionArea(const HeatmapExpression &expression, const CounterMap* const maps[], int lowest_coord_x, int lowest_coord_y,
+                              int width, int height, float** out_columns)
+  {
+    int counter_count = (int)expression.counter_keys().size();
+    int min_columns_per_strip = height < kMinCellsPerExpressionStrip ? kMinCellsPerExpressionStrip / height : 1;
+    std::atomic<bool> out_of_memory(false);
+
+    // Each strip reads its columns of every counter into buffers of its own, and runs the expression over them
+    ParallelFor(0, width, min_columns_per_strip, [&](int column_begin, int column_end) {
+      try {
+        std::vector<uint32_t> counter_values((size_t)counter_count * height);
+        std::vector<const uint32_t*> counter_columns(counter_count);
+        for (int c = 0; c < counter_count; c++)
+          counter_columns[c] = &counter_values[(size_t)c * height];
+        std::vector<float> scratch;
+
+        for (int x = column_begin; x < column_end; x++)
+        {
+          for (int c = 0; c < counter_count; c++)
+            maps[c]->getColumnValues(lowest_coord_x + x, lowest_coord_y, height, &counter_values[(size_t)c * height]);
+          expression.EvaluateColumn(counter_count > 0 ? &counter_columns[0] : nullptr, height, scratch, out_columns[x]);
+        }
+      }
+      catch (const std::bad_alloc&) {
+        out_of_memory = true;
+      }
+    });
+
+    return !out_of_memory;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+////////////////////////////////////////////////////////////////////////
+// HeatmapExpression.h: Arithmetic expressions over counters, evaluated in a single pass over CounterMap areas
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "CounterMap.hpp"
+
+namespace heatmap_service
+{
+  // -- HeatmapExpression is an expression combining counters cell by cell, such as "kills / max(deaths, 1)" or "gold - gold_lost".
+  // Supports +, -, *, /, unary minus, parentheses, numeric constants and the functions min(a, b), max(a, b) and abs(a).
+  // Counters are named by their key, which must be made of letters, digits and underscores and not start with a digit.
+  // Parsing compiles the expression to a postfix program once, which is then run over whole columns at a time:
+  // every instruction is a plain loop over a column of floats, so the compiler can vectorize it, and only one column of each counter
+  // and of each intermediate value is alive at once, instead of a full copy of the area per counter.
+  // Arithmetic follows IEEE floats, so dividing by a cell that is 0 gives infinity or NaN, guard against it with max(counter, 1)
+  class HeatmapExpression
+  {
+  public:
+    // Most parentheses, function calls and unary minuses nested inside each other. The parser recurses once for each, so deeper expressions are refused
+    // rather than running out of stack
+    static const int kMaxExpressionNesting = 256;
+
+    HeatmapExpression();
+
+    // Compiles expression. Returns false if it isn't valid, or is nested deeper than kMaxExpressionNesting, with the reason in out_error
+    bool Parse(const std::string &expression, std::string &out_error);
+
+    // The distinct counters the expression reads, in the order their columns are given to EvaluateColumn
+    const std::vector<std::string>& counter_keys() const;
+
+    // Evaluates the expression over height cells. counter_columns[i] holds the height values of counter_keys()[i], and the result is written to out_values.
+    // Scratch is resized as needed and can be reused across calls to avoid allocating for every column
+    void EvaluateColumn(const uint32_t* const counter_columns[], int height, std::vector<float> &scratch, float* out_values) const;
+
+  private:
+    enum OperationCode
+    {
+      kPushCounter,
+      kPushConstant,
+      kAdd,
+      kSubtract,
+      kMultiply,
+      kDivide,
+      kMinimum,
+      kMaximum,
+      kNegate,
+      kAbsolute
+    };
+
+    struct Instruction
+    {
+      OperationCode code;
+      // Index of the counter for kPushCounter, unused otherwise
+      int counter_index;
+      // Value for kPushConstant, unused otherwise
+      float constant;
+    };
+
+    // -- Recursive descent parser, each level emits the instructions of what it parsed
+    // expression := term (('+' | '-') term)*
+    // term := factor (('*' | '/') factor)*
+    // factor := number | counter | function '(' arguments ')' | '(' expression ')' | '-' factor
+    bool ParseExpression();
+    bool ParseTerm();
+    bool ParseFactor();
+    bool Fail(const std::string &reason);
+    // Enters a parenthesis, function call or unary minus, failing past kMaxExpressionNesting. LeaveNesting is only called once it parsed
+    bool EnterNesting();
+    void LeaveNesting();
+    void SkipSpaces();
+    void Emit(OperationCode code, int counter_index = -1, float constant = 0);
+
+    std::vector<Instruction> program_;
+    std::vector<std::string> counter_keys_;
+    // Most intermediate columns alive at once while running the program
+    int stack_depth_;
+
+    // Parsing state
+    std::string text_;
+    size_t position_;
+    int current_depth_;
+    int nesting_;
+    std::string error_;
+  };
+
+  // Evaluates expression over the area that starts at { lowest_coord_x, lowest_coord_y } and spans width*height cells, writing the result to out_columns,
+  // an array of width columns holding height floats each (the same layout as HeatmapData). Maps holds the map of each of expression.counter_keys().
+  // The columns are split in strips across the worker pool. Returns false if the column buffers could not be allocated
+  bool EvaluateExpressionArea(const HeatmapExpression &expression, const CounterMap* const maps[], int lowest_coord_x, int lowest_coord_y,
+                              int width, int height, float** out_columns);
+}
\ No newline at end of file
@@ -4,36 +4,94 @@
 ////////////////////////////////////////////////////////////////////////
 
 #include "HeatmapPrivate.h"
+#include "HeatmapSmoothing.h"
+#include "HeatmapRendering.h"
+#include "HeatmapExpression.h"
+#include "Instrumentation.h"
+#include "EventLogIngestion.h"
+#include "MappedFile.h"
+#include "ParallelFor.hpp"
 #include <string.h>
+#include <cmath>
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <fstream>
 
 // Boost headers for Serialization
-#include <boost\iostreams\stream.hpp>
-#include <boost\iostreams\device\back_inserter.hpp>
-#include <boost\archive\binary_oarchive.hpp>
-#include <boost\archive\binary_iarchive.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/archive_exception.hpp>
 
 namespace heatmap_service
 {
+  namespace
+  {
+    // Columns are loaded in chunks of at least this many across the worker pool
+    const int kMinColumnsPerLoadChunk = 16;
+
+    template<typename Number>
+    void AppendNumber(std::string &out_buffer, Number number)
+    {
+      out_buffer.append((const char*)&number, sizeof(number));
+    }
+
+    // A column to load, whose section spans [begin, end[ of the sections
+    struct ColumnSection
+    {
+      int map_index;
+      int coord_x;
+      uint64_t begin;
+      uint64_t end;
+    };
+  }
+
   // Spatial resolution initialization
-  HeatmapPrivate::HeatmapPrivate() : single_unit_width_(1), single_unit_height_(1) {}
+  HeatmapPrivate::HeatmapPrivate() : single_unit_width_(1), single_unit_height_(1), storage_layout_(kColumnStorageLayout), checkpoint_running_(false) {}
 
   HeatmapPrivate::HeatmapPrivate(double smallest_spatial_unit_size) : single_unit_width_(smallest_spatial_unit_size > 0 ? smallest_spatial_unit_size : 1), 
-    single_unit_height_(smallest_spatial_unit_size > 0 ? smallest_spatial_unit_size : 1){}
+    single_unit_height_(smallest_spatial_unit_size > 0 ? smallest_spatial_unit_size : 1), storage_layout_(kColumnStorageLayout),
+    checkpoint_running_(false){}
 
   HeatmapPrivate::HeatmapPrivate(double smallest_spatial_unit_width, double smallest_spatial_unit_height) : 
-    single_unit_width_(smallest_spatial_unit_width > 0 ? smallest_spatial_unit_width : 1), single_unit_height_(smallest_spatial_unit_height > 0 ? smallest_spatial_unit_height : 1){}
+    single_unit_width_(smallest_spatial_unit_width > 0 ? smallest_spatial_unit_width : 1), single_unit_height_(smallest_spatial_unit_height > 0 ? smallest_spatial_unit_height : 1),
+    storage_layout_(kColumnStorageLayout), checkpoint_running_(false){}
+
+  HeatmapPrivate::HeatmapPrivate(double smallest_spatial_unit_width, double smallest_spatial_unit_height, HeatmapStorageLayout storage_layout) :
+    single_unit_width_(smallest_spatial_unit_width > 0 ? smallest_spatial_unit_width : 1), single_unit_height_(smallest_spatial_unit_height > 0 ? smallest_spatial_unit_height : 1),
+    storage_layout_(storage_layout), checkpoint_running_(false){}
 
   HeatmapPrivate::HeatmapPrivate(const HeatmapPrivate& copy) : single_unit_width_(copy.single_unit_width_), single_unit_height_(copy.single_unit_height_), 
-    key_map_(copy.key_map_) {}
+    storage_layout_(copy.storage_layout_), key_map_(copy.key_map_), group_map_(copy.group_map_), lazy_maps_(copy.lazy_maps_),
+    query_cache_(copy.query_cache_), checkpoint_running_(false) {}
 
   HeatmapPrivate& HeatmapPrivate::operator=(const HeatmapPrivate& copy)
   {
     if (this != &copy)
+    {
+      single_unit_width_ = copy.single_unit_width_;
+      single_unit_height_ = copy.single_unit_height_;
+      storage_layout_ = copy.storage_layout_;
       key_map_ = copy.key_map_;
+      group_map_ = copy.group_map_;
+      lazy_maps_ = copy.lazy_maps_;
+      query_cache_ = copy.query_cache_;
+    }
     return *this;
   }
 
-  HeatmapPrivate::~HeatmapPrivate() {}
+  // Waits for the checkpoint being written, which reports to this heatmap once done
+  HeatmapPrivate::~HeatmapPrivate()
+  {
+    if (checkpoint_thread_.joinable())
+      checkpoint_thread_.join();
+  }
 
   // -- Getters for the current spatial resolution
   double HeatmapPrivate::single_unit_height() const
@@ -46,10 +104,15 @@ namespace heatmap_service
     return single_unit_width_;
   }
 
+  HeatmapStorageLayout HeatmapPrivate::storage_layout() const
+  {
+    return storage_layout_;
+  }
+
   // Queries if a certain counter has ever been added to the heatmap
   bool HeatmapPrivate::hasMapForCounter(const std::string& counter_key) const
   {
-    return key_map_.has_key(counter_key);
+    return key_map_.has_key(counter_key) || (lazy_maps_ && lazy_maps_->has_counter(counter_key));
   }
 
   // -- Heatmap activity logging methods
@@ -61,7 +124,96 @@ namespace heatmap_service
   bool HeatmapPrivate::IncrementMapCounterByAmount(HeatmapCoordinate coords, const std::string &counter_key, int add_amount)
   {
     HeatmapCoordinate adjusted_coords = AdjustCoordsToSpatialResolution(coords);
-    return key_map_[counter_key].AddAmountAt((int)adjusted_coords.x, (int)adjusted_coords.y, add_amount);
+    return IncrementCellCounterByAmount((int)adjusted_coords.x, (int)adjusted_coords.y, counter_key, add_amount);
+  }
+
+  bool HeatmapPrivate::IncrementCellCounterByAmount(int cell_x, int cell_y, const std::string &counter_key, int add_amount)
+  {
+    CounterMap& map_for_counter = MapForWriting(counter_key);
+    return WriteToMap(counter_key, map_for_counter, cell_x, cell_y, [&]() { return map_for_counter.AddAmountAt(cell_x, cell_y, add_amount); });
+  }
+
+  bool HeatmapPrivate::BuildDiskSplatKernel(double radius, int amount, HeatmapSplatKernel &out_kernel) const
+  {
+    if (!(radius >= 0) || !std::isfinite(radius) || amount <= 0)
+    {
+      std::cout << "[HEATMAP] ERROR: Could not build disk splat kernel. Reason: \"Invalid radius or amount\"" << std::endl;
+      return false;
+    }
+    return BuildSplatKernel(radius, [&](double distance) { return distance <= radius ? (unsigned int)amount : 0u; }, out_kernel);
+  }
+
+  // The gaussian is truncated at 3 standard deviations, where it's down to about 1% of its peak
+  bool HeatmapPrivate::BuildGaussianSplatKernel(double standard_deviation, int peak_amount, HeatmapSplatKernel &out_kernel) const
+  {
+    if (!(standard_deviation > 0) || !std::isfinite(standard_deviation) || peak_amount <= 0)
+    {
+      std::cout << "[HEATMAP] ERROR: Could not build gaussian splat kernel. Reason: \"Invalid standard deviation or amount\"" << std::endl;
+      return false;
+    }
+    double reach = 3 * standard_deviation;
+    return BuildSplatKernel(reach, [&](double distance) {
+      return distance <= reach ? (unsigned int)floor(peak_amount * exp(-distance * distance / (2 * standard_deviation * standard_deviation)) + 0.5) : 0u;
+    }, out_kernel);
+  }
+
+  bool HeatmapPrivate::SplatMapCounter(HeatmapCoordinate coords, const HeatmapSplatKernel &kernel, const std::string &counter_key)
+  {
+    // The kernel must fit the range of cell coordinates wherever it lands
+    HeatmapCoordinate center_cell = AdjustCoordsToSpatialResolution(coords);
+    double lowest_x = center_cell.x - kernel.width / 2, lowest_y = center_cell.y - kernel.height / 2;
+    if (kernel.width < 1 || kernel.height < 1 || kernel.weights.size() != (size_t)kernel.width * kernel.height ||
+        !(lowest_x >= INT_MIN && lowest_x + kernel.width - 1 <= INT_MAX && lowest_y >= INT_MIN && lowest_y + kernel.height - 1 <= INT_MAX))
+    {
+      std::cout << "[HEATMAP] ERROR: Could not splat kernel on counter \"" << counter_key << "\". Reason: \"Invalid kernel or coordinate\"" << std::endl;
+      return false;
+    }
+
+    CounterMap& map_for_counter = MapForWriting(counter_key);
+    return WriteToMap(counter_key, map_for_counter, (int)center_cell.x, (int)center_cell.y, [&]() {
+      return map_for_counter.AddKernelAt((int)lowest_x, (int)lowest_y, kernel.weights.data(), kernel.width, kernel.height);
+    });
+  }
+
+  bool HeatmapPrivate::IncrementTrajectory(const HeatmapCoordinate points[], int point_count, const std::string &counter_key, HeatmapRevisitPolicy revisit_policy)
+  {
+    HeatmapTrajectory trajectory = { points, point_count };
+    return IncrementTrajectories(&trajectory, 1, counter_key, revisit_policy);
+  }
+
+  // Every trajectory is checked before any is registered, so a batch with an invalid one leaves the heatmap untouched
+  bool HeatmapPrivate::IncrementTrajectories(const HeatmapTrajectory trajectories[], int trajectory_count, const std::string &counter_key, HeatmapRevisitPolicy revisit_policy)
+  {
+    if (trajectory_count < 0 || (trajectory_count > 0 && !trajectories))
+    {
+      std::cout << "[HEATMAP] ERROR: Could not register trajectories for counter \"" << counter_key << "\". Reason: \"Invalid trajectory list\"" << std::endl;
+      return false;
+    }
+    for (int i = 0; i < trajectory_count; i++)
+    {
+      if (!IsValidTrajectory(trajectories[i].points, trajectories[i].point_count))
+      {
+        std::cout << "[HEATMAP] ERROR: Could not register trajectory for counter \"" << counter_key << "\". Reason: \"Invalid trajectory\"" << std::endl;
+        return false;
+      }
+    }
+    if (trajectory_count == 0)
+      return true;
+
+    CounterMap& map_for_counter = MapForWriting(counter_key);
+    std::vector<int64_t> scratch_cells;
+    for (int i = 0; i < trajectory_count; i++)
+    {
+      // Growth is reported at the start of the trajectory
+      const HeatmapTrajectory& trajectory = trajectories[i];
+      HeatmapCoordinate first_cell = AdjustCoordsToSpatialResolution(trajectory.points[0]);
+      if (!WriteToMap(counter_key, map_for_counter, (int)first_cell.x, (int)first_cell.y, [&]() {
+            return map_for_counter.AddAmountAlongPolyline(trajectory.points, trajectory.point_count, single_unit_width_, single_unit_height_, 1,
+                                                          revisit_policy, scratch_cells);
+          }))
+        return false;
+    }
+    return true;
   }
 
   bool HeatmapPrivate::IncrementMultipleMapCountersByAmount(HeatmapCoordinate coords, const std::string counter_keys[], int amounts[], int counter_keys_length)
@@ -81,7 +233,15 @@ namespace heatmap_service
       return 0;
 
     HeatmapCoordinate adjusted_coords = AdjustCoordsToSpatialResolution(coords);
-    return key_map_[counter_key].getValueAt((int)adjusted_coords.x, (int)adjusted_coords.y);
+    return MapForReading(counter_key).getValueAt((int)adjusted_coords.x, (int)adjusted_coords.y);
+  }
+
+  unsigned int HeatmapPrivate::getCounterAtCell(int cell_x, int cell_y, const std::string &counter_key) const
+  {
+    if (!hasMapForCounter(counter_key))
+      return 0;
+
+    return MapForReading(counter_key).getValueAt(cell_x, cell_y);
   }
 
   bool HeatmapPrivate::getCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key, HeatmapData &out_data) const
@@ -96,112 +256,1399 @@ namespace heatmap_service
     return getCounterDataInsideAdjustedRect(adjusted_lower_left, adjusted_upper_right, counter_key, out_data);
   }
 
-  bool HeatmapPrivate::getAllCounterData(const std::string &counter_key, HeatmapData &out_data) const
+  // -- Sparse queries
+  bool HeatmapPrivate::getSparseCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key,
+                                                      HeatmapSparseData &out_data) const
   {
     if (!hasMapForCounter(counter_key))
       return false;
 
-    const CounterMap& map_for_counter = key_map_[counter_key];
-
-    return getCounterDataInsideAdjustedRect({ map_for_counter.lowest_coord_x(), map_for_counter.lowest_coord_y() },
-                                            { map_for_counter.highest_coord_x(), map_for_counter.highest_coord_y() }, counter_key, out_data);
+    HeatmapCoordinate adjusted_lower_left = AdjustCoordsToSpatialResolution(lower_left);
+    HeatmapCoordinate adjusted_upper_right = AdjustCoordsToSpatialResolution(upper_right);
+    return getSparseCounterDataInsideAdjustedRect(adjusted_lower_left.x, adjusted_lower_left.y, adjusted_upper_right.x, adjusted_upper_right.y, counter_key, out_data);
   }
 
-  // -- Heatmap serialization
-  bool HeatmapPrivate::SerializeHeatmap(char* &out_buffer, int &out_length) const
+  bool HeatmapPrivate::getAllSparseCounterData(const std::string &counter_key, HeatmapSparseData &out_data) const
   {
-    // First we setup a boost stream, to write to a std::string
-    std::string serial_str;
-    boost::iostreams::back_insert_device<std::string> buffer_destination(serial_str);
-    boost::iostreams::stream<boost::iostreams::back_insert_device<std::string> > stream(buffer_destination);
-    boost::archive::binary_oarchive oa(stream);
+    if (!hasMapForCounter(counter_key))
+      return false;
+
+    const CounterMap& map_for_counter = MapForReading(counter_key);
+    return getSparseCounterDataInsideAdjustedRect(map_for_counter.lowest_coord_x(), map_for_counter.lowest_coord_y(),
+                                                  map_for_counter.highest_coord_x(), map_for_counter.highest_coord_y(), counter_key, out_data);
+  }
 
-    // We write the class values to the string, through the stream. Boost knows how to serialize the values
-    oa << single_unit_width_;
-    oa << single_unit_height_;
+  // -- Region queries
+  // Regions holding every cell inside the map limits hold every counter, so they take the summary the map keeps instead of reading it
+  bool HeatmapPrivate::getCounterSumInsideRegion(const HeatmapRegion &region, const std::string &counter_key, unsigned long long &out_sum) const
+  {
+    CellRegion cells;
+    bool whole_map;
+    if (!RasterizeRegion(region, counter_key, cells, whole_map))
+      return false;
 
-    oa & key_map_;
+    const CounterMap& map_for_counter = MapForReading(counter_key);
+    if (whole_map)
+    {
+      out_sum = map_for_counter.summary().total;
+      return true;
+    }
 
-    // flush when done writting
-    stream.flush();
+    unsigned long long sum = 0;
+    map_for_counter.for_each_nonzero_value_in_region(cells, [&](int x, int y, uint32_t value) { sum += value; });
+    out_sum = sum;
+    return true;
+  }
 
-    // Write the data contained in the std::string to a regular char* buffer
-    char * writable = new char[serial_str.size()];
-    memcpy_s(writable, serial_str.size(), serial_str.data(), serial_str.size());
+  bool HeatmapPrivate::getCounterSummaryInsideRegion(const HeatmapRegion &region, const std::string &counter_key, HeatmapCounterSummary &out_summary) const
+  {
+    CellRegion cells;
+    bool whole_map;
+    if (!RasterizeRegion(region, counter_key, cells, whole_map))
+      return false;
 
-    // Return the data
-    out_buffer = writable;
-    out_length = serial_str.size();
+    const CounterMap& map_for_counter = MapForReading(counter_key);
+    if (whole_map)
+    {
+      out_summary = ToCounterSummary(counter_key, map_for_counter.summary());
+      return true;
+    }
 
+    CounterMapSummary summary = CounterMapSummary();
+    map_for_counter.for_each_nonzero_value_in_region(cells, [&](int x, int y, uint32_t value) { summary.AddCounter(value); });
+    out_summary = ToCounterSummary(counter_key, summary);
     return true;
   }
 
-  bool HeatmapPrivate::DeserializeHeatmap(const char* &in_buffer, int in_length)
+  bool HeatmapPrivate::getSparseCounterDataInsideRegion(const HeatmapRegion &region, const std::string &counter_key, HeatmapSparseData &out_data) const
   {
-    // Cleans current heatmap, so that the serialized data can be loaded while avoiding memory leaks
-    key_map_.clean();
+    CellRegion cells;
+    bool whole_map;
+    if (!RasterizeRegion(region, counter_key, cells, whole_map))
+      return false;
+    if (whole_map)
+      return getAllSparseCounterData(counter_key, out_data);
 
-    // Wrap char* buffer inside a stream to read from
-    boost::iostreams::basic_array_source<char> buffer_source(in_buffer, in_length);
-    boost::iostreams::stream<boost::iostreams::basic_array_source<char> > stream(buffer_source);
-    boost::archive::binary_iarchive ia(stream);
+    out_data = HeatmapSparseData();
+    out_data.counter_name = counter_key;
+    out_data.spatial_resolution = { single_unit_width_, single_unit_height_ };
 
-    // Read serialized values from buffer
-    ia >> single_unit_width_;
-    ia >> single_unit_height_;
-    ia & key_map_;
+    int lowest_cell_y = INT_MAX, highest_cell_y = INT_MIN;
+    try {
+      MapForReading(counter_key).for_each_nonzero_value_in_region(cells, [&](int x, int y, uint32_t value) {
+        out_data.cell_x.push_back(x);
+        out_data.cell_y.push_back(y);
+        out_data.values.push_back(value);
+        lowest_cell_y = std::min(lowest_cell_y, y);
+        highest_cell_y = std::max(highest_cell_y, y);
+      });
+    }
+    catch (const std::bad_alloc&) {
+      std::cout << "[HEATMAP] ERROR: Could not build sparse output for counter \"" << counter_key << "\" .Reason: \"Out of memory\"" << std::endl;
+      out_data = HeatmapSparseData();
+      return false;
+    }
 
+    SetSparseDataBounds(lowest_cell_y, highest_cell_y, out_data);
     return true;
   }
 
-  // -- Private Utility Functions
-  // Adjust regular world space coordinates to the inner spatial resolution
-  HeatmapCoordinate HeatmapPrivate::AdjustCoordsToSpatialResolution(HeatmapCoordinate coords) const
+  // -- Query result cache
+  void HeatmapPrivate::SetQueryCacheCapacity(int entry_count)
   {
-    return { floor(coords.x / single_unit_width_), floor(coords.y / single_unit_height_) };
+    query_cache_.SetCapacity(entry_count);
   }
 
-  // Inner implementation of get counter inside rect. Receives already adjusted coordinates
-  bool HeatmapPrivate::getCounterDataInsideAdjustedRect(HeatmapCoordinate adjusted_lower_left, HeatmapCoordinate adjusted_upper_right,
-    const std::string &counter_key, HeatmapData &out_data) const
+  int HeatmapPrivate::query_cache_capacity() const
   {
-    // If the countermap doesn't exist, or if the area is invalid, we return with a failure
-    if (!hasMapForCounter(counter_key) || adjusted_lower_left.x > adjusted_upper_right.x || adjusted_lower_left.y > adjusted_upper_right.y)
+    return query_cache_.capacity();
+  }
+
+  bool HeatmapPrivate::getSharedCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key,
+                                                      HeatmapSharedData &out_data) const
+  {
+    if (!hasMapForCounter(counter_key))
+      return false;
+
+    return getSharedCounterDataInsideAdjustedRect(AdjustCoordsToSpatialResolution(lower_left), AdjustCoordsToSpatialResolution(upper_right), counter_key, out_data);
+  }
+
+  bool HeatmapPrivate::getAllCounterData(const std::string &counter_key, HeatmapData &out_data) const
+  {
+    if (!hasMapForCounter(counter_key))
+      return false;
+
+    const CounterMap& map_for_counter = MapForReading(counter_key);
+
+    return getCounterDataInsideAdjustedRect({ (double)map_for_counter.lowest_coord_x(), (double)map_for_counter.lowest_coord_y() },
+                                            { (double)map_for_counter.highest_coord_x(), (double)map_for_counter.highest_coord_y() }, counter_key, out_data);
+  }
+
+  bool HeatmapPrivate::getMultipleCountersDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string counter_keys[],
+                                                         int counter_keys_length, HeatmapData out_data[]) const
+  {
+    HeatmapCoordinate adjusted_lower_left = AdjustCoordsToSpatialResolution(lower_left);
+    HeatmapCoordinate adjusted_upper_right = AdjustCoordsToSpatialResolution(upper_right);
+
+    // Each counter is a task of its own, and its columns are split further inside the task, so few large counters still use every thread
+    bool* succeeded = new bool[counter_keys_length]();
+    ParallelFor(0, counter_keys_length, 1, [&](int key_begin, int key_end) {
+      for (int i = key_begin; i < key_end; i++)
+        succeeded[i] = getCounterDataInsideAdjustedRect(adjusted_lower_left, adjusted_upper_right, counter_keys[i], out_data[i]);
+    });
+
+    bool result = true;
+    for (int i = 0; i < counter_keys_length; i++)
+      result = result && succeeded[i];
+
+    // Either every counter is returned, or none is
+    if (!result)
+    {
+      for (int i = 0; i < counter_keys_length; i++)
+      {
+        if (succeeded[i])
+          DestroyHeatmapData(out_data[i]);
+      }
+    }
+
+    delete[] succeeded;
+    return result;
+  }
+
+  bool HeatmapPrivate::getSmoothedCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key,
+                                                        double kernel_radius, HeatmapSmoothingKernel kernel, HeatmapFloatData &out_data) const
+  {
+    if (!hasMapForCounter(counter_key))
       return false;
 
-    const CounterMap& map_for_counter = key_map_[counter_key];
+    HeatmapCoordinate adjusted_lower_left = AdjustCoordsToSpatialResolution(lower_left);
+    HeatmapCoordinate adjusted_upper_right = AdjustCoordsToSpatialResolution(upper_right);
+    if (adjusted_lower_left.x > adjusted_upper_right.x || adjusted_lower_left.y > adjusted_upper_right.y)
+      return false;
 
     int width = (int)adjusted_upper_right.x - (int)adjusted_lower_left.x + 1;
     int height = (int)adjusted_upper_right.y - (int)adjusted_lower_left.y + 1;
 
+    // The radius is converted to cells for each axis separately, as the spatial resolution doesn't have to be square
+    int radius_x = kernel_radius > 0 ? (int)ceil(kernel_radius / single_unit_width_) : 0;
+    int radius_y = kernel_radius > 0 ? (int)ceil(kernel_radius / single_unit_height_) : 0;
+
+    float** smoothed_data = nullptr;
+    bool smoothed = false;
     try {
-      // We create a matrix of values, sized acording to the provided rectangle
-      out_data.heatmap_data = new uint32_t*[width];
+      smoothed_data = new float*[width]();
       for (int i = 0; i < width; i++)
       {
-        out_data.heatmap_data[i] = new uint32_t[height]();
+        smoothed_data[i] = new float[height];
       }
-      // We query the map for each value, using the adjusted coordinates, until we reach the expected width and height
-      for (int x = 0; x < width; x++)
+      smoothed = SmoothCounterMapArea(MapForReading(counter_key), (int)adjusted_lower_left.x, (int)adjusted_lower_left.y, width, height,
+                                      radius_x, radius_y, kernel, smoothed_data);
+    }
+    catch (const std::bad_alloc&) {
+      smoothed = false;
+    }
+
+    if (!smoothed)
+    {
+      std::cout << "[HEATMAP] ERROR: Could not smooth rect [ {" << adjusted_lower_left.x << "," << adjusted_lower_left.y << "} ] - [ {" <<
+        adjusted_upper_right.x << "," << adjusted_upper_right.y << "} ] .Reason: \"Out of memory\". Area may be too big to maintain in memory" << std::endl;
+      if (smoothed_data)
       {
-        for (int y = 0; y < height; y++)
-        {
-          out_data.heatmap_data[x][y] = map_for_counter.getValueAt((int)adjusted_lower_left.x + x, (int)adjusted_lower_left.y + y);
-        }
+        for (int i = 0; i < width; i++)
+          delete[] smoothed_data[i];
+        delete[] smoothed_data;
       }
-    }
-    catch (const std::bad_alloc& e) {
-      std::cout << "[HEATMAP] ERROR: Could not build output for rect [ {" << adjusted_lower_left.x << "," << adjusted_lower_left.x << "} ] - [ {" <<
-        adjusted_upper_right.x << "," << adjusted_upper_right.x << "} ] .Reason: \"" << e.what() << "\". Area may be too big to maintain in memory" << std::endl;
       return false;
     }
 
-    // We fill the remaining values of HeatmapData if creation of the matrix was successfull
+    out_data.heatmap_data = smoothed_data;
     out_data.counter_name = new std::string(counter_key);
     out_data.lower_left_coordinate = adjusted_lower_left;
     out_data.spatial_resolution = { single_unit_width_, single_unit_height_ };
-    out_data.data_size = { width, height };
+    out_data.data_size = { (double)width, (double)height };
+
+    return true;
+  }
+
+  bool HeatmapPrivate::getExpressionDataInsideRect(const std::string &expression, HeatmapCoordinate lower_left, HeatmapCoordinate upper_right,
+                                                   HeatmapFloatData &out_data) const
+  {
+    HeatmapExpression compiled_expression;
+    std::string parse_error;
+    if (!compiled_expression.Parse(expression, parse_error))
+    {
+      std::cout << "[HEATMAP] ERROR: Could not parse expression \"" << expression << "\". Reason: \"" << parse_error << "\"" << std::endl;
+      return false;
+    }
+
+    // Every counter the expression reads must exist, like any other area query
+    const std::vector<std::string>& counter_keys = compiled_expression.counter_keys();
+    std::vector<const CounterMap*> maps;
+    for (const std::string& counter_key : counter_keys)
+    {
+      if (!hasMapForCounter(counter_key))
+        return false;
+      maps.push_back(&MapForReading(counter_key));
+    }
+
+    HeatmapCoordinate adjusted_lower_left = AdjustCoordsToSpatialResolution(lower_left);
+    HeatmapCoordinate adjusted_upper_right = AdjustCoordsToSpatialResolution(upper_right);
+    if (adjusted_lower_left.x > adjusted_upper_right.x || adjusted_lower_left.y > adjusted_upper_right.y)
+      return false;
+
+    int width = (int)adjusted_upper_right.x - (int)adjusted_lower_left.x + 1;
+    int height = (int)adjusted_upper_right.y - (int)adjusted_lower_left.y + 1;
+
+    float** expression_data = nullptr;
+    bool evaluated = false;
+    try {
+      expression_data = new float*[width]();
+      for (int i = 0; i < width; i++)
+      {
+        expression_data[i] = new float[height];
+      }
+      evaluated = EvaluateExpressionArea(compiled_expression, maps.empty() ? nullptr : &maps[0], (int)adjusted_lower_left.x, (int)adjusted_lower_left.y,
+                                         width, height, expression_data);
+    }
+    catch (const std::bad_alloc&) {
+      evaluated = false;
+    }
+
+    if (!evaluated)
+    {
+      std::cout << "[HEATMAP] ERROR: Could not evaluate expression in rect [ {" << adjusted_lower_left.x << "," << adjusted_lower_left.y << "} ] - [ {" <<
+        adjusted_upper_right.x << "," << adjusted_upper_right.y << "} ] .Reason: \"Out of memory\". Area may be too big to maintain in memory" << std::endl;
+      if (expression_data)
+      {
+        for (int i = 0; i < width; i++)
+          delete[] expression_data[i];
+        delete[] expression_data;
+      }
+      return false;
+    }
+
+    out_data.heatmap_data = expression_data;
+    out_data.counter_name = new std::string(expression);
+    out_data.lower_left_coordinate = adjusted_lower_left;
+    out_data.spatial_resolution = { single_unit_width_, single_unit_height_ };
+    out_data.data_size = { (double)width, (double)height };
+
+    return true;
+  }
+
+  // -- Counter groups
+  bool HeatmapPrivate::CreateCounterGroup(const std::string &group_key, const std::string counter_keys[], int counter_keys_length)
+  {
+    if (counter_keys_length <= 0 || hasCounterGroup(group_key))
+      return false;
+
+    // Every counter of a group must be told apart from the others
+    std::vector<std::string> keys(counter_keys, counter_keys + counter_keys_length);
+    for (int i = 0; i < counter_keys_length; i++)
+    {
+      if (std::find(keys.begin() + i + 1, keys.end(), keys[i]) != keys.end())
+        return false;
+    }
+
+    group_map_[group_key] = CounterGroupMap(keys);
+    return true;
+  }
+
+  bool HeatmapPrivate::hasCounterGroup(const std::string &group_key) const
+  {
+    return group_map_.has_key(group_key);
+  }
+
+  bool HeatmapPrivate::getCounterGroupKeys(const std::string &group_key, std::vector<std::string> &out_counter_keys) const
+  {
+    if (!hasCounterGroup(group_key))
+      return false;
+
+    out_counter_keys = group_map_[group_key].counter_keys();
+    return true;
+  }
+
+  bool HeatmapPrivate::IncrementCounterGroupByAmounts(HeatmapCoordinate coords, const std::string &group_key, const int amounts[])
+  {
+    if (!hasCounterGroup(group_key))
+      return false;
+
+    HeatmapCoordinate adjusted_coords = AdjustCoordsToSpatialResolution(coords);
+    return group_map_[group_key].AddAmountsAt((int)adjusted_coords.x, (int)adjusted_coords.y, amounts);
+  }
+
+  unsigned int HeatmapPrivate::getCounterGroupValueAtPosition(HeatmapCoordinate coords, const std::string &group_key, const std::string &counter_key) const
+  {
+    if (!hasCounterGroup(group_key))
+      return 0;
+
+    const CounterGroupMap& group = group_map_[group_key];
+    HeatmapCoordinate adjusted_coords = AdjustCoordsToSpatialResolution(coords);
+    return group.getValueAt((int)adjusted_coords.x, (int)adjusted_coords.y, group.CounterIndex(counter_key));
+  }
+
+  bool HeatmapPrivate::getCounterGroupDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &group_key, HeatmapData out_data[]) const
+  {
+    HeatmapCoordinate adjusted_lower_left = AdjustCoordsToSpatialResolution(lower_left);
+    HeatmapCoordinate adjusted_upper_right = AdjustCoordsToSpatialResolution(upper_right);
+    if (!hasCounterGroup(group_key) || adjusted_lower_left.x > adjusted_upper_right.x || adjusted_lower_left.y > adjusted_upper_right.y)
+      return false;
+
+    const CounterGroupMap& group = group_map_[group_key];
+    int counter_count = group.counter_count();
+    int width = (int)adjusted_upper_right.x - (int)adjusted_lower_left.x + 1;
+    int height = (int)adjusted_upper_right.y - (int)adjusted_lower_left.y + 1;
+
+    // As with single counters, the area is split in strips of whole columns across the worker pool, and each column of the group
+    // is read once to fill the matching column of every counter
+    int min_columns_per_strip = height * counter_count < kMinCellsPerQueryStrip ? kMinCellsPerQueryStrip / (height * counter_count) : 1;
+    std::atomic<bool> out_of_memory(false);
+    int counters_allocated = 0;
+    try {
+      for (; counters_allocated < counter_count; counters_allocated++)
+        out_data[counters_allocated].heatmap_data = new uint32_t*[width]();
+    }
+    catch (const std::bad_alloc&) {
+      out_of_memory = true;
+    }
+
+    if (!out_of_memory)
+    {
+      ParallelFor(0, width, min_columns_per_strip, [&](int column_begin, int column_end) {
+        std::vector<uint32_t*> columns(counter_count);
+        for (int x = column_begin; x < column_end && !out_of_memory; x++)
+        {
+          for (int c = 0; c < counter_count; c++)
+          {
+            columns[c] = new (std::nothrow) uint32_t[height];
+            out_data[c].heatmap_data[x] = columns[c];
+            if (!columns[c])
+            {
+              out_of_memory = true;
+              return;
+            }
+          }
+          group.getColumnValues((int)adjusted_lower_left.x + x, (int)adjusted_lower_left.y, height, &columns[0]);
+        }
+      });
+    }
+
+    if (out_of_memory)
+    {
+      for (int c = 0; c < counters_allocated; c++)
+      {
+        for (int x = 0; x < width; x++)
+          delete[] out_data[c].heatmap_data[x];
+        delete[] out_data[c].heatmap_data;
+        out_data[c].heatmap_data = nullptr;
+      }
+      if (HeatmapEventHook* hook = ActiveEventHook())
+        hook->OnAllocationFailure(kAreaQueryOperation, group_key);
+      std::cout << "[HEATMAP] ERROR: Could not build output for counter group \"" << group_key << "\" in rect [ {" << adjusted_lower_left.x << "," << adjusted_lower_left.y << "} ] - [ {" <<
+        adjusted_upper_right.x << "," << adjusted_upper_right.y << "} ] .Reason: \"Out of memory\". Area may be too big to maintain in memory" << std::endl;
+      return false;
+    }
+
+    for (int c = 0; c < counter_count; c++)
+    {
+      out_data[c].counter_name = new std::string(group.counter_keys()[c]);
+      out_data[c].lower_left_coordinate = adjusted_lower_left;
+      out_data[c].spatial_resolution = { single_unit_width_, single_unit_height_ };
+      out_data[c].data_size = { (double)width, (double)height };
+    }
+    return true;
+  }
+
+  // -- Heatmap rendering
+  bool HeatmapPrivate::RenderCounterToImage(const std::string &counter_key, const std::string &file_path, const HeatmapRenderOptions &options) const
+  {
+    if (!hasMapForCounter(counter_key))
+      return false;
+
+    if (!RenderCounterMapImage(MapForReading(counter_key), options, file_path))
+    {
+      std::cout << "[HEATMAP] ERROR: Could not render counter \"" << counter_key << "\" to image \"" << file_path << "\". Reason: \"Out of memory or file not writable\"" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool HeatmapPrivate::RenderCounterToTilePyramid(const std::string &counter_key, const std::string &directory, const HeatmapRenderOptions &options) const
+  {
+    if (!hasMapForCounter(counter_key))
+      return false;
+
+    if (!RenderCounterMapTilePyramid(MapForReading(counter_key), options, directory))
+    {
+      std::cout << "[HEATMAP] ERROR: Could not render counter \"" << counter_key << "\" to tile pyramid \"" << directory << "\". Reason: \"Invalid tile size, out of memory or directory not writable\"" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // -- Heatmap statistics
+  HeatmapStats HeatmapPrivate::GetStats() const
+  {
+    HeatmapStats stats;
+    stats.allocated_bytes = 0;
+    stats.used_bytes = 0;
+
+    for_each_map([&](const std::string &counter_key, const CounterMap &map_for_counter) {
+      CounterMapStats map_stats;
+      map_for_counter.CollectStats(map_stats);
+      stats.counters.push_back(ToCounterStats(counter_key, map_stats));
+      stats.allocated_bytes += map_stats.allocated_bytes;
+      stats.used_bytes += map_stats.used_bytes;
+    });
+    stats.query_cache_hits = query_cache_.hit_count();
+    stats.query_cache_misses = query_cache_.miss_count();
+    return stats;
+  }
+
+  bool HeatmapPrivate::GetCounterStats(const std::string &counter_key, HeatmapCounterStats &out_stats) const
+  {
+    if (!hasMapForCounter(counter_key))
+      return false;
+
+    CounterMapStats map_stats;
+    MapForReading(counter_key).CollectStats(map_stats);
+    out_stats = ToCounterStats(counter_key, map_stats);
+    return true;
+  }
+
+  bool HeatmapPrivate::getCounterSummary(const std::string &counter_key, HeatmapCounterSummary &out_summary) const
+  {
+    if (!hasMapForCounter(counter_key))
+      return false;
+
+    out_summary = ToCounterSummary(counter_key, MapForReading(counter_key).summary());
+    return true;
+  }
+
+  // -- Heatmap serialization
+  // The buffer is a header, the table of every counter and the sections of their columns, followed by a boost archive of the counter groups.
+  // The header is the 4 characters "HMSF", a uint32 version, the double unit width and height, and a uint32 count of counters.
+  // Each counter of the table is its key, as a uint32 length and its characters, its int32 lowest x, lowest y, highest x and highest y,
+  // the int32 x of its first column, a uint32 count of columns, and for each column a uint64 offset where its section ends.
+  // Sections follow the table one after the other, with offsets counted from the first one, so each column is found without reading the others.
+  // Numbers are written in the byte order of the host, as the boost archive is, so buffers are only read back by hosts of the same byte order
+  bool HeatmapPrivate::SerializeHeatmap(char* &out_buffer, int &out_length) const
+  {
+    SerializedHeatmap parts;
+    if (!EncodeHeatmap(parts))
+    {
+      std::cout << "[HEATMAP] ERROR: Could not serialize heatmap. Reason: \"Counters of the lazily loaded heatmap could not be loaded\"" << std::endl;
+      return false;
+    }
+
+    size_t length = parts.header.size() + parts.table.size() + parts.sections.size() + parts.groups.size();
+    if (length > INT_MAX)
+    {
+      std::cout << "[HEATMAP] ERROR: Could not serialize heatmap. Reason: \"Buffer of " << length << " bytes is longer than an int can tell\"" << std::endl;
+      return false;
+    }
+
+    char* writable = new char[length];
+    char* position = writable;
+    const std::string* ordered_parts[4] = { &parts.header, &parts.table, &parts.sections, &parts.groups };
+    for (const std::string* part : ordered_parts)
+    {
+      memcpy(position, part->data(), part->size());
+      position += part->size();
+    }
+
+    out_buffer = writable;
+    out_length = (int)length;
+    return true;
+  }
+
+  bool HeatmapPrivate::EncodeHeatmap(SerializedHeatmap &out_parts) const
+  {
+    std::vector<uint64_t> section_ends;
+    uint32_t counter_count = 0;
+    bool loaded = for_each_map([&](const std::string &counter_key, const CounterMap &map_for_counter) {
+      section_ends.clear();
+      int32_t lowest_column = map_for_counter.AppendColumnSections(out_parts.sections, section_ends);
+      AppendNumber<uint32_t>(out_parts.table, (uint32_t)counter_key.size());
+      out_parts.table += counter_key;
+      AppendNumber<int32_t>(out_parts.table, map_for_counter.lowest_coord_x());
+      AppendNumber<int32_t>(out_parts.table, map_for_counter.lowest_coord_y());
+      AppendNumber<int32_t>(out_parts.table, map_for_counter.highest_coord_x());
+      AppendNumber<int32_t>(out_parts.table, map_for_counter.highest_coord_y());
+      AppendNumber<int32_t>(out_parts.table, lowest_column);
+      AppendNumber<uint32_t>(out_parts.table, (uint32_t)section_ends.size());
+      out_parts.table.append((const char*)section_ends.data(), section_ends.size() * sizeof(uint64_t));
+      counter_count++;
+    });
+    if (!loaded)
+      return false;
+
+    // Counter groups are few, and stay in a boost archive of their own
+    {
+      boost::iostreams::back_insert_device<std::string> buffer_destination(out_parts.groups);
+      boost::iostreams::stream<boost::iostreams::back_insert_device<std::string> > stream(buffer_destination);
+      boost::archive::binary_oarchive oa(stream);
+      oa & group_map_;
+      stream.flush();
+    }
+
+    out_parts.header.assign(CounterSectionIndex::kMagic, sizeof(CounterSectionIndex::kMagic));
+    AppendNumber<uint32_t>(out_parts.header, CounterSectionIndex::kVersion);
+    AppendNumber<double>(out_parts.header, single_unit_width_);
+    AppendNumber<double>(out_parts.header, single_unit_height_);
+    AppendNumber<uint32_t>(out_parts.header, counter_count);
+    return true;
+  }
+
+  bool HeatmapPrivate::DeserializeHeatmap(const char* &in_buffer, int in_length)
+  {
+    if (in_length > 0 && CounterSectionIndex::IsSectioned(in_buffer, (size_t)in_length))
+      return DeserializeSections(in_buffer, (size_t)in_length);
+
+    // Buffers written before sections existed are a single boost archive, read in order
+    // Cleans current heatmap, so that the serialized data can be loaded while avoiding memory leaks
+    key_map_.clean();
+    group_map_.clean();
+    lazy_maps_.reset();
+    query_cache_.Clear();
+
+    // Wrap char* buffer inside a stream to read from
+    boost::iostreams::basic_array_source<char> buffer_source(in_buffer, in_length);
+    boost::iostreams::stream<boost::iostreams::basic_array_source<char> > stream(buffer_source);
+    boost::archive::binary_iarchive ia(stream);
+
+    // Read serialized values from buffer
+    ia >> single_unit_width_;
+    ia >> single_unit_height_;
+    ia & key_map_;
+
+    // Maps always load with the column layout, the heatmap keeps its own
+    if (storage_layout_ != kColumnStorageLayout)
+      key_map_.for_each([&](const std::string &counter_key, CounterMap &map_for_counter) { map_for_counter.SetLayout(storage_layout_); });
+
+    // Buffers serialized before counter groups existed end right after the counters
+    if (stream.peek() != std::char_traits<char>::eof())
+      ia & group_map_;
+
+    return true;
+  }
+
+  // The table is read and checked first, then the columns are loaded across the worker pool into maps of their own, each thread gathering
+  // the summaries of the columns it loaded. The heatmap only takes the maps once every column loaded
+  bool HeatmapPrivate::DeserializeSections(const char* buffer, size_t length)
+  {
+    auto fail = [](const std::string &reason) {
+      std::cout << "[HEATMAP] ERROR: Could not deserialize heatmap. Reason: \"" << reason << "\"" << std::endl;
+      return false;
+    };
+
+    CounterSectionIndex index;
+    std::string parse_error;
+    if (!index.Parse(buffer, length, parse_error))
+      return fail(parse_error);
+
+    Map loaded_maps;
+    GroupMap loaded_groups;
+    std::vector<CounterMap*> maps;
+    std::vector<ColumnSection> columns;
+    try {
+      for (int c = 0; c < index.counter_count(); c++)
+        loaded_maps[index.counter(c).key];
+      // Maps only stay in place once every key was added, and the table holds no key twice, so they come in the order of the table
+      loaded_maps.for_each([&](const std::string &counter_key, CounterMap &map_for_counter) { maps.push_back(&map_for_counter); });
+      for (int c = 0; c < index.counter_count(); c++)
+      {
+        const CounterSectionIndex::Counter& counter = index.counter(c);
+        maps[c]->BeginSectionLoad(counter.lowest_coord_x, counter.lowest_coord_y, counter.highest_coord_x, counter.highest_coord_y,
+                                  counter.lowest_column, (int)counter.column_count);
+        for (uint32_t column = 0; column < counter.column_count; column++)
+        {
+          ColumnSection section = { c, counter.lowest_column + (int)column, index.SectionBegin(counter, column), index.SectionEnd(counter, column) };
+          columns.push_back(section);
+        }
+      }
+    }
+    catch (const std::bad_alloc&) {
+      return fail("Out of memory");
+    }
+
+    // Consecutive columns mostly belong to the same counter, so each chunk gathers the summary of a counter before merging it
+    std::vector<CounterMapSummary> summaries(maps.size(), CounterMapSummary());
+    std::mutex merge_mutex;
+    std::atomic<bool> invalid(false), out_of_memory(false);
+    ParallelFor(0, (int)columns.size(), kMinColumnsPerLoadChunk, [&](int chunk_begin, int chunk_end) {
+      int map_index = columns[chunk_begin].map_index;
+      CounterMapSummary summary = CounterMapSummary();
+      auto merge_summary = [&]() {
+        std::lock_guard<std::mutex> lock(merge_mutex);
+        summaries[map_index].Merge(summary);
+        summary = CounterMapSummary();
+      };
+
+      try {
+        for (int i = chunk_begin; i < chunk_end && !invalid; i++)
+        {
+          const ColumnSection& column = columns[i];
+          if (column.map_index != map_index)
+          {
+            merge_summary();
+            map_index = column.map_index;
+          }
+          if (!maps[map_index]->LoadColumnSection(column.coord_x, index.sections() + column.begin, (size_t)(column.end - column.begin), summary))
+            invalid = true;
+        }
+      }
+      catch (const std::bad_alloc&) {
+        out_of_memory = true;
+      }
+      merge_summary();
+    });
+    if (invalid)
+      return fail("Malformed column section");
+
+    for (size_t m = 0; m < maps.size(); m++)
+      maps[m]->EndSectionLoad(summaries[m]);
+
+    // Maps load with the column layout, the heatmap keeps its own
+    if (storage_layout_ != kColumnStorageLayout && !out_of_memory)
+    {
+      ParallelFor(0, (int)maps.size(), 1, [&](int map_begin, int map_end) {
+        try {
+          for (int m = map_begin; m < map_end; m++)
+            maps[m]->SetLayout(storage_layout_);
+        }
+        catch (const std::bad_alloc&) {
+          out_of_memory = true;
+        }
+      });
+    }
+    if (out_of_memory)
+    {
+      if (HeatmapEventHook* hook = ActiveEventHook())
+        hook->OnAllocationFailure(kDeserializeOperation, "");
+      return fail("Out of memory");
+    }
+
+    if (!ReadCounterGroups(index, loaded_groups))
+      return fail("Malformed counter groups");
+
+    single_unit_width_ = index.unit_width();
+    single_unit_height_ = index.unit_height();
+    key_map_ = loaded_maps;
+    group_map_ = loaded_groups;
+    lazy_maps_.reset();
+    query_cache_.Clear();
+    return true;
+  }
+
+  // -- Lazy loading
+  // Buffers serialized before the section table existed have no index to load counters from, and are loaded whole
+  bool HeatmapPrivate::LoadHeatmapLazily(const char* in_buffer, int in_length)
+  {
+    if (in_length <= 0 || !CounterSectionIndex::IsSectioned(in_buffer, (size_t)in_length))
+      return DeserializeHeatmap(in_buffer, in_length);
+
+    std::shared_ptr<LazyCounterMaps> lazy_maps = std::make_shared<LazyCounterMaps>();
+    std::string open_error;
+    if (!lazy_maps->OpenBuffer(in_buffer, (size_t)in_length, storage_layout_, open_error))
+    {
+      std::cout << "[HEATMAP] ERROR: Could not load heatmap lazily. Reason: \"" << open_error << "\"" << std::endl;
+      return false;
+    }
+    if (!UseLazyMaps(lazy_maps))
+    {
+      std::cout << "[HEATMAP] ERROR: Could not load heatmap lazily. Reason: \"Malformed counter groups\"" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool HeatmapPrivate::LoadHeatmapFileLazily(const std::string &file_path)
+  {
+    std::unique_ptr<MappedFile> file(new MappedFile());
+    if (!file->Open(file_path))
+      return false;
+
+    // Files holding no table are read whole while still mapped
+    if (!CounterSectionIndex::IsSectioned(file->data(), file->size()))
+    {
+      if (file->size() > INT_MAX)
+      {
+        std::cout << "[HEATMAP] ERROR: Could not load heatmap file \"" << file_path << "\". Reason: \"File is longer than an int can tell\"" << std::endl;
+        return false;
+      }
+      const char* buffer = file->data();
+      return DeserializeHeatmap(buffer, (int)file->size());
+    }
+
+    std::shared_ptr<LazyCounterMaps> lazy_maps = std::make_shared<LazyCounterMaps>();
+    std::string open_error;
+    if (!lazy_maps->OpenMappedFile(std::move(file), storage_layout_, open_error))
+    {
+      std::cout << "[HEATMAP] ERROR: Could not load heatmap file \"" << file_path << "\" lazily. Reason: \"" << open_error << "\"" << std::endl;
+      return false;
+    }
+    if (!UseLazyMaps(lazy_maps))
+    {
+      std::cout << "[HEATMAP] ERROR: Could not load heatmap file \"" << file_path << "\" lazily. Reason: \"Malformed counter groups\"" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool HeatmapPrivate::UseLazyMaps(const std::shared_ptr<LazyCounterMaps> &lazy_maps)
+  {
+    GroupMap loaded_groups;
+    if (!ReadCounterGroups(lazy_maps->index(), loaded_groups))
+      return false;
+
+    single_unit_width_ = lazy_maps->index().unit_width();
+    single_unit_height_ = lazy_maps->index().unit_height();
+    key_map_.clean();
+    group_map_ = loaded_groups;
+    lazy_maps_ = lazy_maps;
+    query_cache_.Clear();
+    return true;
+  }
+
+  // A truncated archive throws once the stream runs out, and a corrupted one may claim sizes that can't be allocated
+  bool HeatmapPrivate::ReadCounterGroups(const CounterSectionIndex &index, GroupMap &out_groups)
+  {
+    if (index.groups_length() == 0)
+      return true;
+
+    try {
+      boost::iostreams::basic_array_source<char> buffer_source(index.groups(), index.groups_length());
+      boost::iostreams::stream<boost::iostreams::basic_array_source<char> > stream(buffer_source);
+      boost::archive::binary_iarchive ia(stream);
+      ia & out_groups;
+    }
+    catch (const boost::archive::archive_exception&) {
+      return false;
+    }
+    catch (const std::bad_alloc&) {
+      return false;
+    }
+    return true;
+  }
+
+  const CounterMap& HeatmapPrivate::MapForReading(const std::string &counter_key) const
+  {
+    if (lazy_maps_ && !key_map_.has_key(counter_key))
+    {
+      const CounterMap* loaded = lazy_maps_->Load(counter_key);
+      return loaded ? *loaded : lazy_maps_->empty_map();
+    }
+    return key_map_[counter_key];
+  }
+
+  template<typename Visitor>
+  bool HeatmapPrivate::for_each_map(Visitor visit) const
+  {
+    key_map_.for_each(visit);
+    if (!lazy_maps_)
+      return true;
+
+    bool result = lazy_maps_->LoadAll();
+    const CounterSectionIndex& index = lazy_maps_->index();
+    for (int c = 0; c < index.counter_count(); c++)
+    {
+      if (!key_map_.has_key(index.counter(c).key))
+        visit(index.counter(c).key, MapForReading(index.counter(c).key));
+    }
+    return result;
+  }
+
+  // -- Checkpointing
+  // The snapshot shares every column of the heatmap, and is the only thing the background thread reads. Columns the heatmap writes to meanwhile
+  // are copied once, as with any other snapshot
+  std::future<bool> HeatmapPrivate::CheckpointTo(const std::string &file_path, std::function<void(bool)> on_complete)
+  {
+    std::shared_ptr< std::promise<bool> > written = std::make_shared< std::promise<bool> >();
+    std::future<bool> result = written->get_future();
+    auto fail = [&](const char* reason) {
+      std::cout << "[HEATMAP] ERROR: Could not checkpoint heatmap to \"" << file_path << "\". Reason: \"" << reason << "\"" << std::endl;
+      written->set_value(false);
+      return std::move(result);
+    };
+
+    if (checkpoint_running_)
+      return fail("A checkpoint is still being written");
+    if (checkpoint_thread_.joinable())
+      checkpoint_thread_.join();
+
+    std::shared_ptr<const HeatmapPrivate> snapshot;
+    try {
+      snapshot = std::make_shared<const HeatmapPrivate>(*this);
+    }
+    catch (const std::bad_alloc&) {
+      return fail("Out of memory");
+    }
+
+    checkpoint_running_ = true;
+    try {
+      checkpoint_thread_ = std::thread([this, snapshot, file_path, on_complete, written]() {
+        bool checkpoint_written = snapshot->WriteCheckpoint(file_path);
+        // Still running while on_complete runs, so a checkpoint it starts fails instead of assigning over this thread
+        if (on_complete)
+          on_complete(checkpoint_written);
+        checkpoint_running_ = false;
+        written->set_value(checkpoint_written);
+      });
+    }
+    catch (const std::system_error&) {
+      checkpoint_running_ = false;
+      return fail("Could not start the checkpoint thread");
+    }
+    return result;
+  }
+
+  // Written next to file_path first, so the file only ever holds a complete checkpoint
+  bool HeatmapPrivate::WriteCheckpoint(const std::string &file_path) const
+  {
+    auto fail = [&](const char* reason) {
+      std::cout << "[HEATMAP] ERROR: Could not write checkpoint \"" << file_path << "\". Reason: \"" << reason << "\"" << std::endl;
+      return false;
+    };
+
+    SerializedHeatmap parts;
+    try {
+      if (!EncodeHeatmap(parts))
+        return fail("Counters of the lazily loaded heatmap could not be loaded");
+    }
+    catch (const std::bad_alloc&) {
+      return fail("Out of memory");
+    }
+
+    std::string written_path = file_path + ".tmp";
+    std::ofstream file(written_path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+      return fail("File not writable");
+
+    const std::string* ordered_parts[4] = { &parts.header, &parts.table, &parts.sections, &parts.groups };
+    for (const std::string* part : ordered_parts)
+      file.write(part->data(), part->size());
+    file.close();
+    if (!file.good())
+    {
+      std::remove(written_path.c_str());
+      return fail("File not writable");
+    }
+
+    // Renaming over an existing file fails on Windows, so the previous checkpoint is removed first there
+    if (std::rename(written_path.c_str(), file_path.c_str()) != 0 &&
+        (std::remove(file_path.c_str()) != 0 || std::rename(written_path.c_str(), file_path.c_str()) != 0))
+    {
+      std::remove(written_path.c_str());
+      return fail("Could not replace the previous checkpoint");
+    }
+    return true;
+  }
+
+  // -- Rebinning
+  // Counter maps are rebinned on a copy of the heatmap's maps, sharing their storage, so a failed allocation leaves the heatmap as it was.
+  // Once every map succeeded, the copies replace the maps, which frees the old storage
+  bool HeatmapPrivate::Rebin(double new_unit_width, double new_unit_height)
+  {
+    int factor_x, factor_y;
+    if (!RebinFactor(single_unit_width_, new_unit_width, factor_x) || !RebinFactor(single_unit_height_, new_unit_height, factor_y))
+    {
+      std::cout << "[HEATMAP] ERROR: Could not rebin heatmap to {" << new_unit_width << "," << new_unit_height << "}. Reason: \"New resolution isn't a multiple of the current one\"" << std::endl;
+      return false;
+    }
+    if (factor_x == 1 && factor_y == 1)
+      return true;
+
+    Map rebinned_maps;
+    if (!for_each_map([&](const std::string &counter_key, const CounterMap &map_for_counter) { rebinned_maps[counter_key] = map_for_counter; }))
+      return false;
+    GroupMap rebinned_groups(group_map_);
+    bool result = true;
+    rebinned_maps.for_each([&](const std::string &counter_key, CounterMap &map_for_counter) {
+      result = result && map_for_counter.Rebin(factor_x, factor_y);
+    });
+    rebinned_groups.for_each([&](const std::string &group_key, CounterGroupMap &group) {
+      result = result && group.Rebin(factor_x, factor_y);
+    });
+    if (!result)
+      return false;
+
+    key_map_ = rebinned_maps;
+    group_map_ = rebinned_groups;
+    lazy_maps_.reset();
+    single_unit_width_ = new_unit_width;
+    single_unit_height_ = new_unit_height;
+    query_cache_.Clear();
+    return true;
+  }
+
+  // -- Merging and bulk ingestion
+  // Everything that could stop the merge is checked before anything is merged, so a heatmap that can't be merged is left as it was
+  bool HeatmapPrivate::MergeHeatmap(const HeatmapPrivate& other)
+  {
+    if (this == &other)
+    {
+      HeatmapPrivate copy(other);
+      return MergeHeatmap(copy);
+    }
+
+    // Both heatmaps are brought to the coarser resolution first. This one is rebinned and merged as a snapshot, which only replaces it once everything succeeded
+    if (single_unit_width_ != other.single_unit_width_ || single_unit_height_ != other.single_unit_height_)
+    {
+      double unit_width = std::max(single_unit_width_, other.single_unit_width_);
+      double unit_height = std::max(single_unit_height_, other.single_unit_height_);
+      int factor;
+      if (!RebinFactor(single_unit_width_, unit_width, factor) || !RebinFactor(single_unit_height_, unit_height, factor) ||
+          !RebinFactor(other.single_unit_width_, unit_width, factor) || !RebinFactor(other.single_unit_height_, unit_height, factor))
+      {
+        std::cout << "[HEATMAP] ERROR: Could not merge heatmaps. Reason: \"Spatial resolutions aren't multiples of each other\"" << std::endl;
+        return false;
+      }
+
+      HeatmapPrivate coarse_other(other);
+      HeatmapPrivate merged(*this);
+      if (!coarse_other.Rebin(unit_width, unit_height) || !merged.Rebin(unit_width, unit_height) || !merged.MergeHeatmap(coarse_other))
+        return false;
+
+      *this = merged;
+      return true;
+    }
+
+    bool groups_match = true;
+    other.group_map_.for_each([&](const std::string &group_key, const CounterGroupMap &other_group) {
+      if (hasCounterGroup(group_key) && group_map_[group_key].counter_keys() != other_group.counter_keys())
+        groups_match = false;
+    });
+    if (!groups_match)
+    {
+      std::cout << "[HEATMAP] ERROR: Could not merge heatmaps. Reason: \"Counter groups of the same key hold different counters\"" << std::endl;
+      return false;
+    }
+
+    // Lazily loaded counters are loaded before merging, every one of the other heatmap and the ones of this heatmap the merge writes to
+    bool loaded = other.for_each_map([&](const std::string &counter_key, const CounterMap &other_map) {});
+    other.for_each_map([&](const std::string &counter_key, const CounterMap &other_map) {
+      if (lazy_maps_ && !key_map_.has_key(counter_key) && lazy_maps_->has_counter(counter_key))
+        loaded = lazy_maps_->Load(counter_key) && loaded;
+    });
+    if (!loaded)
+    {
+      std::cout << "[HEATMAP] ERROR: Could not merge heatmaps. Reason: \"Lazily loaded counters could not be loaded\"" << std::endl;
+      return false;
+    }
+
+    bool result = true;
+    other.for_each_map([&](const std::string &counter_key, const CounterMap &other_map) {
+      result = MapForWriting(counter_key).AddMap(other_map) && result;
+    });
+    other.group_map_.for_each([&](const std::string &group_key, const CounterGroupMap &other_group) {
+      if (!hasCounterGroup(group_key))
+        group_map_[group_key] = other_group;
+      else
+        result = group_map_[group_key].AddMap(other_group) && result;
+    });
+    return result;
+  }
+
+  bool HeatmapPrivate::IngestEventFile(const std::string &file_path, HeatmapEventFormat format, HeatmapIngestResult &out_result)
+  {
+    out_result = HeatmapIngestResult();
+    MappedFile file;
+    if (!file.Open(file_path))
+      return false;
+
+    return IngestEventLog(*this, file.data(), file.size(), format, out_result);
+  }
+
+  bool HeatmapPrivate::IngestEventBuffer(const char* buffer, size_t length, HeatmapEventFormat format, HeatmapIngestResult &out_result)
+  {
+    return IngestEventLog(*this, buffer, length, format, out_result);
+  }
+
+  // -- Private Utility Functions
+  // Adjust regular world space coordinates to the inner spatial resolution
+  HeatmapCoordinate HeatmapPrivate::AdjustCoordsToSpatialResolution(HeatmapCoordinate coords) const
+  {
+    return { floor(coords.x / single_unit_width_), floor(coords.y / single_unit_height_) };
+  }
+
+  // Resolutions are doubles, so a ratio within a tiny relative error of a whole number counts as one, as 0.1 by 3 does with 0.3
+  bool HeatmapPrivate::RebinFactor(double unit_size, double new_unit_size, int &out_factor)
+  {
+    double ratio = new_unit_size / unit_size;
+    if (!(ratio >= 1) || ratio > INT_MAX)
+      return false;
+
+    out_factor = (int)floor(ratio + 0.5);
+    return fabs(ratio - out_factor) <= ratio * 1e-9;
+  }
+
+  // Inner implementation of get counter inside rect. Receives already adjusted coordinates
+  // Results handed out by the plain area queries belong to the caller, so hits are copied out of the cached result, and misses are copied into the cache
+  bool HeatmapPrivate::getCounterDataInsideAdjustedRect(HeatmapCoordinate adjusted_lower_left, HeatmapCoordinate adjusted_upper_right,
+    const std::string &counter_key, HeatmapData &out_data) const
+  {
+    if (query_cache_.capacity() == 0)
+      return ReadCounterDataInsideAdjustedRect(adjusted_lower_left, adjusted_upper_right, counter_key, out_data);
+
+    HeatmapSharedData shared_data;
+    if (!getSharedCounterDataInsideAdjustedRect(adjusted_lower_left, adjusted_upper_right, counter_key, shared_data))
+      return false;
+
+    if (!CopyHeatmapData(*shared_data, out_data))
+    {
+      std::cout << "[HEATMAP] ERROR: Could not build output for rect [ {" << adjusted_lower_left.x << "," << adjusted_lower_left.y << "} ] - [ {" <<
+        adjusted_upper_right.x << "," << adjusted_upper_right.y << "} ] .Reason: \"Out of memory\". Area may be too big to maintain in memory" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool HeatmapPrivate::getSharedCounterDataInsideAdjustedRect(HeatmapCoordinate adjusted_lower_left, HeatmapCoordinate adjusted_upper_right,
+                                                              const std::string &counter_key, HeatmapSharedData &out_data) const
+  {
+    if (!hasMapForCounter(counter_key) || adjusted_lower_left.x > adjusted_upper_right.x || adjusted_lower_left.y > adjusted_upper_right.y)
+      return false;
+
+    const CounterMap& map_for_counter = MapForReading(counter_key);
+    int lowest_x = (int)adjusted_lower_left.x;
+    int lowest_y = (int)adjusted_lower_left.y;
+    int width = (int)adjusted_upper_right.x - lowest_x + 1;
+    int height = (int)adjusted_upper_right.y - lowest_y + 1;
+
+    // The versions are read before the counters, the area can't change in between as writes don't run alongside queries
+    bool cached = query_cache_.capacity() > 0;
+    uint64_t generation = 0, version_sum = 0;
+    if (cached)
+    {
+      generation = map_for_counter.generation();
+      version_sum = map_for_counter.AreaVersionSum(lowest_x, width, lowest_y, height);
+      out_data = query_cache_.Find(counter_key, lowest_x, lowest_y, width, height, generation, version_sum);
+      if (out_data)
+        return true;
+    }
+
+    HeatmapData* data = new (std::nothrow) HeatmapData();
+    if (!data || !ReadCounterDataInsideAdjustedRect(adjusted_lower_left, adjusted_upper_right, counter_key, *data))
+    {
+      delete data;
+      return false;
+    }
+
+    out_data = HeatmapSharedData(data, [](const HeatmapData* shared_data) {
+      DestroyHeatmapData(*const_cast<HeatmapData*>(shared_data));
+      delete shared_data;
+    });
+    if (cached)
+      query_cache_.Store(counter_key, lowest_x, lowest_y, width, height, generation, version_sum, out_data);
+    return true;
+  }
+
+  // The cells come ordered by x, so the tight bounds along x are the first and last cells, and only y needs to be tracked
+  bool HeatmapPrivate::getSparseCounterDataInsideAdjustedRect(double lowest_x, double lowest_y, double highest_x, double highest_y, const std::string &counter_key,
+                                                              HeatmapSparseData &out_data) const
+  {
+    if (!hasMapForCounter(counter_key) || lowest_x > highest_x || lowest_y > highest_y)
+      return false;
+
+    const CounterMap& map_for_counter = MapForReading(counter_key);
+    int from_x = (int)std::max(lowest_x, (double)map_for_counter.lowest_coord_x());
+    int from_y = (int)std::max(lowest_y, (double)map_for_counter.lowest_coord_y());
+    int to_x = (int)std::min(highest_x, (double)map_for_counter.highest_coord_x());
+    int to_y = (int)std::min(highest_y, (double)map_for_counter.highest_coord_y());
+
+    out_data = HeatmapSparseData();
+    out_data.counter_name = counter_key;
+    out_data.spatial_resolution = { single_unit_width_, single_unit_height_ };
+    if (from_x > to_x || from_y > to_y)
+      return true;
+
+    int lowest_cell_y = INT_MAX, highest_cell_y = INT_MIN;
+    try {
+      map_for_counter.for_each_nonzero_value(from_x, to_x - from_x + 1, from_y, to_y - from_y + 1, [&](int x, int y, uint32_t value) {
+        out_data.cell_x.push_back(x);
+        out_data.cell_y.push_back(y);
+        out_data.values.push_back(value);
+        lowest_cell_y = std::min(lowest_cell_y, y);
+        highest_cell_y = std::max(highest_cell_y, y);
+      });
+    }
+    catch (const std::bad_alloc&) {
+      std::cout << "[HEATMAP] ERROR: Could not build sparse output for counter \"" << counter_key << "\" .Reason: \"Out of memory\"" << std::endl;
+      out_data = HeatmapSparseData();
+      return false;
+    }
+
+    SetSparseDataBounds(lowest_cell_y, highest_cell_y, out_data);
+    return true;
+  }
+
+  CounterMap& HeatmapPrivate::MapForWriting(const std::string &counter_key)
+  {
+    // Lazily loaded counters are copied in before their first write, sharing the storage of the loaded map
+    if (lazy_maps_ && !key_map_.has_key(counter_key) && lazy_maps_->has_counter(counter_key))
+      key_map_[counter_key] = MapForReading(counter_key);
+
+    CounterMap& map_for_counter = key_map_[counter_key];
+    if (map_for_counter.layout() != storage_layout_)
+      map_for_counter.SetLayout(storage_layout_);
+    return map_for_counter;
+  }
+
+  template<typename Write>
+  bool HeatmapPrivate::WriteToMap(const std::string &counter_key, CounterMap &map_for_counter, int growth_cell_x, int growth_cell_y, Write write)
+  {
+    HeatmapEventHook* hook = ActiveEventHook();
+    if (!hook)
+      return write();
+
+    uint64_t growth_before = map_for_counter.reallocation_count() + map_for_counter.copy_on_write_count();
+    uint64_t bytes_copied_before = map_for_counter.bytes_copied();
+    bool result = write();
+
+    if (!result)
+      hook->OnAllocationFailure(kIncrementOperation, counter_key);
+    else if (map_for_counter.reallocation_count() + map_for_counter.copy_on_write_count() != growth_before)
+      hook->OnRegionGrowth(counter_key, { growth_cell_x * single_unit_width_, growth_cell_y * single_unit_height_ }, map_for_counter.bytes_copied() - bytes_copied_before);
+    return result;
+  }
+
+  // Cell { x, y } of the kernel sits x - width / 2 cells from its center horizontally and y - height / 2 vertically, so cells are kept as far as the reach
+  // goes from the center of the kernel, the same on either side
+  template<typename Weight>
+  bool HeatmapPrivate::BuildSplatKernel(double reach, Weight weight, HeatmapSplatKernel &out_kernel) const
+  {
+    double reach_x = floor(reach / single_unit_width_), reach_y = floor(reach / single_unit_height_);
+    if ((2 * reach_x + 1) * (2 * reach_y + 1) > kMaxSplatKernelCells)
+    {
+      std::cout << "[HEATMAP] ERROR: Could not build splat kernel. Reason: \"Kernel reaching " << reach << " units is too big\"" << std::endl;
+      return false;
+    }
+
+    out_kernel.width = 2 * (int)reach_x + 1;
+    out_kernel.height = 2 * (int)reach_y + 1;
+    out_kernel.weights.assign((size_t)out_kernel.width * out_kernel.height, 0);
+    for (int x = 0; x < out_kernel.width; x++)
+    {
+      for (int y = 0; y < out_kernel.height; y++)
+      {
+        double offset_x = (x - (int)reach_x) * single_unit_width_, offset_y = (y - (int)reach_y) * single_unit_height_;
+        out_kernel.weights[(size_t)x * out_kernel.height + y] = weight(sqrt(offset_x * offset_x + offset_y * offset_y));
+      }
+    }
+    return true;
+  }
+
+  bool HeatmapPrivate::IsValidTrajectory(const HeatmapCoordinate points[], int point_count) const
+  {
+    if (!points || point_count < 1)
+      return false;
+    for (int i = 0; i < point_count; i++)
+    {
+      HeatmapCoordinate cell = AdjustCoordsToSpatialResolution(points[i]);
+      if (!(cell.x >= INT_MIN && cell.x <= INT_MAX && cell.y >= INT_MIN && cell.y <= INT_MAX))
+        return false;
+    }
+    return true;
+  }
+
+  void HeatmapPrivate::SetSparseDataBounds(int lowest_cell_y, int highest_cell_y, HeatmapSparseData &out_data) const
+  {
+    if (out_data.values.empty())
+      return;
+
+    out_data.lower_left_coordinate = { out_data.cell_x.front() * single_unit_width_, lowest_cell_y * single_unit_height_ };
+    out_data.data_size = { (double)(out_data.cell_x.back() - out_data.cell_x.front() + 1), (double)(highest_cell_y - lowest_cell_y + 1) };
+  }
+
+  bool HeatmapPrivate::RasterizeRegion(const HeatmapRegion &region, const std::string &counter_key, CellRegion &out_cells, bool &out_whole_map) const
+  {
+    if (!hasMapForCounter(counter_key))
+      return false;
+
+    const CounterMap& map_for_counter = MapForReading(counter_key);
+    // Circles are convex, so one holding the centers of the four corner cells of the map holds every cell of it, and needs no spans at all
+    if (region.shape == kCircleRegion && region.radius > 0 && std::isfinite(region.radius))
+    {
+      out_whole_map = true;
+      int corners_x[2] = { map_for_counter.lowest_coord_x(), map_for_counter.highest_coord_x() };
+      int corners_y[2] = { map_for_counter.lowest_coord_y(), map_for_counter.highest_coord_y() };
+      for (int corner_x : corners_x)
+      {
+        for (int corner_y : corners_y)
+        {
+          double offset_x = (corner_x + 0.5) * single_unit_width_ - region.center.x;
+          double offset_y = (corner_y + 0.5) * single_unit_height_ - region.center.y;
+          out_whole_map = out_whole_map && offset_x * offset_x + offset_y * offset_y < region.radius * region.radius;
+        }
+      }
+      if (out_whole_map)
+        return true;
+    }
+
+    try {
+      if (!out_cells.Rasterize(region, single_unit_width_, single_unit_height_, map_for_counter.lowest_coord_x(), map_for_counter.lowest_coord_y(),
+                               map_for_counter.highest_coord_x(), map_for_counter.highest_coord_y()))
+      {
+        std::cout << "[HEATMAP] ERROR: Could not query region of counter \"" << counter_key << "\". Reason: \"Invalid region\"" << std::endl;
+        return false;
+      }
+    }
+    catch (const std::bad_alloc&) {
+      std::cout << "[HEATMAP] ERROR: Could not query region of counter \"" << counter_key << "\". Reason: \"Out of memory\"" << std::endl;
+      return false;
+    }
+
+    out_whole_map = out_cells.ContainsRect(map_for_counter.lowest_coord_x(), map_for_counter.highest_coord_x() - map_for_counter.lowest_coord_x() + 1,
+                                           map_for_counter.lowest_coord_y(), map_for_counter.highest_coord_y() - map_for_counter.lowest_coord_y() + 1);
+    return true;
+  }
+
+  bool HeatmapPrivate::ReadCounterDataInsideAdjustedRect(HeatmapCoordinate adjusted_lower_left, HeatmapCoordinate adjusted_upper_right,
+    const std::string &counter_key, HeatmapData &out_data) const
+  {
+    // If the countermap doesn't exist, or if the area is invalid, we return with a failure
+    if (!hasMapForCounter(counter_key) || adjusted_lower_left.x > adjusted_upper_right.x || adjusted_lower_left.y > adjusted_upper_right.y)
+      return false;
+
+    const CounterMap& map_for_counter = MapForReading(counter_key);
+
+    int width = (int)adjusted_upper_right.x - (int)adjusted_lower_left.x + 1;
+    int height = (int)adjusted_upper_right.y - (int)adjusted_lower_left.y + 1;
+
+    // The area is split in strips of whole columns, each one allocating and copying its own columns on the worker pool.
+    // Strips are kept big enough that splitting small areas isn't more expensive than querying them
+    int min_columns_per_strip = height < kMinCellsPerQueryStrip ? kMinCellsPerQueryStrip / height : 1;
+    std::atomic<bool> out_of_memory(false);
+    try {
+      // We create a matrix of values, sized acording to the provided rectangle
+      out_data.heatmap_data = new uint32_t*[width]();
+    }
+    catch (const std::bad_alloc&) {
+      out_of_memory = true;
+    }
+
+    if (!out_of_memory)
+    {
+      ParallelFor(0, width, min_columns_per_strip, [&](int column_begin, int column_end) {
+        for (int x = column_begin; x < column_end && !out_of_memory; x++)
+        {
+          out_data.heatmap_data[x] = new (std::nothrow) uint32_t[height];
+          if (!out_data.heatmap_data[x])
+          {
+            out_of_memory = true;
+            return;
+          }
+        }
+        // Another strip ran out of memory, so this strip may have stopped before allocating all of its columns, and the result is dropped anyway
+        if (out_of_memory)
+          return;
+
+        // The strip's columns are copied in one go from the map, instead of querying each value
+        map_for_counter.getColumnsValues((int)adjusted_lower_left.x + column_begin, column_end - column_begin, (int)adjusted_lower_left.y, height,
+                                         out_data.heatmap_data + column_begin);
+      });
+
+      if (out_of_memory)
+      {
+        for (int x = 0; x < width; x++)
+          delete[] out_data.heatmap_data[x];
+        delete[] out_data.heatmap_data;
+      }
+    }
+
+    if (out_of_memory)
+    {
+      if (HeatmapEventHook* hook = ActiveEventHook())
+        hook->OnAllocationFailure(kAreaQueryOperation, counter_key);
+      out_data.heatmap_data = nullptr;
+      std::cout << "[HEATMAP] ERROR: Could not build output for rect [ {" << adjusted_lower_left.x << "," << adjusted_lower_left.y << "} ] - [ {" <<
+        adjusted_upper_right.x << "," << adjusted_upper_right.y << "} ] .Reason: \"Out of memory\". Area may be too big to maintain in memory" << std::endl;
+      return false;
+    }
+
+    // We fill the remaining values of HeatmapData if creation of the matrix was successfull
+    out_data.counter_name = new std::string(counter_key);
+    out_data.lower_left_coordinate = adjusted_lower_left;
+    out_data.spatial_resolution = { single_unit_width_, single_unit_height_ };
+    out_data.data_size = { (double)width, (double)height };
+
+    return true;
+  }
+
+  // The bounding box spans from the lower left corner of the lowest non zero cell to the upper right corner of the highest
+  HeatmapCounterStats HeatmapPrivate::ToCounterStats(const std::string &counter_key, const CounterMapStats &map_stats) const
+  {
+    HeatmapCounterStats stats;
+    stats.counter_name = counter_key;
+    stats.allocated_bytes = map_stats.allocated_bytes;
+    stats.used_bytes = map_stats.used_bytes;
+    stats.shared_bytes = map_stats.shared_bytes;
+    stats.region_count = map_stats.region_count;
+    stats.sparse_region_count = map_stats.sparse_region_count;
+    stats.reallocation_count = map_stats.reallocation_count;
+    stats.copy_on_write_count = map_stats.copy_on_write_count;
+    stats.bytes_copied = map_stats.bytes_copied;
+    stats.nonzero_cell_count = map_stats.nonzero_cell_count;
+
+    if (map_stats.nonzero_cell_count == 0)
+    {
+      stats.nonzero_lower_left = { 0, 0 };
+      stats.nonzero_upper_right = { 0, 0 };
+    }
+    else
+    {
+      stats.nonzero_lower_left = { map_stats.lowest_nonzero_x * single_unit_width_, map_stats.lowest_nonzero_y * single_unit_height_ };
+      stats.nonzero_upper_right = { (map_stats.highest_nonzero_x + 1) * single_unit_width_, (map_stats.highest_nonzero_y + 1) * single_unit_height_ };
+    }
+    return stats;
+  }
+
+  HeatmapCounterSummary HeatmapPrivate::ToCounterSummary(const std::string &counter_key, const CounterMapSummary &map_summary)
+  {
+    HeatmapCounterSummary summary;
+    summary.counter_name = counter_key;
+    summary.total = map_summary.total;
+    summary.max_value = map_summary.max_value;
+    summary.nonzero_cell_count = map_summary.nonzero_cell_count;
+    std::copy(map_summary.histogram, map_summary.histogram + CounterMapSummary::kHistogramBuckets, summary.histogram);
+    return summary;
+  }
+
+  // Frees the contents of a successfully built HeatmapData
+  void HeatmapPrivate::DestroyHeatmapData(HeatmapData &data)
+  {
+    for (int x = 0; x < (int)data.data_size.width; x++)
+      delete[] data.heatmap_data[x];
+    delete[] data.heatmap_data;
+    delete data.counter_name;
+    data.heatmap_data = nullptr;
+    data.counter_name = nullptr;
+  }
+
+  bool HeatmapPrivate::CopyHeatmapData(const HeatmapData &data, HeatmapData &out_data)
+  {
+    int width = (int)data.data_size.width;
+    int height = (int)data.data_size.height;
+    HeatmapData copy = data;
+    copy.counter_name = nullptr;
+    copy.heatmap_data = new (std::nothrow) uint32_t*[width]();
+    if (!copy.heatmap_data)
+      return false;
+
+    for (int x = 0; x < width; x++)
+    {
+      copy.heatmap_data[x] = new (std::nothrow) uint32_t[height];
+      if (!copy.heatmap_data[x])
+      {
+        DestroyHeatmapData(copy);
+        return false;
+      }
+      std::copy(data.heatmap_data[x], data.heatmap_data[x] + height, copy.heatmap_data[x]);
+    }
+    copy.counter_name = new std::string(*data.counter_name);
 
+    out_data = copy;
     return true;
   }
 }
\ No newline at end of file
@@ -4,13 +4,24 @@
 ////////////////////////////////////////////////////////////////////////
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "HeatmapServiceTypes.h"
 #include "CounterMap.hpp"
+#include "CounterGroupMap.hpp"
+#include "QueryResultCache.h"
+#include "CellRegion.h"
+#include "CounterSectionIndex.h"
+#include "LazyCounterMaps.h"
 
 #include "LinearSearchMap.hpp"
-#include "SimpleHashmap.hpp"
+#include "FlatHashMap.hpp"
 
 namespace heatmap_service
 {
@@ -18,35 +29,52 @@ namespace heatmap_service
   {
   private:
 
-    // Hashfunction for usage of the SimpleHashmap
-   /** struct HashFunFunctor
-    {
-      int operator()(const std::string& s){
-        int prime = 7;
-        for (const char& c : s)
-          prime = prime >> (int)c;
-        return prime;
-      }
-    };
-    using Map = SimpleHashmap<std::string, CounterMap, HashFunFunctor>;
-    **/
+    // On a regular use of the Heatmap not too many different keys are used (maybe 10, 20 at most?), and performance tests showed linearly searching them
+    // to be faster than hashing, simply due to it's very low operational overhead. Per item counters can add thousands of keys though, so counters are kept
+    // in a FlatHashMap, which searches linearly while it holds few keys and switches to its hash index on its own once they grow past that.
+    // Counter groups are few, and stay in a LinearSearchMap
+    using Map = FlatHashMap<std::string, CounterMap>;
+    using GroupMap = LinearSearchMap<std::string, CounterGroupMap>;
 
-    // Using Linear Search map instead of the hashmap because, although the hashmap is more efficient for large amounts of different keys
-    // in this use case, on a regular use of the Heatmap, not too many different keys will be used (maybe 10, 20 at most?)
-    // As such, performance tests showed this simple map to be faster simply due to it's very low operational overhead
-    using Map = LinearSearchMap<std::string, CounterMap>;
+    // Area queries split into strips of at least this many cells, smaller areas are copied faster than they can be handed to other threads
+    static const int kMinCellsPerQueryStrip = 64 * 1024;
     
     // Spatial Resolution of heatmap
     double single_unit_width_;
     double single_unit_height_;
 
+    // Layout of every counter map of the heatmap
+    HeatmapStorageLayout storage_layout_;
+
     Map key_map_;
+    GroupMap group_map_;
+
+    // Counters of a heatmap loaded lazily, read from here until they're first written to, which copies them into key_map_. Counters in key_map_
+    // take precedence. Null unless the heatmap was loaded lazily, and shared with copies of the heatmap, since loaded maps never change
+    std::shared_ptr<LazyCounterMaps> lazy_maps_;
+
+    // Filled by const area queries, hence mutable. Thread safe on its own
+    mutable QueryResultCache query_cache_;
+
+    // Thread writing the last checkpoint, and whether it's still writing. Copies of the heatmap start without either
+    std::thread checkpoint_thread_;
+    std::atomic<bool> checkpoint_running_;
+
+    // The parts of a serialized heatmap, in the order they're written, see SerializeHeatmap
+    struct SerializedHeatmap
+    {
+      std::string header;
+      std::string table;
+      std::string sections;
+      std::string groups;
+    };
 
   public:
     // Spatial resolution initialization
     HeatmapPrivate();
     explicit HeatmapPrivate(double smallest_spatial_unit_size);
     HeatmapPrivate(double smallest_spatial_unit_width, double smallest_spatial_unit_height);
+    HeatmapPrivate(double smallest_spatial_unit_width, double smallest_spatial_unit_height, HeatmapStorageLayout storage_layout);
     HeatmapPrivate(const HeatmapPrivate& copy);
     HeatmapPrivate& operator=(const HeatmapPrivate& copy);
     ~HeatmapPrivate();
@@ -55,6 +83,8 @@ namespace heatmap_service
     double single_unit_height() const;
     double single_unit_width() const;
 
+    HeatmapStorageLayout storage_layout() const;
+
     // -- Queries if a certain counter has ever been added to the heatmap
     bool hasMapForCounter(const std::string &counter_key) const;
 
@@ -65,23 +95,172 @@ namespace heatmap_service
 
     bool IncrementMultipleMapCountersByAmount(HeatmapCoordinate coords, const std::string counter_keys[], int amounts[], int counter_keys_length);
 
+    // Cell coordinates are already adjusted to the spatial resolution
+    bool IncrementCellCounterByAmount(int cell_x, int cell_y, const std::string &counter_key, int add_amount);
+
+    bool BuildDiskSplatKernel(double radius, int amount, HeatmapSplatKernel &out_kernel) const;
+    bool BuildGaussianSplatKernel(double standard_deviation, int peak_amount, HeatmapSplatKernel &out_kernel) const;
+    bool SplatMapCounter(HeatmapCoordinate coords, const HeatmapSplatKernel &kernel, const std::string &counter_key);
+
+    bool IncrementTrajectory(const HeatmapCoordinate points[], int point_count, const std::string &counter_key, HeatmapRevisitPolicy revisit_policy);
+    bool IncrementTrajectories(const HeatmapTrajectory trajectories[], int trajectory_count, const std::string &counter_key, HeatmapRevisitPolicy revisit_policy);
+
     // -- Heatmap query methods
     unsigned int getCounterAtPosition(HeatmapCoordinate coords, const std::string &counter_key) const;
 
+    unsigned int getCounterAtCell(int cell_x, int cell_y, const std::string &counter_key) const;
+
     bool getCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key, HeatmapData &out_data) const;
 
     bool getAllCounterData(const std::string &counter_key, HeatmapData &out_data) const;
 
+    bool getMultipleCountersDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string counter_keys[],
+                                           int counter_keys_length, HeatmapData out_data[]) const;
+
+    bool getSmoothedCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key,
+                                          double kernel_radius, HeatmapSmoothingKernel kernel, HeatmapFloatData &out_data) const;
+
+    bool getSparseCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key, HeatmapSparseData &out_data) const;
+    bool getAllSparseCounterData(const std::string &counter_key, HeatmapSparseData &out_data) const;
+
+    bool getCounterSumInsideRegion(const HeatmapRegion &region, const std::string &counter_key, unsigned long long &out_sum) const;
+    bool getCounterSummaryInsideRegion(const HeatmapRegion &region, const std::string &counter_key, HeatmapCounterSummary &out_summary) const;
+    bool getSparseCounterDataInsideRegion(const HeatmapRegion &region, const std::string &counter_key, HeatmapSparseData &out_data) const;
+
+    bool getExpressionDataInsideRect(const std::string &expression, HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, HeatmapFloatData &out_data) const;
+
+    // -- Query result cache
+    void SetQueryCacheCapacity(int entry_count);
+    int query_cache_capacity() const;
+
+    bool getSharedCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key, HeatmapSharedData &out_data) const;
+
+    // -- Counter groups
+    bool CreateCounterGroup(const std::string &group_key, const std::string counter_keys[], int counter_keys_length);
+    bool hasCounterGroup(const std::string &group_key) const;
+    bool getCounterGroupKeys(const std::string &group_key, std::vector<std::string> &out_counter_keys) const;
+
+    bool IncrementCounterGroupByAmounts(HeatmapCoordinate coords, const std::string &group_key, const int amounts[]);
+
+    unsigned int getCounterGroupValueAtPosition(HeatmapCoordinate coords, const std::string &group_key, const std::string &counter_key) const;
+
+    bool getCounterGroupDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &group_key, HeatmapData out_data[]) const;
+
+    // -- Heatmap rendering
+    bool RenderCounterToImage(const std::string &counter_key, const std::string &file_path, const HeatmapRenderOptions &options) const;
+
+    bool RenderCounterToTilePyramid(const std::string &counter_key, const std::string &directory, const HeatmapRenderOptions &options) const;
+
+    // -- Heatmap statistics
+    HeatmapStats GetStats() const;
+    bool GetCounterStats(const std::string &counter_key, HeatmapCounterStats &out_stats) const;
+    bool getCounterSummary(const std::string &counter_key, HeatmapCounterSummary &out_summary) const;
+
     // -- Heatmap serialization
     bool SerializeHeatmap(char* &out_buffer, int &out_length) const;
     bool DeserializeHeatmap(const char* &in_buffer, int in_length);
 
+    // -- Checkpointing
+    std::future<bool> CheckpointTo(const std::string &file_path, std::function<void(bool)> on_complete);
+
+    // -- Lazy loading
+    bool LoadHeatmapLazily(const char* in_buffer, int in_length);
+    bool LoadHeatmapFileLazily(const std::string &file_path);
+
+    // -- Rebinning
+    bool Rebin(double new_unit_width, double new_unit_height);
+
+    // -- Merging and bulk ingestion
+    bool MergeHeatmap(const HeatmapPrivate& other);
+
+    bool IngestEventFile(const std::string &file_path, HeatmapEventFormat format, HeatmapIngestResult &out_result);
+    bool IngestEventBuffer(const char* buffer, size_t length, HeatmapEventFormat format, HeatmapIngestResult &out_result);
+
   private:
     // -- Private Utility Functions
     // Adjust regular world space coordinates to the inner spatial resolution
     HeatmapCoordinate AdjustCoordsToSpatialResolution(HeatmapCoordinate coords) const;
 
-    // Inner implementation of get counter inside rect. Receives already adjusted coordinates, called by public methods
+    // How many units of unit_size fit in new_unit_size. Returns false if new_unit_size isn't a whole multiple of unit_size
+    static bool RebinFactor(double unit_size, double new_unit_size, int &out_factor);
+
+    // Inner implementation of get counter inside rect. Receives already adjusted coordinates, called by public methods.
+    // Answers from the query result cache when it's enabled, and stores what it reads in it
     bool getCounterDataInsideAdjustedRect(HeatmapCoordinate adjusted_lower_left, HeatmapCoordinate adjusted_upper_right, const std::string &counter_key, HeatmapData &out_data) const;
+
+    // Inner implementation of the sparse queries, receives the area in cell coordinates. Only the part of the area inside the map limits is read,
+    // the counters outside of it are all 0
+    bool getSparseCounterDataInsideAdjustedRect(double lowest_x, double lowest_y, double highest_x, double highest_y, const std::string &counter_key,
+                                                HeatmapSparseData &out_data) const;
+
+    // Most cells a splat kernel can hold, 64MB of weights
+    static const int kMaxSplatKernelCells = 16 * 1024 * 1024;
+
+    // The map of counter_key, created if it doesn't exist yet. Maps are created with the column layout, and moved to the heatmap's while still empty
+    CounterMap& MapForWriting(const std::string &counter_key);
+
+    // Runs write, which writes to map_for_counter and returns false if it couldn't allocate. With an event hook installed, growth is noticed through
+    // the allocation activity of the map changing and reported at the cell { growth_cell_x, growth_cell_y }, and failures are reported as well
+    template<typename Write>
+    bool WriteToMap(const std::string &counter_key, CounterMap &map_for_counter, int growth_cell_x, int growth_cell_y, Write write);
+
+    // Builds a kernel reaching reach world units around its center, weighting each cell by the distance from its center to the center of the kernel
+    template<typename Weight>
+    bool BuildSplatKernel(double reach, Weight weight, HeatmapSplatKernel &out_kernel) const;
+
+    // Encodes every counter and counter group into out_parts. Returns false if lazily loaded counters can't be loaded.
+    // Throws std::bad_alloc if the parts can't be allocated
+    bool EncodeHeatmap(SerializedHeatmap &out_parts) const;
+
+    // Encodes the heatmap and writes it to file_path, on the thread calling it. Returns false, writing the reason to cout, if it can't
+    bool WriteCheckpoint(const std::string &file_path) const;
+
+    // Loads a buffer written by SerializeHeatmap, which starts with CounterSectionIndex::kMagic. Returns false, writing the reason to cout
+    // and leaving the heatmap as it was, if the buffer is malformed or the counters can't be allocated
+    bool DeserializeSections(const char* buffer, size_t length);
+
+    // Replaces the contents of the heatmap with the counters of lazy_maps, reading its counter groups.
+    // Returns false, leaving the heatmap as it was, if the counter groups are malformed
+    bool UseLazyMaps(const std::shared_ptr<LazyCounterMaps> &lazy_maps);
+    // Reads the boost archive of counter groups that follows the sections. Returns false if it's malformed, or claims more than can be allocated
+    static bool ReadCounterGroups(const CounterSectionIndex &index, GroupMap &out_groups);
+
+    // The map of counter_key, which must exist, loading it first if it's a lazily loaded counter that wasn't read yet.
+    // Lazily loaded counters that can't be loaded read as empty
+    const CounterMap& MapForReading(const std::string &counter_key) const;
+
+    // Calls visit(counter_key, map) for every counter map, loading every lazily loaded one first. Returns false if any of them can't be loaded
+    template<typename Visitor>
+    bool for_each_map(Visitor visit) const;
+
+    // Whether every point of the trajectory is finite and falls on a cell inside the range of cell coordinates
+    bool IsValidTrajectory(const HeatmapCoordinate points[], int point_count) const;
+
+    // Sets the lower left coordinate and data size of sparse data to the tight bounds of its cells, already ordered by x
+    void SetSparseDataBounds(int lowest_cell_y, int highest_cell_y, HeatmapSparseData &out_data) const;
+
+    // Rasterizes region against the cells inside the limits of the counter map, the only ones that can hold counters. Out_whole_map tells if every cell
+    // inside the limits belongs to the region, in which case out_cells may be left empty, as the whole map is read instead.
+    // Returns false if the counter doesn't exist, or if region isn't valid or can't be allocated
+    bool RasterizeRegion(const HeatmapRegion &region, const std::string &counter_key, CellRegion &out_cells, bool &out_whole_map) const;
+
+    // Reads the area from the counter map, without the cache
+    bool ReadCounterDataInsideAdjustedRect(HeatmapCoordinate adjusted_lower_left, HeatmapCoordinate adjusted_upper_right, const std::string &counter_key, HeatmapData &out_data) const;
+
+    // Same as getCounterDataInsideAdjustedRect, returning the cached result itself
+    bool getSharedCounterDataInsideAdjustedRect(HeatmapCoordinate adjusted_lower_left, HeatmapCoordinate adjusted_upper_right, const std::string &counter_key,
+                                                HeatmapSharedData &out_data) const;
+
+    // Translates the stats of a counter map into the public stats, moving its bounds to world coordinates
+    HeatmapCounterStats ToCounterStats(const std::string &counter_key, const CounterMapStats &map_stats) const;
+
+    // Translates the summary of a counter map, or of part of it, into the public summary
+    static HeatmapCounterSummary ToCounterSummary(const std::string &counter_key, const CounterMapSummary &map_summary);
+
+    // Frees the contents of a HeatmapData returned by the area queries
+    static void DestroyHeatmapData(HeatmapData &data);
+
+    // Copies a HeatmapData into newly allocated memory. Returns false if it can't be allocated, leaving out_data untouched
+    static bool CopyHeatmapData(const HeatmapData &data, HeatmapData &out_data);
   };
 }
\ No newline at end of file
@@ -0,0 +1,451 @@
+////////////////////////////////////////////////////////////////////////
+// HeatmapRendering.cpp: Implementation of the heatmap image and tile renderers
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "HeatmapRendering.h"
+#include "ImageEncoding.h"
+#include "ParallelFor.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <new>
+#include <sstream>
+
+namespace heatmap_service
+{
+  namespace
+  {
+    const int kBytesPerPixel = 4;
+
+    // Minimum amount of rows, or columns, handed to each thread
+    const int kMinLinesPerThread = 64;
+
+    // Values are colored a few rows at a time, so reading the columns, which run along y, touches whole cache lines
+    const int kRowsPerColorBlock = 16;
+
+    // Quantile scales are built from a sample of at most this many cells
+    const size_t kMaxQuantileSamples = 1 << 20;
+
+    // -- Color maps
+    // 256 RGBA colors, from the lowest value to the highest. Color 0 is reserved for cells with a counter of 0, which are left transparent
+    struct ColorMap
+    {
+      unsigned char rgba[256][kBytesPerPixel];
+
+      explicit ColorMap(HeatmapColorMap color_map)
+      {
+        // Each color map is a gradient between a few evenly spaced control colors
+        static const unsigned char kGrayscale[2][3] = { { 0, 0, 0 }, { 255, 255, 255 } };
+        static const unsigned char kHeat[4][3] = { { 0, 0, 0 }, { 255, 0, 0 }, { 255, 255, 0 }, { 255, 255, 255 } };
+        static const unsigned char kViridis[5][3] = { { 68, 1, 84 }, { 59, 82, 139 }, { 33, 145, 140 }, { 94, 201, 98 }, { 253, 231, 37 } };
+
+        const unsigned char (*controls)[3] = kHeat;
+        int control_count = 4;
+        if (color_map == kGrayscaleColorMap) { controls = kGrayscale; control_count = 2; }
+        else if (color_map == kViridisColorMap) { controls = kViridis; control_count = 5; }
+
+        for (int i = 0; i < 256; i++)
+        {
+          double position = i / 255.0 * (control_count - 1);
+          int control = std::min((int)position, control_count - 2);
+          double blend = position - control;
+          for (int channel = 0; channel < 3; channel++)
+            rgba[i][channel] = (unsigned char)(controls[control][channel] * (1 - blend) + controls[control + 1][channel] * blend + 0.5);
+          rgba[i][3] = 255;
+        }
+        rgba[0][0] = rgba[0][1] = rgba[0][2] = rgba[0][3] = 0;
+      }
+    };
+
+    // -- Value scaling
+    // Maps counter values to color map indexes. thresholds[i] is the lowest value drawn with color i + 1,
+    // so every scaling is applied the same way, with a binary search, no matter how expensive its formula is
+    struct ValueScale
+    {
+      uint32_t thresholds[255];
+
+      int ColorIndex(uint32_t value) const
+      {
+        if (value == 0)
+          return 0;
+        int index = (int)(std::upper_bound(thresholds, thresholds + 255, value) - thresholds);
+        return index > 0 ? index : 1;
+      }
+    };
+
+    // Gathers what the scalings need to know about the values being rendered: their maximum, and for quantiles, a sample of the non zero values.
+    // Can be fed from several threads at once
+    class ValueScaleBuilder
+    {
+    private:
+      HeatmapValueScaling scaling_;
+      size_t sample_stride_;
+      std::atomic<uint32_t> max_value_;
+
+      std::mutex samples_mutex_;
+      uint32_t* samples_;
+      size_t sample_count_;
+      size_t sample_capacity_;
+
+    public:
+      // cell_count is the amount of cells that will be added, used to pick how many of them are sampled
+      ValueScaleBuilder(HeatmapValueScaling scaling, size_t cell_count) : scaling_(scaling), sample_stride_(1), max_value_(0),
+        samples_(nullptr), sample_count_(0), sample_capacity_(0)
+      {
+        if (scaling_ == kQuantileScaling)
+        {
+          sample_stride_ = cell_count / kMaxQuantileSamples + 1;
+          // Every chunk of values may round its share of samples up by one
+          sample_capacity_ = cell_count / sample_stride_ + 1 + kMaxQuantileSamples / 64;
+          samples_ = new uint32_t[sample_capacity_];
+        }
+      }
+      ~ValueScaleBuilder() { delete[] samples_; }
+
+      void Add(const uint32_t* values, size_t count)
+      {
+        uint32_t local_max = 0;
+        for (size_t i = 0; i < count; i++)
+          local_max = std::max(local_max, values[i]);
+
+        uint32_t current_max = max_value_.load();
+        while (local_max > current_max && !max_value_.compare_exchange_weak(current_max, local_max)) {}
+
+        if (scaling_ == kQuantileScaling)
+        {
+          std::lock_guard<std::mutex> lock(samples_mutex_);
+          for (size_t i = 0; i < count && sample_count_ < sample_capacity_; i += sample_stride_)
+          {
+            if (values[i] > 0)
+              samples_[sample_count_++] = values[i];
+          }
+        }
+      }
+
+      ValueScale Build()
+      {
+        ValueScale scale;
+        double max_value = (double)max_value_.load();
+
+        if (scaling_ == kQuantileScaling && sample_count_ > 0)
+        {
+          std::sort(samples_, samples_ + sample_count_);
+          for (int i = 0; i < 255; i++)
+            scale.thresholds[i] = samples_[(size_t)(i + 1) * sample_count_ / 256];
+        }
+        else
+        {
+          for (int i = 0; i < 255; i++)
+          {
+            // Lowest value whose position in the scale, from 0 to 1, reaches (i + 1)/255
+            double position = (i + 1) / 255.0;
+            double threshold = scaling_ == kLogarithmicScaling ? exp(position * log(1 + max_value)) - 1 : position * max_value;
+            scale.thresholds[i] = (uint32_t)std::min(ceil(threshold - 1e-9), 4294967295.0);
+          }
+        }
+
+        return scale;
+      }
+    };
+
+    // Colors rows [row_begin, row_end[ of an area stored in columns into RGBA pixels. Row 0 is the top of the image, the highest y of the columns
+    void ColorizeColumns(const uint32_t* const* columns, int width, int height, const ValueScale& scale, const ColorMap& color_map,
+                         unsigned char* rgba_pixels, int row_begin, int row_end)
+    {
+      for (int block_begin = row_begin; block_begin < row_end; block_begin += kRowsPerColorBlock)
+      {
+        int block_end = std::min(block_begin + kRowsPerColorBlock, row_end);
+        for (int x = 0; x < width; x++)
+        {
+          const uint32_t* column = columns[x];
+          for (int row = block_begin; row < block_end; row++)
+          {
+            const unsigned char* color = color_map.rgba[scale.ColorIndex(column[height - 1 - row])];
+            unsigned char* pixel = rgba_pixels + ((size_t)row * width + x) * kBytesPerPixel;
+            pixel[0] = color[0];
+            pixel[1] = color[1];
+            pixel[2] = color[2];
+            pixel[3] = color[3];
+          }
+        }
+      }
+    }
+
+    bool WriteImage(const std::string &file_path, const unsigned char* rgba_pixels, int width, int height, HeatmapImageFormat format, bool split_across_threads)
+    {
+      if (format == kPpmImageFormat)
+        return WritePpmImage(file_path, rgba_pixels, width, height);
+      return WritePngImage(file_path, rgba_pixels, width, height, split_across_threads);
+    }
+
+    // -- Tile pyramid
+    class TilePyramidBuilder
+    {
+    private:
+      const CounterMap& map_;
+      const HeatmapRenderOptions& options_;
+      const std::string& directory_;
+      const ValueScale& scale_;
+      ColorMap color_map_;
+
+      int tile_size_;
+      int deepest_zoom_;
+      // Cell at the top left corner of the pyramid
+      int left_coord_x_;
+      int top_coord_y_;
+
+      std::atomic<bool> failed_;
+
+    public:
+      TilePyramidBuilder(const CounterMap& map, const HeatmapRenderOptions& options, const std::string& directory, const ValueScale& scale) :
+        map_(map), options_(options), directory_(directory), scale_(scale), color_map_(options.color_map), tile_size_(options.tile_size), deepest_zoom_(0),
+        left_coord_x_(map.lowest_coord_x()), top_coord_y_(map.highest_coord_y()), failed_(false)
+      {
+        int side = std::max(map.highest_coord_x() - map.lowest_coord_x() + 1, map.highest_coord_y() - map.lowest_coord_y() + 1);
+        while (((long long)tile_size_ << deepest_zoom_) < side)
+          deepest_zoom_++;
+      }
+
+      bool failed() const { return failed_; }
+
+      bool Build()
+      {
+        if (!MakeDirectory(directory_))
+          return false;
+
+        // Subtrees are split across threads from the first level that has a few of them for each thread
+        int threads = WorkerPool::Instance().concurrency();
+        int split_zoom = 0;
+        while (split_zoom < deepest_zoom_ && (1LL << (2 * split_zoom)) < 4LL * threads)
+          split_zoom++;
+
+        int tiles_per_side = 1 << split_zoom;
+        uint32_t** split_tiles = new uint32_t*[tiles_per_side * tiles_per_side]();
+        // Tasks of ParallelFor must not throw, so anything left allocating with new fails the pyramid instead
+        ParallelFor(0, tiles_per_side * tiles_per_side, 1, [&](int tile_begin, int tile_end) {
+          try {
+            for (int tile = tile_begin; tile < tile_end; tile++)
+              split_tiles[tile] = BuildTile(split_zoom, tile % tiles_per_side, tile / tiles_per_side, nullptr);
+          }
+          catch (const std::bad_alloc&) {
+            failed_ = true;
+          }
+        });
+
+        // The levels above are built from the subtrees already done
+        uint32_t* root = BuildTile(0, 0, 0, split_tiles, split_zoom);
+        delete[] root;
+        delete[] split_tiles;
+
+        return !failed_;
+      }
+
+    private:
+      // Returns the values of a tile, tile_size columns of tile_size values from the bottom up, or nullptr if the tile has no counters.
+      // Tiles at built_zoom are taken from built_tiles instead of being built
+      uint32_t* BuildTile(int zoom, int tile_x, int tile_y, uint32_t** built_tiles, int built_zoom = -1)
+      {
+        if (zoom == built_zoom)
+        {
+          uint32_t* built = built_tiles[tile_y * (1 << zoom) + tile_x];
+          built_tiles[tile_y * (1 << zoom) + tile_x] = nullptr;
+          return built;
+        }
+
+        // Cells covered by the tile
+        long long cells_per_pixel = 1LL << (deepest_zoom_ - zoom);
+        long long lowest_x = left_coord_x_ + tile_x * tile_size_ * cells_per_pixel;
+        long long highest_y = top_coord_y_ - tile_y * tile_size_ * cells_per_pixel;
+        long long lowest_y = highest_y - tile_size_ * cells_per_pixel + 1;
+        if (lowest_x > map_.highest_coord_x() || highest_y < map_.lowest_coord_y() || lowest_y > map_.highest_coord_y())
+          return nullptr;
+
+        uint32_t* values = new (std::nothrow) uint32_t[(size_t)tile_size_ * tile_size_]();
+        if (!values)
+        {
+          failed_ = true;
+          return nullptr;
+        }
+
+        bool has_counters = false;
+        if (zoom == deepest_zoom_)
+        {
+          for (int x = 0; x < tile_size_; x++)
+            map_.getColumnValues((int)lowest_x + x, (int)lowest_y, tile_size_, values + (size_t)x * tile_size_);
+          for (size_t i = 0; i < (size_t)tile_size_ * tile_size_ && !has_counters; i++)
+            has_counters = values[i] > 0;
+        }
+        else
+        {
+          // Each child covers a quarter of the tile. Child y grows downwards, so the children at 2*tile_y cover the upper half
+          int half = tile_size_ / 2;
+          for (int child = 0; child < 4; child++)
+          {
+            int child_x = child % 2;
+            int child_y = child / 2;
+            uint32_t* child_values = BuildTile(zoom + 1, tile_x * 2 + child_x, tile_y * 2 + child_y, built_tiles, built_zoom);
+            if (!child_values)
+              continue;
+
+            has_counters = true;
+            int offset_x = child_x * half;
+            int offset_y = child_y == 0 ? half : 0;
+            for (int x = 0; x < half; x++)
+            {
+              const uint32_t* left = child_values + (size_t)(2 * x) * tile_size_;
+              const uint32_t* right = left + tile_size_;
+              uint32_t* out = values + (size_t)(offset_x + x) * tile_size_ + offset_y;
+              for (int y = 0; y < half; y++)
+                out[y] = std::max(std::max(left[2 * y], left[2 * y + 1]), std::max(right[2 * y], right[2 * y + 1]));
+            }
+            delete[] child_values;
+          }
+        }
+
+        if (!has_counters)
+        {
+          delete[] values;
+          return nullptr;
+        }
+
+        WriteTile(zoom, tile_x, tile_y, values);
+        return values;
+      }
+
+      void WriteTile(int zoom, int tile_x, int tile_y, const uint32_t* values)
+      {
+        const uint32_t** columns = new (std::nothrow) const uint32_t*[tile_size_];
+        unsigned char* rgba_pixels = new (std::nothrow) unsigned char[(size_t)tile_size_ * tile_size_ * kBytesPerPixel];
+        if (!columns || !rgba_pixels)
+        {
+          delete[] rgba_pixels;
+          delete[] columns;
+          failed_ = true;
+          return;
+        }
+        for (int x = 0; x < tile_size_; x++)
+          columns[x] = values + (size_t)x * tile_size_;
+        ColorizeColumns(columns, tile_size_, tile_size_, scale_, color_map_, rgba_pixels, 0, tile_size_);
+
+        // Tiles are written from tasks of ParallelFor, so the paths, which allocate, fail the pyramid instead of throwing
+        try {
+          std::ostringstream zoom_path, column_path, tile_path;
+          zoom_path << directory_ << "/" << zoom;
+          column_path << zoom_path.str() << "/" << tile_x;
+          tile_path << column_path.str() << "/" << tile_y << (options_.format == kPpmImageFormat ? ".ppm" : ".png");
+
+          // Tiles are written from several threads, it's fine if another one created the directories first
+          if (!MakeDirectory(zoom_path.str()) || !MakeDirectory(column_path.str()) ||
+              !WriteImage(tile_path.str(), rgba_pixels, tile_size_, tile_size_, options_.format, false))
+            failed_ = true;
+        }
+        catch (const std::bad_alloc&) {
+          failed_ = true;
+        }
+
+        delete[] rgba_pixels;
+        delete[] columns;
+      }
+    };
+  }
+
+  bool RenderValueColumns(const uint32_t* const* columns, int width, int height, const HeatmapRenderOptions &options, const std::string &file_path)
+  {
+    if (width <= 0 || height <= 0)
+      return false;
+
+    unsigned char* rgba_pixels = nullptr;
+    try {
+      ValueScaleBuilder scale_builder(options.scaling, (size_t)width * height);
+      ParallelFor(0, width, kMinLinesPerThread, [&](int column_begin, int column_end) {
+        for (int x = column_begin; x < column_end; x++)
+          scale_builder.Add(columns[x], height);
+      });
+      ValueScale scale = scale_builder.Build();
+      ColorMap color_map(options.color_map);
+
+      rgba_pixels = new unsigned char[(size_t)width * height * kBytesPerPixel];
+      ParallelFor(0, height, kMinLinesPerThread, [&](int row_begin, int row_end) {
+        ColorizeColumns(columns, width, height, scale, color_map, rgba_pixels, row_begin, row_end);
+      });
+    }
+    catch (const std::bad_alloc&) {
+      delete[] rgba_pixels;
+      return false;
+    }
+
+    bool written = WriteImage(file_path, rgba_pixels, width, height, options.format, true);
+    delete[] rgba_pixels;
+    return written;
+  }
+
+  bool RenderCounterMapImage(const CounterMap& map, const HeatmapRenderOptions &options, const std::string &file_path)
+  {
+    int width = map.highest_coord_x() - map.lowest_coord_x() + 1;
+    int height = map.highest_coord_y() - map.lowest_coord_y() + 1;
+
+    uint32_t* values = new (std::nothrow) uint32_t[(size_t)width * height];
+    const uint32_t** columns = new (std::nothrow) const uint32_t*[width];
+    if (!values || !columns)
+    {
+      delete[] values;
+      delete[] columns;
+      return false;
+    }
+
+    ParallelFor(0, width, kMinLinesPerThread, [&](int column_begin, int column_end) {
+      for (int x = column_begin; x < column_end; x++)
+      {
+        map.getColumnValues(map.lowest_coord_x() + x, map.lowest_coord_y(), height, values + (size_t)x * height);
+        columns[x] = values + (size_t)x * height;
+      }
+    });
+
+    bool rendered = RenderValueColumns(columns, width, height, options, file_path);
+    delete[] columns;
+    delete[] values;
+    return rendered;
+  }
+
+  bool RenderCounterMapTilePyramid(const CounterMap& map, const HeatmapRenderOptions &options, const std::string &directory)
+  {
+    // Each zoom level halves the tile resolution, which needs an even tile size
+    if (options.tile_size < 2 || options.tile_size % 2 != 0)
+      return false;
+
+    int width = map.highest_coord_x() - map.lowest_coord_x() + 1;
+    int height = map.highest_coord_y() - map.lowest_coord_y() + 1;
+
+    try {
+      // Every zoom level keeps the highest counter of the cells under each pixel, so all of them share the scale of the map's cells
+      ValueScaleBuilder scale_builder(options.scaling, (size_t)width * height);
+      std::atomic<bool> out_of_memory(false);
+      ParallelFor(0, width, kMinLinesPerThread, [&](int column_begin, int column_end) {
+        uint32_t* column = new (std::nothrow) uint32_t[height];
+        if (!column)
+        {
+          out_of_memory = true;
+          return;
+        }
+        for (int x = column_begin; x < column_end; x++)
+        {
+          map.getColumnValues(map.lowest_coord_x() + x, map.lowest_coord_y(), height, column);
+          scale_builder.Add(column, height);
+        }
+        delete[] column;
+      });
+      if (out_of_memory)
+        return false;
+      ValueScale scale = scale_builder.Build();
+
+      TilePyramidBuilder builder(map, options, directory, scale);
+      return builder.Build();
+    }
+    catch (const std::bad_alloc&) {
+      return false;
+    }
+  }
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+////////////////////////////////////////////////////////////////////////
+// HeatmapRendering.h: Rendering of counter values into images and tile pyramids
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+#include "HeatmapServiceTypes.h"
+#include "CounterMap.hpp"
+
+namespace heatmap_service
+{
+  // Renders width*height values, stored in columns from the lowest y up (the layout of HeatmapData), to an image file.
+  // Each value becomes one pixel, with the highest row at the top of the image
+  bool RenderValueColumns(const uint32_t* const* columns, int width, int height, const HeatmapRenderOptions &options, const std::string &file_path);
+
+  // Renders the whole registered area of a counter map to an image file, one pixel per unit of space
+  bool RenderCounterMapImage(const CounterMap& map, const HeatmapRenderOptions &options, const std::string &file_path);
+
+  // Renders a counter map as a z/x/y tile pyramid, writing each tile to directory/z/x/y.
+  // At the deepest zoom level each pixel is one unit of space, every level above halves the resolution, keeping the highest counter of each 2x2 block,
+  // until zoom level 0 covers the whole map in a single tile. Tile y grows downwards, as web map viewers expect, and tiles without any counter are not written.
+  // The pyramid is built depth first, from subtrees split across threads, so only a few tiles per level are kept in memory at a time
+  bool RenderCounterMapTilePyramid(const CounterMap& map, const HeatmapRenderOptions &options, const std::string &directory);
+}
\ No newline at end of file
@@ -0,0 +1,333 @@
+////////////////////////////////////////////////////////////////////////
+// HeatmapSmoothing.cpp: Implementation of the separable kernel smoothing
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "HeatmapSmoothing.h"
+#include "ParallelFor.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <new>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define HEATMAP_SMOOTHING_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace heatmap_service
+{
+  namespace
+  {
+    // Minimum amount of columns, or rows, handed to each thread. Below this spawning threads costs more than it saves
+    const int kMinLinesPerThread = 64;
+
+    // The horizontal pass walks the whole width of the area for a band of this many rows at a time,
+    // keeping the columns it slides over, and its intermediate results, small enough to stay in cache
+    const int kRowsPerBand = 64;
+
+    // -- Vectorized primitives
+    // Both smoothing passes are arranged so that their inner loops run over contiguous floats,
+    // allowing them to process four cells per instruction with SSE, with a scalar loop for the remainder
+
+    // out[i] += in[i] * weight
+    void AccumulateScaled(float* out, const float* in, float weight, int count)
+    {
+      int i = 0;
+#ifdef HEATMAP_SMOOTHING_SSE
+      __m128 weight_4 = _mm_set1_ps(weight);
+      for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), weight_4)));
+#endif
+      for (; i < count; i++)
+        out[i] += in[i] * weight;
+    }
+
+    // running_sum[i] += entering[i] - leaving[i]
+    void SlideWindow(float* running_sum, const float* entering, const float* leaving, int count)
+    {
+      int i = 0;
+#ifdef HEATMAP_SMOOTHING_SSE
+      for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(running_sum + i, _mm_add_ps(_mm_loadu_ps(running_sum + i), _mm_sub_ps(_mm_loadu_ps(entering + i), _mm_loadu_ps(leaving + i))));
+#endif
+      for (; i < count; i++)
+        running_sum[i] += entering[i] - leaving[i];
+    }
+
+    // out[i] = max(in[i] * scale, 0). Clamping hides the rounding residue sliding windows leave behind in empty areas
+    void StoreScaled(float* out, const float* in, float scale, int count)
+    {
+      int i = 0;
+#ifdef HEATMAP_SMOOTHING_SSE
+      __m128 scale_4 = _mm_set1_ps(scale);
+      __m128 zero_4 = _mm_setzero_ps();
+      for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(out + i, _mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale_4), zero_4));
+#endif
+      for (; i < count; i++)
+        out[i] = std::max(in[i] * scale, 0.f);
+    }
+
+    // -- Kernels
+    // Normalized weights of a gaussian with 2*radius+1 taps. The gaussian is truncated at 3 standard deviations
+    float* CreateGaussianWeights(int radius)
+    {
+      float* weights = new float[2 * radius + 1];
+      double sigma = radius / 3.0;
+      double total = 0;
+      for (int k = -radius; k <= radius; k++)
+      {
+        weights[k + radius] = (float)exp(-(k * k) / (2 * sigma * sigma));
+        total += weights[k + radius];
+      }
+      for (int k = 0; k <= 2 * radius; k++)
+        weights[k] = (float)(weights[k] / total);
+
+      return weights;
+    }
+
+    // Radius of each of the three successive box blurs that approximate a gaussian of the given radius.
+    // Three boxes of width w have a variance of 3*(w*w - 1)/12, which is matched against the variance of the gaussian, (radius/3)^2
+    int BoxRadiusForGaussianRadius(int radius)
+    {
+      double sigma = radius / 3.0;
+      double box_width = sqrt(4 * sigma * sigma + 1);
+      return (int)floor((box_width - 1) / 2 + 0.5);
+    }
+
+    // -- Vertical passes, run on a single column of in_height = out_height + 2*reach values
+
+    // out[y] = sum of weights[k] * in[y + k]
+    // Each group of four outputs accumulates all taps in a register, so every output is stored only once
+    void GaussianColumnPass(const float* in, float* out, int out_height, const float* weights, int radius)
+    {
+      int y = 0;
+#ifdef HEATMAP_SMOOTHING_SSE
+      for (; y + 4 <= out_height; y += 4)
+      {
+        __m128 sum_4 = _mm_setzero_ps();
+        for (int k = 0; k <= 2 * radius; k++)
+          sum_4 = _mm_add_ps(sum_4, _mm_mul_ps(_mm_loadu_ps(in + y + k), _mm_set1_ps(weights[k])));
+        _mm_storeu_ps(out + y, sum_4);
+      }
+#endif
+      for (; y < out_height; y++)
+      {
+        float sum = 0;
+        for (int k = 0; k <= 2 * radius; k++)
+          sum += in[y + k] * weights[k];
+        out[y] = sum;
+      }
+    }
+
+    // Three box passes, each one shrinking the column by 2*box_radius: in -> scratch -> in -> out.
+    // Running sums along a column can't be vectorized, but they're kept in a double so they don't drift over long columns
+    void BoxColumnPasses(float* in, float* scratch, float* out, int out_height, int box_radius)
+    {
+      int window = 2 * box_radius + 1;
+      float inverse_window = 1.f / window;
+      float* sources[3] = { in, scratch, in };
+      float* destinations[3] = { scratch, in, out };
+
+      int destination_height = out_height + 4 * box_radius;
+      for (int pass = 0; pass < 3; pass++, destination_height -= 2 * box_radius)
+      {
+        const float* source = sources[pass];
+        float* destination = destinations[pass];
+
+        double running_sum = 0;
+        for (int y = 0; y < window; y++)
+          running_sum += source[y];
+        destination[0] = (float)(running_sum * inverse_window);
+        for (int y = 1; y < destination_height; y++)
+        {
+          // Only one addition per value depends on the previous one, which keeps the dependency chain short
+          running_sum += (double)source[y + window - 1] - source[y - 1];
+          destination[y] = std::max((float)(running_sum * inverse_window), 0.f);
+        }
+      }
+    }
+
+    // -- Horizontal passes, run over a band of rows. Each column pointer already points to the first row of the band
+
+    // out_columns[x][y] = sum of weights[k] * columns[x + k][y]
+    void GaussianRowPass(float* const* columns, float** out_columns, int out_width, int rows, const float* weights, int radius)
+    {
+      for (int x = 0; x < out_width; x++)
+      {
+        float* const* taps = columns + x;
+        float* out = out_columns[x];
+        int y = 0;
+#ifdef HEATMAP_SMOOTHING_SSE
+        for (; y + 4 <= rows; y += 4)
+        {
+          __m128 sum_4 = _mm_setzero_ps();
+          for (int k = 0; k <= 2 * radius; k++)
+            sum_4 = _mm_add_ps(sum_4, _mm_mul_ps(_mm_loadu_ps(taps[k] + y), _mm_set1_ps(weights[k])));
+          _mm_storeu_ps(out + y, sum_4);
+        }
+#endif
+        for (; y < rows; y++)
+        {
+          float sum = 0;
+          for (int k = 0; k <= 2 * radius; k++)
+            sum += taps[k][y] * weights[k];
+          out[y] = sum;
+        }
+      }
+    }
+
+    // A box over a band of rows. The running sum of the whole band slides one column at a time, which vectorizes across the rows
+    void BoxRowPass(float* const* columns, float** out_columns, int out_width, int rows, int box_radius, float* running_sum)
+    {
+      int window = 2 * box_radius + 1;
+      float inverse_window = 1.f / window;
+
+      std::fill(running_sum, running_sum + rows, 0.f);
+      for (int k = 0; k < window; k++)
+        AccumulateScaled(running_sum, columns[k], 1.f, rows);
+      StoreScaled(out_columns[0], running_sum, inverse_window, rows);
+
+      for (int x = 1; x < out_width; x++)
+      {
+        SlideWindow(running_sum, columns[x + window - 1], columns[x - 1], rows);
+        StoreScaled(out_columns[x], running_sum, inverse_window, rows);
+      }
+    }
+  }
+
+  bool SmoothCounterMapArea(const CounterMap& map, int lowest_coord_x, int lowest_coord_y, int width, int height,
+                            int radius_x, int radius_y, HeatmapSmoothingKernel kernel, float** out_columns)
+  {
+    bool gaussian = kernel == kGaussianKernel;
+    int box_radius_x = gaussian ? 0 : BoxRadiusForGaussianRadius(radius_x);
+    int box_radius_y = gaussian ? 0 : BoxRadiusForGaussianRadius(radius_y);
+
+    // How many cells outside the area each pass needs to read
+    int reach_x = gaussian ? radius_x : 3 * box_radius_x;
+    int reach_y = gaussian ? radius_y : 3 * box_radius_y;
+    int padded_width = width + 2 * reach_x;
+    int padded_height = height + 2 * reach_y;
+
+    float* weights_x = nullptr;
+    float* weights_y = nullptr;
+    float* vertical = nullptr;
+    try {
+      if (gaussian && reach_x > 0)
+        weights_x = CreateGaussianWeights(radius_x);
+      if (gaussian && reach_y > 0)
+        weights_y = CreateGaussianWeights(radius_y);
+      // Result of the vertical pass, padded_width columns of height values each
+      vertical = new float[(size_t)padded_width * height];
+    }
+    catch (const std::bad_alloc&) {
+      delete[] weights_x;
+      delete[] weights_y;
+      delete[] vertical;
+      return false;
+    }
+
+    std::atomic<bool> failed(false);
+
+    // Vertical pass: each padded column is read from the map and smoothed on its own
+    ParallelFor(0, padded_width, kMinLinesPerThread, [&](int column_begin, int column_end) {
+      uint32_t* raw_values = nullptr;
+      float* values = nullptr;
+      float* scratch = nullptr;
+      try {
+        raw_values = new uint32_t[padded_height];
+        values = new float[padded_height];
+        scratch = gaussian ? nullptr : new float[padded_height];
+
+        for (int x = column_begin; x < column_end; x++)
+        {
+          map.getColumnValues(lowest_coord_x - reach_x + x, lowest_coord_y - reach_y, padded_height, raw_values);
+          for (int y = 0; y < padded_height; y++)
+            values[y] = (float)raw_values[y];
+
+          float* out = vertical + (size_t)x * height;
+          if (reach_y == 0)
+            std::copy(values, values + height, out);
+          else if (gaussian)
+            GaussianColumnPass(values, out, height, weights_y, radius_y);
+          else
+            BoxColumnPasses(values, scratch, out, height, box_radius_y);
+        }
+      }
+      catch (const std::bad_alloc&) {
+        failed = true;
+      }
+      delete[] raw_values;
+      delete[] values;
+      delete[] scratch;
+    });
+
+    // Horizontal pass: split in chunks of rows, so every thread slides along the whole width of the area
+    if (!failed)
+    {
+      ParallelFor(0, height, kMinLinesPerThread, [&](int chunk_begin, int chunk_end) {
+        int first_width = width + 4 * box_radius_x;
+        int second_width = width + 2 * box_radius_x;
+        float** sources = nullptr;
+        float** destinations = nullptr;
+        float* band_buffers = nullptr;
+        float** band_columns = nullptr;
+        float* running_sum = nullptr;
+        try {
+          sources = new float*[padded_width];
+          destinations = new float*[width];
+          if (!gaussian && reach_x > 0)
+          {
+            // The two intermediate box results only need to exist for the band being processed
+            band_buffers = new float[(size_t)(first_width + second_width) * kRowsPerBand];
+            band_columns = new float*[first_width + second_width];
+            running_sum = new float[kRowsPerBand];
+            for (int x = 0; x < first_width + second_width; x++)
+              band_columns[x] = band_buffers + (size_t)x * kRowsPerBand;
+          }
+
+          for (int row_begin = chunk_begin; row_begin < chunk_end; row_begin += kRowsPerBand)
+          {
+            int rows = std::min(kRowsPerBand, chunk_end - row_begin);
+            for (int x = 0; x < padded_width; x++)
+              sources[x] = vertical + (size_t)x * height + row_begin;
+            for (int x = 0; x < width; x++)
+              destinations[x] = out_columns[x] + row_begin;
+
+            if (reach_x == 0)
+            {
+              for (int x = 0; x < width; x++)
+                std::copy(sources[x], sources[x] + rows, destinations[x]);
+            }
+            else if (gaussian)
+            {
+              GaussianRowPass(sources, destinations, width, rows, weights_x, radius_x);
+            }
+            else
+            {
+              BoxRowPass(sources, band_columns, first_width, rows, box_radius_x, running_sum);
+              BoxRowPass(band_columns, band_columns + first_width, second_width, rows, box_radius_x, running_sum);
+              BoxRowPass(band_columns + first_width, destinations, width, rows, box_radius_x, running_sum);
+            }
+          }
+        }
+        catch (const std::bad_alloc&) {
+          failed = true;
+        }
+        delete[] sources;
+        delete[] destinations;
+        delete[] band_buffers;
+        delete[] band_columns;
+        delete[] running_sum;
+      });
+    }
+
+    delete[] weights_x;
+    delete[] weights_y;
+    delete[] vertical;
+
+    return !failed;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+////////////////////////////////////////////////////////////////////////
+// HeatmapSmoothing.h: Separable kernel smoothing of CounterMap areas
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <string>
+
+#include "HeatmapServiceTypes.h"
+#include "CounterMap.hpp"
+
+namespace heatmap_service
+{
+  // Smooths the area of the map that starts at { lowest_coord_x, lowest_coord_y } and spans width*height cells, writing the result to out_columns,
+  // an array of width columns holding height floats each (the same layout as HeatmapData).
+  // The kernel reaches radius_x cells horizontally and radius_y cells vertically. The cells within that reach outside of the area are read from the map as well,
+  // so values along the edges of the area are smoothed against their real neighbours, instead of against a zeroed or clamped border.
+  // The work is done in a vertical and a horizontal pass, each split across threads.
+  // Returns false if the intermediate buffers could not be allocated
+  bool SmoothCounterMapArea(const CounterMap& map, int lowest_coord_x, int lowest_coord_y, int width, int height,
+                            int radius_x, int radius_y, HeatmapSmoothingKernel kernel, float** out_columns);
+}
\ No newline at end of file
@@ -0,0 +1,398 @@
+////////////////////////////////////////////////////////////////////////
+// ImageEncoding.cpp: Implementation of the PNG and PPM encoders
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "ImageEncoding.h"
+#include "ParallelFor.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <fstream>
+#include <new>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+#include <errno.h>
+
+namespace heatmap_service
+{
+  namespace
+  {
+    // Rows compressed into each IDAT chunk, the unit of work handed to each thread
+    const int kPngRowsPerBand = 128;
+
+    const int kBytesPerPixel = 4;
+
+    // Fixed tables needed by the encoder, built once before main
+    struct EncodingTables
+    {
+      // CRC32 of PNG chunks
+      uint32_t crc[256];
+
+      // Deflate fixed huffman codes for literals and lengths (0-287), already bit reversed so they can be written least significant bit first
+      uint32_t literal_code[288];
+      int literal_code_length[288];
+
+      // Length code (257-285), number of extra bits and value of the extra bits for each match length from 3 to 258
+      int length_symbol[259];
+      int length_extra_bits[259];
+      int length_extra_value[259];
+
+      EncodingTables()
+      {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+          uint32_t c = n;
+          for (int k = 0; k < 8; k++)
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+          crc[n] = c;
+        }
+
+        for (int symbol = 0; symbol < 288; symbol++)
+        {
+          uint32_t code;
+          int length;
+          if (symbol < 144)      { code = 0x30 + symbol;          length = 8; }
+          else if (symbol < 256) { code = 0x190 + symbol - 144;   length = 9; }
+          else if (symbol < 280) { code = symbol - 256;           length = 7; }
+          else                   { code = 0xc0 + symbol - 280;    length = 8; }
+
+          uint32_t reversed = 0;
+          for (int bit = 0; bit < length; bit++)
+            reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+          literal_code[symbol] = reversed;
+          literal_code_length[symbol] = length;
+        }
+
+        const int base_lengths[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        const int extra_bits[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        for (int code = 0; code < 29; code++)
+        {
+          int last_length = code < 28 ? base_lengths[code] + (1 << extra_bits[code]) - 1 : 258;
+          for (int length = base_lengths[code]; length <= last_length && length <= 258; length++)
+          {
+            length_symbol[length] = 257 + code;
+            length_extra_bits[length] = extra_bits[code];
+            length_extra_value[length] = length - base_lengths[code];
+          }
+        }
+      }
+    };
+    const EncodingTables kTables;
+
+    uint32_t UpdateCrc(uint32_t crc, const unsigned char* data, size_t length)
+    {
+      for (size_t i = 0; i < length; i++)
+        crc = kTables.crc[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+      return crc;
+    }
+
+    // -- Adler32 of the zlib stream. Computed for each band separately and combined in order afterwards
+    const uint32_t kAdlerBase = 65521;
+
+    uint32_t Adler32(const unsigned char* data, size_t length)
+    {
+      uint32_t a = 1, b = 0;
+      while (length > 0)
+      {
+        // 5552 is the largest amount of bytes that can be summed before b may overflow
+        size_t block = length < 5552 ? length : 5552;
+        length -= block;
+        while (block--)
+        {
+          a += *data++;
+          b += a;
+        }
+        a %= kAdlerBase;
+        b %= kAdlerBase;
+      }
+      return (b << 16) | a;
+    }
+
+    // Adler32 of the concatenation of two buffers, given their adlers and the length of the second one (as zlib's adler32_combine)
+    uint32_t CombineAdler32(uint32_t first_adler, uint32_t second_adler, size_t second_length)
+    {
+      uint32_t remainder = (uint32_t)(second_length % kAdlerBase);
+      uint32_t sum1 = first_adler & 0xffff;
+      uint32_t sum2 = (uint32_t)(((uint64_t)remainder * sum1) % kAdlerBase);
+      sum1 += (second_adler & 0xffff) + kAdlerBase - 1;
+      sum2 += ((first_adler >> 16) & 0xffff) + ((second_adler >> 16) & 0xffff) + kAdlerBase - remainder;
+      if (sum1 >= kAdlerBase) sum1 -= kAdlerBase;
+      if (sum1 >= kAdlerBase) sum1 -= kAdlerBase;
+      if (sum2 >= (kAdlerBase << 1)) sum2 -= (kAdlerBase << 1);
+      if (sum2 >= kAdlerBase) sum2 -= kAdlerBase;
+      return sum1 | (sum2 << 16);
+    }
+
+    // Writes deflate bits, least significant bit first, to a buffer known to be large enough
+    class BitWriter
+    {
+    private:
+      unsigned char* out_;
+      size_t position_;
+      uint64_t bits_;
+      int bit_count_;
+
+    public:
+      explicit BitWriter(unsigned char* out) : out_(out), position_(0), bits_(0), bit_count_(0) {}
+
+      size_t position() const { return position_; }
+
+      void Write(uint32_t value, int length)
+      {
+        bits_ |= (uint64_t)value << bit_count_;
+        bit_count_ += length;
+        while (bit_count_ >= 8)
+        {
+          out_[position_++] = (unsigned char)bits_;
+          bits_ >>= 8;
+          bit_count_ -= 8;
+        }
+      }
+
+      void WriteSymbol(int symbol) { Write(kTables.literal_code[symbol], kTables.literal_code_length[symbol]); }
+
+      void AlignToByte()
+      {
+        if (bit_count_ > 0)
+          Write(0, 8 - bit_count_);
+      }
+    };
+
+    // Compresses a band of filtered rows into one non final fixed huffman block, replacing runs of a repeated byte with matches at distance 1.
+    // The block is followed by an empty stored block, which realigns the stream to a byte boundary so the next band can simply be appended.
+    // Returns the size of the compressed band
+    size_t DeflateBand(const unsigned char* in, size_t length, unsigned char* out)
+    {
+      BitWriter writer(out);
+      writer.Write(0, 1); // Not the final block
+      writer.Write(1, 2); // Compressed with fixed huffman codes
+
+      size_t i = 0;
+      while (i < length)
+      {
+        unsigned char value = in[i];
+        size_t run = 1;
+        while (i + run < length && in[i + run] == value)
+          run++;
+
+        // The first byte of a run is always a literal, the remaining ones repeat it from one byte behind
+        writer.WriteSymbol(value);
+        size_t repeats = run - 1;
+        while (repeats >= 3)
+        {
+          int match = repeats > 258 ? 258 : (int)repeats;
+          // A run of 259 or 260 would leave a remainder too short for a match, split it more evenly instead
+          if (repeats - match > 0 && repeats - match < 3)
+            match -= 3;
+          writer.WriteSymbol(kTables.length_symbol[match]);
+          writer.Write(kTables.length_extra_value[match], kTables.length_extra_bits[match]);
+          writer.Write(0, 5); // Distance code 0, a distance of 1
+          repeats -= match;
+        }
+        while (repeats-- > 0)
+          writer.WriteSymbol(value);
+
+        i += run;
+      }
+      writer.WriteSymbol(256); // End of block
+
+      // Empty stored block to realign the stream
+      writer.Write(0, 1);
+      writer.Write(0, 2);
+      writer.AlignToByte();
+      const unsigned char empty_stored_block[4] = { 0x00, 0x00, 0xff, 0xff };
+      memcpy(out + writer.position(), empty_stored_block, 4);
+
+      return writer.position() + 4;
+    }
+
+    void WriteBigEndian(unsigned char* out, uint32_t value)
+    {
+      out[0] = (unsigned char)(value >> 24);
+      out[1] = (unsigned char)(value >> 16);
+      out[2] = (unsigned char)(value >> 8);
+      out[3] = (unsigned char)value;
+    }
+
+    // Writes a PNG chunk. crc must already include type and data, as computed by ChunkCrc
+    void WriteChunk(std::ofstream &file, const char* type, const unsigned char* data, size_t length, uint32_t crc)
+    {
+      unsigned char header[8];
+      WriteBigEndian(header, (uint32_t)length);
+      memcpy(header + 4, type, 4);
+      file.write((const char*)header, 8);
+      if (length > 0)
+        file.write((const char*)data, length);
+
+      unsigned char footer[4];
+      WriteBigEndian(footer, crc);
+      file.write((const char*)footer, 4);
+    }
+
+    uint32_t ChunkCrc(const char* type, const unsigned char* data, size_t length)
+    {
+      uint32_t crc = UpdateCrc(0xffffffffu, (const unsigned char*)type, 4);
+      return UpdateCrc(crc, data, length) ^ 0xffffffffu;
+    }
+
+    // Everything needed to write one band of rows as an IDAT chunk
+    struct EncodedBand
+    {
+      unsigned char* data;
+      size_t length;
+      size_t filtered_length;
+      uint32_t adler;
+      uint32_t crc;
+    };
+  }
+
+  bool WritePngImage(const std::string &file_path, const unsigned char* rgba_pixels, int width, int height, bool split_across_threads)
+  {
+    if (width <= 0 || height <= 0)
+      return false;
+
+    int band_count = (height + kPngRowsPerBand - 1) / kPngRowsPerBand;
+    size_t row_length = (size_t)width * kBytesPerPixel;
+
+    EncodedBand* bands = new (std::nothrow) EncodedBand[band_count]();
+    if (!bands)
+      return false;
+
+    std::atomic<bool> failed(false);
+
+    // Filters and compresses each band of rows on its own. Rows are prefixed by their filter type, 1 (Sub),
+    // which stores each byte as its difference to the same byte of the pixel to its left
+    auto encode_bands = [&](int band_begin, int band_end) {
+      for (int band = band_begin; band < band_end; band++)
+      {
+        int first_row = band * kPngRowsPerBand;
+        int rows = first_row + kPngRowsPerBand <= height ? kPngRowsPerBand : height - first_row;
+        size_t filtered_length = (size_t)rows * (row_length + 1);
+
+        unsigned char* filtered = new (std::nothrow) unsigned char[filtered_length];
+        // Each byte costs at most 9 bits, plus the block headers and the realigning stored block
+        unsigned char* compressed = new (std::nothrow) unsigned char[filtered_length + filtered_length / 8 + 16];
+        if (!filtered || !compressed)
+        {
+          delete[] filtered;
+          delete[] compressed;
+          failed = true;
+          continue;
+        }
+
+        for (int row = 0; row < rows; row++)
+        {
+          const unsigned char* pixels = rgba_pixels + (size_t)(first_row + row) * row_length;
+          unsigned char* out = filtered + (size_t)row * (row_length + 1);
+          out[0] = 1;
+          for (size_t i = 0; i < kBytesPerPixel; i++)
+            out[1 + i] = pixels[i];
+          for (size_t i = kBytesPerPixel; i < row_length; i++)
+            out[1 + i] = (unsigned char)(pixels[i] - pixels[i - kBytesPerPixel]);
+        }
+
+        bands[band].data = compressed;
+        bands[band].length = DeflateBand(filtered, filtered_length, compressed);
+        bands[band].filtered_length = filtered_length;
+        bands[band].adler = Adler32(filtered, filtered_length);
+        bands[band].crc = ChunkCrc("IDAT", compressed, bands[band].length);
+        delete[] filtered;
+      }
+    };
+
+    if (split_across_threads)
+      ParallelFor(0, band_count, 1, encode_bands);
+    else
+      encode_bands(0, band_count);
+
+    bool written = false;
+    if (!failed)
+    {
+      std::ofstream file(file_path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+      if (file.is_open())
+      {
+        const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+        file.write((const char*)signature, 8);
+
+        // Header: size, 8 bits per channel, color type 6 (RGBA), default compression, filtering and no interlacing
+        unsigned char header[13];
+        WriteBigEndian(header, (uint32_t)width);
+        WriteBigEndian(header + 4, (uint32_t)height);
+        header[8] = 8;
+        header[9] = 6;
+        header[10] = header[11] = header[12] = 0;
+        WriteChunk(file, "IHDR", header, 13, ChunkCrc("IHDR", header, 13));
+
+        // The zlib stream is split in several IDAT chunks: its header, one chunk per band, and the final block with the checksum
+        const unsigned char zlib_header[2] = { 0x78, 0x01 };
+        WriteChunk(file, "IDAT", zlib_header, 2, ChunkCrc("IDAT", zlib_header, 2));
+
+        uint32_t adler = 1;
+        for (int band = 0; band < band_count; band++)
+        {
+          WriteChunk(file, "IDAT", bands[band].data, bands[band].length, bands[band].crc);
+          adler = CombineAdler32(adler, bands[band].adler, bands[band].filtered_length);
+        }
+
+        unsigned char zlib_trailer[9] = { 0x01, 0x00, 0x00, 0xff, 0xff };
+        WriteBigEndian(zlib_trailer + 5, adler);
+        WriteChunk(file, "IDAT", zlib_trailer, 9, ChunkCrc("IDAT", zlib_trailer, 9));
+
+        WriteChunk(file, "IEND", nullptr, 0, ChunkCrc("IEND", nullptr, 0));
+        written = file.good();
+      }
+    }
+
+    for (int band = 0; band < band_count; band++)
+      delete[] bands[band].data;
+    delete[] bands;
+
+    return written;
+  }
+
+  bool WritePpmImage(const std::string &file_path, const unsigned char* rgba_pixels, int width, int height)
+  {
+    if (width <= 0 || height <= 0)
+      return false;
+
+    size_t pixel_count = (size_t)width * height;
+    unsigned char* rgb = new (std::nothrow) unsigned char[pixel_count * 3];
+    if (!rgb)
+      return false;
+
+    for (size_t i = 0; i < pixel_count; i++)
+    {
+      rgb[i * 3] = rgba_pixels[i * kBytesPerPixel];
+      rgb[i * 3 + 1] = rgba_pixels[i * kBytesPerPixel + 1];
+      rgb[i * 3 + 2] = rgba_pixels[i * kBytesPerPixel + 2];
+    }
+
+    std::ofstream file(file_path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    bool written = false;
+    if (file.is_open())
+    {
+      file << "P6\n" << width << " " << height << "\n255\n";
+      file.write((const char*)rgb, pixel_count * 3);
+      written = file.good();
+    }
+
+    delete[] rgb;
+    return written;
+  }
+
+  bool MakeDirectory(const std::string &directory_path)
+  {
+#ifdef _WIN32
+    int result = _mkdir(directory_path.c_str());
+#else
+    int result = mkdir(directory_path.c_str(), 0755);
+#endif
+    return result == 0 || errno == EEXIST;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+////////////////////////////////////////////////////////////////////////
+// ImageEncoding.h: Minimal PNG and PPM encoders used to render heatmaps
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <string>
+
+namespace heatmap_service
+{
+  // Both encoders receive the image as width*height RGBA pixels, stored row by row from the top of the image.
+
+  // Writes a PNG file with an alpha channel. Rows go through PNG's Sub filter and are compressed with a run-length only deflate,
+  // which is quick to encode and still shrinks the large flat areas heatmaps tend to have.
+  // Each band of rows is compressed into its own IDAT chunk, so bands can be encoded in parallel when split_across_threads is true.
+  // Returns false if the file couldn't be written or the buffers couldn't be allocated
+  bool WritePngImage(const std::string &file_path, const unsigned char* rgba_pixels, int width, int height, bool split_across_threads);
+
+  // Writes a binary PPM (P6) file. PPM has no alpha channel, so it is dropped
+  bool WritePpmImage(const std::string &file_path, const unsigned char* rgba_pixels, int width, int height);
+
+  // Creates a directory, succeeding as well if it already exists. Parent directories must already exist
+  bool MakeDirectory(const std::string &directory_path);
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+////////////////////////////////////////////////////////////////////////
+// Instrumentation.cpp: Implementation of the Instrumentation class
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "Instrumentation.h"
+
+namespace heatmap_service
+{
+  namespace
+  {
+    Instrumentation g_instrumentation;
+  }
+
+  Instrumentation& Instrumentation::Instance()
+  {
+    return g_instrumentation;
+  }
+
+  Instrumentation::Instrumentation() : timing_enabled_(false), histograms_enabled_(false), event_hook_(nullptr)
+  {
+    for (int i = 0; i < kHeatmapOperationCount; i++)
+      slow_thresholds_ns_[i].store(0);
+  }
+
+  void Instrumentation::EnableLatencyHistograms(bool enabled)
+  {
+    histograms_enabled_ = enabled;
+    UpdateTimingEnabled();
+  }
+
+  void Instrumentation::ResetLatencyHistograms()
+  {
+    for (int i = 0; i < kHeatmapOperationCount; i++)
+      histograms_[i].Reset();
+  }
+
+  void Instrumentation::GetLatencySummary(HeatmapOperation operation, HeatmapLatencySummary &out_summary) const
+  {
+    const LatencyHistogram& histogram = histograms_[operation];
+    out_summary.operation = operation;
+    out_summary.count = histogram.count();
+    out_summary.mean_ns = histogram.mean();
+    out_summary.p50_ns = (double)histogram.ValueAtQuantile(0.5);
+    out_summary.p90_ns = (double)histogram.ValueAtQuantile(0.9);
+    out_summary.p99_ns = (double)histogram.ValueAtQuantile(0.99);
+    out_summary.p999_ns = (double)histogram.ValueAtQuantile(0.999);
+    out_summary.max_ns = (double)histogram.max();
+  }
+
+  void Instrumentation::SetSlowOperationThreshold(HeatmapOperation operation, double nanoseconds)
+  {
+    slow_thresholds_ns_[operation] = nanoseconds > 0 ? (uint64_t)nanoseconds : 0;
+    UpdateTimingEnabled();
+  }
+
+  void Instrumentation::SetEventHook(HeatmapEventHook* hook)
+  {
+    event_hook_ = hook;
+    UpdateTimingEnabled();
+  }
+
+  void Instrumentation::RecordOperation(HeatmapOperation operation, uint64_t nanoseconds)
+  {
+    if (histograms_enabled_.load(std::memory_order_relaxed))
+      histograms_[operation].Record(nanoseconds);
+
+    uint64_t slow_threshold = slow_thresholds_ns_[operation].load(std::memory_order_relaxed);
+    HeatmapEventHook* hook = event_hook();
+    if (hook && slow_threshold > 0 && nanoseconds > slow_threshold)
+      hook->OnSlowOperation(operation, (double)nanoseconds);
+  }
+
+  void Instrumentation::UpdateTimingEnabled()
+  {
+    bool watching_slow_operations = false;
+    for (int i = 0; i < kHeatmapOperationCount; i++)
+      watching_slow_operations = watching_slow_operations || slow_thresholds_ns_[i].load() > 0;
+
+    timing_enabled_ = histograms_enabled_ || (event_hook_.load() != nullptr && watching_slow_operations);
+  }
+}
\ No newline at end of file
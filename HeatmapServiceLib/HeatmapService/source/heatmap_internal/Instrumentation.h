@@ -0,0 +1,95 @@
+////////////////////////////////////////////////////////////////////////
+// Instrumentation.h: Latency histograms and event hooks of the public operations
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "HeatmapServiceTypes.h"
+#include "LatencyHistogram.h"
+
+namespace heatmap_service
+{
+  // -- Instrumentation keeps a latency histogram for each public operation, and the hook that receives the library's events, for the whole process.
+  // It's only built into the library when HEATMAP_SERVICE_INSTRUMENTATION is defined. Without it HEATMAP_TIME_OPERATION expands to nothing
+  // and ActiveEventHook always returns nullptr, so instrumented code compiles down to what it was without instrumentation.
+  // When built in, operations only read the clock while the histograms are enabled or slow operations are being watched
+  class Instrumentation
+  {
+  public:
+    static Instrumentation& Instance();
+
+    Instrumentation();
+
+    // True if operations should be timed
+    bool timing_enabled() const { return timing_enabled_.load(std::memory_order_relaxed); }
+    HeatmapEventHook* event_hook() const { return event_hook_.load(std::memory_order_relaxed); }
+
+    void EnableLatencyHistograms(bool enabled);
+    void ResetLatencyHistograms();
+    void GetLatencySummary(HeatmapOperation operation, HeatmapLatencySummary &out_summary) const;
+
+    // Operations that take longer than nanoseconds are reported to the event hook. 0 stops watching the operation
+    void SetSlowOperationThreshold(HeatmapOperation operation, double nanoseconds);
+    void SetEventHook(HeatmapEventHook* hook);
+
+    // Records how long an operation took, and reports it to the event hook if it was slow
+    void RecordOperation(HeatmapOperation operation, uint64_t nanoseconds);
+
+  private:
+    Instrumentation(const Instrumentation&);
+    Instrumentation& operator=(const Instrumentation&);
+
+    // Timing is needed while the histograms are enabled, or while a hook watches for slow operations
+    void UpdateTimingEnabled();
+
+    std::atomic<bool> timing_enabled_;
+    std::atomic<bool> histograms_enabled_;
+    std::atomic<HeatmapEventHook*> event_hook_;
+    std::atomic<uint64_t> slow_thresholds_ns_[kHeatmapOperationCount];
+    LatencyHistogram histograms_[kHeatmapOperationCount];
+  };
+
+  // -- ScopedOperationTimer times the scope it's declared in as a single operation
+  class ScopedOperationTimer
+  {
+  public:
+    explicit ScopedOperationTimer(HeatmapOperation operation) : operation_(operation), timing_(Instrumentation::Instance().timing_enabled())
+    {
+      if (timing_)
+        begin_ = std::chrono::steady_clock::now();
+    }
+
+    ~ScopedOperationTimer()
+    {
+      if (timing_)
+      {
+        std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - begin_;
+        Instrumentation::Instance().RecordOperation(operation_, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+      }
+    }
+
+  private:
+    ScopedOperationTimer(const ScopedOperationTimer&);
+    ScopedOperationTimer& operator=(const ScopedOperationTimer&);
+
+    HeatmapOperation operation_;
+    bool timing_;
+    std::chrono::steady_clock::time_point begin_;
+  };
+
+#ifdef HEATMAP_SERVICE_INSTRUMENTATION
+  #define HEATMAP_TIME_OPERATION(operation) ScopedOperationTimer operation_timer(operation)
+
+  // The hook events should be raised to, or nullptr if there's none
+  inline HeatmapEventHook* ActiveEventHook() { return Instrumentation::Instance().event_hook(); }
+#else
+  #define HEATMAP_TIME_OPERATION(operation)
+
+  inline HeatmapEventHook* ActiveEventHook() { return nullptr; }
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,113 @@
+////////////////////////////////////////////////////////////////////////
+// LatencyHistogram.cpp: Implementation of the LatencyHistogram class
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "LatencyHistogram.h"
+
+#include <cmath>
+
+namespace heatmap_service
+{
+  LatencyHistogram::LatencyHistogram()
+  {
+    Reset();
+  }
+
+  void LatencyHistogram::Record(uint64_t nanoseconds)
+  {
+    counts_[BucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    total_ns_.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    // The max is only written when beaten, which quickly becomes rare
+    uint64_t current_max = max_ns_.load(std::memory_order_relaxed);
+    while (nanoseconds > current_max && !max_ns_.compare_exchange_weak(current_max, nanoseconds, std::memory_order_relaxed)) {}
+  }
+
+  void LatencyHistogram::Reset()
+  {
+    for (int i = 0; i < kBucketCount; i++)
+      counts_[i].store(0, std::memory_order_relaxed);
+    total_ns_.store(0, std::memory_order_relaxed);
+    max_ns_.store(0, std::memory_order_relaxed);
+  }
+
+  uint64_t LatencyHistogram::count() const
+  {
+    uint64_t total_count = 0;
+    for (int i = 0; i < kBucketCount; i++)
+      total_count += counts_[i].load(std::memory_order_relaxed);
+    return total_count;
+  }
+
+  uint64_t LatencyHistogram::max() const
+  {
+    return max_ns_.load(std::memory_order_relaxed);
+  }
+
+  double LatencyHistogram::mean() const
+  {
+    uint64_t total_count = count();
+    return total_count > 0 ? (double)total_ns_.load(std::memory_order_relaxed) / total_count : 0;
+  }
+
+  uint64_t LatencyHistogram::ValueAtQuantile(double quantile) const
+  {
+    uint64_t total_count = count();
+    if (total_count == 0)
+      return 0;
+
+    // The rank of the latency asked for, counting from 1
+    uint64_t rank = (uint64_t)std::ceil(quantile * total_count);
+    if (rank < 1)
+      rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < kBucketCount; i++)
+    {
+      seen += counts_[i].load(std::memory_order_relaxed);
+      if (seen >= rank)
+      {
+        // The bucket's highest latency may be above anything actually recorded
+        uint64_t highest_value = BucketHighestValue(i);
+        return highest_value < max() ? highest_value : max();
+      }
+    }
+    return max();
+  }
+
+  // -- Bucket layout
+  // Latencies of kSubBucketCount ns or more are bucketed by their highest set bit, and the kSubBucketBits bits below it
+  int LatencyHistogram::BucketIndex(uint64_t nanoseconds)
+  {
+    if (nanoseconds < (uint64_t)kSubBucketCount)
+      return (int)nanoseconds;
+
+    int highest_bit = 0;
+    uint64_t remaining = nanoseconds;
+    if (remaining >> 32) { remaining >>= 32; highest_bit += 32; }
+    if (remaining >> 16) { remaining >>= 16; highest_bit += 16; }
+    if (remaining >> 8) { remaining >>= 8; highest_bit += 8; }
+    if (remaining >> 4) { remaining >>= 4; highest_bit += 4; }
+    if (remaining >> 2) { remaining >>= 2; highest_bit += 2; }
+    if (remaining >> 1) { highest_bit += 1; }
+
+    if (highest_bit > kHighestExponent)
+      return kBucketCount - 1;
+
+    int shift = highest_bit - kSubBucketBits;
+    int sub_bucket = (int)((nanoseconds >> shift) & (kSubBucketCount - 1));
+    return kSubBucketCount + shift * kSubBucketCount + sub_bucket;
+  }
+
+  uint64_t LatencyHistogram::BucketHighestValue(int bucket_index)
+  {
+    if (bucket_index < kSubBucketCount)
+      return (uint64_t)bucket_index;
+
+    int shift = (bucket_index - kSubBucketCount) / kSubBucketCount;
+    int sub_bucket = (bucket_index - kSubBucketCount) % kSubBucketCount;
+    uint64_t lowest_value = (uint64_t)(kSubBucketCount + sub_bucket) << shift;
+    return lowest_value + ((uint64_t)1 << shift) - 1;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+////////////////////////////////////////////////////////////////////////
+// LatencyHistogram.h: Log-linear histogram of operation latencies
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace heatmap_service
+{
+  // -- LatencyHistogram counts latencies in buckets whose width grows with the latency, in the style of HDR histograms.
+  // Latencies under kSubBucketCount ns get a bucket each, every power of two above that is split in kSubBucketCount buckets,
+  // so any latency, from nanoseconds to minutes, is kept within 1/kSubBucketCount of its value in a fixed amount of memory.
+  // Recording is a couple of relaxed atomic additions, and may happen from several threads at once
+  class LatencyHistogram
+  {
+  public:
+    static const int kSubBucketBits = 5;
+    static const int kSubBucketCount = 1 << kSubBucketBits;
+    // Latencies from 2^kHighestExponent ns up (about 18 minutes) all fall in the last bucket
+    static const int kHighestExponent = 40;
+    static const int kBucketCount = kSubBucketCount + (kHighestExponent - kSubBucketBits + 1) * kSubBucketCount;
+
+    LatencyHistogram();
+
+    void Record(uint64_t nanoseconds);
+    void Reset();
+
+    uint64_t count() const;
+    uint64_t max() const;
+    double mean() const;
+
+    // Latency at or under which quantile (0 to 1) of the recorded latencies fall. Returns the highest latency of the bucket it lands in
+    uint64_t ValueAtQuantile(double quantile) const;
+
+  private:
+    LatencyHistogram(const LatencyHistogram&);
+    LatencyHistogram& operator=(const LatencyHistogram&);
+
+    static int BucketIndex(uint64_t nanoseconds);
+    static uint64_t BucketHighestValue(int bucket_index);
+
+    std::atomic<uint64_t> counts_[kBucketCount];
+    std::atomic<uint64_t> total_ns_;
+    std::atomic<uint64_t> max_ns_;
+  };
+}
\ No newline at end of file
@@ -0,0 +1,76 @@
+////////////////////////////////////////////////////////////////////////
+// LazyCounterMaps.cpp: Implementation of the LazyCounterMaps class
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "LazyCounterMaps.h"
+#include <iostream>
+#include <new>
+
+namespace heatmap_service
+{
+  LazyCounterMaps::LazyCounterMaps() : storage_layout_(kColumnStorageLayout) {}
+
+  bool LazyCounterMaps::OpenBuffer(const char* buffer, size_t length, HeatmapStorageLayout storage_layout, std::string &out_error)
+  {
+    if (!index_.Parse(buffer, length, out_error))
+      return false;
+
+    storage_layout_ = storage_layout;
+    maps_.clear();
+    maps_.resize(index_.counter_count());
+    return true;
+  }
+
+  bool LazyCounterMaps::OpenMappedFile(std::unique_ptr<MappedFile> file, HeatmapStorageLayout storage_layout, std::string &out_error)
+  {
+    if (!OpenBuffer(file->data(), file->size(), storage_layout, out_error))
+      return false;
+
+    file_ = std::move(file);
+    return true;
+  }
+
+  const CounterMap* LazyCounterMaps::Load(const std::string &counter_key)
+  {
+    int counter_index = index_.find(counter_key);
+    if (counter_index == -1)
+      return nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    return LoadLocked(counter_index);
+  }
+
+  bool LazyCounterMaps::LoadAll()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool result = true;
+    for (int counter_index = 0; counter_index < index_.counter_count(); counter_index++)
+      result = LoadLocked(counter_index) && result;
+    return result;
+  }
+
+  const CounterMap* LazyCounterMaps::LoadLocked(int counter_index)
+  {
+    if (maps_[counter_index])
+      return maps_[counter_index].get();
+
+    const char* reason = "Malformed column section";
+    try {
+      std::unique_ptr<CounterMap> map_for_counter(new CounterMap());
+      if (index_.LoadCounter(counter_index, *map_for_counter))
+      {
+        if (storage_layout_ != kColumnStorageLayout)
+          map_for_counter->SetLayout(storage_layout_);
+        maps_[counter_index] = std::move(map_for_counter);
+        return maps_[counter_index].get();
+      }
+    }
+    catch (const std::bad_alloc&) {
+      reason = "Out of memory";
+    }
+
+    std::cout << "[HEATMAP] ERROR: Could not load counter \"" << index_.counter(counter_index).key << "\". Reason: \"" << reason << "\"" << std::endl;
+    return nullptr;
+  }
+}
@@ -0,0 +1,62 @@
+////////////////////////////////////////////////////////////////////////
+// LazyCounterMaps.h: Counters of a serialized heatmap, loaded the first time they're read
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "HeatmapServiceTypes.h"
+#include "CounterMap.hpp"
+#include "CounterSectionIndex.h"
+#include "MappedFile.h"
+
+namespace heatmap_service
+{
+  // -- LazyCounterMaps keeps the index of a serialized heatmap instead of its counters, and loads each counter the first time it's read,
+  // keeping the map for every read after that. A heatmap only needing a couple of its counters then costs the index and those counters.
+  // Maps are never changed once loaded, so copies of a heatmap share them. Thread safe, as const queries of a heatmap can run on any thread
+  class LazyCounterMaps
+  {
+  public:
+    LazyCounterMaps();
+
+    // Reads the index of a sectioned buffer, which must outlive this object. Maps load in storage_layout.
+    // Returns false, with the reason in out_error, if the buffer is malformed
+    bool OpenBuffer(const char* buffer, size_t length, HeatmapStorageLayout storage_layout, std::string &out_error);
+    // Reads the index of a mapped file, keeping it mapped for as long as this object lives
+    bool OpenMappedFile(std::unique_ptr<MappedFile> file, HeatmapStorageLayout storage_layout, std::string &out_error);
+
+    const CounterSectionIndex& index() const { return index_; }
+
+    bool has_counter(const std::string &counter_key) const { return index_.find(counter_key) != -1; }
+
+    // Returns the map of counter_key, loading it if it wasn't loaded yet. Returns nullptr if the index doesn't hold the counter, or if it can't be loaded,
+    // being malformed or too big to allocate, writing the reason to cout. Loading is tried again the next time. Only one counter loads at a time
+    const CounterMap* Load(const std::string &counter_key);
+    // An empty map, for readers of counters that couldn't be loaded
+    const CounterMap& empty_map() const { return empty_map_; }
+
+    // Loads every counter that wasn't loaded yet. Returns false if any can't be loaded
+    bool LoadAll();
+
+  private:
+    LazyCounterMaps(const LazyCounterMaps&);
+    LazyCounterMaps& operator=(const LazyCounterMaps&);
+
+    // Loads the counter at counter_index of the index, with mutex_ held. Returns nullptr if it can't be loaded
+    const CounterMap* LoadLocked(int counter_index);
+
+    std::unique_ptr<MappedFile> file_;
+    CounterSectionIndex index_;
+    HeatmapStorageLayout storage_layout_;
+
+    std::mutex mutex_;
+    // Map of each counter of the index, null until it's loaded
+    std::vector< std::unique_ptr<CounterMap> > maps_;
+    const CounterMap empty_map_;
+  };
+}
@@ -0,0 +1,133 @@
+////////////////////////////////////////////////////////////////////////
+// MappedFile.cpp: Implementation of the MappedFile class, through mmap, or file mappings on Windows
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "MappedFile.h"
+#include <iostream>
+#include <cstdint>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace heatmap_service
+{
+  MappedFile::MappedFile() : data_(nullptr), size_(0) {}
+
+  MappedFile::~MappedFile()
+  {
+    Close();
+  }
+
+  const char* MappedFile::data() const
+  {
+    return data_;
+  }
+
+  size_t MappedFile::size() const
+  {
+    return size_;
+  }
+
+#ifdef _WIN32
+  bool MappedFile::Open(const std::string &file_path)
+  {
+    Close();
+
+    HANDLE file = CreateFileA(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+      std::cout << "[HEATMAP] ERROR: Could not open file \"" << file_path << "\"" << std::endl;
+      return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || (unsigned long long)file_size.QuadPart > SIZE_MAX)
+    {
+      std::cout << "[HEATMAP] ERROR: Could not map file \"" << file_path << "\". Reason: \"File too big for the address space\"" << std::endl;
+      CloseHandle(file);
+      return false;
+    }
+
+    // The view keeps the file mapped once both handles are closed
+    if (file_size.QuadPart > 0)
+    {
+      HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+      if (mapping)
+        CloseHandle(mapping);
+      if (!view)
+      {
+        std::cout << "[HEATMAP] ERROR: Could not map file \"" << file_path << "\"" << std::endl;
+        CloseHandle(file);
+        return false;
+      }
+      data_ = (const char*)view;
+      size_ = (size_t)file_size.QuadPart;
+    }
+    CloseHandle(file);
+    return true;
+  }
+
+  void MappedFile::Close()
+  {
+    if (data_)
+      UnmapViewOfFile(data_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+#else
+  bool MappedFile::Open(const std::string &file_path)
+  {
+    Close();
+
+    int descriptor = open(file_path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+    {
+      std::cout << "[HEATMAP] ERROR: Could not open file \"" << file_path << "\"" << std::endl;
+      return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(descriptor, &file_stat) != 0 || (unsigned long long)file_stat.st_size > SIZE_MAX)
+    {
+      std::cout << "[HEATMAP] ERROR: Could not map file \"" << file_path << "\". Reason: \"File too big for the address space\"" << std::endl;
+      close(descriptor);
+      return false;
+    }
+
+    // The mapping stays valid once the descriptor is closed
+    if (file_stat.st_size > 0)
+    {
+      void* mapping = mmap(nullptr, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+      if (mapping == MAP_FAILED)
+      {
+        std::cout << "[HEATMAP] ERROR: Could not map file \"" << file_path << "\"" << std::endl;
+        close(descriptor);
+        return false;
+      }
+      // Each thread reads its chunks front to back, so read ahead aggressively
+      madvise(mapping, (size_t)file_stat.st_size, MADV_SEQUENTIAL);
+      data_ = (const char*)mapping;
+      size_ = (size_t)file_stat.st_size;
+    }
+    close(descriptor);
+    return true;
+  }
+
+  void MappedFile::Close()
+  {
+    if (data_)
+      munmap((void*)data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+#endif
+}
\ No newline at end of file
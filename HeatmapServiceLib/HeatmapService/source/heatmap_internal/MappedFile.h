@@ -0,0 +1,35 @@
+////////////////////////////////////////////////////////////////////////
+// MappedFile.h: Read only memory mapping of a whole file
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace heatmap_service
+{
+  // -- MappedFile maps a file into memory for reading, so it can be parsed straight from the pages the operating system reads in,
+  // from any number of threads, without copying it into buffers first. The mapping is released when the MappedFile is closed or destroyed
+  class MappedFile
+  {
+  public:
+    MappedFile();
+    ~MappedFile();
+
+    // Maps the whole file. Returns false, writing the reason to cout, if it can't be opened or mapped.
+    // Empty files open successfully, with no data
+    bool Open(const std::string &file_path);
+    void Close();
+
+    const char* data() const;
+    size_t size() const;
+
+  private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const char* data_;
+    size_t size_;
+  };
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+////////////////////////////////////////////////////////////////////////
+// ParallelFor.hpp: Helper to split an index range across the worker pool
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <functional>
+
+#include "WorkerPool.h"
+
+namespace heatmap_service
+{
+  // Ranges are split in a few more chunks than there are threads, so threads that finish early can steal the chunks of slower ones
+  const int kParallelForChunksPerThread = 4;
+
+  // Splits the index range [begin, end[ into contiguous chunks and calls func(chunk_begin, chunk_end) for each of them on the WorkerPool.
+  // The calling thread works on the chunks too, and only returns once every chunk is done.
+  // Chunks are never smaller than min_chunk_size, so small ranges run entirely on the calling thread without touching the pool.
+  // Func must be safe to call concurrently and must not throw.
+  template <typename Func>
+  void ParallelFor(int begin, int end, int min_chunk_size, const Func& func)
+  {
+    int count = end - begin;
+    if (count <= 0)
+      return;
+
+    WorkerPool& pool = WorkerPool::Instance();
+    int chunks = pool.concurrency() > 1 ? pool.concurrency() * kParallelForChunksPerThread : 1;
+    if (min_chunk_size > 0 && count / min_chunk_size < chunks)
+      chunks = count / min_chunk_size;
+    if (chunks > count)
+      chunks = count;
+
+    if (chunks <= 1)
+    {
+      func(begin, end);
+      return;
+    }
+
+    int chunk_size = count / chunks;
+    int remainder = count % chunks;
+    pool.RunTasks(chunks, [&](int chunk) {
+      int chunk_begin = begin + chunk * chunk_size + (chunk < remainder ? chunk : remainder);
+      int chunk_end = chunk_begin + chunk_size + (chunk < remainder ? 1 : 0);
+      func(chunk_begin, chunk_end);
+    });
+  }
+}
\ No newline at end of file
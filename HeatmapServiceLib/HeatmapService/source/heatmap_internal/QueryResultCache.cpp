@@ -0,0 +1,98 @@
+////////////////////////////////////////////////////////////////////////
+// QueryResultCache.cpp: Implementation of the area query result cache
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "QueryResultCache.h"
+
+namespace heatmap_service
+{
+  QueryResultCache::QueryResultCache() : capacity_(0), hit_count_(0), miss_count_(0) {}
+
+  QueryResultCache::QueryResultCache(const QueryResultCache& copy) : capacity_(copy.capacity()), hit_count_(0), miss_count_(0) {}
+
+  QueryResultCache& QueryResultCache::operator=(const QueryResultCache& copy)
+  {
+    if (this != &copy)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      entries_.clear();
+      capacity_ = copy.capacity();
+    }
+    return *this;
+  }
+
+  // -- Capacity
+  void QueryResultCache::SetCapacity(int entry_count)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = entry_count > 0 ? entry_count : 0;
+    while ((int)entries_.size() > capacity_)
+      entries_.pop_back();
+  }
+
+  std::shared_ptr<const HeatmapData> QueryResultCache::Find(const std::string &counter_key, int lowest_x, int lowest_y, int width, int height,
+                                                            uint64_t generation, uint64_t version_sum)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::list<Entry>::iterator entry = entries_.begin(); entry != entries_.end(); ++entry)
+    {
+      if (!entry->IsArea(counter_key, lowest_x, lowest_y, width, height))
+        continue;
+
+      if (entry->generation != generation || entry->version_sum != version_sum)
+      {
+        entries_.erase(entry);
+        break;
+      }
+
+      // Moves to the front as the most recently used
+      entries_.splice(entries_.begin(), entries_, entry);
+      hit_count_++;
+      return entries_.front().result;
+    }
+
+    miss_count_++;
+    return nullptr;
+  }
+
+  void QueryResultCache::Store(const std::string &counter_key, int lowest_x, int lowest_y, int width, int height, uint64_t generation, uint64_t version_sum,
+                               const std::shared_ptr<const HeatmapData> &result)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capacity_ == 0)
+      return;
+
+    for (std::list<Entry>::iterator entry = entries_.begin(); entry != entries_.end(); ++entry)
+    {
+      if (entry->IsArea(counter_key, lowest_x, lowest_y, width, height))
+      {
+        entries_.erase(entry);
+        break;
+      }
+    }
+
+    Entry entry = { counter_key, lowest_x, lowest_y, width, height, generation, version_sum, result };
+    entries_.push_front(entry);
+    while ((int)entries_.size() > capacity_)
+      entries_.pop_back();
+  }
+
+  void QueryResultCache::Clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+  }
+
+  uint64_t QueryResultCache::hit_count() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hit_count_;
+  }
+
+  uint64_t QueryResultCache::miss_count() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return miss_count_;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+////////////////////////////////////////////////////////////////////////
+// QueryResultCache.h: Least recently used cache of area query results
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "HeatmapServiceTypes.h"
+
+namespace heatmap_service
+{
+  // -- QueryResultCache keeps the results of the most recently used area queries of a heatmap, each with the generation of its counter map
+  // and the sum of the versions of the regions it was read from (see CounterMap::AreaVersionSum). A result is only handed out again while both
+  // are still the same, so checking it costs a version per region of the area instead of copying its counters.
+  // Areas are few and searched linearly, as the LinearSearchMap does with keys. It's thread safe, as const queries of a heatmap can run on any thread
+  class QueryResultCache
+  {
+  public:
+    QueryResultCache();
+    // Copies of a cache start empty, with the capacity of the original
+    QueryResultCache(const QueryResultCache& copy);
+    QueryResultCache& operator=(const QueryResultCache& copy);
+
+    // -- Capacity, in results. 0 disables the cache and drops every result it held
+    void SetCapacity(int entry_count);
+    int capacity() const { return capacity_.load(std::memory_order_relaxed); }
+
+    // Returns the result stored for the area of the counter, if it was stored with the same generation and version sum, and nullptr otherwise.
+    // A result that no longer matches is dropped
+    std::shared_ptr<const HeatmapData> Find(const std::string &counter_key, int lowest_x, int lowest_y, int width, int height,
+                                            uint64_t generation, uint64_t version_sum);
+
+    // Stores the result of an area, replacing any other result of the same area, and drops the least recently used results past the capacity
+    void Store(const std::string &counter_key, int lowest_x, int lowest_y, int width, int height, uint64_t generation, uint64_t version_sum,
+               const std::shared_ptr<const HeatmapData> &result);
+
+    void Clear();
+
+    // Finds that returned a result, and finds that didn't, since the cache was created
+    uint64_t hit_count() const;
+    uint64_t miss_count() const;
+
+  private:
+    struct Entry
+    {
+      std::string counter_key;
+      int lowest_x;
+      int lowest_y;
+      int width;
+      int height;
+      uint64_t generation;
+      uint64_t version_sum;
+      std::shared_ptr<const HeatmapData> result;
+
+      bool IsArea(const std::string &key, int x, int y, int area_width, int area_height) const
+      {
+        return lowest_x == x && lowest_y == y && width == area_width && height == area_height && counter_key == key;
+      }
+    };
+
+    mutable std::mutex mutex_;
+    // Most recently used first
+    std::list<Entry> entries_;
+    std::atomic<int> capacity_;
+    uint64_t hit_count_;
+    uint64_t miss_count_;
+  };
+}
\ No newline at end of file
@@ -0,0 +1,231 @@
+////////////////////////////////////////////////////////////////////////
+// WorkerPool.cpp: Implementation of the work stealing thread pool
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "WorkerPool.h"
+
+namespace heatmap_service
+{
+  namespace
+  {
+    // A requested worker count below 0 means the default, one worker per hardware thread except the calling one
+    const int kDefaultWorkerCount = -1;
+
+    int ResolveWorkerCount(int requested_workers)
+    {
+      if (requested_workers >= 0)
+        return requested_workers;
+      int hardware_threads = (int)std::thread::hardware_concurrency();
+      return hardware_threads > 1 ? hardware_threads - 1 : 0;
+    }
+
+    // The pool is a global instead of a function static, so its construction doesn't depend on thread safe static initialization
+    WorkerPool g_worker_pool;
+  }
+
+  WorkerPool& WorkerPool::Instance()
+  {
+    return g_worker_pool;
+  }
+
+  WorkerPool::WorkerPool() : running_batches_(0), requested_workers_(kDefaultWorkerCount), started_(false), workers_(nullptr), queues_(nullptr), worker_count_(0),
+    queued_tasks_(0), stopping_(false), next_queue_(0) {}
+
+  WorkerPool::~WorkerPool()
+  {
+    std::lock_guard<std::mutex> lock(configuration_mutex_);
+    StopWorkers();
+  }
+
+  // -- Pool size
+  // Batches read the queues without holding the lock, so the workers are only stopped once none is running
+  void WorkerPool::SetWorkerCount(int worker_count)
+  {
+    std::unique_lock<std::mutex> lock(configuration_mutex_);
+    batches_done_.wait(lock, [this] { return running_batches_ == 0; });
+    StopWorkers();
+    requested_workers_ = worker_count > 0 ? worker_count : 0;
+  }
+
+  int WorkerPool::worker_count() const
+  {
+    return started_ ? worker_count_ : ResolveWorkerCount(requested_workers_);
+  }
+
+  int WorkerPool::concurrency() const
+  {
+    return worker_count() + 1;
+  }
+
+  void WorkerPool::RunTasks(int task_count, const std::function<void(int)>& task)
+  {
+    if (task_count <= 0)
+      return;
+
+    // Synchronous pools, and batches with a single task, have nothing to share
+    BeginBatch();
+    if (worker_count_ == 0 || task_count == 1)
+    {
+      for (int i = 0; i < task_count; i++)
+        task(i);
+      EndBatch();
+      return;
+    }
+
+    TaskBatch batch;
+    batch.task = &task;
+    batch.pending = task_count;
+
+    // Tasks are dealt like cards, so every worker starts with its own share of the batch
+    int first_queue = (int)(next_queue_++ % (unsigned int)worker_count_);
+    queued_tasks_ += task_count;
+    for (int i = 0; i < task_count; i++)
+    {
+      WorkerQueue& queue = queues_[(first_queue + i) % worker_count_];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back({ &batch, i });
+    }
+    {
+      std::lock_guard<std::mutex> lock(idle_mutex_);
+    }
+    work_available_.notify_all();
+
+    // The calling thread works on any queued task until its batch is done. Once there's nothing left to take,
+    // the remaining tasks of the batch are already running elsewhere, so it's safe to sleep until they finish
+    QueuedTask queued_task;
+    while (batch.pending > 0)
+    {
+      if (TakeTask(first_queue, queued_task))
+      {
+        RunTask(queued_task);
+      }
+      else
+      {
+        std::unique_lock<std::mutex> lock(batch.done_mutex);
+        batch.done.wait(lock, [&batch] { return batch.pending == 0; });
+      }
+    }
+
+    // The last task to finish may still be notifying, the batch can only leave the stack once it lets go of the mutex
+    {
+      std::lock_guard<std::mutex> lock(batch.done_mutex);
+    }
+    EndBatch();
+  }
+
+  // -- Private methods
+  void WorkerPool::BeginBatch()
+  {
+    std::lock_guard<std::mutex> lock(configuration_mutex_);
+    if (!started_)
+      StartWorkers();
+    running_batches_++;
+  }
+
+  void WorkerPool::EndBatch()
+  {
+    std::lock_guard<std::mutex> lock(configuration_mutex_);
+    if (--running_batches_ == 0)
+      batches_done_.notify_all();
+  }
+
+  void WorkerPool::StartWorkers()
+  {
+    worker_count_ = ResolveWorkerCount(requested_workers_);
+    if (worker_count_ > 0)
+    {
+      queues_ = new WorkerQueue[worker_count_];
+      workers_ = new std::thread[worker_count_];
+      for (int i = 0; i < worker_count_; i++)
+        workers_[i] = std::thread(&WorkerPool::WorkerLoop, this, i);
+    }
+    started_ = true;
+  }
+
+  void WorkerPool::StopWorkers()
+  {
+    if (!started_)
+      return;
+
+    {
+      std::lock_guard<std::mutex> lock(idle_mutex_);
+      stopping_ = true;
+    }
+    work_available_.notify_all();
+
+    for (int i = 0; i < worker_count_; i++)
+      workers_[i].join();
+
+    delete[] workers_;
+    delete[] queues_;
+    workers_ = nullptr;
+    queues_ = nullptr;
+    worker_count_ = 0;
+    stopping_ = false;
+    started_ = false;
+  }
+
+  void WorkerPool::WorkerLoop(int worker_index)
+  {
+    QueuedTask queued_task;
+    while (true)
+    {
+      if (TakeTask(worker_index, queued_task))
+      {
+        RunTask(queued_task);
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(idle_mutex_);
+      work_available_.wait(lock, [this] { return stopping_ || queued_tasks_ > 0; });
+      if (stopping_ && queued_tasks_ == 0)
+        return;
+    }
+  }
+
+  bool WorkerPool::TakeTask(int preferred_queue, QueuedTask& out_task)
+  {
+    if (queued_tasks_ <= 0)
+      return false;
+
+    // Own work is taken from the back, where the most recently queued tasks, and their data, are still warm in cache
+    {
+      WorkerQueue& queue = queues_[preferred_queue];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty())
+      {
+        out_task = queue.tasks.back();
+        queue.tasks.pop_back();
+        --queued_tasks_;
+        return true;
+      }
+    }
+
+    // Stealing takes from the front, away from the owner of the queue
+    for (int i = 1; i < worker_count_; i++)
+    {
+      WorkerQueue& queue = queues_[(preferred_queue + i) % worker_count_];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty())
+      {
+        out_task = queue.tasks.front();
+        queue.tasks.pop_front();
+        --queued_tasks_;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void WorkerPool::RunTask(const QueuedTask& queued_task)
+  {
+    TaskBatch* batch = queued_task.batch;
+    (*batch->task)(queued_task.index);
+
+    std::lock_guard<std::mutex> lock(batch->done_mutex);
+    if (--batch->pending == 0)
+      batch->done.notify_all();
+  }
+}
\ No newline at end of file
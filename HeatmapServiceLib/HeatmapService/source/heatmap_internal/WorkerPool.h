@@ -0,0 +1,99 @@
+////////////////////////////////////////////////////////////////////////
+// WorkerPool.h: Work stealing thread pool shared by every heatmap
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace heatmap_service
+{
+  // -- WorkerPool keeps a set of worker threads alive, so parallel queries don't pay for creating threads every time they run.
+  // Each worker has its own queue of tasks. Batches of tasks are dealt across the queues, workers take tasks from the back of their own queue
+  // and, once it's empty, steal from the front of the others, so a worker stuck on a slow strip doesn't hold back the rest of the batch.
+  // The thread that runs a batch helps with its tasks instead of sleeping, which also lets tasks run batches of their own without deadlocking the pool.
+  // With 0 workers the pool is synchronous, and every batch runs entirely on the calling thread.
+  class WorkerPool
+  {
+  public:
+    // The pool shared by the whole library. Its workers are only started the first time a batch needs them
+    static WorkerPool& Instance();
+
+    WorkerPool();
+    ~WorkerPool();
+
+    // -- Pool size
+    // Defaults to one worker less than the hardware threads, as the calling thread works too.
+    // Changing it waits for the batches running on other threads to finish first, so it must not be called from a task
+    void SetWorkerCount(int worker_count);
+    int worker_count() const;
+
+    // Amount of threads that work on a batch, the workers plus the calling thread
+    int concurrency() const;
+
+    // Calls task(i) for every i in [0, task_count[, spread across the workers, and returns once all of them are done.
+    // Task must be safe to call concurrently and must not throw
+    void RunTasks(int task_count, const std::function<void(int)>& task);
+
+  private:
+    // Tasks of the same RunTasks call. Lives in the stack of the calling thread, which waits for pending to reach 0
+    struct TaskBatch
+    {
+      const std::function<void(int)>* task;
+      std::atomic<int> pending;
+      std::mutex done_mutex;
+      std::condition_variable done;
+    };
+
+    struct QueuedTask
+    {
+      TaskBatch* batch;
+      int index;
+    };
+
+    struct WorkerQueue
+    {
+      std::mutex mutex;
+      std::deque<QueuedTask> tasks;
+    };
+
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    // Starts the workers if they aren't running yet, and counts the batch as running until EndBatch, so the workers aren't resized under it
+    void BeginBatch();
+    void EndBatch();
+    void StartWorkers();
+    void StopWorkers();
+    void WorkerLoop(int worker_index);
+
+    // Takes a task, first from the back of the preferred queue, then from the front of every other one. Returns false if all queues are empty
+    bool TakeTask(int preferred_queue, QueuedTask& out_task);
+    void RunTask(const QueuedTask& queued_task);
+
+    // Guards starting and stopping the workers, which only happens with no batches running
+    std::mutex configuration_mutex_;
+    std::condition_variable batches_done_;
+    int running_batches_;
+    int requested_workers_;
+    std::atomic<bool> started_;
+
+    std::thread* workers_;
+    WorkerQueue* queues_;
+    int worker_count_;
+
+    // Idle workers sleep until tasks are queued or the pool stops
+    std::mutex idle_mutex_;
+    std::condition_variable work_available_;
+    std::atomic<int> queued_tasks_;
+    bool stopping_;
+
+    // Queue that receives the first task of the next batch, so consecutive batches don't all start on the same worker
+    std::atomic<unsigned int> next_queue_;
+  };
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+////////////////////////////////////////////////////////////////////////
+// HeatmapEventQueue.cpp: Asynchronous logging front-end of a HeatmapService
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#include "HeatmapEventQueue.h"
+#include "EventAggregator.h"
+
+namespace heatmap_service
+{
+  // As with HeatmapService, the queue only passes its arguments on to the inner EventAggregator
+  HeatmapEventQueue::HeatmapEventQueue(HeatmapService &heatmap, int capacity, HeatmapQueueBackpressure backpressure) :
+    aggregator_(new EventAggregator(heatmap, capacity, backpressure)){}
+
+  HeatmapEventQueue::~HeatmapEventQueue()
+  {
+    delete(aggregator_);
+  }
+
+  // -- Counter registration
+  int HeatmapEventQueue::RegisterCounter(const std::string &counter_key)
+  {
+    return aggregator_->RegisterCounter(counter_key);
+  }
+
+  // -- Heatmap activity logging methods. Not timed, reading the clock would cost more than pushing the event
+  bool HeatmapEventQueue::IncrementMapCounter(HeatmapCoordinate coords, int counter_index)
+  {
+    return IncrementMapCounterByAmount(coords, counter_index, 1);
+  }
+
+  bool HeatmapEventQueue::IncrementMapCounterByAmount(HeatmapCoordinate coords, int counter_index, int add_amount)
+  {
+    if (!aggregator_->IsRegisteredCounter(counter_index))
+      return false;
+
+    EventAggregator::QueuedEvent event = { coords, counter_index, add_amount };
+    return aggregator_->Push(event);
+  }
+
+  // -- Consistent reads
+  void HeatmapEventQueue::Flush()
+  {
+    aggregator_->Flush();
+  }
+
+  void HeatmapEventQueue::Snapshot(HeatmapService &out_snapshot)
+  {
+    aggregator_->Snapshot(out_snapshot);
+  }
+
+  // -- Queue state
+  unsigned long long HeatmapEventQueue::dropped_event_count() const
+  {
+    return aggregator_->dropped_event_count();
+  }
+
+  int HeatmapEventQueue::capacity() const
+  {
+    return aggregator_->capacity();
+  }
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+////////////////////////////////////////////////////////////////////////
+// HeatmapEventQueue.h: Asynchronous logging front-end of a HeatmapService
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <string>
+#include "HeatmapServiceTypes.h"
+
+namespace heatmap_service
+{
+  // Forward declarations of the heatmap the queue logs into, and of the private implementation of the queue
+  class HeatmapService;
+  class EventAggregator;
+
+  // The HeatmapEventQueue class logs into a HeatmapService from any amount of threads without ever touching its counters on the logging threads.
+  // Logging only pushes the event into a lock free ring buffer, a compare and swap and a write of a few bytes, while a background thread owned by the queue
+  // drains the ring in batches and adds them to the heatmap. Logging threads never wait on a lock, a cache miss in the counters or the heatmap growing.
+  // While the queue exists, only its thread may write to the heatmap, and reading it is only consistent through Flush or Snapshot.
+  // The heatmap must outlive the queue, and nothing may be pushed once the queue starts being destroyed
+  class HeatmapEventQueue
+  {
+  public:
+    static const int kDefaultCapacity = 64 * 1024;
+
+    // The capacity is the amount of events the ring holds, rounded up to a power of two. Backpressure chooses what happens to events pushed
+    // while it's full (see HeatmapQueueBackpressure)
+    explicit HeatmapEventQueue(HeatmapService &heatmap, int capacity = kDefaultCapacity, HeatmapQueueBackpressure backpressure = kBlockWhenFull);
+    // Adds every event still queued to the heatmap before returning
+    ~HeatmapEventQueue();
+
+    // -- Counter registration
+    // Events name their counter by the index returned here, so logging never copies or compares strings. Registering the same key again returns the same index.
+    // Thread safe, but takes a lock, so counters are best registered once, before logging starts
+    int RegisterCounter(const std::string &counter_key);
+
+    // -- Heatmap activity logging methods, as in HeatmapService
+    // Return false if the counter index wasn't registered, or if the event was dropped because the ring was full
+    bool IncrementMapCounter(HeatmapCoordinate coords, int counter_index);
+    bool IncrementMapCounterByAmount(HeatmapCoordinate coords, int counter_index, int add_amount);
+
+    // -- Consistent reads
+    // Flush returns once every event pushed before it was called is in the heatmap. Once it returns, the heatmap can be read directly
+    // as long as no thread is logging, otherwise Snapshot should be used
+    void Flush();
+    // Flushes, then copies the heatmap into out_snapshot between two batches of the background thread. As with any copy of a HeatmapService,
+    // the snapshot shares the storage of the heatmap, and can be read from any thread while logging carries on
+    void Snapshot(HeatmapService &out_snapshot);
+
+    // -- Queue state
+    // Events dropped with kCountDropsWhenFull since the queue was created
+    unsigned long long dropped_event_count() const;
+    int capacity() const;
+
+  private:
+    HeatmapEventQueue(const HeatmapEventQueue&);
+    HeatmapEventQueue& operator=(const HeatmapEventQueue&);
+
+    // Internal implementation of the queue, hidden from the library header as with HeatmapService
+    EventAggregator* aggregator_;
+  };
+}
\ No newline at end of file
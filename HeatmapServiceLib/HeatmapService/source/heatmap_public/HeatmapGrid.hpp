@@ -0,0 +1,126 @@
+////////////////////////////////////////////////////////////////////////
+// HeatmapGrid.hpp: Heatmap front-end whose spatial resolution is known at compile time
+// Templated, so the implementation lives in the header
+// Written by: Pedro Engana (http://pedroengana.com)
+////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <cmath>
+#include <string>
+#include <type_traits>
+
+#include "HeatmapService.h"
+
+namespace heatmap_service
+{
+  namespace grid_internal
+  {
+    // Compile time log2 of a power of two
+    template <int N>
+    struct Log2 { static const int value = 1 + Log2<N / 2>::value; };
+    template <>
+    struct Log2<1> { static const int value = 0; };
+
+    // Floors a coordinate divided by the cell size, the same as the runtime resolution of HeatmapService does with doubles.
+    // Chosen at compile time by the type of the coordinate and whether the cell size is a power of two
+    template <int Cell, typename Coord, bool IsInteger = std::is_integral<Coord>::value, bool IsPowerOfTwo = (Cell & (Cell - 1)) == 0>
+    struct AxisQuantizer;
+
+    // Integer coordinates, power of two cells: an arithmetic shift right, which floors negative coordinates too
+    // (right shifting negative values is implementation defined, but arithmetic on every compiler the library builds with)
+    template <int Cell, typename Coord>
+    struct AxisQuantizer<Cell, Coord, true, true>
+    {
+      static int ToCell(Coord value) { return (int)(value >> Log2<Cell>::value); }
+    };
+
+    // Integer coordinates, any other cell: division by a constant, which compilers turn into a multiply by its reciprocal.
+    // Division truncates towards zero, so negative coordinates that aren't a multiple of the cell move one cell down
+    template <int Cell, typename Coord>
+    struct AxisQuantizer<Cell, Coord, true, false>
+    {
+      static int ToCell(Coord value)
+      {
+        Coord quotient = value / Cell;
+        return (int)(value % Cell < 0 ? quotient - 1 : quotient);
+      }
+    };
+
+    // Floating point coordinates, power of two cells: the reciprocal is exact, so multiplying by it gives the same result as dividing
+    template <int Cell, typename Coord>
+    struct AxisQuantizer<Cell, Coord, false, true>
+    {
+      static int ToCell(Coord value) { return (int)std::floor(value * (Coord(1) / Cell)); }
+    };
+
+    // Floating point coordinates, any other cell: the reciprocal isn't exact, and would floor multiples of the cell to the cell below
+    template <int Cell, typename Coord>
+    struct AxisQuantizer<Cell, Coord, false, false>
+    {
+      static int ToCell(Coord value) { return (int)std::floor(value / Cell); }
+    };
+  }
+
+  // The HeatmapGrid class is a HeatmapService whose spatial resolution, CellWidth by CellHeight, is fixed at compile time.
+  // HeatmapService divides every coordinate by its resolution at runtime, two double divisions and two floors per event. HeatmapGrid knows
+  // its cell size and coordinate type when compiled, so integer coordinates with power of two cells are quantized with two shifts,
+  // other integer cells with a multiply by the reciprocal, and only fractional coordinates still need a floor.
+  // The counters are stored in the HeatmapService returned by service(), a regular one with the same resolution, so everything else it offers
+  // (area queries, smoothing, rendering, statistics, serialization, snapshots) works on the grid's data, and reads back the same values.
+  template <int CellWidth, int CellHeight, typename Coord = int32_t>
+  class HeatmapGrid
+  {
+    static_assert(CellWidth > 0 && CellHeight > 0, "HeatmapGrid cells must have a positive size");
+    static_assert(std::is_arithmetic<Coord>::value, "HeatmapGrid coordinates must be integer or floating point");
+
+    typedef grid_internal::AxisQuantizer<CellWidth, Coord> QuantizerX;
+    typedef grid_internal::AxisQuantizer<CellHeight, Coord> QuantizerY;
+
+  public:
+    static const int kCellWidth = CellWidth;
+    static const int kCellHeight = CellHeight;
+
+    HeatmapGrid() : service_(CellWidth, CellHeight) {}
+
+    // -- Quantization of world coordinates into cell coordinates
+    static int CellX(Coord x) { return QuantizerX::ToCell(x); }
+    static int CellY(Coord y) { return QuantizerY::ToCell(y); }
+
+    // -- Heatmap activity logging methods, as in HeatmapService
+    bool IncrementMapCounter(Coord x, Coord y, const std::string &counter_key)
+    {
+      return service_.IncrementCellCounterByAmount(CellX(x), CellY(y), counter_key, 1);
+    }
+
+    bool IncrementMapCounterByAmount(Coord x, Coord y, const std::string &counter_key, int add_amount)
+    {
+      return service_.IncrementCellCounterByAmount(CellX(x), CellY(y), counter_key, add_amount);
+    }
+
+    // -- Heatmap query methods, as in HeatmapService
+    unsigned int getCounterAtPosition(Coord x, Coord y, const std::string &counter_key) const
+    {
+      return service_.getCounterAtCell(CellX(x), CellY(y), counter_key);
+    }
+
+    // The corners are passed to the service as the lower left corners of their cells, which it quantizes back to the exact same cells
+    bool getCounterDataInsideRect(Coord lower_left_x, Coord lower_left_y, Coord upper_right_x, Coord upper_right_y,
+                                  const std::string &counter_key, HeatmapData &out_data) const
+    {
+      return service_.getCounterDataInsideRect(CellCorner(lower_left_x, lower_left_y), CellCorner(upper_right_x, upper_right_y), counter_key, out_data);
+    }
+
+    // -- The HeatmapService holding the counters
+    HeatmapService& service() { return service_; }
+    const HeatmapService& service() const { return service_; }
+
+  private:
+    static HeatmapCoordinate CellCorner(Coord x, Coord y)
+    {
+      HeatmapCoordinate corner = { (double)CellX(x) * CellWidth, (double)CellY(y) * CellHeight };
+      return corner;
+    }
+
+    HeatmapService service_;
+  };
+}
\ No newline at end of file
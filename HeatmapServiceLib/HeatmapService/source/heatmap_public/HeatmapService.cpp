@@ -6,6 +6,9 @@
 #include <iostream>
 #include "HeatmapService.h"
 #include "HeatmapPrivate.h"
+#include "HeatmapRendering.h"
+#include "Instrumentation.h"
+#include "WorkerPool.h"
 
 namespace heatmap_service
 {
@@ -16,6 +19,8 @@ namespace heatmap_service
   HeatmapService::HeatmapService(double smallest_spatial_unit_size) : private_heatmap_(new HeatmapPrivate(smallest_spatial_unit_size)){}
   HeatmapService::HeatmapService(double smallest_spatial_unit_width, 
                                  double smallest_spatial_unit_height) : private_heatmap_(new HeatmapPrivate(smallest_spatial_unit_width, smallest_spatial_unit_height)){}
+  HeatmapService::HeatmapService(double smallest_spatial_unit_width, double smallest_spatial_unit_height, HeatmapStorageLayout storage_layout) :
+    private_heatmap_(new HeatmapPrivate(smallest_spatial_unit_width, smallest_spatial_unit_height, storage_layout)){}
   HeatmapService::HeatmapService(const HeatmapService& copy) : private_heatmap_(new HeatmapPrivate(*copy.private_heatmap_)){}
 
   HeatmapService& HeatmapService::operator=(const HeatmapService& copy)
@@ -44,6 +49,11 @@ namespace heatmap_service
     return private_heatmap_->single_unit_width();
   }
 
+  HeatmapStorageLayout HeatmapService::storage_layout() const
+  {
+    return private_heatmap_->storage_layout();
+  }
+
   // -- Counter queries
   bool HeatmapService::hasMapForCounter(const std::string &counter_key) const
   {
@@ -53,46 +63,334 @@ namespace heatmap_service
   // -- Heatmap activity logging methods
   bool HeatmapService::IncrementMapCounter(HeatmapCoordinate coords, const std::string &counter_key)
   {
+    HEATMAP_TIME_OPERATION(kIncrementOperation);
     return private_heatmap_->IncrementMapCounter(coords, counter_key);
   }
 
   bool HeatmapService::IncrementMapCounterByAmount(HeatmapCoordinate coords, const std::string &counter_key, int add_amount)
   {
+    HEATMAP_TIME_OPERATION(kIncrementOperation);
     return private_heatmap_->IncrementMapCounterByAmount(coords, counter_key, add_amount);
   }
 
   bool HeatmapService::IncrementMultipleMapCountersByAmount(HeatmapCoordinate coords, const std::string counter_keys[], int amounts[], int counter_keys_length)
   {
+    HEATMAP_TIME_OPERATION(kIncrementOperation);
     return private_heatmap_->IncrementMultipleMapCountersByAmount(coords, counter_keys, amounts, counter_keys_length);
   }
 
+  bool HeatmapService::IncrementCellCounterByAmount(int cell_x, int cell_y, const std::string &counter_key, int add_amount)
+  {
+    HEATMAP_TIME_OPERATION(kIncrementOperation);
+    return private_heatmap_->IncrementCellCounterByAmount(cell_x, cell_y, counter_key, add_amount);
+  }
+
+  bool HeatmapService::BuildDiskSplatKernel(double radius, int amount, HeatmapSplatKernel &out_kernel) const
+  {
+    return private_heatmap_->BuildDiskSplatKernel(radius, amount, out_kernel);
+  }
+
+  bool HeatmapService::BuildGaussianSplatKernel(double standard_deviation, int peak_amount, HeatmapSplatKernel &out_kernel) const
+  {
+    return private_heatmap_->BuildGaussianSplatKernel(standard_deviation, peak_amount, out_kernel);
+  }
+
+  bool HeatmapService::SplatMapCounter(HeatmapCoordinate coords, const HeatmapSplatKernel &kernel, const std::string &counter_key)
+  {
+    HEATMAP_TIME_OPERATION(kIncrementOperation);
+    return private_heatmap_->SplatMapCounter(coords, kernel, counter_key);
+  }
+
+  bool HeatmapService::IncrementTrajectory(const HeatmapCoordinate points[], int point_count, const std::string &counter_key, HeatmapRevisitPolicy revisit_policy)
+  {
+    HEATMAP_TIME_OPERATION(kIncrementOperation);
+    return private_heatmap_->IncrementTrajectory(points, point_count, counter_key, revisit_policy);
+  }
+
+  bool HeatmapService::IncrementTrajectories(const HeatmapTrajectory trajectories[], int trajectory_count, const std::string &counter_key, HeatmapRevisitPolicy revisit_policy)
+  {
+    HEATMAP_TIME_OPERATION(kIncrementOperation);
+    return private_heatmap_->IncrementTrajectories(trajectories, trajectory_count, counter_key, revisit_policy);
+  }
+
   // -- Heatmap query methods
   unsigned int HeatmapService::getCounterAtPosition(HeatmapCoordinate coords, const std::string &counter_key) const
   {
+    HEATMAP_TIME_OPERATION(kPointQueryOperation);
     return private_heatmap_->getCounterAtPosition(coords, counter_key);
   }
 
+  unsigned int HeatmapService::getCounterAtCell(int cell_x, int cell_y, const std::string &counter_key) const
+  {
+    HEATMAP_TIME_OPERATION(kPointQueryOperation);
+    return private_heatmap_->getCounterAtCell(cell_x, cell_y, counter_key);
+  }
+
   bool HeatmapService::getCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key, HeatmapData &out_data) const
   {
+    HEATMAP_TIME_OPERATION(kAreaQueryOperation);
     return private_heatmap_->getCounterDataInsideRect(lower_left, upper_right, counter_key, out_data);
   }
 
   bool HeatmapService::getAllCounterData(const std::string &counter_key, HeatmapData &out_data) const
   {
+    HEATMAP_TIME_OPERATION(kAreaQueryOperation);
     return private_heatmap_->getAllCounterData(counter_key, out_data);
   }
 
+  bool HeatmapService::getMultipleCountersDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string counter_keys[],
+                                                         int counter_keys_length, HeatmapData out_data[]) const
+  {
+    HEATMAP_TIME_OPERATION(kAreaQueryOperation);
+    return private_heatmap_->getMultipleCountersDataInsideRect(lower_left, upper_right, counter_keys, counter_keys_length, out_data);
+  }
+
+  bool HeatmapService::getSparseCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key,
+                                                      HeatmapSparseData &out_data) const
+  {
+    HEATMAP_TIME_OPERATION(kAreaQueryOperation);
+    return private_heatmap_->getSparseCounterDataInsideRect(lower_left, upper_right, counter_key, out_data);
+  }
+
+  bool HeatmapService::getAllSparseCounterData(const std::string &counter_key, HeatmapSparseData &out_data) const
+  {
+    HEATMAP_TIME_OPERATION(kAreaQueryOperation);
+    return private_heatmap_->getAllSparseCounterData(counter_key, out_data);
+  }
+
+  bool HeatmapService::getCounterSumInsideRegion(const HeatmapRegion &region, const std::string &counter_key, unsigned long long &out_sum) const
+  {
+    HEATMAP_TIME_OPERATION(kAreaQueryOperation);
+    return private_heatmap_->getCounterSumInsideRegion(region, counter_key, out_sum);
+  }
+
+  bool HeatmapService::getCounterSummaryInsideRegion(const HeatmapRegion &region, const std::string &counter_key, HeatmapCounterSummary &out_summary) const
+  {
+    HEATMAP_TIME_OPERATION(kAreaQueryOperation);
+    return private_heatmap_->getCounterSummaryInsideRegion(region, counter_key, out_summary);
+  }
+
+  bool HeatmapService::getSparseCounterDataInsideRegion(const HeatmapRegion &region, const std::string &counter_key, HeatmapSparseData &out_data) const
+  {
+    HEATMAP_TIME_OPERATION(kAreaQueryOperation);
+    return private_heatmap_->getSparseCounterDataInsideRegion(region, counter_key, out_data);
+  }
+
+  bool HeatmapService::getSmoothedCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key,
+                                                        double kernel_radius, HeatmapSmoothingKernel kernel, HeatmapFloatData &out_data) const
+  {
+    HEATMAP_TIME_OPERATION(kSmoothedQueryOperation);
+    return private_heatmap_->getSmoothedCounterDataInsideRect(lower_left, upper_right, counter_key, kernel_radius, kernel, out_data);
+  }
+
+  // -- Derived maps
+  bool HeatmapService::getExpressionDataInsideRect(const std::string &expression, HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, HeatmapFloatData &out_data) const
+  {
+    HEATMAP_TIME_OPERATION(kAreaQueryOperation);
+    return private_heatmap_->getExpressionDataInsideRect(expression, lower_left, upper_right, out_data);
+  }
+
+  // -- Query result cache
+  void HeatmapService::SetQueryCacheCapacity(int entry_count)
+  {
+    private_heatmap_->SetQueryCacheCapacity(entry_count);
+  }
+
+  int HeatmapService::query_cache_capacity() const
+  {
+    return private_heatmap_->query_cache_capacity();
+  }
+
+  bool HeatmapService::getSharedCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key, HeatmapSharedData &out_data) const
+  {
+    HEATMAP_TIME_OPERATION(kAreaQueryOperation);
+    return private_heatmap_->getSharedCounterDataInsideRect(lower_left, upper_right, counter_key, out_data);
+  }
+
+  // -- Counter groups
+  bool HeatmapService::CreateCounterGroup(const std::string &group_key, const std::string counter_keys[], int counter_keys_length)
+  {
+    return private_heatmap_->CreateCounterGroup(group_key, counter_keys, counter_keys_length);
+  }
+
+  bool HeatmapService::hasCounterGroup(const std::string &group_key) const
+  {
+    return private_heatmap_->hasCounterGroup(group_key);
+  }
+
+  bool HeatmapService::getCounterGroupKeys(const std::string &group_key, std::vector<std::string> &out_counter_keys) const
+  {
+    return private_heatmap_->getCounterGroupKeys(group_key, out_counter_keys);
+  }
+
+  bool HeatmapService::IncrementCounterGroupByAmounts(HeatmapCoordinate coords, const std::string &group_key, const int amounts[])
+  {
+    HEATMAP_TIME_OPERATION(kIncrementOperation);
+    return private_heatmap_->IncrementCounterGroupByAmounts(coords, group_key, amounts);
+  }
+
+  unsigned int HeatmapService::getCounterGroupValueAtPosition(HeatmapCoordinate coords, const std::string &group_key, const std::string &counter_key) const
+  {
+    HEATMAP_TIME_OPERATION(kPointQueryOperation);
+    return private_heatmap_->getCounterGroupValueAtPosition(coords, group_key, counter_key);
+  }
+
+  bool HeatmapService::getCounterGroupDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &group_key, HeatmapData out_data[]) const
+  {
+    HEATMAP_TIME_OPERATION(kAreaQueryOperation);
+    return private_heatmap_->getCounterGroupDataInsideRect(lower_left, upper_right, group_key, out_data);
+  }
+
+  // -- Heatmap rendering
+  bool HeatmapService::RenderCounterToImage(const std::string &counter_key, const std::string &file_path, const HeatmapRenderOptions &options) const
+  {
+    HEATMAP_TIME_OPERATION(kRenderOperation);
+    return private_heatmap_->RenderCounterToImage(counter_key, file_path, options);
+  }
+
+  bool HeatmapService::RenderCounterToTilePyramid(const std::string &counter_key, const std::string &directory, const HeatmapRenderOptions &options) const
+  {
+    HEATMAP_TIME_OPERATION(kRenderOperation);
+    return private_heatmap_->RenderCounterToTilePyramid(counter_key, directory, options);
+  }
+
   // -- Heatmap serialization
   bool HeatmapService::SerializeHeatmap(char* &out_buffer, int &out_length) const
   {
+    HEATMAP_TIME_OPERATION(kSerializeOperation);
     return private_heatmap_->SerializeHeatmap(out_buffer, out_length);
   }
 
   bool HeatmapService::DeserializeHeatmap(const char* &in_buffer, int in_length)
   {
+    HEATMAP_TIME_OPERATION(kDeserializeOperation);
     return private_heatmap_->DeserializeHeatmap(in_buffer, in_length);
   }
 
+  // Only the snapshot taken on the calling thread is timed, the checkpoint is written in the background
+  std::future<bool> HeatmapService::CheckpointTo(const std::string &file_path, std::function<void(bool)> on_complete)
+  {
+    HEATMAP_TIME_OPERATION(kCheckpointOperation);
+    return private_heatmap_->CheckpointTo(file_path, on_complete);
+  }
+
+  bool HeatmapService::LoadHeatmapLazily(const char* in_buffer, int in_length)
+  {
+    HEATMAP_TIME_OPERATION(kDeserializeOperation);
+    return private_heatmap_->LoadHeatmapLazily(in_buffer, in_length);
+  }
+
+  bool HeatmapService::LoadHeatmapFileLazily(const std::string &file_path)
+  {
+    HEATMAP_TIME_OPERATION(kDeserializeOperation);
+    return private_heatmap_->LoadHeatmapFileLazily(file_path);
+  }
+
+  // -- Merging and bulk ingestion. Not timed, a single call adds as many counters as millions of increments
+  bool HeatmapService::Rebin(double new_unit_width, double new_unit_height)
+  {
+    return private_heatmap_->Rebin(new_unit_width, new_unit_height);
+  }
+
+  bool HeatmapService::MergeHeatmap(const HeatmapService& other)
+  {
+    return private_heatmap_->MergeHeatmap(*other.private_heatmap_);
+  }
+
+  bool HeatmapService::IngestEventFile(const std::string &file_path, HeatmapEventFormat format, HeatmapIngestResult &out_result)
+  {
+    return private_heatmap_->IngestEventFile(file_path, format, out_result);
+  }
+
+  bool HeatmapService::IngestEventBuffer(const char* buffer, size_t length, HeatmapEventFormat format, HeatmapIngestResult &out_result)
+  {
+    return private_heatmap_->IngestEventBuffer(buffer, length, format, out_result);
+  }
+
+  // -- Heatmap statistics
+  HeatmapStats HeatmapService::GetStats() const
+  {
+    HEATMAP_TIME_OPERATION(kStatsOperation);
+    return private_heatmap_->GetStats();
+  }
+
+  bool HeatmapService::GetCounterStats(const std::string &counter_key, HeatmapCounterStats &out_stats) const
+  {
+    HEATMAP_TIME_OPERATION(kStatsOperation);
+    return private_heatmap_->GetCounterStats(counter_key, out_stats);
+  }
+
+  bool HeatmapService::getCounterSummary(const std::string &counter_key, HeatmapCounterSummary &out_summary) const
+  {
+    HEATMAP_TIME_OPERATION(kStatsOperation);
+    return private_heatmap_->getCounterSummary(counter_key, out_summary);
+  }
+
+  // -- Worker threads
+  // The pool is shared by every heatmap, so these are static and go straight to it
+  void HeatmapService::SetWorkerThreadCount(int worker_count)
+  {
+    WorkerPool::Instance().SetWorkerCount(worker_count);
+  }
+
+  int HeatmapService::worker_thread_count()
+  {
+    return WorkerPool::Instance().worker_count();
+  }
+
+  // -- Instrumentation
+  // Like the worker pool, the histograms and the event hook are shared by every heatmap.
+  // Without HEATMAP_SERVICE_INSTRUMENTATION these do nothing
+  bool HeatmapService::instrumentation_available()
+  {
+#ifdef HEATMAP_SERVICE_INSTRUMENTATION
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void HeatmapService::EnableLatencyHistograms(bool enabled)
+  {
+#ifdef HEATMAP_SERVICE_INSTRUMENTATION
+    Instrumentation::Instance().EnableLatencyHistograms(enabled);
+#endif
+  }
+
+  void HeatmapService::ResetLatencyHistograms()
+  {
+#ifdef HEATMAP_SERVICE_INSTRUMENTATION
+    Instrumentation::Instance().ResetLatencyHistograms();
+#endif
+  }
+
+  bool HeatmapService::GetLatencySummary(HeatmapOperation operation, HeatmapLatencySummary &out_summary)
+  {
+#ifdef HEATMAP_SERVICE_INSTRUMENTATION
+    if (operation < 0 || operation >= kHeatmapOperationCount)
+      return false;
+    Instrumentation::Instance().GetLatencySummary(operation, out_summary);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void HeatmapService::SetSlowOperationThreshold(HeatmapOperation operation, double nanoseconds)
+  {
+#ifdef HEATMAP_SERVICE_INSTRUMENTATION
+    if (operation >= 0 && operation < kHeatmapOperationCount)
+      Instrumentation::Instance().SetSlowOperationThreshold(operation, nanoseconds);
+#endif
+  }
+
+  void HeatmapService::SetEventHook(HeatmapEventHook* hook)
+  {
+#ifdef HEATMAP_SERVICE_INSTRUMENTATION
+    Instrumentation::Instance().SetEventHook(hook);
+#endif
+  }
+
   // -- Utility Functions
   // Since this is a static utility function with no bindings to internal implementations, it's defined outside of the pimpl idiom.
   void HeatmapService::PrintHeatmapData(const heatmap_service::HeatmapData &data)
@@ -110,4 +408,15 @@ namespace heatmap_service
     }
     std::cout << std::endl << "---------------------------------------" << std::endl;
   }
+
+  // Like PrintHeatmapData, rendering query results has no bindings to internal implementations
+  bool HeatmapService::RenderHeatmapData(const heatmap_service::HeatmapData &data, const std::string &file_path, const HeatmapRenderOptions &options)
+  {
+    if (!RenderValueColumns(data.heatmap_data, (int)data.data_size.width, (int)data.data_size.height, options, file_path))
+    {
+      std::cout << "[HEATMAP_SERVICE] ERROR: Could not render heatmap data to image \"" << file_path << "\"" << std::endl;
+      return false;
+    }
+    return true;
+  }
 }
\ No newline at end of file
@@ -4,7 +4,10 @@
 ////////////////////////////////////////////////////////////////////////
 
 #pragma once
+#include <functional>
+#include <future>
 #include <string>
+#include <vector>
 #include "HeatmapServiceTypes.h"
 
 namespace heatmap_service
@@ -25,6 +28,12 @@ namespace heatmap_service
     HeatmapService();
     explicit HeatmapService(double smallest_spatial_unit_size);
     HeatmapService(double smallest_spatial_unit_width, double smallest_spatial_unit_height);
+    // The storage layout changes how the counters are kept in memory, see HeatmapStorageLayout. Both layouts behave the same and store the same data,
+    // serialized heatmaps can be loaded into either, and the default constructors use kColumnStorageLayout
+    HeatmapService(double smallest_spatial_unit_width, double smallest_spatial_unit_height, HeatmapStorageLayout storage_layout);
+    // Copying a Heatmap makes a snapshot of it. The copy shares the storage of the original, column by column, and a column is only
+    // duplicated when either heatmap writes to it, so copying costs O(columns) rather than O(counters), and memory is only spent on what changes.
+    // A snapshot can be queried from other threads while the original keeps logging, as long as the copy itself is made from the logging thread
     HeatmapService(const HeatmapService& copy);
     HeatmapService& operator=(const HeatmapService& copy);
 
@@ -35,6 +44,8 @@ namespace heatmap_service
     double single_unit_width() const;
     HeatmapSize single_unit_size() const;
 
+    HeatmapStorageLayout storage_layout() const;
+
     // -- Queries if a certain counter has ever been added to the heatmap
     bool hasMapForCounter(const std::string &counter_key) const;
 
@@ -50,14 +61,43 @@ namespace heatmap_service
     // It can be convenient to log to several different counters at the same time for the same coordinate (deaths, gold lost, etc...), this function provides syntax sugar for those situations
     bool IncrementMultipleMapCountersByAmount(HeatmapCoordinate coords, const std::string counter_keys[], int amounts[], int counter_keys_length);
 
+    // Adds to the counter of a unit of space given by its cell coordinates, the world coordinates divided by the spatial resolution and floored.
+    // Meant for callers that already quantized their coordinates, such as HeatmapGrid, which does it at compile time
+    bool IncrementCellCounterByAmount(int cell_x, int cell_y, const std::string &counter_key, int add_amount);
+
+    // Build splat kernels for this heatmap's spatial resolution, adding amount to every unit of space whose center is within radius of the center of
+    // the unit splatted on, or peak_amount weighted by a gaussian of the distance between both centers, reaching as far as 3 standard deviations.
+    // Return false if the radius or standard deviation is negative or not finite, the amount isn't positive, or the kernel would hold over 16M units
+    bool BuildDiskSplatKernel(double radius, int amount, HeatmapSplatKernel &out_kernel) const;
+    bool BuildGaussianSplatKernel(double standard_deviation, int peak_amount, HeatmapSplatKernel &out_kernel) const;
+
+    // Adds the weights of kernel to the units of space around coords, for events reaching an area, centering the kernel on the unit coords lands in.
+    // The map grows once for the whole kernel and each column of the map once for its part of it, so a splat costs about as much as writing a rectangle
+    // of the kernel's size, rather than one increment per unit. Returns false if the weights don't match the kernel size, or the kernel reaches beyond
+    // the range of the map, and false if the map can't grow, with part of the kernel added
+    bool SplatMapCounter(HeatmapCoordinate coords, const HeatmapSplatKernel &kernel, const std::string &counter_key);
+
+    // Increments by one every unit of space crossed by the polyline through points, a path walked by a player for instance. The grid is walked
+    // from cell to cell along each segment, so no cell is skipped however far apart the points are, at a cost of one step per cell crossed.
+    // revisit_policy tells whether the cells the path comes back to are counted every time, or once. Returns false, registering nothing,
+    // if there are no points or a point isn't finite or lies beyond the range of cell coordinates, and false if the map can't grow, with part of the path registered
+    bool IncrementTrajectory(const HeatmapCoordinate points[], int point_count, const std::string &counter_key, HeatmapRevisitPolicy revisit_policy);
+
+    // Registers many trajectories in the same counter, as IncrementTrajectory does for each, looking up the counter map once. An invalid trajectory
+    // makes it return false before anything is registered
+    bool IncrementTrajectories(const HeatmapTrajectory trajectories[], int trajectory_count, const std::string &counter_key, HeatmapRevisitPolicy revisit_policy);
+
 
     // -- Heatmap query methods
     // Similar to the logging methods, these fetch the heatmap values for any given counter. If data is requested from a counter that doesn't yet exist, or
     // if the provided coordinate was never previously logged, the return will be 0.
     // Querying a single coordinate inside a counter map has O(1) complexity, 
-    // Querying an area, inside a counter map, will naturally have O(n) where n = width*height.
+    // Querying an area, inside a counter map, will naturally have O(n) where n = width*height. Large areas are split in strips of columns across the worker threads.
     unsigned int getCounterAtPosition(HeatmapCoordinate coords, const std::string &counter_key) const;
 
+    // Returns the counter of a unit of space given by its cell coordinates, as in IncrementCellCounterByAmount
+    unsigned int getCounterAtCell(int cell_x, int cell_y, const std::string &counter_key) const;
+
     // These methods fetch an area of the heatmap instead of a single point. The data is returned via the HeatmapData output parameter and the function returns true if successful.
     // Its the responsibility of the function that calls this to destroy HeatmapData when it no longer needs to be used
     bool getCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key, HeatmapData &out_data) const;
@@ -66,24 +106,202 @@ namespace heatmap_service
     // The counter value for any coordinate outside the area returned by this function is 0
     bool getAllCounterData(const std::string &counter_key, HeatmapData &out_data) const;
 
+    // It can be convenient to fetch the same area for several counters at once (deaths, gold lost, etc...), the counters are then queried in parallel.
+    // Out_data must hold counter_keys_length HeatmapData. Either every counter is returned and the function returns true, or none is
+    bool getMultipleCountersDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string counter_keys[],
+                                           int counter_keys_length, HeatmapData out_data[]) const;
+
+    // Sparse versions of getCounterDataInsideRect and getAllCounterData, returning only the cells whose counter isn't 0 as lists of (x, y, value),
+    // with the exact bounding box of those cells (see HeatmapSparseData). Counters logged in a few places of a big world come back in the memory of those cells,
+    // rather than a matrix of everything in between. Regions that don't exist, and the blocks of cells their occupancy bitmaps know are empty, aren't read,
+    // so the cost follows the cells that were written to rather than the area
+    bool getSparseCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key, HeatmapSparseData &out_data) const;
+    bool getAllSparseCounterData(const std::string &counter_key, HeatmapSparseData &out_data) const;
+
+    // Region queries read the cells inside a circle or a polygon (see HeatmapRegion) instead of a rectangle: the sum of their counters, the summary of their
+    // counters as getCounterSummary gives it for the whole counter, or the cells whose counter isn't 0, as the sparse queries list them.
+    // The region is rasterized into runs of cells along each column, and only those runs are read, skipping the empty blocks of cells as the sparse queries do,
+    // so a zone costs its own area rather than the rectangle around it. Tiles entirely inside the region are read without checking each cell against it,
+    // and regions holding every cell of the map answer the sum and the summary from the summary of the counter, in O(1) for circles.
+    // Return false if the counter doesn't exist or the region isn't valid (a negative radius, fewer than 3 vertices, or coordinates that aren't finite)
+    bool getCounterSumInsideRegion(const HeatmapRegion &region, const std::string &counter_key, unsigned long long &out_sum) const;
+    bool getCounterSummaryInsideRegion(const HeatmapRegion &region, const std::string &counter_key, HeatmapCounterSummary &out_summary) const;
+    bool getSparseCounterDataInsideRegion(const HeatmapRegion &region, const std::string &counter_key, HeatmapSparseData &out_data) const;
+
+    // Fetches an area of the heatmap, like getCounterDataInsideRect, but smoothed by a kernel of the given radius (in the same units as the coordinates).
+    // The counters up to a radius outside the rectangle are taken into account, so the edges of the area are smoothed the same as its center.
+    // The smoothing is split across threads. The caller is responsible for destroying the returned HeatmapFloatData
+    bool getSmoothedCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key,
+                                          double kernel_radius, HeatmapSmoothingKernel kernel, HeatmapFloatData &out_data) const;
+
+
+    // -- Query result cache
+    // Area queries of a single counter (getCounterDataInsideRect, getAllCounterData and getSharedCounterDataInsideRect) can keep their results in a cache
+    // of the entry_count most recently queried areas. Every column of a counter (every tile, with the Morton tile layout) carries a version that grows as it's written to,
+    // so a cached result is checked by comparing the versions of the regions under the area instead of reading its counters again, and is only used if none of them changed.
+    // Cached results cost the memory of the whole area each. 0 disables the cache, which is the default. Copies of the heatmap start with an empty cache of the same capacity
+    void SetQueryCacheCapacity(int entry_count);
+    int query_cache_capacity() const;
+
+    // Fetches an area like getCounterDataInsideRect, but returns the result the cache holds for it instead of a copy, so repeating the query on an area
+    // that didn't change costs a version per region instead of a copy of every cell. Works without the cache too, returning a result of its own.
+    // The result is read only, and is freed when the last HeatmapSharedData holding it goes, it must not be destroyed by the caller
+    bool getSharedCounterDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &counter_key, HeatmapSharedData &out_data) const;
+
+
+    // -- Counter groups
+    // Counters that are always logged at the same positions (deaths, gold lost, xp lost...) can be stored as a group, where the counters
+    // of a unit of space sit next to each other in memory. Logging every counter of the group is then a single lookup and a write to contiguous
+    // values, instead of a lookup and a separate map per counter, and an area query reads the group once for all of its counters.
+    // Groups are stored apart from the counters logged through the methods above, a counter of a group is only reachable through its group.
+    // CreateCounterGroup returns false if the group already exists, or the counter keys are empty or repeated
+    bool CreateCounterGroup(const std::string &group_key, const std::string counter_keys[], int counter_keys_length);
+    bool hasCounterGroup(const std::string &group_key) const;
+    // The counters of the group, in the order their amounts and data are given. Returns false if the group doesn't exist
+    bool getCounterGroupKeys(const std::string &group_key, std::vector<std::string> &out_counter_keys) const;
+
+    // Adds amounts[i] to the i-th counter of the group. Amounts must hold one value per counter of the group, zero or negative values leave their counter untouched
+    bool IncrementCounterGroupByAmounts(HeatmapCoordinate coords, const std::string &group_key, const int amounts[]);
+
+    // Returns 0 if the group, or the counter inside it, doesn't exist
+    unsigned int getCounterGroupValueAtPosition(HeatmapCoordinate coords, const std::string &group_key, const std::string &counter_key) const;
+
+    // Fetches an area for every counter of the group in one pass. Out_data must hold one HeatmapData per counter of the group, filled in the group's order.
+    // Either every counter is returned and the function returns true, or none is. The caller is responsible for destroying every returned HeatmapData
+    bool getCounterGroupDataInsideRect(HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, const std::string &group_key, HeatmapData out_data[]) const;
+
+
+    // -- Derived maps
+    // Fetches an area of a map derived from several counters by an expression, such as "kills / max(deaths, 1)" or "gold_obtained - gold_lost",
+    // evaluated cell by cell. Supports +, -, *, /, parentheses, constants, min(a, b), max(a, b) and abs(a), with counters named by their keys.
+    // The expression is evaluated in a single pass over the counters, column by column across the worker threads, instead of querying each counter first.
+    // Division follows floats, so cells divided by 0 are infinite or NaN. Returns false if the expression is invalid or any counter it uses doesn't exist.
+    // The returned counter_name is the expression. The caller is responsible for destroying the returned HeatmapFloatData
+    bool getExpressionDataInsideRect(const std::string &expression, HeatmapCoordinate lower_left, HeatmapCoordinate upper_right, HeatmapFloatData &out_data) const;
+
 
     // -- Heatmap serialization
     // The Heatmap can be serialized into a char* buffer. This buffer can be saved to a file and later restored with the serialize function
     // Serialization returns the buffer and it's size via the output parameters and returns true if successful, false if any error occurred.
     // Deserializing a char buffer into this map will firstly clean it of any data, and then load the serialized data in, 
     // make sure you saved your current data before you deserialize into a Heatmap
+    // The buffer holds a table with the offset of every column of every counter, followed by the columns themselves, so deserializing loads the
+    // columns across the worker threads. Buffers serialized before the table existed still load, in a single thread.
+    // Deserializing a buffer with the table returns false, leaving the heatmap as it was, if the buffer is malformed or truncated, or the counters can't be allocated.
+    // Heatmaps serialize to at most 2GB, since the length of the buffer is an int
     // --- WARNING!: Serialization uses the boost serialization library
     // ---   More specifically, libboost_iostreams-vc120-mt-1_57.lib and libboost_serialization-vc120-mt-1_57.lib as well as the serialization and archive hpp headers.
     // ---   As such, boost exceptions will be launched upon errors or invalid input data
     bool SerializeHeatmap(char* &out_buffer, int &out_length) const;
     bool DeserializeHeatmap(const char* &in_buffer, int in_length);
 
+    // -- Checkpointing
+    // Writes the heatmap to file_path on a background thread, in the format of SerializeHeatmap, as it was when CheckpointTo was called.
+    // The calling thread only takes a snapshot of the heatmap, which shares its storage, so logging carries on while the checkpoint is written;
+    // the first write to each region shared with the snapshot copies it, leaving the snapshot untouched.
+    // The file is written next to file_path and renamed over it once complete, so a checkpoint that fails leaves the previous one in place.
+    // The future, and on_complete if given, tell whether the checkpoint was written. on_complete runs on the background thread before the future is ready,
+    // so it must be thread safe, and must not call back into this heatmap.
+    // One checkpoint is written at a time: calling CheckpointTo while the last one is still being written, on_complete included, fails right away.
+    // Destroying the heatmap waits for it
+    std::future<bool> CheckpointTo(const std::string &file_path, std::function<void(bool)> on_complete = nullptr);
+
+    // -- Lazy loading
+    // Loads only the counter table of a serialized heatmap, replacing the contents of this one as deserializing does, and loads each counter
+    // the first time it's read or written to. hasMapForCounter answers from the table, so a tool reading a couple of counters of a large heatmap
+    // only spends the time and memory of those. Operations on the whole heatmap, such as GetStats, SerializeHeatmap, Rebin and MergeHeatmap, load every counter.
+    // LoadHeatmapLazily reads counters from in_buffer, which must be kept alive and unchanged until this heatmap is deserialized or loaded again, or destroyed,
+    // along with every snapshot taken from it. LoadHeatmapFileLazily maps the file instead, and keeps it mapped for as long.
+    // Returns false if the table is malformed. A counter whose columns turn out to be malformed, or can't be allocated, is reported when first read and reads as empty.
+    // Buffers serialized before the counter table existed have nothing to load lazily from, and are deserialized whole
+    bool LoadHeatmapLazily(const char* in_buffer, int in_length);
+    bool LoadHeatmapFileLazily(const std::string &file_path);
+
+
+    // -- Rebinning
+    // Coarsens the spatial resolution of the heatmap to new_unit_width by new_unit_height, which must be whole multiples of the current width and height.
+    // Every block of cells that fits in a new cell is summed into it, so totals over any area aligned with the new cells are kept, and the old storage is freed
+    // once no snapshot shares it. Rebinning costs O(n), where n is the amount of counters stored, and needs room for the new storage while the old one is still held.
+    // Returns false, writing the reason to cout, if the new resolution isn't a multiple of the current one or the memory can't be allocated, leaving the heatmap as it was.
+    // A heatmap held by a HeatmapGrid must not be rebinned, as its resolution is fixed at compile time
+    bool Rebin(double new_unit_width, double new_unit_height);
+
+
+    // -- Merging and bulk ingestion
+    // Adds every counter of other to the counters of this heatmap, creating the ones it doesn't have yet. Counter groups are added to the group
+    // of the same key, or copied if this heatmap doesn't have it. Groups of the same key must hold the same counters. Heatmaps of different spatial resolutions
+    // are merged at the coarser of the two along each axis, which must be a whole multiple of the finer one: a finer other is rebinned on a snapshot of it,
+    // and a finer heatmap is rebinned itself, as Rebin does. Otherwise an error is written to cout, false is returned and nothing is merged.
+    // Counters that are still empty here take the storage of other, shared until either writes to it
+    bool MergeHeatmap(const HeatmapService& other);
+
+    // Adds every event of a log file in the given format (see HeatmapEventFormat) to this heatmap, as IncrementMapCounterByAmount would.
+    // The file is memory mapped and split in chunks parsed across the worker threads, each thread adding its events to a heatmap of its own,
+    // which are merged into this one once they finish. Returns false, writing the reason to cout, if the file can't be read or isn't in the given format;
+    // records that aren't events are skipped and counted in out_result. Events with an amount of 0 or less are read but don't change any counter
+    bool IngestEventFile(const std::string &file_path, HeatmapEventFormat format, HeatmapIngestResult &out_result);
+    // Same as IngestEventFile, for a log already in memory
+    bool IngestEventBuffer(const char* buffer, size_t length, HeatmapEventFormat format, HeatmapIngestResult &out_result);
+
+
+    // -- Heatmap statistics
+    // Reports the memory and activity of each counter, see HeatmapCounterStats. Keeping the statistics costs nothing on increments that don't allocate,
+    // but gathering them walks every counter stored, split across the worker threads, so they are meant to be polled rather than read on every frame.
+    // GetCounterStats returns false if the counter doesn't exist
+    HeatmapStats GetStats() const;
+    bool GetCounterStats(const std::string &counter_key, HeatmapCounterStats &out_stats) const;
+
+    // Total, highest value, non zero cell count and histogram of the values of a counter, see HeatmapCounterSummary. These are updated by every increment,
+    // merge, rebin, clear and deserialization, so reading them is O(1) and can be done as often as needed. Returns false if the counter doesn't exist
+    bool getCounterSummary(const std::string &counter_key, HeatmapCounterSummary &out_summary) const;
+
+
+    // -- Worker threads
+    // Area queries, smoothing and rendering split their work across a pool of worker threads shared by every HeatmapService.
+    // By default it has one worker less than the hardware threads, since the thread that calls a query works as well.
+    // Setting 0 workers makes the library synchronous, everything then runs on the calling thread.
+    // Resizing the pool waits for the queries running on other threads to finish first
+    static void SetWorkerThreadCount(int worker_count);
+    static int worker_thread_count();
+
+
+    // -- Instrumentation
+    // The library can time every public operation into a latency histogram per operation (see HeatmapOperation), shared by every HeatmapService of the process,
+    // and raise events such as storage growth, allocation failures and slow operations to a HeatmapEventHook.
+    // It's only built in when the library is compiled with HEATMAP_SERVICE_INSTRUMENTATION defined, otherwise instrumentation_available returns false,
+    // these methods do nothing, and operations cost exactly what they would without it. Built in, operations only read the clock
+    // while the histograms are enabled or a hook watches for slow operations, which adds tens of nanoseconds to each.
+    static bool instrumentation_available();
+    static void EnableLatencyHistograms(bool enabled);
+    static void ResetLatencyHistograms();
+    // Returns false if instrumentation isn't available
+    static bool GetLatencySummary(HeatmapOperation operation, HeatmapLatencySummary &out_summary);
+
+    // Operations that take longer than nanoseconds are reported to the hook through OnSlowOperation. 0 stops watching the operation
+    static void SetSlowOperationThreshold(HeatmapOperation operation, double nanoseconds);
+    // The hook isn't owned by the library, and must outlive its use. Pass nullptr to remove it
+    static void SetEventHook(HeatmapEventHook* hook);
+
 
     // -- Utility Functions
     // PrintHeatmapData is a static method that receives a heatmap data object and prints it's contents to the standard output.
     // Usefull to visually debug heatmap contents
     static void PrintHeatmapData(const heatmap_service::HeatmapData &data);
 
+
+    // -- Heatmap rendering
+    // Renders the entirety of the currently registered map data for a counter into a PNG or PPM image, one pixel per unit of space, with the highest y at the top.
+    // The image is colored and encoded across threads. Returns false if the counter doesn't exist or the image couldn't be written
+    bool RenderCounterToImage(const std::string &counter_key, const std::string &file_path, const HeatmapRenderOptions &options) const;
+
+    // Renders a counter into a z/x/y tile pyramid of options.tile_size pixel tiles, written to directory/zoom/x/y.png (or .ppm), ready to be served to web map viewers.
+    // The deepest zoom level has one pixel per unit of space, each level above halves the resolution, keeping the highest counter, until a single tile covers the map.
+    // Tiles without any counter aren't written. The directory is created if it doesn't exist, but its parent must
+    bool RenderCounterToTilePyramid(const std::string &counter_key, const std::string &directory, const HeatmapRenderOptions &options) const;
+
+    // RenderHeatmapData is a static method that renders the result of an area query into an image, like RenderCounterToImage
+    static bool RenderHeatmapData(const heatmap_service::HeatmapData &data, const std::string &file_path, const HeatmapRenderOptions &options);
+
   private:
     // Internal instance of the Heatmap. Use of the pimpl idiom to hide private and internal methods from the library header
     HeatmapPrivate* private_heatmap_;
@@ -4,6 +4,11 @@
 ////////////////////////////////////////////////////////////////////////
 
 #pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace heatmap_service
 {
   // Heatmap Service Types contains public structs used by the HeatmapService library API, to be used when calling its methods
@@ -32,4 +37,267 @@ namespace heatmap_service
     HeatmapSize data_size;
     unsigned int **heatmap_data;
   };
+
+  // Result of an area query shared with the query result cache of the heatmap, see HeatmapService::getSharedCounterDataInsideRect.
+  // It's read only, and its memory is freed once the last copy of the pointer goes, so it must not be destroyed like a HeatmapData
+  typedef std::shared_ptr<const HeatmapData> HeatmapSharedData;
+
+  // Return data structure for area queries whose values aren't whole counts, such as smoothed queries.
+  // Mirrors HeatmapData, but its matrix contains floats
+  struct HeatmapFloatData
+  {
+    std::string* counter_name;
+
+    HeatmapCoordinate lower_left_coordinate;
+    HeatmapSize spatial_resolution;
+
+    HeatmapSize data_size;
+    float **heatmap_data;
+  };
+
+  // Return data structure for sparse area queries, which list only the cells whose counter isn't 0 instead of a matrix of the whole area.
+  // Cell i is { cell_x[i], cell_y[i] }, in cell coordinates (the world coordinates divided by the spatial resolution and floored), and holds values[i].
+  // Cells are ordered by cell_x and then by cell_y. The lower left coordinate, in world coordinates, and the data size, in cells, are the tight bounding box
+  // of the cells listed, and are all zeros if there are none. The vectors free themselves, so the caller doesn't need to destroy it
+  struct HeatmapSparseData
+  {
+    std::string counter_name;
+
+    HeatmapCoordinate lower_left_coordinate;
+    HeatmapSize spatial_resolution;
+
+    HeatmapSize data_size;
+    std::vector<int> cell_x;
+    std::vector<int> cell_y;
+    std::vector<unsigned int> values;
+  };
+
+  // How trajectory ingestion counts the cells a trajectory passes through more than once. A trajectory staying inside a cell from one point to the next
+  // never counts it twice. kCountEveryVisit increments a cell every time the trajectory enters it, so ground walked back and forth weighs more,
+  // while kCountOncePerTrajectory increments every cell the trajectory crosses once, however often it comes back to it
+  enum HeatmapRevisitPolicy
+  {
+    kCountEveryVisit,
+    kCountOncePerTrajectory
+  };
+
+  // A polyline of point_count world coordinates, for the batch form of trajectory ingestion. The points aren't copied, and must outlive the call
+  struct HeatmapTrajectory
+  {
+    const HeatmapCoordinate* points;
+    int point_count;
+  };
+
+  // Weights a splat adds around the cell of a coordinate, for events reaching an area rather than a point, such as explosions or auras.
+  // Built by HeatmapService for disks and gaussians, or filled by hand. weights holds width*height weights column by column, the weight of cell { x, y }
+  // of the kernel being weights[x * height + y], and cell { width / 2, height / 2 } of the kernel lands on the cell of the coordinate
+  struct HeatmapSplatKernel
+  {
+    int width;
+    int height;
+    std::vector<unsigned int> weights;
+  };
+
+  enum HeatmapRegionShape
+  {
+    kCircleRegion,
+    kPolygonRegion
+  };
+
+  // Zone of the world read by the region queries, in world coordinates. Circles use center and radius, and polygons their vertices, in either winding,
+  // the last one joining the first. Polygons can be concave, and those crossing themselves follow the even-odd rule.
+  // The cells of the zone are those whose center lies inside it, counting the lower and left edges but not the upper and right ones,
+  // so zones that share an edge don't share any cell
+  struct HeatmapRegion
+  {
+    HeatmapRegionShape shape;
+    HeatmapCoordinate center;
+    double radius;
+    std::vector<HeatmapCoordinate> vertices;
+  };
+
+  // How the counters of each counter map are laid out in memory.
+  // kColumnStorageLayout keeps a vector per column, the fastest for increments spread over the whole map and for tall, narrow areas.
+  // kMortonTileStorageLayout keeps square tiles of 16 by 16 cells ordered along a Morton curve, so cells close to each other in any direction
+  // are close in memory, which favours trajectories and square areas
+  enum HeatmapStorageLayout
+  {
+    kColumnStorageLayout,
+    kMortonTileStorageLayout
+  };
+
+  // Kernels available to smooth area queries.
+  // kGaussianKernel applies a true gaussian, its cost per cell grows with the kernel radius.
+  // kBoxApproximatedGaussianKernel approximates the gaussian with three successive box blurs, its cost per cell doesn't depend on the radius
+  enum HeatmapSmoothingKernel
+  {
+    kGaussianKernel,
+    kBoxApproximatedGaussianKernel
+  };
+
+  // Color maps available to render heatmaps into images. Cells whose counter is 0 are always left transparent
+  enum HeatmapColorMap
+  {
+    kGrayscaleColorMap,
+    kHeatColorMap,
+    kViridisColorMap
+  };
+
+  // How counter values are spread over the colors of a color map.
+  // kLinearScaling splits the range from 0 to the highest counter evenly, kLogarithmicScaling gives more colors to the lower counters,
+  // and kQuantileScaling gives each color roughly the same amount of cells, which keeps detail when a few hotspots dwarf everything else
+  enum HeatmapValueScaling
+  {
+    kLinearScaling,
+    kLogarithmicScaling,
+    kQuantileScaling
+  };
+
+  enum HeatmapImageFormat
+  {
+    kPngImageFormat,
+    kPpmImageFormat
+  };
+
+  // Options used when rendering heatmaps into images. tile_size is only used by tile pyramids, and must be an even number of pixels
+  struct HeatmapRenderOptions
+  {
+    HeatmapColorMap color_map;
+    HeatmapValueScaling scaling;
+    HeatmapImageFormat format;
+    int tile_size;
+  };
+
+  // Memory and activity report of a single counter, returned by the GetStats methods.
+  // allocated_bytes is all the memory reserved to hold the counter, used_bytes the part of it already holding initialized counters, and the rest is
+  // room to grow into. shared_bytes is the part of allocated_bytes still shared with copies of the heatmap, which doesn't cost extra memory for each of them.
+  // Regions are the columns of the map that hold counters (the tiles, with the Morton tile layout), and sparse_region_count how many of those hold
+  // only the few cells written to instead of every cell between them. Reallocations count the times the columns, or the matrix of columns, grew into a new allocation,
+  // and bytes_copied what was copied by those and by the copy on write of shared columns, since the heatmap was created.
+  // The bounding box covers every non zero cell, in world coordinates, and is all zeros if the counter has none
+  struct HeatmapCounterStats
+  {
+    std::string counter_name;
+
+    unsigned long long allocated_bytes;
+    unsigned long long used_bytes;
+    unsigned long long shared_bytes;
+    int region_count;
+    int sparse_region_count;
+
+    unsigned long long reallocation_count;
+    unsigned long long copy_on_write_count;
+    unsigned long long bytes_copied;
+
+    unsigned long long nonzero_cell_count;
+    HeatmapCoordinate nonzero_lower_left;
+    HeatmapCoordinate nonzero_upper_right;
+  };
+
+  // Aggregates of the values of a counter, kept up to date as it's logged, for colour scaling and alerting without reading the counter.
+  // histogram[b] counts the cells holding a value from 2^b up to 2^(b+1) - 1, so its buckets cover every non zero cell
+  struct HeatmapCounterSummary
+  {
+    static const int kHistogramBuckets = 32;
+
+    std::string counter_name;
+
+    unsigned long long total;
+    unsigned int max_value;
+    unsigned long long nonzero_cell_count;
+    unsigned long long histogram[kHistogramBuckets];
+  };
+
+  // Stats of every counter of a heatmap, and the memory of all of them added together
+  struct HeatmapStats
+  {
+    std::vector<HeatmapCounterStats> counters;
+
+    unsigned long long allocated_bytes;
+    unsigned long long used_bytes;
+
+    // Area queries answered from the query result cache, and those that had to read the counters, since the heatmap was created
+    unsigned long long query_cache_hits;
+    unsigned long long query_cache_misses;
+  };
+
+  // Formats of the event logs read by the bulk ingestion of HeatmapService::IngestEventFile.
+  // kCsvEventFormat is one event per line, "x,y,counter_key" or "x,y,counter_key,amount", with the amount 1 when it's left out.
+  // kBinaryEventFormat starts with the 4 characters "HMEV", then a uint32 version (1) and a uint32 count of counter keys, each key stored as
+  // a uint32 length followed by its characters. Events follow, 24 bytes each: the double x, the double y, the uint32 index of the event's key and an int32 amount.
+  // Every number is little endian
+  enum HeatmapEventFormat
+  {
+    kCsvEventFormat,
+    kBinaryEventFormat
+  };
+
+  // Report of a bulk ingestion. Rejected records are the lines (or binary events) that couldn't be read as an event, such as a CSV header, or whose position
+  // falls outside the range of cells a heatmap holds, and are skipped without stopping the ingestion
+  struct HeatmapIngestResult
+  {
+    unsigned long long bytes_read;
+    unsigned long long events_ingested;
+    unsigned long long rejected_records;
+    double seconds;
+  };
+
+  // What a HeatmapEventQueue does with an event pushed while its ring buffer is full.
+  // kBlockWhenFull waits for the aggregator to make room, so no event is lost but the producer stalls.
+  // kDropWhenFull returns false straight away and forgets the event, kCountDropsWhenFull does the same but also counts it in dropped_event_count
+  enum HeatmapQueueBackpressure
+  {
+    kBlockWhenFull,
+    kDropWhenFull,
+    kCountDropsWhenFull
+  };
+
+  // Public operations of the HeatmapService timed by the latency histograms. Area queries include getAllCounterData and getMultipleCountersDataInsideRect.
+  // Checkpoints only time the snapshot taken on the calling thread
+  enum HeatmapOperation
+  {
+    kIncrementOperation,
+    kPointQueryOperation,
+    kAreaQueryOperation,
+    kSmoothedQueryOperation,
+    kRenderOperation,
+    kStatsOperation,
+    kSerializeOperation,
+    kDeserializeOperation,
+    kCheckpointOperation,
+    kHeatmapOperationCount
+  };
+
+  // Latencies of an operation recorded since the histograms were enabled or last reset, in nanoseconds.
+  // Percentiles are accurate to within about 3% of their value
+  struct HeatmapLatencySummary
+  {
+    HeatmapOperation operation;
+    unsigned long long count;
+
+    double mean_ns;
+    double p50_ns;
+    double p90_ns;
+    double p99_ns;
+    double p999_ns;
+    double max_ns;
+  };
+
+  // Receives events from inside the library, once installed through HeatmapService::SetEventHook. Override the events of interest, the rest do nothing.
+  // Events are raised on the thread that caused them, which may be a worker thread or a thread querying a snapshot, so hooks must be thread safe,
+  // and they must not call back into the heatmap that raised them
+  class HeatmapEventHook
+  {
+  public:
+    virtual ~HeatmapEventHook() {}
+
+    // The storage of a counter grew, or a column shared with a snapshot was copied, to register an increment in the unit of space whose lower left corner is coords. bytes_copied is what had to be copied
+    virtual void OnRegionGrowth(const std::string &counter_key, HeatmapCoordinate coords, unsigned long long bytes_copied) {}
+
+    // An operation on a counter failed because memory couldn't be allocated
+    virtual void OnAllocationFailure(HeatmapOperation operation, const std::string &counter_key) {}
+
+    // An operation took longer than the threshold set for it through HeatmapService::SetSlowOperationThreshold
+    virtual void OnSlowOperation(HeatmapOperation operation, double nanoseconds) {}
+  };
 }
\ No newline at end of file
@@ -4,10 +4,12 @@
 //////////////////////////////////////////////////////////////////////////////////////
 #include <iostream>
 #include <ctime>
+#include <string>
 #include "HeatmapService.h"
 
 #include "SignedIndexVectorTests.h"
 #include "SimpleHashmapTests.h"
+#include "FlatHashMapTests.h"
 #include "HeatmapTests.h"
 #include "HeatmapStressTests.h"
 
@@ -19,9 +21,17 @@ int main(int argc, char* argv[])
 {
   TestSIVAll();
   TestHashMapAll();
+  TestFlatHashMapAll();
   TestHeatmapAll();
   HeatmapStressTestAll();
 
+  // Automated runs pass --no-wait, as they may never close the console's input
+  if (argc > 1 && string(argv[1]) == "--no-wait")
+  {
+    cout << endl << "... Tests Finished ..." << endl;
+    return 0;
+  }
+
   cout << endl << "... Tests Finished, Press Enter to close ..." << endl;
   cin.get();
 
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "FlatHashMapTests.h"
+#include "FlatHashMap.hpp"
+#include "LinearSearchMap.hpp"
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+using namespace heatmap_service;
+
+namespace
+{
+  const int kManyKeys = 5000;
+
+  string ItemKey(int item)
+  {
+    stringstream key_stream;
+    key_stream << "item_" << item << "_picked_up";
+    return key_stream.str();
+  }
+}
+
+void TestFlatHashMapAll()
+{
+  cout << "######## Flat Hash Map Tests ########" << endl << endl;
+
+  cout << "TestFlatHashMapPlacementAndRetrieval: [" << (TestFlatHashMapPlacementAndRetrieval() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestFlatHashMapManyKeys: [" << (TestFlatHashMapManyKeys() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestFlatHashMapCollision: [" << (TestFlatHashMapCollision() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestFlatHashMapCopyAndSerialization: [" << (TestFlatHashMapCopyAndSerialization() ? "PASSED" : "FAILED") << "]" << endl;
+
+  cout << endl;
+}
+
+bool TestFlatHashMapPlacementAndRetrieval() {
+  FlatHashMap<string, int> map;
+  bool empty = !map.has_key("deaths") && map.size() == 0;
+
+  map["deaths"] = 2;
+  map["deaths"] = 0;
+  map["gold_obtained"] = 4;
+  map["xp_gained"] = 10;
+
+  const FlatHashMap<string, int> &const_map = map;
+  bool missing_throws = false;
+  try {
+    const_map["kills"];
+  }
+  catch (const std::out_of_range&) {
+    missing_throws = true;
+  }
+
+  // Few keys are searched linearly, without an index
+  return empty && missing_throws && !map.indexed() && map.size() == 3 && map.has_key("deaths") &&
+    const_map["deaths"] == 0 && const_map["gold_obtained"] == 4 && const_map["xp_gained"] == 10;
+}
+
+bool TestFlatHashMapManyKeys() {
+  FlatHashMap<string, int> map;
+  for (int item = 0; item < kManyKeys; item++)
+    map[ItemKey(item)] = item;
+  for (int item = 0; item < kManyKeys; item += 3)
+    map[ItemKey(item)] += 1;
+
+  bool values_correct = map.indexed() && map.size() == kManyKeys && !map.has_key(ItemKey(kManyKeys)) && !map.has_key("deaths");
+  for (int item = 0; item < kManyKeys && values_correct; item++)
+    values_correct = map.has_key(ItemKey(item)) && map[ItemKey(item)] == item + (item % 3 == 0 ? 1 : 0);
+
+  // Keys are visited in the order they were added
+  int visited = 0;
+  bool order_correct = true;
+  map.for_each([&](const string &key, int value) {
+    order_correct = order_correct && key == ItemKey(visited);
+    visited++;
+  });
+
+  map.clear();
+  bool cleared = map.size() == 0 && !map.indexed() && !map.has_key(ItemKey(0));
+  return values_correct && order_correct && visited == kManyKeys && cleared;
+}
+
+bool TestFlatHashMapCollision() {
+  // Every key hashes to the same slot, so they're all found by probing past each other
+  struct CollidingHashFunc {
+    size_t operator()(const string &key) const { return 42; }
+  };
+
+  FlatHashMap<string, string, CollidingHashFunc> map;
+  for (int item = 0; item < 200; item++)
+    map[ItemKey(item)] = ItemKey(item + 1);
+
+  bool values_correct = map.indexed() && map.size() == 200 && !map.has_key(ItemKey(200));
+  for (int item = 0; item < 200 && values_correct; item++)
+    values_correct = map[ItemKey(item)] == ItemKey(item + 1);
+  return values_correct;
+}
+
+bool TestFlatHashMapCopyAndSerialization() {
+  FlatHashMap<string, int> map;
+  for (int item = 0; item < 100; item++)
+    map[ItemKey(item)] = item;
+
+  // Copies don't see what's added to the original afterwards
+  FlatHashMap<string, int> copy(map);
+  map[ItemKey(100)] = 100;
+  map[ItemKey(0)] = 50;
+  bool copy_isolated = copy.size() == 100 && !copy.has_key(ItemKey(100)) && copy[ItemKey(0)] == 0 && copy[ItemKey(99)] == 99;
+
+  // Serializes as a LinearSearchMap, so each map loads what the other saved
+  stringstream flat_stream;
+  {
+    boost::archive::binary_oarchive oa(flat_stream);
+    oa & map;
+  }
+  LinearSearchMap<string, int> linear;
+  {
+    boost::archive::binary_iarchive ia(flat_stream);
+    ia & linear;
+  }
+  bool linear_loaded = linear.has_key(ItemKey(100)) && linear[ItemKey(0)] == 50 && linear[ItemKey(57)] == 57;
+
+  stringstream linear_stream;
+  {
+    boost::archive::binary_oarchive oa(linear_stream);
+    oa & linear;
+  }
+  FlatHashMap<string, int> loaded;
+  {
+    boost::archive::binary_iarchive ia(linear_stream);
+    ia & loaded;
+  }
+  bool flat_loaded = loaded.indexed() && loaded.size() == 101 && loaded[ItemKey(0)] == 50 && loaded[ItemKey(100)] == 100 && loaded[ItemKey(57)] == 57;
+
+  return copy_isolated && linear_loaded && flat_loaded;
+}
\ No newline at end of file
@@ -0,0 +1,11 @@
+//////////////////////////////////////////////////////////////////////////////////////
+// FlatHashMapTests.h: Test functions for the FlatHashMap class
+// Written by: Pedro Engana (http://pedroengana.com)
+//////////////////////////////////////////////////////////////////////////////////////
+
+void TestFlatHashMapAll();
+
+bool TestFlatHashMapPlacementAndRetrieval();
+bool TestFlatHashMapManyKeys();
+bool TestFlatHashMapCollision();
+bool TestFlatHashMapCopyAndSerialization();
\ No newline at end of file
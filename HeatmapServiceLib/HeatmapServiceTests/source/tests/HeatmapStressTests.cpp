@@ -4,6 +4,7 @@
 #include "HeatmapStressTests.h"
 #include <iostream>
 #include <ctime>
+#include <chrono>
 
 using namespace std;
 using namespace heatmap_service;
@@ -27,6 +28,12 @@ void HeatmapStressTestAll()
   StressTestMillionRegisters5kper5kOnlyNegativeCoords();
   cout << endl << "Starting... StressTestThousandRegistriesFractionalResolution";
   StressTestThousandRegistriesFractionalResolution();
+  cout << endl << "Starting... StressTestSmooth4kper4kArea";
+  StressTestSmooth4kper4kArea();
+  cout << endl << "Starting... StressTestGetAllData4kper4kParallelAndSynchronous";
+  StressTestGetAllData4kper4kParallelAndSynchronous();
+  cout << endl << "Starting... StressTestSnapshot4kper4kWhileLogging";
+  StressTestSnapshot4kper4kWhileLogging();
 
   cout << endl;
 }
@@ -40,7 +47,7 @@ void StressTestMillionRegisters10per5Coords()
   {
     int randX = rand() % 10;
     int randY = rand() % 5;
-    heatmap.IncrementMapCounter({ randX, randY }, kDeathsCounterKey);
+    heatmap.IncrementMapCounter({ (double)randX, (double)randY }, kDeathsCounterKey);
   }
   clock_t end = clock();
   float diff((float)end - (float)init);
@@ -56,7 +63,7 @@ void StressTestMillionRegisters10kper10kCoords()
   {
     int randX = rand() % 10000 - 5000;
     int randY = rand() % 10000 - 5000;
-    heatmap.IncrementMapCounter({ randX, randY }, kDeathsCounterKey);
+    heatmap.IncrementMapCounter({ (double)randX, (double)randY }, kDeathsCounterKey);
   }
   clock_t end = clock();
   float diff((float)end - (float)init);
@@ -72,7 +79,7 @@ void StressTestMillionRegisters5kper5kOnlyNegativeCoords()
   {
     int randX = rand() % 5000 - 5000;
     int randY = rand() % 5000 - 5000;
-    heatmap.IncrementMapCounter({ randX, randY }, kDeathsCounterKey);
+    heatmap.IncrementMapCounter({ (double)randX, (double)randY }, kDeathsCounterKey);
   }
   clock_t end = clock();
   float diff((float)end - (float)init);
@@ -88,10 +95,103 @@ void StressTestThousandRegistriesFractionalResolution()
   {
     int randX = rand() % 100 - 50;
     int randY = rand() % 100 - 50;
-    heatmap.IncrementMapCounter({ randX, randY }, kDeathsCounterKey);
+    heatmap.IncrementMapCounter({ (double)randX, (double)randY }, kDeathsCounterKey);
   }
   clock_t end = clock();
   float diff((float)end - (float)init);
   cout << " test took " << (diff / CLOCKS_PER_SEC) << " seconds " << endl;
 }
 
+
+
+void StressTestSmooth4kper4kArea()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(1);
+
+  for (long int i = 0; i < 1000000; i++)
+  {
+    int randX = rand() % 4096;
+    int randY = rand() % 4096;
+    heatmap.IncrementMapCounter({ (double)randX, (double)randY }, kDeathsCounterKey);
+  }
+
+  HeatmapSmoothingKernel kernels[2] = { kGaussianKernel, kBoxApproximatedGaussianKernel };
+  const char* kernel_names[2] = { "gaussian", "box approximated" };
+  for (int k = 0; k < 2; k++)
+  {
+    heatmap_service::HeatmapFloatData out_data;
+    // Smoothing runs on several threads, so it's timed by wall clock instead of clock()
+    std::chrono::steady_clock::time_point init = std::chrono::steady_clock::now();
+    heatmap.getSmoothedCounterDataInsideRect({ 0, 0 }, { 4095, 4095 }, kDeathsCounterKey, 8, kernels[k], out_data);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    cout << endl << "  " << kernel_names[k] << " smoothing took " << std::chrono::duration<float>(end - init).count() << " seconds";
+
+    for (int x = 0; x < out_data.data_size.width; x++)
+      delete[] out_data.heatmap_data[x];
+    delete[] out_data.heatmap_data;
+    delete(out_data.counter_name);
+  }
+  cout << endl;
+}
+
+void StressTestGetAllData4kper4kParallelAndSynchronous()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(1);
+
+  for (long int i = 0; i < 1000000; i++)
+  {
+    int randX = rand() % 4096;
+    int randY = rand() % 4096;
+    heatmap.IncrementMapCounter({ (double)randX, (double)randY }, kDeathsCounterKey);
+  }
+
+  // The same full map extraction, first split across the worker pool, then with the library set to synchronous
+  int default_worker_count = HeatmapService::worker_thread_count();
+  int worker_counts[2] = { default_worker_count, 0 };
+  for (int k = 0; k < 2; k++)
+  {
+    HeatmapService::SetWorkerThreadCount(worker_counts[k]);
+
+    heatmap_service::HeatmapData out_data;
+    std::chrono::steady_clock::time_point init = std::chrono::steady_clock::now();
+    heatmap.getAllCounterData(kDeathsCounterKey, out_data);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    cout << endl << "  extraction with " << worker_counts[k] << " worker threads took " << std::chrono::duration<float>(end - init).count() << " seconds";
+
+    for (int x = 0; x < out_data.data_size.width; x++)
+      delete[] out_data.heatmap_data[x];
+    delete[] out_data.heatmap_data;
+    delete(out_data.counter_name);
+  }
+  HeatmapService::SetWorkerThreadCount(default_worker_count);
+  cout << endl;
+}
+
+void StressTestSnapshot4kper4kWhileLogging()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(1);
+
+  for (long int i = 0; i < 1000000; i++)
+  {
+    int randX = rand() % 4096;
+    int randY = rand() % 4096;
+    heatmap.IncrementMapCounter({ (double)randX, (double)randY }, kDeathsCounterKey);
+  }
+
+  // Snapshots only copy one pointer per column, the columns themselves are copied as logging reaches them
+  std::chrono::steady_clock::time_point init = std::chrono::steady_clock::now();
+  heatmap_service::HeatmapService snapshot(heatmap);
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  cout << endl << "  snapshot took " << std::chrono::duration<float>(end - init).count() << " seconds";
+
+  init = std::chrono::steady_clock::now();
+  for (long int i = 0; i < 1000000; i++)
+  {
+    int randX = rand() % 4096;
+    int randY = rand() % 4096;
+    heatmap.IncrementMapCounter({ (double)randX, (double)randY }, kDeathsCounterKey);
+  }
+  end = std::chrono::steady_clock::now();
+  cout << endl << "  logging a million counters over the snapshot took " << std::chrono::duration<float>(end - init).count() << " seconds";
+  cout << endl;
+}
\ No newline at end of file
@@ -8,4 +8,7 @@ void HeatmapStressTestAll();
 void StressTestMillionRegisters10kper10kCoords();
 void StressTestMillionRegisters10per5Coords();
 void StressTestMillionRegisters5kper5kOnlyNegativeCoords();
-void StressTestThousandRegistriesFractionalResolution();
\ No newline at end of file
+void StressTestThousandRegistriesFractionalResolution();
+void StressTestSmooth4kper4kArea();
+void StressTestGetAllData4kper4kParallelAndSynchronous();
+void StressTestSnapshot4kper4kWhileLogging();
\ No newline at end of file
@@ -1,8 +1,17 @@
 #pragma once
 
 #include "HeatmapService.h"
+#include "HeatmapGrid.hpp"
+#include "HeatmapEventQueue.h"
 #include "HeatmapTests.h"
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <atomic>
 
 using namespace std;
 using namespace heatmap_service;
@@ -23,6 +32,50 @@ void TestHeatmapAll()
   cout << "TestRegisterReadMultipleNonDefaultResolution: [" << (TestRegisterReadMultipleNonDefaultResolution() ? "PASSED" : "FAILED") << "]" << endl;
   cout << "TestRegisterReadMultipleCounters: [" << (TestRegisterReadMultipleCounters() ? "PASSED" : "FAILED") << "]" << endl;
   cout << "TestAllRegisteringMethods: [" << (TestAllRegisteringMethods() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestTrajectoryCrossesEveryCell: [" << (TestTrajectoryCrossesEveryCell() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestTrajectoryRevisitPolicies: [" << (TestTrajectoryRevisitPolicies() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestSplatMatchesCellIncrements: [" << (TestSplatMatchesCellIncrements() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestSplatKernelsAndInvalidSplats: [" << (TestSplatKernelsAndInvalidSplats() ? "PASSED" : "FAILED") << "]" << endl;
+
+  cout << endl;
+
+  cout << "TestGridMatchesRuntimeResolution: [" << (TestGridMatchesRuntimeResolution() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestGridSharesServiceStorage: [" << (TestGridSharesServiceStorage() ? "PASSED" : "FAILED") << "]" << endl;
+
+  cout << endl;
+
+  cout << "TestMortonLayoutMatchesColumnLayout: [" << (TestMortonLayoutMatchesColumnLayout() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestMortonLayoutSnapshotAndSerialize: [" << (TestMortonLayoutSnapshotAndSerialize() ? "PASSED" : "FAILED") << "]" << endl;
+
+  cout << endl;
+
+  cout << "TestCounterGroupRegisterRead: [" << (TestCounterGroupRegisterRead() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestCounterGroupArea: [" << (TestCounterGroupArea() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestCounterGroupSerializeAndSnapshot: [" << (TestCounterGroupSerializeAndSnapshot() ? "PASSED" : "FAILED") << "]" << endl;
+
+  cout << endl;
+
+  cout << "TestSnapshotIsolatedFromWrites: [" << (TestSnapshotIsolatedFromWrites() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestSnapshotReadWhileLogging: [" << (TestSnapshotReadWhileLogging() ? "PASSED" : "FAILED") << "]" << endl;
+
+  cout << endl;
+
+  cout << "TestEventQueueMatchesDirectLogging: [" << (TestEventQueueMatchesDirectLogging() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestEventQueueBackpressure: [" << (TestEventQueueBackpressure() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestEventQueueSnapshotWhileLogging: [" << (TestEventQueueSnapshotWhileLogging() ? "PASSED" : "FAILED") << "]" << endl;
+
+  cout << endl;
+
+  cout << "TestGetStats: [" << (TestGetStats() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestStatsTrackSnapshotCopies: [" << (TestStatsTrackSnapshotCopies() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestCounterSummary: [" << (TestCounterSummary() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestCounterSummaryAfterMergeRebinAndLoad: [" << (TestCounterSummaryAfterMergeRebinAndLoad() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestSparseRegionsPromoteAndDemote: [" << (TestSparseRegionsPromoteAndDemote() ? "PASSED" : "FAILED") << "]" << endl;
+
+  cout << endl;
+
+  cout << "TestLatencyHistograms: [" << (TestLatencyHistograms() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestEventHookReceivesEvents: [" << (TestEventHookReceivesEvents() ? "PASSED" : "FAILED") << "]" << endl;
 
   cout << endl;
 
@@ -30,180 +83,1783 @@ void TestHeatmapAll()
   cout << "TestGetAreaUnitSizedRect: [" << (TestGetAreaUnitSizedRect() ? "PASSED" : "FAILED") << "]" << endl;
   cout << "TestGetAreaUpperLowerSwitched: [" << (TestGetAreaUpperLowerSwitched() ? "PASSED" : "FAILED") << "]" << endl;
   cout << "TestSimpleGetEntireArea: [" << (TestSimpleGetEntireArea() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestGetMultipleCountersArea: [" << (TestGetMultipleCountersArea() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestParallelGetAreaMatchesSynchronous: [" << (TestParallelGetAreaMatchesSynchronous() ? "PASSED" : "FAILED") << "]" << endl;
+
+  cout << endl;
+
+  cout << "TestQueryCacheReturnsCachedResult: [" << (TestQueryCacheReturnsCachedResult() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestQueryCacheInvalidation: [" << (TestQueryCacheInvalidation() ? "PASSED" : "FAILED") << "]" << endl;
+
+  cout << endl;
+
+  cout << "TestSparseQueryTightBounds: [" << (TestSparseQueryTightBounds() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestSparseQueryMatchesDenseArea: [" << (TestSparseQueryMatchesDenseArea() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestRegionQueriesMatchMaskedCells: [" << (TestRegionQueriesMatchMaskedCells() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestRegionQueryWholeMapAndInvalidRegions: [" << (TestRegionQueryWholeMapAndInvalidRegions() ? "PASSED" : "FAILED") << "]" << endl;
+
+  cout << endl;
+
+  cout << "TestSmoothedAreaPreservesTotal: [" << (TestSmoothedAreaPreservesTotal() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestSmoothedAreaUsesNeighboursOutsideRect: [" << (TestSmoothedAreaUsesNeighboursOutsideRect() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestExpressionArea: [" << (TestExpressionArea() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestInvalidExpressions: [" << (TestInvalidExpressions() ? "PASSED" : "FAILED") << "]" << endl;
+
+  cout << endl;
+
+  cout << "TestRenderCounterToPpmImage: [" << (TestRenderCounterToPpmImage() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestRenderCounterToPngImage: [" << (TestRenderCounterToPngImage() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestRenderCounterToTilePyramid: [" << (TestRenderCounterToTilePyramid() ? "PASSED" : "FAILED") << "]" << endl;
 
   cout << endl;
 
   cout << "TestSimpleSerializeDeserialize: [" << (TestSimpleSerializeDeserialize() ? "PASSED" : "FAILED") << "]" << endl;
   cout << "TestDeserializeIntoFilledHeatmap: [" << (TestDeserializeIntoFilledHeatmap() ? "PASSED" : "FAILED") << "]" << endl;
   cout << "TestInvalidBufferForDeserialization: [" << (TestInvalidBufferForDeserialization() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestSectionedSerializeKeepsColumnsAndGroups: [" << (TestSectionedSerializeKeepsColumnsAndGroups() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestMalformedSectionedBuffers: [" << (TestMalformedSectionedBuffers() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestLazyLoadOnlyReadsUsedCounters: [" << (TestLazyLoadOnlyReadsUsedCounters() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestLazyLoadFileAndWholeHeatmapOperations: [" << (TestLazyLoadFileAndWholeHeatmapOperations() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestCheckpointKeepsPointInTimeView: [" << (TestCheckpointKeepsPointInTimeView() ? "PASSED" : "FAILED") << "]" << endl;
+
+  cout << endl;
+
+  cout << "TestMergeHeatmaps: [" << (TestMergeHeatmaps() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestRebinSumsCells: [" << (TestRebinSumsCells() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestMergeDifferentResolutions: [" << (TestMergeDifferentResolutions() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestIngestCsvEvents: [" << (TestIngestCsvEvents() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestIngestBinaryEventFile: [" << (TestIngestBinaryEventFile() ? "PASSED" : "FAILED") << "]" << endl;
 
   cout << endl;
 }
 
-bool TestSimpleRegisterRead()
+bool TestSimpleRegisterRead()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+
+  return 1 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey);
+}
+
+bool TestRegisterReadMultiple()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 1, 1 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 2, 2 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 3, 3 }, kDeathsCounterKey);
+
+  return 1 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) &&
+    1 == heatmap.getCounterAtPosition({ 1, 1 }, kDeathsCounterKey) &&
+    1 == heatmap.getCounterAtPosition({ 2, 2 }, kDeathsCounterKey) &&
+    1 == heatmap.getCounterAtPosition({ 3, 3 }, kDeathsCounterKey);
+}
+
+bool TestRegisterReadMultipleNonDefaultResolution()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2);
+  heatmap.IncrementMapCounter({ -1, -1 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 1, 1 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 2, 2 }, kDeathsCounterKey);
+
+  return 1 == heatmap.getCounterAtPosition({ -1, -1 }, kDeathsCounterKey) &&
+    2 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) &&
+    2 == heatmap.getCounterAtPosition({ 1, 1 }, kDeathsCounterKey) &&
+    1 == heatmap.getCounterAtPosition({ 2, 2 }, kDeathsCounterKey) &&
+    0 == heatmap.getCounterAtPosition({ 10, 10 }, kDeathsCounterKey);
+}
+
+bool TestRegisterReadMultipleCounters()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2);
+  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 0, 0 }, kDodgesKey);
+  heatmap.IncrementMapCounter({ 0, 0 }, kExperienceGainedCounterKey);
+  heatmap.IncrementMapCounter({ 0, 0 }, kKillsCounterKey);
+
+  return 1 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) &&
+    1 == heatmap.getCounterAtPosition({ 0, 0 }, kDodgesKey) &&
+    1 == heatmap.getCounterAtPosition({ 0, 0 }, kExperienceGainedCounterKey) &&
+    1 == heatmap.getCounterAtPosition({ 0, 0 }, kKillsCounterKey);
+}
+
+bool TestAllRegisteringMethods()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2);
+  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+
+  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, 1);
+  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, 1);
+  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, -1);
+  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, -1);
+
+  const std::string counters[3] = { kDeathsCounterKey, kDodgesKey, kGoldObtainedCounterKey };
+  int amounts[3] = { 1, 3, 4 };
+  heatmap.IncrementMultipleMapCountersByAmount({ 0, 0 }, counters, amounts, 3);
+
+  return 5 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) &&
+    3 == heatmap.getCounterAtPosition({ 0, 0 }, kDodgesKey) &&
+    4 == heatmap.getCounterAtPosition({ 0, 0 }, kGoldObtainedCounterKey);
+}
+
+// Whether the segment between from and to touches the cell, clipping the segment against the cell one axis at a time
+bool SegmentTouchesCell(HeatmapCoordinate from, HeatmapCoordinate to, int cell_x, int cell_y, double unit_width, double unit_height)
+{
+  const double kEpsilon = 1e-9;
+  double enter = 0, leave = 1;
+  double origins[2] = { from.x, from.y }, deltas[2] = { to.x - from.x, to.y - from.y };
+  double lowest[2] = { cell_x * unit_width, cell_y * unit_height }, highest[2] = { (cell_x + 1) * unit_width, (cell_y + 1) * unit_height };
+  for (int axis = 0; axis < 2; axis++)
+  {
+    if (deltas[axis] == 0)
+    {
+      if (origins[axis] < lowest[axis] - kEpsilon || origins[axis] > highest[axis] + kEpsilon)
+        return false;
+      continue;
+    }
+    double t0 = (lowest[axis] - origins[axis]) / deltas[axis], t1 = (highest[axis] - origins[axis]) / deltas[axis];
+    enter = std::max(enter, std::min(t0, t1));
+    leave = std::min(leave, std::max(t0, t1));
+  }
+  return enter <= leave + kEpsilon;
+}
+
+bool TestTrajectoryCrossesEveryCell()
+{
+  bool result = true;
+  HeatmapStorageLayout layouts[2] = { kColumnStorageLayout, kMortonTileStorageLayout };
+  for (HeatmapStorageLayout layout : layouts)
+  {
+    unsigned int seed = 12345;
+    auto next_coordinate = [&seed]() { seed = seed * 1103515245 + 12345; return (double)(seed >> 8 & 0xFFFF) / 97.3 - 330; };
+    for (int i = 0; i < 300; i++)
+    {
+      heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 3, layout);
+      HeatmapCoordinate points[2] = { { next_coordinate(), next_coordinate() }, { next_coordinate(), next_coordinate() } };
+      // Horizontal, vertical and short segments along with the arbitrary ones
+      if (i % 10 == 1)
+        points[1].y = points[0].y;
+      else if (i % 10 == 2)
+        points[1].x = points[0].x;
+      else if (i % 10 == 3)
+        points[1] = { points[0].x + 0.7, points[0].y - 1.1 };
+
+      HeatmapSparseData cells;
+      if (!heatmap.IncrementTrajectory(points, 2, kDeathsCounterKey, kCountEveryVisit) || !heatmap.getAllSparseCounterData(kDeathsCounterKey, cells))
+        return false;
+
+      // A segment that doesn't go through a corner of the grid crosses one border per cell it enters, so it touches exactly that many cells past
+      // the first. Finding as many different cells, all touching it, means every cell it crosses was counted, and nothing else
+      int first_x = (int)floor(points[0].x / 2), first_y = (int)floor(points[0].y / 3);
+      int last_x = (int)floor(points[1].x / 2), last_y = (int)floor(points[1].y / 3);
+      result = result && cells.values.size() == (size_t)(abs(last_x - first_x) + abs(last_y - first_y) + 1);
+      for (size_t cell = 0; cell < cells.values.size(); cell++)
+        result = result && cells.values[cell] == 1 && SegmentTouchesCell(points[0], points[1], cells.cell_x[cell], cells.cell_y[cell], 2, 3);
+      result = result && heatmap.getCounterAtCell(first_x, first_y, kDeathsCounterKey) == 1 && heatmap.getCounterAtCell(last_x, last_y, kDeathsCounterKey) == 1;
+    }
+  }
+  return result;
+}
+
+bool TestTrajectoryRevisitPolicies()
+{
+  // A player walking five cells right and back again, and one standing still inside a cell
+  HeatmapCoordinate back_and_forth[3] = { { 0.5, 0.5 }, { 5.5, 0.5 }, { 0.5, 0.5 } };
+  HeatmapCoordinate standing[3] = { { 10.2, 10.2 }, { 10.7, 10.9 }, { 10.3, 10.4 } };
+
+  heatmap_service::HeatmapService every_visit = heatmap_service::HeatmapService(1, 1);
+  heatmap_service::HeatmapService once = heatmap_service::HeatmapService(1, 1, kMortonTileStorageLayout);
+  bool result = every_visit.IncrementTrajectory(back_and_forth, 3, kDeathsCounterKey, kCountEveryVisit) &&
+    every_visit.IncrementTrajectory(standing, 3, kDeathsCounterKey, kCountEveryVisit) &&
+    once.IncrementTrajectory(back_and_forth, 3, kDeathsCounterKey, kCountOncePerTrajectory) &&
+    once.IncrementTrajectory(standing, 3, kDeathsCounterKey, kCountOncePerTrajectory);
+  for (int x = 0; x <= 5; x++)
+    result = result && every_visit.getCounterAtCell(x, 0, kDeathsCounterKey) == (x < 5 ? 2u : 1u) && once.getCounterAtCell(x, 0, kDeathsCounterKey) == 1;
+  result = result && every_visit.getCounterAtCell(10, 10, kDeathsCounterKey) == 1 && once.getCounterAtCell(10, 10, kDeathsCounterKey) == 1;
+
+  // Registering many trajectories at once matches registering them one by one
+  std::vector<std::vector<HeatmapCoordinate>> paths(50);
+  std::vector<HeatmapTrajectory> trajectories;
+  for (int i = 0; i < 50; i++)
+  {
+    for (int j = 0; j <= i % 7; j++)
+      paths[i].push_back({ (double)((i * 37 + j * 53) % 90) - 45.5, (double)((i * 11 + j * 29) % 70) - 35.25 });
+    trajectories.push_back({ paths[i].data(), (int)paths[i].size() });
+  }
+  HeatmapRevisitPolicy policies[2] = { kCountEveryVisit, kCountOncePerTrajectory };
+  for (HeatmapRevisitPolicy policy : policies)
+  {
+    heatmap_service::HeatmapService batched = heatmap_service::HeatmapService(2, 3);
+    heatmap_service::HeatmapService one_by_one = heatmap_service::HeatmapService(2, 3);
+    result = result && batched.IncrementTrajectories(trajectories.data(), 50, kDeathsCounterKey, policy);
+    for (const HeatmapTrajectory &trajectory : trajectories)
+      result = result && one_by_one.IncrementTrajectory(trajectory.points, trajectory.point_count, kDeathsCounterKey, policy);
+
+    HeatmapSparseData batched_cells, one_by_one_cells;
+    result = result && batched.getAllSparseCounterData(kDeathsCounterKey, batched_cells) && one_by_one.getAllSparseCounterData(kDeathsCounterKey, one_by_one_cells) &&
+      batched_cells.cell_x == one_by_one_cells.cell_x && batched_cells.cell_y == one_by_one_cells.cell_y && batched_cells.values == one_by_one_cells.values;
+  }
+
+  // Invalid trajectories register nothing, even when the others of the batch are valid
+  HeatmapCoordinate not_finite[2] = { { 0, 0 }, { NAN, 1 } };
+  HeatmapCoordinate too_far[2] = { { 0, 0 }, { 1e300, 1 } };
+  trajectories[20] = { too_far, 2 };
+  HeatmapSparseData cells;
+  result = result && !every_visit.IncrementTrajectory(nullptr, 2, kKillsCounterKey, kCountEveryVisit) &&
+    !every_visit.IncrementTrajectory(back_and_forth, 0, kKillsCounterKey, kCountEveryVisit) &&
+    !every_visit.IncrementTrajectory(not_finite, 2, kKillsCounterKey, kCountEveryVisit) &&
+    !every_visit.IncrementTrajectories(trajectories.data(), 50, kKillsCounterKey, kCountOncePerTrajectory) &&
+    !every_visit.getAllSparseCounterData(kKillsCounterKey, cells);
+  return result;
+}
+
+
+// Whether both heatmaps hold the same cells for the counter, and keep the same summary of them
+bool SameCounterCells(const heatmap_service::HeatmapService &heatmap, const heatmap_service::HeatmapService &expected, const std::string &counter_key)
+{
+  HeatmapSparseData cells, expected_cells;
+  HeatmapCounterSummary summary, expected_summary;
+  if (!heatmap.getAllSparseCounterData(counter_key, cells) || !expected.getAllSparseCounterData(counter_key, expected_cells) ||
+      !heatmap.getCounterSummary(counter_key, summary) || !expected.getCounterSummary(counter_key, expected_summary))
+    return false;
+
+  return cells.cell_x == expected_cells.cell_x && cells.cell_y == expected_cells.cell_y && cells.values == expected_cells.values &&
+    summary.total == expected_summary.total && summary.max_value == expected_summary.max_value && summary.nonzero_cell_count == expected_summary.nonzero_cell_count &&
+    std::equal(summary.histogram, summary.histogram + HeatmapCounterSummary::kHistogramBuckets, expected_summary.histogram);
+}
+
+bool TestSplatMatchesCellIncrements()
+{
+  bool result = true;
+  HeatmapStorageLayout layouts[2] = { kColumnStorageLayout, kMortonTileStorageLayout };
+  for (HeatmapStorageLayout layout : layouts)
+  {
+    heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 3, layout);
+    heatmap_service::HeatmapService expected = heatmap_service::HeatmapService(2, 3, layout);
+
+    // A disk, a gaussian, and a kernel of an even size with zeros inside it
+    HeatmapSplatKernel kernels[3];
+    result = result && heatmap.BuildDiskSplatKernel(31, 4, kernels[0]) && heatmap.BuildGaussianSplatKernel(12, 50, kernels[1]);
+    kernels[2].width = 4;
+    kernels[2].height = 6;
+    kernels[2].weights = { 1, 0, 0, 2, 0, 3, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 0, 9, 9, 0, 0, 1 };
+
+    heatmap_service::HeatmapService snapshot = heatmap, expected_snapshot = expected;
+    for (int i = 0; i < 300; i++)
+    {
+      // Events overlap near the origin, where columns turn dense, and a few land far away, on columns that stay sparse
+      const HeatmapSplatKernel &kernel = kernels[i % 3];
+      HeatmapCoordinate coords = { (double)((i * 37) % 200 - 100) + 0.5, (double)((i * 53) % 300 - 150) + 0.25 };
+      if (i % 17 == 0)
+        coords = { coords.x * 1000, coords.y * 4000 };
+      if (i == 150)
+      {
+        snapshot = heatmap;
+        expected_snapshot = expected;
+      }
+
+      result = result && heatmap.SplatMapCounter(coords, kernel, kDeathsCounterKey);
+      int center_x = (int)floor(coords.x / 2), center_y = (int)floor(coords.y / 3);
+      for (int x = 0; x < kernel.width; x++)
+      {
+        for (int y = 0; y < kernel.height; y++)
+          expected.IncrementCellCounterByAmount(center_x - kernel.width / 2 + x, center_y - kernel.height / 2 + y, kDeathsCounterKey, kernel.weights[x * kernel.height + y]);
+      }
+    }
+    result = result && SameCounterCells(heatmap, expected, kDeathsCounterKey) && SameCounterCells(snapshot, expected_snapshot, kDeathsCounterKey);
+  }
+  return result;
+}
+
+bool TestSplatKernelsAndInvalidSplats()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(1, 1);
+  HeatmapSplatKernel disk, gaussian;
+  bool result = heatmap.BuildDiskSplatKernel(5, 2, disk) && heatmap.BuildGaussianSplatKernel(2, 100, gaussian);
+
+  // The disk holds the 81 cells whose center lies within 5 units of the center cell's, and the gaussian peaks on the center, fading the same way on every side
+  result = result && disk.width == 11 && disk.height == 11 && std::count(disk.weights.begin(), disk.weights.end(), 2u) == 81 &&
+    std::count(disk.weights.begin(), disk.weights.end(), 0u) == 121 - 81;
+  result = result && gaussian.width == 13 && gaussian.height == 13 && gaussian.weights[6 * 13 + 6] == 100 && *std::max_element(gaussian.weights.begin(), gaussian.weights.end()) == 100;
+  for (int x = 0; x < 13; x++)
+  {
+    for (int y = 0; y < 13; y++)
+      result = result && gaussian.weights[x * 13 + y] == gaussian.weights[(12 - x) * 13 + y] && gaussian.weights[x * 13 + y] == gaussian.weights[y * 13 + x];
+  }
+
+  // Counters wrapping around under a splat are accounted for in the summary, as with any increment
+  heatmap_service::HeatmapService expected = heatmap_service::HeatmapService(1, 1);
+  for (int y = -3; y <= 3; y++)
+  {
+    heatmap.IncrementCellCounterByAmount(0, y, kDeathsCounterKey, INT_MAX);
+    heatmap.IncrementCellCounterByAmount(0, y, kDeathsCounterKey, INT_MAX);
+    expected.IncrementCellCounterByAmount(0, y, kDeathsCounterKey, INT_MAX);
+    expected.IncrementCellCounterByAmount(0, y, kDeathsCounterKey, INT_MAX);
+  }
+  result = result && heatmap.SplatMapCounter({ 0.5, 0.5 }, disk, kDeathsCounterKey);
+  for (int x = 0; x < 11; x++)
+  {
+    for (int y = 0; y < 11; y++)
+      expected.IncrementCellCounterByAmount(x - 5, y - 5, kDeathsCounterKey, disk.weights[x * 11 + y]);
+  }
+  result = result && SameCounterCells(heatmap, expected, kDeathsCounterKey);
+
+  // Invalid kernels and coordinates register nothing
+  HeatmapSplatKernel mismatched = { 3, 3, { 1, 2, 3 } };
+  HeatmapSplatKernel unused;
+  HeatmapSparseData cells;
+  result = result && !heatmap.BuildDiskSplatKernel(-1, 1, unused) && !heatmap.BuildDiskSplatKernel(NAN, 1, unused) && !heatmap.BuildDiskSplatKernel(5, 0, unused) &&
+    !heatmap.BuildGaussianSplatKernel(0, 1, unused) && !heatmap.BuildDiskSplatKernel(1e6, 1, unused);
+  result = result && !heatmap.SplatMapCounter({ 0, 0 }, mismatched, kKillsCounterKey) && !heatmap.SplatMapCounter({ NAN, 0 }, disk, kKillsCounterKey) &&
+    !heatmap.SplatMapCounter({ 2147483647.5, 0 }, disk, kKillsCounterKey) && !heatmap.getAllSparseCounterData(kKillsCounterKey, cells);
+  return result;
+}
+
+// Logs the same coordinates to a grid and to a runtime resolution heatmap of the same resolution, and compares the cells every coordinate lands in
+template <typename Grid, typename Coord>
+bool GridMatchesRuntimeResolution(Coord lowest, Coord highest, Coord step)
+{
+  Grid grid;
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(Grid::kCellWidth, Grid::kCellHeight);
+  for (Coord x = lowest; x <= highest; x += step)
+  {
+    for (Coord y = lowest; y <= highest; y += step)
+    {
+      grid.IncrementMapCounterByAmount(x, y, kDeathsCounterKey, 2);
+      heatmap.IncrementMapCounterByAmount({ (double)x, (double)y }, kDeathsCounterKey, 2);
+    }
+  }
+
+  for (Coord x = lowest; x <= highest; x += step)
+  {
+    for (Coord y = lowest; y <= highest; y += step)
+    {
+      if (grid.getCounterAtPosition(x, y, kDeathsCounterKey) != heatmap.getCounterAtPosition({ (double)x, (double)y }, kDeathsCounterKey) ||
+          grid.service().getCounterAtPosition({ (double)x, (double)y }, kDeathsCounterKey) != heatmap.getCounterAtPosition({ (double)x, (double)y }, kDeathsCounterKey))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool TestGridMatchesRuntimeResolution()
+{
+  // Shifts, reciprocal divisions and floors, including negative coordinates that aren't multiples of the cell
+  return GridMatchesRuntimeResolution<HeatmapGrid<4, 8>, int32_t>(-37, 37, 1) &&
+    GridMatchesRuntimeResolution<HeatmapGrid<3, 5>, int32_t>(-37, 37, 1) &&
+    GridMatchesRuntimeResolution<HeatmapGrid<1, 1, int64_t>, int64_t>(-10, 10, 1) &&
+    GridMatchesRuntimeResolution<HeatmapGrid<2, 2, double>, double>(-9, 9, 0.25) &&
+    GridMatchesRuntimeResolution<HeatmapGrid<3, 7, double>, double>(-21, 21, 0.5) &&
+    HeatmapGrid<4, 4>::CellX(-1) == -1 && HeatmapGrid<3, 3>::CellX(-3) == -1 && HeatmapGrid<3, 3>::CellX(-4) == -2;
+}
+
+bool TestGridSharesServiceStorage()
+{
+  HeatmapGrid<2, 2> grid;
+  grid.IncrementMapCounter(-1, -1, kDeathsCounterKey);
+  grid.IncrementMapCounter(0, 0, kDeathsCounterKey);
+  grid.IncrementMapCounter(1, 1, kDeathsCounterKey);
+  grid.IncrementMapCounter(5, 2, kDeathsCounterKey);
+
+  // The same area, queried through the grid and through its service
+  HeatmapData grid_data;
+  HeatmapData service_data;
+  if (!grid.getCounterDataInsideRect(-1, -1, 5, 3, kDeathsCounterKey, grid_data))
+    return false;
+  if (!grid.service().getCounterDataInsideRect({ -2, -2 }, { 5.5, 3.5 }, kDeathsCounterKey, service_data))
+    return false;
+
+  bool result = grid_data.data_size.width == 4 && grid_data.data_size.height == 3 &&
+    grid_data.data_size.width == service_data.data_size.width && grid_data.data_size.height == service_data.data_size.height &&
+    grid_data.heatmap_data[0][0] == 1 && grid_data.heatmap_data[1][1] == 2 && grid_data.heatmap_data[3][2] == 1;
+  for (int x = 0; x < grid_data.data_size.width; x++)
+  {
+    for (int y = 0; y < grid_data.data_size.height; y++)
+      result = result && grid_data.heatmap_data[x][y] == service_data.heatmap_data[x][y];
+    delete[] grid_data.heatmap_data[x];
+    delete[] service_data.heatmap_data[x];
+  }
+  delete[] grid_data.heatmap_data;
+  delete[] service_data.heatmap_data;
+  delete(grid_data.counter_name);
+  delete(service_data.counter_name);
+
+  // What's logged through the service is read back through the grid
+  grid.service().IncrementMapCounter({ 0.5, 0.5 }, kDeathsCounterKey);
+  return result && grid.getCounterAtPosition(1, 0, kDeathsCounterKey) == 3 && grid.service().single_unit_width() == 2;
+}
+
+// True if both heatmaps hold the same counters for kDeathsCounterKey inside the rect
+bool SameCountersInsideRect(const heatmap_service::HeatmapService &heatmap, const heatmap_service::HeatmapService &other,
+                            HeatmapCoordinate lower_left, HeatmapCoordinate upper_right)
+{
+  HeatmapData data;
+  HeatmapData other_data;
+  if (!heatmap.getCounterDataInsideRect(lower_left, upper_right, kDeathsCounterKey, data))
+    return false;
+  if (!other.getCounterDataInsideRect(lower_left, upper_right, kDeathsCounterKey, other_data))
+    return false;
+
+  bool result = data.data_size.width == other_data.data_size.width && data.data_size.height == other_data.data_size.height;
+  for (int x = 0; x < data.data_size.width; x++)
+  {
+    for (int y = 0; y < data.data_size.height && result; y++)
+      result = data.heatmap_data[x][y] == other_data.heatmap_data[x][y];
+    delete[] data.heatmap_data[x];
+    delete[] other_data.heatmap_data[x];
+  }
+  delete[] data.heatmap_data;
+  delete[] other_data.heatmap_data;
+  delete(data.counter_name);
+  delete(other_data.counter_name);
+  return result;
+}
+
+bool TestMortonLayoutMatchesColumnLayout()
+{
+  heatmap_service::HeatmapService columns = heatmap_service::HeatmapService(1, 1, kColumnStorageLayout);
+  heatmap_service::HeatmapService tiles = heatmap_service::HeatmapService(1, 1, kMortonTileStorageLayout);
+
+  // A walk crossing tile borders in every direction, through negative coordinates
+  for (int i = 0; i < 2000; i++)
+  {
+    HeatmapCoordinate coords = { (double)((i * 7) % 83) - 40, (double)((i * 13) % 71) - 35 };
+    columns.IncrementMapCounterByAmount(coords, kDeathsCounterKey, 1 + i % 3);
+    tiles.IncrementMapCounterByAmount(coords, kDeathsCounterKey, 1 + i % 3);
+  }
+
+  HeatmapCounterStats column_stats;
+  HeatmapCounterStats tile_stats;
+  columns.GetCounterStats(kDeathsCounterKey, column_stats);
+  tiles.GetCounterStats(kDeathsCounterKey, tile_stats);
+
+  bool points_match = true;
+  for (int x = -50; x <= 50; x++)
+  {
+    for (int y = -50; y <= 50; y++)
+      points_match = points_match && columns.getCounterAtPosition({ (double)x, (double)y }, kDeathsCounterKey) == tiles.getCounterAtPosition({ (double)x, (double)y }, kDeathsCounterKey);
+  }
+
+  return tiles.storage_layout() == kMortonTileStorageLayout && points_match &&
+    SameCountersInsideRect(columns, tiles, { -45, -40 }, { 45, 40 }) && SameCountersInsideRect(columns, tiles, { -3, 5 }, { 2, 6 }) &&
+    column_stats.nonzero_cell_count == tile_stats.nonzero_cell_count && column_stats.nonzero_lower_left.x == tile_stats.nonzero_lower_left.x &&
+    column_stats.nonzero_lower_left.y == tile_stats.nonzero_lower_left.y && column_stats.nonzero_upper_right.x == tile_stats.nonzero_upper_right.x &&
+    column_stats.nonzero_upper_right.y == tile_stats.nonzero_upper_right.y && tile_stats.region_count > 0;
+}
+
+bool TestMortonLayoutSnapshotAndSerialize()
+{
+  heatmap_service::HeatmapService tiles = heatmap_service::HeatmapService(2, 2, kMortonTileStorageLayout);
+  for (int i = 0; i < 300; i++)
+    tiles.IncrementMapCounter({ (double)(i % 37) - 18, (double)(i % 23) - 11 }, kDeathsCounterKey);
+
+  // Writing to a tile shared with a snapshot copies it, leaving the snapshot untouched
+  heatmap_service::HeatmapService snapshot(tiles);
+  tiles.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, 100);
+  HeatmapCounterStats tile_stats;
+  tiles.GetCounterStats(kDeathsCounterKey, tile_stats);
+  bool snapshot_isolated = snapshot.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) + 100 == tiles.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) &&
+    tile_stats.copy_on_write_count == 1 && snapshot.storage_layout() == kMortonTileStorageLayout;
+
+  // Tiles serialize as columns, and load into heatmaps of either layout
+  char* buffer;
+  int buffer_size;
+  if (!tiles.SerializeHeatmap(buffer, buffer_size))
+    return false;
+
+  heatmap_service::HeatmapService loaded_columns = heatmap_service::HeatmapService(1, 1, kColumnStorageLayout);
+  heatmap_service::HeatmapService loaded_tiles = heatmap_service::HeatmapService(1, 1, kMortonTileStorageLayout);
+  const char* const_buffer = buffer;
+  loaded_columns.DeserializeHeatmap(const_buffer, buffer_size);
+  const_buffer = buffer;
+  loaded_tiles.DeserializeHeatmap(const_buffer, buffer_size);
+  delete[] buffer;
+
+  return snapshot_isolated && loaded_tiles.storage_layout() == kMortonTileStorageLayout && loaded_tiles.single_unit_width() == 2 &&
+    SameCountersInsideRect(tiles, loaded_columns, { -20, -12 }, { 20, 12 }) && SameCountersInsideRect(tiles, loaded_tiles, { -20, -12 }, { 20, 12 });
+}
+
+const string kCombatGroupKey = "combat";
+const string kCombatCounters[3] = { kDeathsCounterKey, kGoldObtainedCounterKey, kExperienceGainedCounterKey };
+
+bool TestCounterGroupRegisterRead()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2);
+  const string repeated_counters[2] = { kDeathsCounterKey, kDeathsCounterKey };
+  if (!heatmap.CreateCounterGroup(kCombatGroupKey, kCombatCounters, 3) || heatmap.CreateCounterGroup(kCombatGroupKey, kCombatCounters, 3) ||
+      heatmap.CreateCounterGroup("repeated", repeated_counters, 2) || heatmap.CreateCounterGroup("empty", kCombatCounters, 0))
+    return false;
+
+  int amounts[3] = { 1, 10, 100 };
+  int only_gold[3] = { 0, 5, 0 };
+  heatmap.IncrementCounterGroupByAmounts({ -3, -3 }, kCombatGroupKey, amounts);
+  heatmap.IncrementCounterGroupByAmounts({ -4, -4 }, kCombatGroupKey, amounts);
+  heatmap.IncrementCounterGroupByAmounts({ 7, -1 }, kCombatGroupKey, amounts);
+  heatmap.IncrementCounterGroupByAmounts({ 7, 30 }, kCombatGroupKey, only_gold);
+
+  vector<string> keys;
+  return heatmap.hasCounterGroup(kCombatGroupKey) && !heatmap.hasCounterGroup("repeated") && !heatmap.hasMapForCounter(kDeathsCounterKey) &&
+    heatmap.getCounterGroupKeys(kCombatGroupKey, keys) && keys.size() == 3 && keys[2] == kExperienceGainedCounterKey &&
+    2 == heatmap.getCounterGroupValueAtPosition({ -3, -3 }, kCombatGroupKey, kDeathsCounterKey) &&
+    20 == heatmap.getCounterGroupValueAtPosition({ -3, -3 }, kCombatGroupKey, kGoldObtainedCounterKey) &&
+    200 == heatmap.getCounterGroupValueAtPosition({ -3, -3 }, kCombatGroupKey, kExperienceGainedCounterKey) &&
+    100 == heatmap.getCounterGroupValueAtPosition({ 6, -2 }, kCombatGroupKey, kExperienceGainedCounterKey) &&
+    0 == heatmap.getCounterGroupValueAtPosition({ 7, 30 }, kCombatGroupKey, kDeathsCounterKey) &&
+    5 == heatmap.getCounterGroupValueAtPosition({ 7, 30 }, kCombatGroupKey, kGoldObtainedCounterKey) &&
+    0 == heatmap.getCounterGroupValueAtPosition({ 7, 10 }, kCombatGroupKey, kGoldObtainedCounterKey) &&
+    0 == heatmap.getCounterGroupValueAtPosition({ -3, -3 }, kCombatGroupKey, kKillsCounterKey) &&
+    0 == heatmap.getCounterGroupValueAtPosition({ -3, -3 }, "missing", kDeathsCounterKey) &&
+    !heatmap.IncrementCounterGroupByAmounts({ 0, 0 }, "missing", amounts);
+}
+
+bool TestCounterGroupArea()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  heatmap.CreateCounterGroup(kCombatGroupKey, kCombatCounters, 3);
+
+  // The same events logged to the group and to separate counters must read back the same areas
+  for (int i = 0; i < 200; i++)
+  {
+    int amounts[3] = { 1, i % 7, i % 3 };
+    HeatmapCoordinate coords = { (double)(i % 13) - 6, (double)(i % 17) - 8 };
+    heatmap.IncrementCounterGroupByAmounts(coords, kCombatGroupKey, amounts);
+    heatmap.IncrementMultipleMapCountersByAmount(coords, kCombatCounters, amounts, 3);
+  }
+
+  HeatmapData group_data[3];
+  HeatmapData counter_data[3];
+  if (!heatmap.getCounterGroupDataInsideRect({ -8, -10 }, { 4, 12 }, kCombatGroupKey, group_data))
+    return false;
+  if (!heatmap.getMultipleCountersDataInsideRect({ -8, -10 }, { 4, 12 }, kCombatCounters, 3, counter_data))
+    return false;
+
+  bool result = true;
+  for (int i = 0; i < 3; i++)
+  {
+    result = result && *group_data[i].counter_name == kCombatCounters[i] && group_data[i].data_size.width == 13 && group_data[i].data_size.height == 23 &&
+      group_data[i].lower_left_coordinate.x == -8 && group_data[i].lower_left_coordinate.y == -10;
+    for (int x = 0; x < group_data[i].data_size.width; x++)
+    {
+      for (int y = 0; y < group_data[i].data_size.height; y++)
+        result = result && group_data[i].heatmap_data[x][y] == counter_data[i].heatmap_data[x][y];
+      delete[] group_data[i].heatmap_data[x];
+      delete[] counter_data[i].heatmap_data[x];
+    }
+    delete[] group_data[i].heatmap_data;
+    delete[] counter_data[i].heatmap_data;
+    delete(group_data[i].counter_name);
+    delete(counter_data[i].counter_name);
+  }
+
+  return result && !heatmap.getCounterGroupDataInsideRect({ 4, 12 }, { -8, -10 }, kCombatGroupKey, group_data) &&
+    !heatmap.getCounterGroupDataInsideRect({ -8, -10 }, { 4, 12 }, "missing", group_data);
+}
+
+bool TestCounterGroupSerializeAndSnapshot()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  heatmap.CreateCounterGroup(kCombatGroupKey, kCombatCounters, 3);
+  int amounts[3] = { 1, 2, 3 };
+  heatmap.IncrementCounterGroupByAmounts({ 1, -1 }, kCombatGroupKey, amounts);
+  heatmap.IncrementMapCounter({ 1, -1 }, kKillsCounterKey);
+
+  // Writing to the original after a snapshot leaves the snapshot's group untouched
+  heatmap_service::HeatmapService snapshot(heatmap);
+  heatmap.IncrementCounterGroupByAmounts({ 1, -1 }, kCombatGroupKey, amounts);
+
+  char* buffer;
+  int buffer_size;
+  if (!heatmap.SerializeHeatmap(buffer, buffer_size))
+    return false;
+
+  heatmap_service::HeatmapService restored = heatmap_service::HeatmapService();
+  const char* const_buffer = buffer;
+  restored.DeserializeHeatmap(const_buffer, buffer_size);
+  delete[] buffer;
+
+  return 3 == snapshot.getCounterGroupValueAtPosition({ 1, -1 }, kCombatGroupKey, kExperienceGainedCounterKey) &&
+    6 == heatmap.getCounterGroupValueAtPosition({ 1, -1 }, kCombatGroupKey, kExperienceGainedCounterKey) &&
+    restored.hasCounterGroup(kCombatGroupKey) &&
+    2 == restored.getCounterGroupValueAtPosition({ 1, -1 }, kCombatGroupKey, kDeathsCounterKey) &&
+    6 == restored.getCounterGroupValueAtPosition({ 1, -1 }, kCombatGroupKey, kExperienceGainedCounterKey) &&
+    1 == restored.getCounterAtPosition({ 1, -1 }, kKillsCounterKey);
+}
+
+bool TestSnapshotIsolatedFromWrites()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2);
+  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, 5);
+  heatmap.IncrementMapCounterByAmount({ -10, 6 }, kDeathsCounterKey, 3);
+
+  heatmap_service::HeatmapService snapshot(heatmap);
+  heatmap_service::HeatmapService assigned_snapshot;
+  assigned_snapshot = heatmap;
+
+  // Writing to the original, in shared and brand new columns, mustn't reach the snapshots, nor should writing to a snapshot reach the original
+  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, 1);
+  heatmap.IncrementMapCounterByAmount({ 50, -50 }, kDeathsCounterKey, 1);
+  heatmap.IncrementMapCounter({ 0, 0 }, kKillsCounterKey);
+  snapshot.IncrementMapCounterByAmount({ -10, 6 }, kDeathsCounterKey, 10);
+
+  return heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) == 6 && heatmap.getCounterAtPosition({ -10, 6 }, kDeathsCounterKey) == 3 &&
+    heatmap.getCounterAtPosition({ 50, -50 }, kDeathsCounterKey) == 1 &&
+    snapshot.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) == 5 && snapshot.getCounterAtPosition({ -10, 6 }, kDeathsCounterKey) == 13 &&
+    snapshot.getCounterAtPosition({ 50, -50 }, kDeathsCounterKey) == 0 && !snapshot.hasMapForCounter(kKillsCounterKey) &&
+    assigned_snapshot.single_unit_width() == 2 && assigned_snapshot.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) == 5 &&
+    assigned_snapshot.getCounterAtPosition({ -10, 6 }, kDeathsCounterKey) == 3 && assigned_snapshot.getCounterAtPosition({ 50, -50 }, kDeathsCounterKey) == 0;
+}
+
+bool TestSnapshotReadWhileLogging()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  for (int i = 0; i < 10000; i++)
+    heatmap.IncrementMapCounter({ (double)(i % 100), (double)(i / 100) }, kDeathsCounterKey);
+
+  // A reader thread sums the whole snapshot over and over, while this thread keeps logging to the original. Every sum must match the snapshot
+  heatmap_service::HeatmapService snapshot(heatmap);
+  std::atomic<bool> consistent(true);
+  std::atomic<bool> logging(true);
+  std::thread reader([&]() {
+    do
+    {
+      heatmap_service::HeatmapData out_data;
+      if (!snapshot.getAllCounterData(kDeathsCounterKey, out_data))
+      {
+        consistent = false;
+        return;
+      }
+      unsigned int sum = 0;
+      for (int x = 0; x < out_data.data_size.width; x++)
+      {
+        for (int y = 0; y < out_data.data_size.height; y++)
+          sum += out_data.heatmap_data[x][y];
+        delete[] out_data.heatmap_data[x];
+      }
+      delete[] out_data.heatmap_data;
+      delete(out_data.counter_name);
+
+      if (sum != 10000)
+        consistent = false;
+    } while (logging);
+  });
+
+  for (int i = 0; i < 100000; i++)
+    heatmap.IncrementMapCounter({ (double)(i % 150 - 25), (double)(i % 130 - 15) }, kDeathsCounterKey);
+  logging = false;
+  reader.join();
+
+  return consistent && heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) > 1 && snapshot.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) == 1;
+}
+
+bool TestEventQueueMatchesDirectLogging()
+{
+  heatmap_service::HeatmapService direct = heatmap_service::HeatmapService(2);
+  heatmap_service::HeatmapService queued = heatmap_service::HeatmapService(2);
+
+  // Four producers log through a small ring, so they keep filling it and waiting on the aggregator
+  const int kProducers = 4;
+  const int kEventsPerProducer = 50000;
+  {
+    HeatmapEventQueue queue(queued, 256);
+    int deaths = queue.RegisterCounter(kDeathsCounterKey);
+    int kills = queue.RegisterCounter(kKillsCounterKey);
+    if (queue.RegisterCounter(kDeathsCounterKey) != deaths || queue.capacity() != 256 ||
+        queue.IncrementMapCounter({ 0, 0 }, 2) || queue.IncrementMapCounter({ 0, 0 }, -1))
+      return false;
+
+    std::atomic<bool> all_pushed(true);
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < kProducers; producer++)
+    {
+      producers.push_back(std::thread([&, producer]() {
+        for (int i = 0; i < kEventsPerProducer; i++)
+        {
+          HeatmapCoordinate coords = { (double)((i * 7 + producer) % 97 - 40), (double)((i * 13) % 89 - 30) };
+          if (!queue.IncrementMapCounterByAmount(coords, i % 3 == 0 ? kills : deaths, 1 + i % 4))
+            all_pushed = false;
+        }
+      }));
+    }
+    for (std::thread &producer : producers)
+      producer.join();
+    queue.Flush();
+
+    if (!all_pushed || queue.dropped_event_count() != 0)
+      return false;
+  }
+
+  for (int producer = 0; producer < kProducers; producer++)
+  {
+    for (int i = 0; i < kEventsPerProducer; i++)
+    {
+      HeatmapCoordinate coords = { (double)((i * 7 + producer) % 97 - 40), (double)((i * 13) % 89 - 30) };
+      direct.IncrementMapCounterByAmount(coords, i % 3 == 0 ? kKillsCounterKey : kDeathsCounterKey, 1 + i % 4);
+    }
+  }
+
+  for (int x = -40; x < 57; x++)
+  {
+    for (int y = -30; y < 59; y++)
+    {
+      if (direct.getCounterAtPosition({ (double)x, (double)y }, kDeathsCounterKey) != queued.getCounterAtPosition({ (double)x, (double)y }, kDeathsCounterKey) ||
+          direct.getCounterAtPosition({ (double)x, (double)y }, kKillsCounterKey) != queued.getCounterAtPosition({ (double)x, (double)y }, kKillsCounterKey))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool TestEventQueueBackpressure()
+{
+  // Whether the ring fills up depends on how fast the aggregator drains it, but every event is either in the heatmap or dropped
+  const int kEvents = 200000;
+  heatmap_service::HeatmapService counted = heatmap_service::HeatmapService();
+  int pushed = 0;
+  unsigned long long dropped = 0;
+  {
+    HeatmapEventQueue queue(counted, 4, kCountDropsWhenFull);
+    int deaths = queue.RegisterCounter(kDeathsCounterKey);
+    for (int i = 0; i < kEvents; i++)
+      pushed += queue.IncrementMapCounter({ 0, 0 }, deaths) ? 1 : 0;
+    queue.Flush();
+    dropped = queue.dropped_event_count();
+    if ((int)counted.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) != pushed)
+      return false;
+  }
+
+  heatmap_service::HeatmapService silent = heatmap_service::HeatmapService();
+  int silent_pushed = 0;
+  unsigned long long silent_dropped = 0;
+  {
+    HeatmapEventQueue queue(silent, 4, kDropWhenFull);
+    int deaths = queue.RegisterCounter(kDeathsCounterKey);
+    for (int i = 0; i < kEvents; i++)
+      silent_pushed += queue.IncrementMapCounter({ 0, 0 }, deaths) ? 1 : 0;
+    silent_dropped = queue.dropped_event_count();
+  }
+
+  // Destroying the queue adds whatever it still held
+  heatmap_service::HeatmapService blocking = heatmap_service::HeatmapService();
+  {
+    HeatmapEventQueue queue(blocking, 4, kBlockWhenFull);
+    int deaths = queue.RegisterCounter(kDeathsCounterKey);
+    for (int i = 0; i < kEvents; i++)
+      queue.IncrementMapCounter({ 0, 0 }, deaths);
+  }
+
+  return pushed + dropped == kEvents && silent_dropped == 0 && (int)silent.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) == silent_pushed &&
+    blocking.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) == kEvents;
+}
+
+bool TestEventQueueSnapshotWhileLogging()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  HeatmapEventQueue queue(heatmap, 1024);
+  int deaths = queue.RegisterCounter(kDeathsCounterKey);
+
+  // The producer logs one death at {0,0} and one at {1,0} per step. Snapshots are taken between batches, so they can be half a step behind,
+  // but never miss an event pushed before they were asked for
+  const int kSteps = 100000;
+  std::atomic<int> steps_pushed(0);
+  std::thread producer([&]() {
+    for (int i = 0; i < kSteps; i++)
+    {
+      queue.IncrementMapCounter({ 0, 0 }, deaths);
+      queue.IncrementMapCounter({ 1, 0 }, deaths);
+      steps_pushed = i + 1;
+    }
+  });
+
+  bool consistent = true;
+  while (steps_pushed < kSteps)
+  {
+    int pushed_before = steps_pushed;
+    heatmap_service::HeatmapService snapshot;
+    queue.Snapshot(snapshot);
+    unsigned int first = snapshot.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey);
+    unsigned int second = snapshot.getCounterAtPosition({ 1, 0 }, kDeathsCounterKey);
+    if (first < (unsigned int)pushed_before || second < (unsigned int)pushed_before || first < second || first > second + 1)
+      consistent = false;
+  }
+  producer.join();
+  queue.Flush();
+
+  return consistent && heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) == kSteps && heatmap.getCounterAtPosition({ 1, 0 }, kDeathsCounterKey) == kSteps;
+}
+
+bool TestGetStats()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2);
+  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, 5);
+  heatmap.IncrementMapCounterByAmount({ -10, 6 }, kDeathsCounterKey, 3);
+  heatmap.IncrementMapCounter({ 7, -3 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 0, 0 }, kKillsCounterKey);
+
+  HeatmapCounterStats deaths_stats;
+  HeatmapCounterStats missing_stats;
+  if (!heatmap.GetCounterStats(kDeathsCounterKey, deaths_stats) || heatmap.GetCounterStats(kGoldObtainedCounterKey, missing_stats))
+    return false;
+
+  // Deaths were logged in cells {0,0}, {-5,3} and {3,-2}, each in a column of its own
+  bool deaths_correct = deaths_stats.counter_name == kDeathsCounterKey && deaths_stats.nonzero_cell_count == 3 && deaths_stats.region_count == 3 &&
+    deaths_stats.nonzero_lower_left.x == -10 && deaths_stats.nonzero_lower_left.y == -4 &&
+    deaths_stats.nonzero_upper_right.x == 8 && deaths_stats.nonzero_upper_right.y == 8 &&
+    deaths_stats.used_bytes > 0 && deaths_stats.allocated_bytes >= deaths_stats.used_bytes && deaths_stats.shared_bytes == 0 &&
+    deaths_stats.reallocation_count >= 3 && deaths_stats.copy_on_write_count == 0;
+
+  HeatmapStats stats = heatmap.GetStats();
+  unsigned long long allocated_bytes = 0;
+  for (const HeatmapCounterStats& counter_stats : stats.counters)
+    allocated_bytes += counter_stats.allocated_bytes;
+
+  return deaths_correct && stats.counters.size() == 2 && stats.allocated_bytes == allocated_bytes &&
+    stats.counters[0].counter_name == kDeathsCounterKey && stats.counters[0].allocated_bytes == deaths_stats.allocated_bytes &&
+    stats.counters[1].counter_name == kKillsCounterKey && stats.counters[1].nonzero_cell_count == 1;
+}
+
+bool TestStatsTrackSnapshotCopies()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  for (int x = 0; x < 10; x++)
+    heatmap.IncrementMapCounter({ (double)x, (double)x }, kDeathsCounterKey);
+
+  HeatmapCounterStats before_stats;
+  heatmap.GetCounterStats(kDeathsCounterKey, before_stats);
+
+  heatmap_service::HeatmapService snapshot(heatmap);
+  HeatmapCounterStats shared_stats;
+  heatmap.GetCounterStats(kDeathsCounterKey, shared_stats);
+
+  // Writing to a shared column copies it, and only that column stops being shared
+  heatmap.IncrementMapCounter({ 3, 3 }, kDeathsCounterKey);
+  HeatmapCounterStats written_stats;
+  HeatmapCounterStats snapshot_stats;
+  heatmap.GetCounterStats(kDeathsCounterKey, written_stats);
+  snapshot.GetCounterStats(kDeathsCounterKey, snapshot_stats);
+
+  return before_stats.shared_bytes == 0 && shared_stats.shared_bytes > 0 && shared_stats.allocated_bytes == before_stats.allocated_bytes &&
+    written_stats.copy_on_write_count == 1 && written_stats.bytes_copied > shared_stats.bytes_copied &&
+    written_stats.shared_bytes < shared_stats.shared_bytes && snapshot_stats.shared_bytes == written_stats.shared_bytes &&
+    snapshot_stats.copy_on_write_count == 0 && written_stats.nonzero_cell_count == 10 && snapshot_stats.nonzero_cell_count == 10;
+}
+
+// Gathers the summary of a counter from every one of its non zero cells, and compares it with the one the heatmap keeps
+bool SummaryMatchesCells(const heatmap_service::HeatmapService &heatmap, const std::string &counter_key)
+{
+  HeatmapCounterSummary summary;
+  HeatmapSparseData cells;
+  if (!heatmap.getCounterSummary(counter_key, summary) || !heatmap.getAllSparseCounterData(counter_key, cells))
+    return false;
+
+  unsigned long long total = 0;
+  unsigned int max_value = 0;
+  unsigned long long histogram[HeatmapCounterSummary::kHistogramBuckets] = {};
+  for (unsigned int value : cells.values)
+  {
+    total += value;
+    max_value = std::max(max_value, value);
+    int bucket = 0;
+    while (value >>= 1)
+      bucket++;
+    histogram[bucket]++;
+  }
+
+  bool result = summary.counter_name == counter_key && summary.total == total && summary.max_value == max_value && summary.nonzero_cell_count == cells.values.size();
+  for (int bucket = 0; bucket < HeatmapCounterSummary::kHistogramBuckets; bucket++)
+    result = result && summary.histogram[bucket] == histogram[bucket];
+  return result;
+}
+
+bool TestCounterSummary()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, 2);
+  heatmap.IncrementMapCounterByAmount({ 5, 5 }, kDeathsCounterKey, 100);
+  heatmap.IncrementMapCounter({ -3, 2 }, kDeathsCounterKey);
+
+  HeatmapCounterSummary summary;
+  bool result = !heatmap.getCounterSummary(kKillsCounterKey, summary);
+  result = result && heatmap.getCounterSummary(kDeathsCounterKey, summary);
+  result = result && summary.total == 104 && summary.max_value == 100 && summary.nonzero_cell_count == 3;
+  result = result && summary.histogram[0] == 1 && summary.histogram[1] == 1 && summary.histogram[6] == 1;
+
+  HeatmapStorageLayout layouts[2] = { kColumnStorageLayout, kMortonTileStorageLayout };
+  for (HeatmapStorageLayout layout : layouts)
+  {
+    // Counters crossing every bucket boundary, in columns both sparse and dense
+    heatmap_service::HeatmapService logged = heatmap_service::HeatmapService(1, 1, layout);
+    for (int i = 0; i < 20000; i++)
+      logged.IncrementMapCounterByAmount({ (double)((i * 37) % 150 - 60), (double)((i * 7919) % 2000 - 500) }, kDeathsCounterKey, (i % 7) * (i % 7) * 3 + 1);
+    result = result && SummaryMatchesCells(logged, kDeathsCounterKey);
+
+    // A snapshot keeps the summary it was taken with
+    HeatmapCounterSummary snapshot_summary;
+    HeatmapService snapshot = logged;
+    for (int i = 0; i < 1000; i++)
+      logged.IncrementMapCounter({ (double)(i % 40), (double)(i * 13 % 3000) }, kDeathsCounterKey);
+    result = result && snapshot.getCounterSummary(kDeathsCounterKey, snapshot_summary) && logged.getCounterSummary(kDeathsCounterKey, summary);
+    result = result && summary.total == snapshot_summary.total + 1000;
+    result = result && SummaryMatchesCells(logged, kDeathsCounterKey) && SummaryMatchesCells(snapshot, kDeathsCounterKey);
+
+    // Counters wrap around past the highest unsigned int, which can take the highest counter with them
+    logged.IncrementMapCounterByAmount({ 1000, 1000 }, kDeathsCounterKey, INT_MAX);
+    logged.IncrementMapCounterByAmount({ 1000, 1000 }, kDeathsCounterKey, INT_MAX);
+    logged.IncrementMapCounterByAmount({ 1000, 1000 }, kDeathsCounterKey, INT_MAX);
+    result = result && SummaryMatchesCells(logged, kDeathsCounterKey);
+  }
+  return result;
+}
+
+bool TestCounterSummaryAfterMergeRebinAndLoad()
+{
+  bool result = true;
+  HeatmapStorageLayout layouts[2] = { kColumnStorageLayout, kMortonTileStorageLayout };
+  for (HeatmapStorageLayout layout : layouts)
+  {
+    heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(1, 1, layout);
+    heatmap_service::HeatmapService other = heatmap_service::HeatmapService(1, 1, layout);
+    for (int i = 0; i < 5000; i++)
+    {
+      heatmap.IncrementMapCounterByAmount({ (double)((i * 37) % 90 - 30), (double)((i * 7919) % 3000 - 700) }, kDeathsCounterKey, i % 5 + 1);
+      other.IncrementMapCounterByAmount({ (double)((i * 11) % 200 - 100), (double)((i * 31) % 900) }, kDeathsCounterKey, i % 9 + 1);
+      other.IncrementMapCounter({ (double)(i % 50), (double)(i % 70) }, kKillsCounterKey);
+    }
+
+    // Merging into an empty heatmap takes the counters of other, and into a filled one adds them
+    heatmap_service::HeatmapService empty = heatmap_service::HeatmapService(1, 1, layout);
+    result = result && empty.MergeHeatmap(other) && SummaryMatchesCells(empty, kDeathsCounterKey) && SummaryMatchesCells(empty, kKillsCounterKey);
+    result = result && heatmap.MergeHeatmap(other) && SummaryMatchesCells(heatmap, kDeathsCounterKey) && SummaryMatchesCells(heatmap, kKillsCounterKey);
+
+    // Rebinning keeps the total, while the cells it sums change every other aggregate
+    HeatmapCounterSummary before, after;
+    result = result && heatmap.getCounterSummary(kDeathsCounterKey, before) && heatmap.Rebin(4, 4) && heatmap.getCounterSummary(kDeathsCounterKey, after);
+    result = result && before.total == after.total && after.nonzero_cell_count < before.nonzero_cell_count && SummaryMatchesCells(heatmap, kDeathsCounterKey);
+
+    // Deserializing clears the counters already logged
+    char* buffer;
+    int buffer_size;
+    if (!heatmap.SerializeHeatmap(buffer, buffer_size))
+      return false;
+    const char* const_buffer = buffer;
+    result = result && other.DeserializeHeatmap(const_buffer, buffer_size);
+    delete[] buffer;
+    result = result && SummaryMatchesCells(other, kDeathsCounterKey) && SummaryMatchesCells(other, kKillsCounterKey);
+    result = result && other.getCounterSummary(kDeathsCounterKey, before) && before.total == after.total;
+  }
+  return result;
+}
+
+bool TestSparseRegionsPromoteAndDemote()
+{
+  // A column crossing the wilderness, with three events far apart, and a town centre column written to all along
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  heatmap.IncrementMapCounter({ 5, 1000 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounterByAmount({ 5, -2000 }, kDeathsCounterKey, 4);
+  heatmap.IncrementMapCounter({ 5, 3000 }, kDeathsCounterKey);
+  for (int y = 0; y < 200; y++)
+    heatmap.IncrementMapCounterByAmount({ 6, (double)y }, kDeathsCounterKey, y + 1);
+
+  HeatmapCounterStats stats;
+  heatmap.GetCounterStats(kDeathsCounterKey, stats);
+  bool promoted_dense_column = stats.region_count == 2 && stats.sparse_region_count == 1 && stats.nonzero_cell_count == 203 &&
+    stats.used_bytes < 200 * sizeof(uint32_t) + 1000;
+
+  // Writing to a sparse column shared with a snapshot copies the list, leaving the snapshot untouched
+  heatmap_service::HeatmapService snapshot(heatmap);
+  heatmap.IncrementMapCounter({ 5, 1000 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 5, 1500 }, kDeathsCounterKey);
+  bool snapshot_isolated = snapshot.getCounterAtPosition({ 5, 1000 }, kDeathsCounterKey) == 1 && heatmap.getCounterAtPosition({ 5, 1000 }, kDeathsCounterKey) == 2 &&
+    snapshot.getCounterAtPosition({ 5, 1500 }, kDeathsCounterKey) == 0 && heatmap.getCounterAtPosition({ 5, -2000 }, kDeathsCounterKey) == 4;
+
+  HeatmapData data;
+  if (!heatmap.getCounterDataInsideRect({ 5, -2000 }, { 6, 3000 }, kDeathsCounterKey, data))
+    return false;
+  bool area_correct = data.heatmap_data[0][0] == 4 && data.heatmap_data[0][3000] == 2 && data.heatmap_data[0][3500] == 1 &&
+    data.heatmap_data[0][5000] == 1 && data.heatmap_data[0][1] == 0 && data.heatmap_data[1][2000] == 1 && data.heatmap_data[1][2199] == 200;
+  for (int x = 0; x < data.data_size.width; x++)
+    delete[] data.heatmap_data[x];
+  delete[] data.heatmap_data;
+  delete(data.counter_name);
+
+  // Columns load dense, and the one with few counters is demoted back to sparse
+  char* buffer;
+  int buffer_size;
+  if (!heatmap.SerializeHeatmap(buffer, buffer_size))
+    return false;
+  heatmap_service::HeatmapService loaded = heatmap_service::HeatmapService();
+  const char* const_buffer = buffer;
+  loaded.DeserializeHeatmap(const_buffer, buffer_size);
+  delete[] buffer;
+
+  HeatmapCounterStats loaded_stats;
+  loaded.GetCounterStats(kDeathsCounterKey, loaded_stats);
+  return promoted_dense_column && snapshot_isolated && area_correct && loaded_stats.sparse_region_count == 1 && loaded_stats.nonzero_cell_count == 204 &&
+    SameCountersInsideRect(heatmap, loaded, { 5, -2000 }, { 6, 3000 });
+}
+
+bool TestLatencyHistograms()
+{
+  // Nothing is recorded when the library is built without instrumentation
+  HeatmapLatencySummary summary;
+  if (!HeatmapService::instrumentation_available())
+    return !HeatmapService::GetLatencySummary(kIncrementOperation, summary);
+
+  HeatmapService::EnableLatencyHistograms(true);
+  HeatmapService::ResetLatencyHistograms();
+
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  for (int i = 0; i < 1000; i++)
+    heatmap.IncrementMapCounter({ (double)(i % 50), (double)(i / 50) }, kDeathsCounterKey);
+  HeatmapData out_data;
+  if (heatmap.getAllCounterData(kDeathsCounterKey, out_data))
+  {
+    for (int x = 0; x < out_data.data_size.width; x++)
+      delete[] out_data.heatmap_data[x];
+    delete[] out_data.heatmap_data;
+    delete(out_data.counter_name);
+  }
+
+  HeatmapLatencySummary increment_summary;
+  HeatmapLatencySummary area_summary;
+  HeatmapLatencySummary serialize_summary;
+  bool result = HeatmapService::GetLatencySummary(kIncrementOperation, increment_summary) && HeatmapService::GetLatencySummary(kAreaQueryOperation, area_summary) &&
+    HeatmapService::GetLatencySummary(kSerializeOperation, serialize_summary);
+
+  // Once disabled, operations aren't recorded anymore
+  HeatmapService::EnableLatencyHistograms(false);
+  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  HeatmapLatencySummary disabled_summary;
+  HeatmapService::GetLatencySummary(kIncrementOperation, disabled_summary);
+  HeatmapService::ResetLatencyHistograms();
+
+  return result && increment_summary.operation == kIncrementOperation && increment_summary.count == 1000 && area_summary.count == 1 && serialize_summary.count == 0 &&
+    increment_summary.p50_ns <= increment_summary.p90_ns && increment_summary.p90_ns <= increment_summary.p99_ns &&
+    increment_summary.p99_ns <= increment_summary.p999_ns && increment_summary.p999_ns <= increment_summary.max_ns &&
+    increment_summary.max_ns > 0 && increment_summary.mean_ns <= increment_summary.max_ns && disabled_summary.count == 1000;
+}
+
+// Counts the events it receives
+class CountingEventHook : public HeatmapEventHook
+{
+public:
+  CountingEventHook() : region_growths(0), bytes_copied(0), slow_operations(0) {}
+
+  void OnRegionGrowth(const std::string &counter_key, HeatmapCoordinate coords, unsigned long long bytes) override
+  {
+    region_growths++;
+    bytes_copied += bytes;
+  }
+
+  void OnSlowOperation(HeatmapOperation operation, double nanoseconds) override
+  {
+    if (operation == kAreaQueryOperation && nanoseconds > 0)
+      slow_operations++;
+  }
+
+  int region_growths;
+  unsigned long long bytes_copied;
+  int slow_operations;
+};
+
+bool TestEventHookReceivesEvents()
+{
+  if (!HeatmapService::instrumentation_available())
+    return true;
+
+  CountingEventHook hook;
+  HeatmapService::SetEventHook(&hook);
+  HeatmapService::SetSlowOperationThreshold(kAreaQueryOperation, 1);
+
+  // Logging the same cell twice only grows the map the first time
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  for (int x = 0; x < 20; x++)
+    heatmap.IncrementMapCounter({ (double)x, (double)x }, kDeathsCounterKey);
+  int growths_after_new_cells = hook.region_growths;
+  heatmap.IncrementMapCounter({ 5, 5 }, kDeathsCounterKey);
+
+  // Writing to a column shared with a snapshot copies it
+  heatmap_service::HeatmapService snapshot(heatmap);
+  heatmap.IncrementMapCounter({ 5, 5 }, kDeathsCounterKey);
+
+  HeatmapData out_data;
+  if (heatmap.getCounterDataInsideRect({ 0, 0 }, { 10, 10 }, kDeathsCounterKey, out_data))
+  {
+    for (int x = 0; x < out_data.data_size.width; x++)
+      delete[] out_data.heatmap_data[x];
+    delete[] out_data.heatmap_data;
+    delete(out_data.counter_name);
+  }
+
+  HeatmapService::SetSlowOperationThreshold(kAreaQueryOperation, 0);
+  HeatmapService::SetEventHook(nullptr);
+
+  return growths_after_new_cells >= 20 && hook.region_growths == growths_after_new_cells + 1 && hook.bytes_copied > 0 && hook.slow_operations == 1;
+}
+
+bool TestSimpleGetArea()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2);
+  heatmap.IncrementMapCounter({ -1, -1 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 1, 1 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 2, 2 }, kDeathsCounterKey);
+
+  heatmap_service::HeatmapData out_data;
+  if (!heatmap.getCounterDataInsideRect({ -2, -2 }, { 1, 1 }, kDeathsCounterKey, out_data))
+    return false;
+
+  bool result = out_data.counter_name->compare(kDeathsCounterKey) == 0 &&
+    out_data.spatial_resolution.width == 2 && out_data.spatial_resolution.height == 2 &&
+    out_data.data_size.width == 2 && out_data.data_size.height == 2 &&
+    2 == out_data.heatmap_data[1][1];
+
+  delete(out_data.counter_name);
+  delete[] out_data.heatmap_data;
+
+  return result;
+}
+
+bool TestGetAreaUnitSizedRect()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2);
+  heatmap.IncrementMapCounter({ -1, -1 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 1, 1 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 2, 2 }, kDeathsCounterKey);
+
+  heatmap_service::HeatmapData out_data;
+  if (!heatmap.getCounterDataInsideRect({ 0, 0 }, { 0, 0 }, kDeathsCounterKey, out_data))
+    return false;
+
+  bool result = out_data.counter_name->compare(kDeathsCounterKey) == 0 &&
+    out_data.spatial_resolution.width == 2 && out_data.spatial_resolution.height == 2 &&
+    out_data.data_size.width == 1 && out_data.data_size.height == 1 &&
+    2 == out_data.heatmap_data[0][0];
+
+  delete(out_data.counter_name);
+  delete[] out_data.heatmap_data;
+
+  return result;
+}
+
+bool TestGetAreaUpperLowerSwitched()
+{
+  // Should fail at getting data. Invalid rect
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2);
+  heatmap.IncrementMapCounter({ -1, -1 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 1, 1 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 2, 2 }, kDeathsCounterKey);
+
+  heatmap_service::HeatmapData out_data;
+
+  bool result = !heatmap.getCounterDataInsideRect({ 2, 2 }, { -2, -2 }, kDeathsCounterKey, out_data);
+
+  if (result == false)
+  {
+    delete(out_data.counter_name);
+    delete[] out_data.heatmap_data;
+  }
+
+  return result;
+}
+
+bool TestSimpleGetEntireArea()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2);
+  heatmap.IncrementMapCounter({ -1, -1 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 1, 1 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 2, 2 }, kDeathsCounterKey);
+
+  heatmap_service::HeatmapData out_data;
+  if (!heatmap.getAllCounterData(kDeathsCounterKey, out_data))
+    return false;
+
+  bool result = out_data.counter_name->compare(kDeathsCounterKey) == 0 &&
+    out_data.spatial_resolution.width == 2 && out_data.spatial_resolution.height == 2 &&
+    out_data.data_size.width == 3 && out_data.data_size.height == 3 &&
+    2 == out_data.heatmap_data[1][1];
+
+  delete(out_data.counter_name);
+  delete[] out_data.heatmap_data;
+
+  return result;
+}
+
+bool TestGetMultipleCountersArea()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+
+  const std::string counters[3] = { kDeathsCounterKey, kDodgesKey, kGoldObtainedCounterKey };
+  int amounts[3] = { 1, 2, 3 };
+  heatmap.IncrementMultipleMapCountersByAmount({ 1, 1 }, counters, amounts, 3);
+  heatmap.IncrementMultipleMapCountersByAmount({ -2, 3 }, counters, amounts, 3);
+
+  heatmap_service::HeatmapData out_data[3];
+  if (!heatmap.getMultipleCountersDataInsideRect({ -2, 0 }, { 1, 3 }, counters, 3, out_data))
+    return false;
+
+  bool result = true;
+  for (int i = 0; i < 3; i++)
+  {
+    result = result && *out_data[i].counter_name == counters[i] && out_data[i].data_size.width == 4 && out_data[i].data_size.height == 4 &&
+      out_data[i].heatmap_data[3][1] == (unsigned int)amounts[i] && out_data[i].heatmap_data[0][3] == (unsigned int)amounts[i] && out_data[i].heatmap_data[1][1] == 0;
+
+    for (int x = 0; x < out_data[i].data_size.width; x++)
+      delete[] out_data[i].heatmap_data[x];
+    delete[] out_data[i].heatmap_data;
+    delete(out_data[i].counter_name);
+  }
+
+  // A single missing counter fails the whole query
+  const std::string missing_counters[2] = { kDeathsCounterKey, kKillsCounterKey };
+  return result && !heatmap.getMultipleCountersDataInsideRect({ -2, 0 }, { 1, 3 }, missing_counters, 2, out_data);
+}
+
+bool TestParallelGetAreaMatchesSynchronous()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  for (int i = 0; i < 20000; i++)
+    heatmap.IncrementMapCounterByAmount({ (double)((i * 7919) % 600), (double)((i * 104729) % 300) }, kDeathsCounterKey, i % 5 + 1);
+
+  // The area is big enough to be split in strips. It's queried with a few workers, whatever the hardware, and then synchronously
+  int default_worker_count = HeatmapService::worker_thread_count();
+  int worker_counts[2] = { 3, 0 };
+  bool result = true;
+  for (int k = 0; k < 2; k++)
+  {
+    HeatmapService::SetWorkerThreadCount(worker_counts[k]);
+    result = result && HeatmapService::worker_thread_count() == worker_counts[k];
+
+    heatmap_service::HeatmapData out_data;
+    if (!heatmap.getCounterDataInsideRect({ -10, -10 }, { 609, 309 }, kDeathsCounterKey, out_data))
+    {
+      result = false;
+      continue;
+    }
+
+    for (int x = 0; x < out_data.data_size.width; x++)
+    {
+      for (int y = 0; y < out_data.data_size.height; y++)
+        result = result && out_data.heatmap_data[x][y] == heatmap.getCounterAtPosition({ (double)(x - 10), (double)(y - 10) }, kDeathsCounterKey);
+      delete[] out_data.heatmap_data[x];
+    }
+    delete[] out_data.heatmap_data;
+    delete(out_data.counter_name);
+  }
+  HeatmapService::SetWorkerThreadCount(default_worker_count);
+
+  return result;
+}
+
+bool TestQueryCacheReturnsCachedResult()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  for (int i = 0; i < 2000; i++)
+    heatmap.IncrementMapCounterByAmount({ (double)((i * 31) % 100), (double)((i * 17) % 80) }, kDeathsCounterKey, i % 3 + 1);
+
+  heatmap.SetQueryCacheCapacity(4);
+  heatmap_service::HeatmapSharedData first, second, after_write, after_distant_write;
+  if (heatmap.query_cache_capacity() != 4 ||
+      !heatmap.getSharedCounterDataInsideRect({ 10, 10 }, { 49, 39 }, kDeathsCounterKey, first) ||
+      !heatmap.getSharedCounterDataInsideRect({ 10, 10 }, { 49, 39 }, kDeathsCounterKey, second))
+    return false;
+
+  // A repeated query on an unchanged area hands out the very same result
+  bool result = first == second && first->data_size.width == 40 && first->data_size.height == 30 && *first->counter_name == kDeathsCounterKey;
+
+  // Writing outside the columns of the area doesn't touch its regions, writing inside it does
+  heatmap.IncrementMapCounter({ 90, 20 }, kDeathsCounterKey);
+  result = result && heatmap.getSharedCounterDataInsideRect({ 10, 10 }, { 49, 39 }, kDeathsCounterKey, after_distant_write) && after_distant_write == first;
+
+  unsigned int old_value = first->heatmap_data[5][5];
+  heatmap.IncrementMapCounterByAmount({ 15, 15 }, kDeathsCounterKey, 7);
+  result = result && heatmap.getSharedCounterDataInsideRect({ 10, 10 }, { 49, 39 }, kDeathsCounterKey, after_write) && after_write != first &&
+    after_write->heatmap_data[5][5] == old_value + 7 && first->heatmap_data[5][5] == old_value;
+
+  // Copied out results match the counters, whether they came from the cache or not
+  for (int k = 0; k < 2; k++)
+  {
+    heatmap_service::HeatmapData out_data;
+    if (!heatmap.getCounterDataInsideRect({ 10, 10 }, { 49, 39 }, kDeathsCounterKey, out_data))
+      return false;
+    for (int x = 0; x < out_data.data_size.width; x++)
+    {
+      for (int y = 0; y < out_data.data_size.height; y++)
+        result = result && out_data.heatmap_data[x][y] == heatmap.getCounterAtPosition({ (double)(x + 10), (double)(y + 10) }, kDeathsCounterKey);
+      delete[] out_data.heatmap_data[x];
+    }
+    delete[] out_data.heatmap_data;
+    delete(out_data.counter_name);
+  }
+
+  HeatmapStats stats = heatmap.GetStats();
+  return result && stats.query_cache_hits == 4 && stats.query_cache_misses == 2;
+}
+
+bool TestQueryCacheInvalidation()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(1, 1, kMortonTileStorageLayout);
+  heatmap.SetQueryCacheCapacity(2);
+  for (int i = 0; i < 500; i++)
+    heatmap.IncrementMapCounter({ (double)(i % 40), (double)(i % 25) }, kDeathsCounterKey);
+
+  heatmap_service::HeatmapSharedData cached, reread;
+  if (!heatmap.getSharedCounterDataInsideRect({ 0, 0 }, { 39, 24 }, kDeathsCounterKey, cached))
+    return false;
+
+  // A tile far from the area doesn't invalidate it, a tile inside it does
+  heatmap.IncrementMapCounter({ 200, 200 }, kDeathsCounterKey);
+  bool result = heatmap.getSharedCounterDataInsideRect({ 0, 0 }, { 39, 24 }, kDeathsCounterKey, reread) && reread == cached;
+  heatmap.IncrementMapCounter({ 39, 24 }, kDeathsCounterKey);
+  result = result && heatmap.getSharedCounterDataInsideRect({ 0, 0 }, { 39, 24 }, kDeathsCounterKey, reread) && reread != cached &&
+    reread->heatmap_data[39][24] == cached->heatmap_data[39][24] + 1;
+
+  // Snapshots start with an empty cache, and keep reading their own counters
+  HeatmapService snapshot = heatmap;
+  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  heatmap_service::HeatmapSharedData snapshot_data;
+  result = result && snapshot.query_cache_capacity() == 2 && snapshot.getSharedCounterDataInsideRect({ 0, 0 }, { 39, 24 }, kDeathsCounterKey, snapshot_data) &&
+    snapshot_data != reread && snapshot_data->heatmap_data[0][0] == reread->heatmap_data[0][0] && snapshot.GetStats().query_cache_misses == 1;
+
+  // Loading other counters over the heatmap leaves nothing to hit, even if the versions of its regions happen to be the same
+  heatmap_service::HeatmapService other = heatmap_service::HeatmapService(1, 1, kMortonTileStorageLayout);
+  for (int i = 0; i < 500; i++)
+    other.IncrementMapCounterByAmount({ (double)(i % 40), (double)(i % 25) }, kDeathsCounterKey, 2);
+  char* buffer;
+  int buffer_length;
+  if (!heatmap.getSharedCounterDataInsideRect({ 0, 0 }, { 39, 24 }, kDeathsCounterKey, cached) || !other.SerializeHeatmap(buffer, buffer_length))
+    return false;
+  const char* read_buffer = buffer;
+  result = result && heatmap.DeserializeHeatmap(read_buffer, buffer_length);
+  delete[] buffer;
+
+  result = result && heatmap.getSharedCounterDataInsideRect({ 0, 0 }, { 39, 24 }, kDeathsCounterKey, reread) && reread != cached &&
+    reread->heatmap_data[0][0] == other.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey);
+
+  // Turning the cache off drops its results
+  heatmap.SetQueryCacheCapacity(0);
+  heatmap_service::HeatmapSharedData uncached;
+  return result && heatmap.getSharedCounterDataInsideRect({ 0, 0 }, { 39, 24 }, kDeathsCounterKey, uncached) && uncached != reread;
+}
+
+bool TestSparseQueryTightBounds()
+{
+  bool result = true;
+  HeatmapStorageLayout layouts[2] = { kColumnStorageLayout, kMortonTileStorageLayout };
+  for (HeatmapStorageLayout layout : layouts)
+  {
+    // A few events far from the origin, while the map limits still reach down to 0,0
+    heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2, layout);
+    heatmap.IncrementMapCounterByAmount({ 10001, 10050 }, kDeathsCounterKey, 3);
+    heatmap.IncrementMapCounter({ 10200, 9990 }, kDeathsCounterKey);
+    heatmap.IncrementMapCounter({ 10200, 10010 }, kDeathsCounterKey);
+
+    heatmap_service::HeatmapSparseData out_data;
+    result = result && heatmap.getAllSparseCounterData(kDeathsCounterKey, out_data) && out_data.counter_name == kDeathsCounterKey &&
+      out_data.values.size() == 3 && out_data.cell_x.size() == 3 && out_data.cell_y.size() == 3 &&
+      out_data.cell_x[0] == 5000 && out_data.cell_y[0] == 5025 && out_data.values[0] == 3 &&
+      out_data.cell_x[1] == 5100 && out_data.cell_y[1] == 4995 && out_data.cell_x[2] == 5100 && out_data.cell_y[2] == 5005 &&
+      out_data.lower_left_coordinate.x == 10000 && out_data.lower_left_coordinate.y == 9990 &&
+      out_data.data_size.width == 101 && out_data.data_size.height == 31 && out_data.spatial_resolution.width == 2;
+
+    // Areas only list their own cells, and areas without any come back empty, but still succeed
+    heatmap_service::HeatmapSparseData area_data, empty_data;
+    result = result && heatmap.getSparseCounterDataInsideRect({ 10100, 9000 }, { 11000, 10005 }, kDeathsCounterKey, area_data) &&
+      area_data.values.size() == 1 && area_data.cell_y[0] == 4995 && area_data.data_size.width == 1 && area_data.data_size.height == 1 &&
+      heatmap.getSparseCounterDataInsideRect({ -500, -500 }, { 500, 500 }, kDeathsCounterKey, empty_data) && empty_data.values.empty() &&
+      empty_data.data_size.width == 0 && !heatmap.getAllSparseCounterData(kGoldObtainedCounterKey, empty_data) &&
+      !heatmap.getSparseCounterDataInsideRect({ 10, 10 }, { 0, 0 }, kDeathsCounterKey, empty_data);
+  }
+  return result;
+}
+
+bool TestSparseQueryMatchesDenseArea()
+{
+  bool result = true;
+  HeatmapStorageLayout layouts[2] = { kColumnStorageLayout, kMortonTileStorageLayout };
+  for (HeatmapStorageLayout layout : layouts)
+  {
+    // Columns dense enough to be promoted, sparse ones, negative cells, and a snapshot that copies some of them on write
+    heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(1, 1, layout);
+    for (int i = 0; i < 6000; i++)
+      heatmap.IncrementMapCounterByAmount({ (double)((i * 37) % 90 - 30), (double)((i * 7919) % 3000 - 700) }, kDeathsCounterKey, i % 5 + 1);
+    HeatmapService snapshot = heatmap;
+    for (int i = 0; i < 500; i++)
+      heatmap.IncrementMapCounter({ (double)(i % 20), (double)(i * 13 % 5000) }, kDeathsCounterKey);
+
+    // And the same counters loaded from a serialized copy, which rebuilds the occupancy of its columns
+    char* buffer;
+    int buffer_size;
+    if (!heatmap.SerializeHeatmap(buffer, buffer_size))
+      return false;
+    heatmap_service::HeatmapService loaded = heatmap_service::HeatmapService(1, 1, layout);
+    const char* const_buffer = buffer;
+    result = result && loaded.DeserializeHeatmap(const_buffer, buffer_size);
+    delete[] buffer;
+
+    HeatmapService* heatmaps[3] = { &heatmap, &snapshot, &loaded };
+    for (HeatmapService* checked : heatmaps)
+    {
+      heatmap_service::HeatmapData dense_data;
+      heatmap_service::HeatmapSparseData sparse_data;
+      if (!checked->getCounterDataInsideRect({ -40, -800 }, { 70, 4200 }, kDeathsCounterKey, dense_data) ||
+          !checked->getSparseCounterDataInsideRect({ -40, -800 }, { 70, 4200 }, kDeathsCounterKey, sparse_data))
+        return false;
+
+      // Every non zero cell of the dense area is listed, in order, and nothing else
+      size_t listed = 0;
+      for (int x = 0; x < dense_data.data_size.width; x++)
+      {
+        for (int y = 0; y < dense_data.data_size.height; y++)
+        {
+          if (dense_data.heatmap_data[x][y] == 0)
+            continue;
+          result = result && listed < sparse_data.values.size() && sparse_data.cell_x[listed] == x - 40 && sparse_data.cell_y[listed] == y - 800 &&
+            sparse_data.values[listed] == dense_data.heatmap_data[x][y];
+          listed++;
+        }
+        delete[] dense_data.heatmap_data[x];
+      }
+      delete[] dense_data.heatmap_data;
+      delete(dense_data.counter_name);
+      result = result && listed == sparse_data.values.size();
+    }
+  }
+  return result;
+}
+
+// Whether the center of a cell lies inside region, tested on its own: by distance for circles, and by counting the edges a ray towards +x crosses for polygons
+bool CellCenterInsideRegion(const HeatmapRegion &region, int cell_x, int cell_y, double unit_width, double unit_height)
 {
-  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
-  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  double x = (cell_x + 0.5) * unit_width;
+  double y = (cell_y + 0.5) * unit_height;
+  if (region.shape == kCircleRegion)
+    return (x - region.center.x) * (x - region.center.x) + (y - region.center.y) * (y - region.center.y) < region.radius * region.radius;
 
-  return 1 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey);
+  bool inside = false;
+  for (size_t i = 0, j = region.vertices.size() - 1; i < region.vertices.size(); j = i++)
+  {
+    const HeatmapCoordinate &a = region.vertices[i], &b = region.vertices[j];
+    if ((a.y > y) != (b.y > y) && x < a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y))
+      inside = !inside;
+  }
+  return inside;
 }
 
-bool TestRegisterReadMultiple()
+bool TestRegionQueriesMatchMaskedCells()
 {
-  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
-  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 1, 1 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 2, 2 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 3, 3 }, kDeathsCounterKey);
+  // A circle, a concave zone shaped like a city block with a courtyard cut into it, and a polygon crossing itself
+  HeatmapRegion regions[3] = {
+    { kCircleRegion, { 13.7, -21.3 }, 120.4, {} },
+    { kPolygonRegion, { 0, 0 }, 0, { { -150.3, -200.1 }, { 140.7, -180.9 }, { 90.2, 30.3 }, { -20.1, -60.7 }, { -60.9, 170.2 }, { -170.4, 90.6 } } },
+    { kPolygonRegion, { 0, 0 }, 0, { { -100.3, -100.7 }, { 100.9, 100.1 }, { 100.4, -100.2 }, { -100.6, 100.3 } } }
+  };
+
+  bool result = true;
+  HeatmapStorageLayout layouts[2] = { kColumnStorageLayout, kMortonTileStorageLayout };
+  for (HeatmapStorageLayout layout : layouts)
+  {
+    heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 3, layout);
+    for (int i = 0; i < 20000; i++)
+      heatmap.IncrementMapCounterByAmount({ (double)((i * 37) % 400 - 200), (double)((i * 7919) % 600 - 300) }, kDeathsCounterKey, i % 5 + 1);
+
+    HeatmapSparseData all_cells;
+    if (!heatmap.getAllSparseCounterData(kDeathsCounterKey, all_cells))
+      return false;
+
+    for (const HeatmapRegion &region : regions)
+    {
+      // Every non zero cell of the counter whose center is inside the region, by increasing x and then y
+      HeatmapSparseData expected;
+      for (size_t i = 0; i < all_cells.values.size(); i++)
+      {
+        if (!CellCenterInsideRegion(region, all_cells.cell_x[i], all_cells.cell_y[i], 2, 3))
+          continue;
+        expected.cell_x.push_back(all_cells.cell_x[i]);
+        expected.cell_y.push_back(all_cells.cell_y[i]);
+        expected.values.push_back(all_cells.values[i]);
+      }
+      unsigned long long expected_sum = 0;
+      for (unsigned int value : expected.values)
+        expected_sum += value;
+
+      unsigned long long sum;
+      HeatmapCounterSummary summary;
+      HeatmapSparseData cells;
+      if (!heatmap.getCounterSumInsideRegion(region, kDeathsCounterKey, sum) || !heatmap.getCounterSummaryInsideRegion(region, kDeathsCounterKey, summary) ||
+          !heatmap.getSparseCounterDataInsideRegion(region, kDeathsCounterKey, cells))
+        return false;
+
+      result = result && !expected.values.empty() && sum == expected_sum && summary.total == expected_sum && summary.nonzero_cell_count == expected.values.size();
+      result = result && summary.max_value == *std::max_element(expected.values.begin(), expected.values.end());
+      result = result && cells.cell_x == expected.cell_x && cells.cell_y == expected.cell_y && cells.values == expected.values;
+      result = result && cells.lower_left_coordinate.x == expected.cell_x.front() * 2.0 && cells.data_size.width == expected.cell_x.back() - expected.cell_x.front() + 1;
+    }
+  }
+  return result;
+}
 
-  return 1 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) &&
-    1 == heatmap.getCounterAtPosition({ 1, 1 }, kDeathsCounterKey) &&
-    1 == heatmap.getCounterAtPosition({ 2, 2 }, kDeathsCounterKey) &&
-    1 == heatmap.getCounterAtPosition({ 3, 3 }, kDeathsCounterKey);
+bool TestRegionQueryWholeMapAndInvalidRegions()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(1, 1, kMortonTileStorageLayout);
+  for (int i = 0; i < 5000; i++)
+    heatmap.IncrementMapCounterByAmount({ (double)((i * 37) % 300 - 100), (double)((i * 7919) % 500 - 250) }, kDeathsCounterKey, i % 3 + 1);
+
+  // A region holding the whole map answers from the summary of the counter
+  HeatmapRegion everything = { kCircleRegion, { 0, 0 }, 1e6, {} };
+  unsigned long long sum;
+  HeatmapCounterSummary summary, region_summary;
+  HeatmapSparseData cells, all_cells;
+  bool result = heatmap.getCounterSummary(kDeathsCounterKey, summary) && heatmap.getCounterSumInsideRegion(everything, kDeathsCounterKey, sum) &&
+    heatmap.getCounterSummaryInsideRegion(everything, kDeathsCounterKey, region_summary);
+  result = result && sum == summary.total && region_summary.total == summary.total && region_summary.nonzero_cell_count == summary.nonzero_cell_count &&
+    region_summary.max_value == summary.max_value && std::equal(summary.histogram, summary.histogram + HeatmapCounterSummary::kHistogramBuckets, region_summary.histogram);
+  result = result && heatmap.getSparseCounterDataInsideRegion(everything, kDeathsCounterKey, cells) && heatmap.getAllSparseCounterData(kDeathsCounterKey, all_cells);
+  result = result && cells.values == all_cells.values && cells.cell_x == all_cells.cell_x && cells.cell_y == all_cells.cell_y;
+
+  // As does a polygon, once rasterized
+  HeatmapRegion everything_polygon = { kPolygonRegion, { 0, 0 }, 0, { { -1e4, -1e4 }, { 1e4, -1e4 }, { 1e4, 1e4 }, { -1e4, 1e4 } } };
+  result = result && heatmap.getCounterSumInsideRegion(everything_polygon, kDeathsCounterKey, sum) && sum == summary.total;
+
+  // A region away from every counter holds nothing
+  HeatmapRegion far_away = { kPolygonRegion, { 0, 0 }, 0, { { 5000, 5000 }, { 5100, 5000 }, { 5050, 5100 } } };
+  result = result && heatmap.getCounterSumInsideRegion(far_away, kDeathsCounterKey, sum) && sum == 0;
+  result = result && heatmap.getSparseCounterDataInsideRegion(far_away, kDeathsCounterKey, cells) && cells.values.empty() && cells.data_size.width == 0;
+
+  // Invalid regions and counters that don't exist fail
+  HeatmapRegion negative_radius = { kCircleRegion, { 0, 0 }, -1, {} };
+  HeatmapRegion segment = { kPolygonRegion, { 0, 0 }, 0, { { 0, 0 }, { 10, 10 } } };
+  HeatmapRegion not_finite = { kPolygonRegion, { 0, 0 }, 0, { { 0, 0 }, { 10, 10 }, { NAN, 0 } } };
+  result = result && !heatmap.getCounterSumInsideRegion(negative_radius, kDeathsCounterKey, sum) && !heatmap.getCounterSumInsideRegion(segment, kDeathsCounterKey, sum);
+  result = result && !heatmap.getSparseCounterDataInsideRegion(not_finite, kDeathsCounterKey, cells);
+  result = result && !heatmap.getCounterSumInsideRegion(everything, kKillsCounterKey, sum);
+  return result;
 }
 
-bool TestRegisterReadMultipleNonDefaultResolution()
+bool TestSmoothedAreaPreservesTotal()
 {
   heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2);
-  heatmap.IncrementMapCounter({ -1, -1 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 1, 1 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 2, 2 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, 100);
 
-  return 1 == heatmap.getCounterAtPosition({ -1, -1 }, kDeathsCounterKey) &&
-    2 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) &&
-    2 == heatmap.getCounterAtPosition({ 1, 1 }, kDeathsCounterKey) &&
-    1 == heatmap.getCounterAtPosition({ 2, 2 }, kDeathsCounterKey) &&
-    0 == heatmap.getCounterAtPosition({ 10, 10 }, kDeathsCounterKey);
+  bool result = true;
+  HeatmapSmoothingKernel kernels[2] = { kGaussianKernel, kBoxApproximatedGaussianKernel };
+  for (HeatmapSmoothingKernel kernel : kernels)
+  {
+    heatmap_service::HeatmapFloatData out_data;
+    if (!heatmap.getSmoothedCounterDataInsideRect({ -40, -40 }, { 40, 40 }, kDeathsCounterKey, 20, kernel, out_data))
+      return false;
+
+    // The counter should be spread around its cell, { 20, 20 } in the output, without losing or gaining anything
+    double total = 0;
+    for (int x = 0; x < out_data.data_size.width; x++)
+      for (int y = 0; y < out_data.data_size.height; y++)
+        total += out_data.heatmap_data[x][y];
+
+    result = result && out_data.data_size.width == 41 && out_data.data_size.height == 41 &&
+      fabs(total - 100) < 0.01 &&
+      out_data.heatmap_data[20][20] < 100 && out_data.heatmap_data[20][20] > out_data.heatmap_data[21][20] &&
+      fabs(out_data.heatmap_data[19][20] - out_data.heatmap_data[21][20]) < 0.001 &&
+      out_data.heatmap_data[0][0] == 0;
+
+    for (int x = 0; x < out_data.data_size.width; x++)
+      delete[] out_data.heatmap_data[x];
+    delete[] out_data.heatmap_data;
+    delete(out_data.counter_name);
+  }
+
+  return result;
 }
 
-bool TestRegisterReadMultipleCounters()
+bool TestSmoothedAreaUsesNeighboursOutsideRect()
 {
-  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2);
-  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 0, 0 }, kDodgesKey);
-  heatmap.IncrementMapCounter({ 0, 0 }, kExperienceGainedCounterKey);
-  heatmap.IncrementMapCounter({ 0, 0 }, kKillsCounterKey);
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  heatmap.IncrementMapCounterByAmount({ 6, 0 }, kDeathsCounterKey, 100);
 
-  return 1 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) &&
-    1 == heatmap.getCounterAtPosition({ 0, 0 }, kDodgesKey) &&
-    1 == heatmap.getCounterAtPosition({ 0, 0 }, kExperienceGainedCounterKey) &&
-    1 == heatmap.getCounterAtPosition({ 0, 0 }, kKillsCounterKey);
+  // The counter lies just outside the rect, it should still bleed into its right edge, but not reach the left one
+  heatmap_service::HeatmapFloatData out_data;
+  if (!heatmap.getSmoothedCounterDataInsideRect({ 0, -5 }, { 5, 5 }, kDeathsCounterKey, 3, kGaussianKernel, out_data))
+    return false;
+
+  bool result = out_data.data_size.width == 6 && out_data.data_size.height == 11 &&
+    out_data.heatmap_data[5][5] > 0 && out_data.heatmap_data[0][5] == 0;
+
+  for (int x = 0; x < out_data.data_size.width; x++)
+    delete[] out_data.heatmap_data[x];
+  delete[] out_data.heatmap_data;
+  delete(out_data.counter_name);
+
+  return result;
 }
 
-bool TestAllRegisteringMethods()
+// Evaluates expression over an area holding kills and deaths, and compares every cell with expected(kills, deaths)
+template <typename Expected>
+bool ExpressionMatches(const heatmap_service::HeatmapService &heatmap, const std::string &expression, Expected expected)
 {
-  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2);
-  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  HeatmapFloatData out_data;
+  if (!heatmap.getExpressionDataInsideRect(expression, { -5, -5 }, { 5, 5 }, out_data))
+    return false;
 
-  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, 1);
-  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, 1);
-  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, -1);
-  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, -1);
+  bool result = *out_data.counter_name == expression && out_data.data_size.width == 11 && out_data.data_size.height == 11;
+  for (int x = 0; x < out_data.data_size.width; x++)
+  {
+    for (int y = 0; y < out_data.data_size.height; y++)
+    {
+      HeatmapCoordinate coords = { (double)x - 5, (double)y - 5 };
+      float value = expected((float)heatmap.getCounterAtPosition(coords, kKillsCounterKey), (float)heatmap.getCounterAtPosition(coords, kDeathsCounterKey));
+      result = result && std::fabs(out_data.heatmap_data[x][y] - value) < 1e-4f;
+    }
+    delete[] out_data.heatmap_data[x];
+  }
+  delete[] out_data.heatmap_data;
+  delete(out_data.counter_name);
+  return result;
+}
 
-  const std::string counters[3] = { kDeathsCounterKey, kDodgesKey, kGoldObtainedCounterKey };
-  int amounts[3] = { 1, 3, 4 };
-  heatmap.IncrementMultipleMapCountersByAmount({ 0, 0 }, counters, amounts, 3);
+bool TestExpressionArea()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  for (int i = 0; i < 100; i++)
+  {
+    heatmap.IncrementMapCounterByAmount({ (double)(i % 7) - 3, (double)(i % 9) - 4 }, kKillsCounterKey, i % 4);
+    heatmap.IncrementMapCounterByAmount({ (double)(i % 5) - 2, (double)(i % 11) - 5 }, kDeathsCounterKey, 1);
+  }
 
-  return 5 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) &&
-    3 == heatmap.getCounterAtPosition({ 0, 0 }, kDodgesKey) &&
-    4 == heatmap.getCounterAtPosition({ 0, 0 }, kGoldObtainedCounterKey);
+  return ExpressionMatches(heatmap, "kills / max(deaths, 1)", [](float kills, float deaths) { return kills / std::max(deaths, 1.0f); }) &&
+    ExpressionMatches(heatmap, "kills - deaths * 2 + 0.5", [](float kills, float deaths) { return kills - deaths * 2 + 0.5f; }) &&
+    ExpressionMatches(heatmap, "(kills - deaths) * 2", [](float kills, float deaths) { return (kills - deaths) * 2; }) &&
+    ExpressionMatches(heatmap, "-abs(deaths - kills) / 4", [](float kills, float deaths) { return -std::fabs(deaths - kills) / 4; }) &&
+    ExpressionMatches(heatmap, "min(kills, deaths) + max(kills, 3) - -1", [](float kills, float deaths) { return std::min(kills, deaths) + std::max(kills, 3.0f) + 1; }) &&
+    ExpressionMatches(heatmap, "  deaths  ", [](float kills, float deaths) { return deaths; }) &&
+    ExpressionMatches(heatmap, "2.5", [](float kills, float deaths) { return 2.5f; });
 }
 
-
-bool TestSimpleGetArea()
+bool TestInvalidExpressions()
 {
-  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2);
-  heatmap.IncrementMapCounter({ -1, -1 }, kDeathsCounterKey);
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  heatmap.IncrementMapCounter({ 0, 0 }, kKillsCounterKey);
   heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 1, 1 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 2, 2 }, kDeathsCounterKey);
 
-  heatmap_service::HeatmapData out_data;
-  if (!heatmap.getCounterDataInsideRect({ -2, -2 }, { 1, 1 }, kDeathsCounterKey, out_data))
+  const char* invalid_expressions[] = { "", "kills +", "kills / (deaths", "max(kills)", "sqrt(kills)", "kills deaths", "kills $ 2", "kills / gold_obtained" };
+  HeatmapFloatData out_data;
+  for (const char* expression : invalid_expressions)
+  {
+    if (heatmap.getExpressionDataInsideRect(expression, { -1, -1 }, { 1, 1 }, out_data))
+      return false;
+  }
+  if (heatmap.getExpressionDataInsideRect("kills", { 1, 1 }, { -1, -1 }, out_data))
     return false;
 
-  bool result = out_data.counter_name->compare(kDeathsCounterKey) == 0 &&
-    out_data.spatial_resolution.width == 2 && out_data.spatial_resolution.height == 2 &&
-    out_data.data_size.width == 2 && out_data.data_size.height == 2 &&
-    2 == out_data.heatmap_data[1][1];
-
-  delete(out_data.counter_name);
+  // Nesting is refused past 256 levels instead of overflowing the stack, whether it comes from parentheses, unary minuses or function calls
+  const int kMaxNesting = 256;
+  string deepest_allowed = string(kMaxNesting, '(') + "kills" + string(kMaxNesting, ')');
+  string too_deep[3] = { string(1000000, '(') + "kills" + string(1000000, ')'), string(1000000, '-') + "kills", "kills" };
+  for (int level = 0; level < kMaxNesting + 1; level++)
+    too_deep[2] = "abs(" + too_deep[2] + ")";
+  for (const string& expression : too_deep)
+  {
+    if (heatmap.getExpressionDataInsideRect(expression, { -1, -1 }, { 1, 1 }, out_data))
+      return false;
+  }
+  if (!heatmap.getExpressionDataInsideRect(deepest_allowed, { -1, -1 }, { 1, 1 }, out_data))
+    return false;
+  bool result = 1 == out_data.heatmap_data[1][1];
+  for (int x = 0; x < out_data.data_size.width; x++)
+    delete[] out_data.heatmap_data[x];
   delete[] out_data.heatmap_data;
-
+  delete(out_data.counter_name);
   return result;
 }
 
-bool TestGetAreaUnitSizedRect()
+bool TestRenderCounterToPpmImage()
 {
-  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2);
-  heatmap.IncrementMapCounter({ -1, -1 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 1, 1 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 2, 2 }, kDeathsCounterKey);
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, 10);
+  heatmap.IncrementMapCounterByAmount({ 3, 1 }, kDeathsCounterKey, 1);
 
-  heatmap_service::HeatmapData out_data;
-  if (!heatmap.getCounterDataInsideRect({ 0, 0 }, { 0, 0 }, kDeathsCounterKey, out_data))
+  HeatmapRenderOptions options = { kGrayscaleColorMap, kLinearScaling, kPpmImageFormat, 0 };
+  if (!heatmap.RenderCounterToImage(kDeathsCounterKey, "test_render.ppm", options))
     return false;
 
-  bool result = out_data.counter_name->compare(kDeathsCounterKey) == 0 &&
-    out_data.spatial_resolution.width == 2 && out_data.spatial_resolution.height == 2 &&
-    out_data.data_size.width == 1 && out_data.data_size.height == 1 &&
-    2 == out_data.heatmap_data[0][0];
+  // The map spans x [0,3] and y [0,1], so the image is 4x2 pixels, with the highest counter in white at the bottom left
+  ifstream image("test_render.ppm", ios::binary);
+  string magic;
+  int width = 0, height = 0, max_color = 0;
+  image >> magic >> width >> height >> max_color;
+  image.get();
+  unsigned char pixels[4 * 2 * 3] = {};
+  image.read((char*)pixels, sizeof(pixels));
 
-  delete(out_data.counter_name);
-  delete[] out_data.heatmap_data;
+  bool result = image.gcount() == sizeof(pixels) && magic == "P6" && width == 4 && height == 2 && max_color == 255 &&
+    pixels[4 * 3] == 255 && pixels[3 * 3] > 0 && pixels[3 * 3] < 255 && pixels[0] == 0;
 
-  return result;
+  image.close();
+  remove("test_render.ppm");
+
+  return result && !heatmap.RenderCounterToImage(kKillsCounterKey, "test_render.ppm", options);
 }
 
-bool TestGetAreaUpperLowerSwitched()
+bool TestRenderCounterToPngImage()
 {
-  // Should fail at getting data. Invalid rect
-  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2);
-  heatmap.IncrementMapCounter({ -1, -1 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 1, 1 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 2, 2 }, kDeathsCounterKey);
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  for (int i = 0; i < 300; i++)
+    heatmap.IncrementMapCounterByAmount({ (double)i, (double)(i % 7) }, kDeathsCounterKey, i + 1);
 
-  heatmap_service::HeatmapData out_data;
+  HeatmapRenderOptions options = { kViridisColorMap, kQuantileScaling, kPngImageFormat, 0 };
+  if (!heatmap.RenderCounterToImage(kDeathsCounterKey, "test_render.png", options))
+    return false;
 
-  bool result = !heatmap.getCounterDataInsideRect({ 2, 2 }, { -2, -2 }, kDeathsCounterKey, out_data);
+  // Checks the PNG signature and the image size in the IHDR chunk, stored big endian
+  ifstream image("test_render.png", ios::binary);
+  unsigned char header[24] = {};
+  image.read((char*)header, sizeof(header));
+  const unsigned char kSignature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
 
-  if (result == false)
-  {
-    delete(out_data.counter_name);
-    delete[] out_data.heatmap_data;
-  }
+  int width = (header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+  int height = (header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+  bool result = image.gcount() == sizeof(header) && equal(kSignature, kSignature + 8, header) &&
+    string((char*)header + 12, 4) == "IHDR" && width == 300 && height == 7;
+
+  image.close();
+  remove("test_render.png");
 
   return result;
 }
 
-bool TestSimpleGetEntireArea()
+bool TestRenderCounterToTilePyramid()
 {
-  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2);
-  heatmap.IncrementMapCounter({ -1, -1 }, kDeathsCounterKey);
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
   heatmap.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 1, 1 }, kDeathsCounterKey);
-  heatmap.IncrementMapCounter({ 2, 2 }, kDeathsCounterKey);
+  heatmap.IncrementMapCounter({ 9, 9 }, kDeathsCounterKey);
 
-  heatmap_service::HeatmapData out_data;
-  if (!heatmap.getAllCounterData(kDeathsCounterKey, out_data))
+  // A 10x10 map in 4 pixel tiles needs 3 zoom levels. At the deepest, tile 0 0 is the top left corner, and the counters lie in tiles 2 0 and 0 2
+  HeatmapRenderOptions options = { kHeatColorMap, kLogarithmicScaling, kPngImageFormat, 4 };
+  if (!heatmap.RenderCounterToTilePyramid(kDeathsCounterKey, "test_pyramid", options))
     return false;
 
-  bool result = out_data.counter_name->compare(kDeathsCounterKey) == 0 &&
-    out_data.spatial_resolution.width == 2 && out_data.spatial_resolution.height == 2 &&
-    out_data.data_size.width == 3 && out_data.data_size.height == 3 &&
-    2 == out_data.heatmap_data[1][1];
+  const char* kWrittenTiles[5] = { "test_pyramid/0/0/0.png", "test_pyramid/1/1/0.png", "test_pyramid/1/0/1.png", "test_pyramid/2/2/0.png", "test_pyramid/2/0/2.png" };
+  bool result = true;
+  for (const char* tile : kWrittenTiles)
+  {
+    result = result && ifstream(tile).good();
+    remove(tile);
+  }
+  result = result && !ifstream("test_pyramid/2/0/0.png").good() && !ifstream("test_pyramid/2/1/1.png").good();
 
-  delete(out_data.counter_name);
-  delete[] out_data.heatmap_data;
+  const char* kDirectories[8] = { "test_pyramid/0/0", "test_pyramid/1/0", "test_pyramid/1/1", "test_pyramid/2/0", "test_pyramid/2/2",
+    "test_pyramid/0", "test_pyramid/1", "test_pyramid/2" };
+  for (const char* directory : kDirectories)
+    remove(directory);
+  remove("test_pyramid");
 
-  return result;
+  options.tile_size = 5;
+  return result && !heatmap.RenderCounterToTilePyramid(kDeathsCounterKey, "test_pyramid", options);
 }
 
-
 bool TestSimpleSerializeDeserialize()
 {
   heatmap_service::HeatmapService *heatmap = new heatmap_service::HeatmapService(1, 1);
@@ -325,4 +1981,461 @@ bool TestInvalidBufferForDeserialization()
   }
   delete(heatmap);
   return false;
+}
+
+bool TestSectionedSerializeKeepsColumnsAndGroups()
+{
+  const string group_keys[2] = { kKillsCounterKey, kDodgesKey };
+  int group_amounts[2] = { 2, 3 };
+
+  // A dense column, sparse columns far apart, and a counter group
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(1, 1);
+  for (int y = -100; y < 100; y++)
+    heatmap.IncrementMapCounterByAmount({ 0, (double)y }, kDeathsCounterKey, y + 101);
+  heatmap.IncrementMapCounterByAmount({ -5000, 20 }, kDeathsCounterKey, 7);
+  heatmap.IncrementMapCounterByAmount({ 3000, -4000 }, kGoldObtainedCounterKey, 9);
+  heatmap.IncrementMapCounterByAmount({ 3000, 4000 }, kGoldObtainedCounterKey, 1);
+  heatmap.CreateCounterGroup("combat", group_keys, 2);
+  heatmap.IncrementCounterGroupByAmounts({ 4, 4 }, "combat", group_amounts);
+
+  char* buffer;
+  int buffer_size;
+  if (!heatmap.SerializeHeatmap(buffer, buffer_size))
+    return false;
+
+  // Loads into either layout, replacing what the heatmap held
+  heatmap_service::HeatmapService columns = heatmap_service::HeatmapService(10, 10);
+  heatmap_service::HeatmapService tiles = heatmap_service::HeatmapService(10, 10, kMortonTileStorageLayout);
+  columns.IncrementMapCounterByAmount({ 50, 50 }, kDodgesKey, 1);
+  const char* const_buffer = buffer;
+  bool result = columns.DeserializeHeatmap(const_buffer, buffer_size) && tiles.DeserializeHeatmap(const_buffer, buffer_size);
+  delete[] buffer;
+  for (heatmap_service::HeatmapService* loaded : { &columns, &tiles })
+  {
+    result = result && 1 == loaded->single_unit_width() && 1 == loaded->single_unit_height() &&
+      SameCounterCells(*loaded, heatmap, kDeathsCounterKey) && SameCounterCells(*loaded, heatmap, kGoldObtainedCounterKey) &&
+      SummaryMatchesCells(*loaded, kDeathsCounterKey) && 0 == loaded->getCounterAtPosition({ 50, 50 }, kDodgesKey) &&
+      2 == loaded->getCounterGroupValueAtPosition({ 4, 4 }, "combat", kKillsCounterKey) &&
+      3 == loaded->getCounterGroupValueAtPosition({ 4, 4 }, "combat", kDodgesKey);
+  }
+
+  // Tiles are written as the columns they stand for
+  if (!result || !tiles.SerializeHeatmap(buffer, buffer_size))
+    return false;
+  heatmap_service::HeatmapService from_tiles = heatmap_service::HeatmapService(1, 1);
+  const_buffer = buffer;
+  result = from_tiles.DeserializeHeatmap(const_buffer, buffer_size) && SameCounterCells(from_tiles, heatmap, kDeathsCounterKey) &&
+    SameCounterCells(from_tiles, heatmap, kGoldObtainedCounterKey) && 3 == from_tiles.getCounterGroupValueAtPosition({ 4, 4 }, "combat", kDodgesKey);
+  delete[] buffer;
+  return result;
+}
+
+bool TestMalformedSectionedBuffers()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(1, 1);
+  for (int x = 0; x < 100; x++)
+  {
+    for (int y = 0; y < 100; y++)
+      heatmap.IncrementMapCounterByAmount({ (double)x, (double)y }, kDeathsCounterKey, 1);
+  }
+  const string group_keys[2] = { kKillsCounterKey, kGoldObtainedCounterKey };
+  int group_amounts[2] = { 2, 3 };
+  heatmap.CreateCounterGroup("combat", group_keys, 2);
+  heatmap.IncrementCounterGroupByAmounts({ 4, 4 }, "combat", group_amounts);
+
+  char* buffer;
+  int buffer_size;
+  if (!heatmap.SerializeHeatmap(buffer, buffer_size))
+    return false;
+
+  // Buffers cut short, inside the sections or inside the counter groups that end them, or with a version that doesn't exist,
+  // are refused and leave the heatmap as it was
+  heatmap_service::HeatmapService loaded = heatmap_service::HeatmapService(1, 1);
+  loaded.IncrementMapCounterByAmount({ 5, 5 }, kDodgesKey, 3);
+  const char* const_buffer = buffer;
+  bool result = !loaded.DeserializeHeatmap(const_buffer, 4) && !loaded.DeserializeHeatmap(const_buffer, 20) &&
+    !loaded.DeserializeHeatmap(const_buffer, 40) && !loaded.DeserializeHeatmap(const_buffer, buffer_size / 2) &&
+    !loaded.DeserializeHeatmap(const_buffer, buffer_size - 10) && !loaded.LoadHeatmapLazily(buffer, buffer_size - 10);
+  buffer[4] = 9;
+  result = result && !loaded.DeserializeHeatmap(const_buffer, buffer_size) &&
+    3 == loaded.getCounterAtPosition({ 5, 5 }, kDodgesKey) && 0 == loaded.getCounterAtPosition({ 5, 5 }, kDeathsCounterKey);
+  delete[] buffer;
+  return result;
+}
+
+bool TestLazyLoadOnlyReadsUsedCounters()
+{
+  const string group_keys[2] = { kKillsCounterKey, kDodgesKey };
+  int group_amounts[2] = { 2, 3 };
+
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(1, 1);
+  for (int y = 0; y < 100; y++)
+    heatmap.IncrementMapCounterByAmount({ 3, (double)y }, kDeathsCounterKey, y + 1);
+  heatmap.IncrementMapCounterByAmount({ -700, 40 }, kDeathsCounterKey, 4);
+  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kGoldObtainedCounterKey, 77);
+  heatmap.CreateCounterGroup("combat", group_keys, 2);
+  heatmap.IncrementCounterGroupByAmounts({ 4, 4 }, "combat", group_amounts);
+
+  char* buffer;
+  int buffer_size;
+  if (!heatmap.SerializeHeatmap(buffer, buffer_size))
+    return false;
+
+  // The gold column is a dense section of kind 0, holding a single counter of 77 from index 0. Its kind is broken, which only matters once gold is read
+  const char gold_section[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 77, 0, 0, 0 };
+  char* gold = std::search(buffer, buffer + buffer_size, gold_section, gold_section + 16);
+  if (gold == buffer + buffer_size)
+  {
+    delete[] buffer;
+    return false;
+  }
+  gold[0] = 9;
+
+  heatmap_service::HeatmapService lazy = heatmap_service::HeatmapService(10, 10);
+  lazy.IncrementMapCounterByAmount({ 50, 50 }, kDodgesKey, 1);
+  bool result = lazy.LoadHeatmapLazily(buffer, buffer_size) && 1 == lazy.single_unit_width() &&
+    lazy.hasMapForCounter(kDeathsCounterKey) && lazy.hasMapForCounter(kGoldObtainedCounterKey) && !lazy.hasMapForCounter(kDodgesKey) &&
+    SameCounterCells(lazy, heatmap, kDeathsCounterKey) && SummaryMatchesCells(lazy, kDeathsCounterKey) &&
+    3 == lazy.getCounterGroupValueAtPosition({ 4, 4 }, "combat", kDodgesKey) &&
+    // Malformed counters read as empty
+    0 == lazy.getCounterAtPosition({ 0, 0 }, kGoldObtainedCounterKey);
+
+  // Writes go to a copy of the loaded counter, leaving snapshots taken before untouched
+  heatmap_service::HeatmapService snapshot(lazy);
+  result = result && lazy.IncrementMapCounterByAmount({ 3, 10 }, kDeathsCounterKey, 5) && lazy.IncrementMapCounterByAmount({ 9, 9 }, kKillsCounterKey, 1) &&
+    16 == lazy.getCounterAtPosition({ 3, 10 }, kDeathsCounterKey) && 1 == lazy.getCounterAtPosition({ 9, 9 }, kKillsCounterKey) &&
+    11 == snapshot.getCounterAtPosition({ 3, 10 }, kDeathsCounterKey) && !snapshot.hasMapForCounter(kKillsCounterKey) &&
+    SummaryMatchesCells(lazy, kDeathsCounterKey) && SameCounterCells(snapshot, heatmap, kDeathsCounterKey);
+
+  // Deserializing reads every section, so it refuses the buffer
+  heatmap_service::HeatmapService eager = heatmap_service::HeatmapService(1, 1);
+  const char* const_buffer = buffer;
+  result = result && !eager.DeserializeHeatmap(const_buffer, buffer_size) && !lazy.LoadHeatmapLazily(buffer, 20);
+  delete[] buffer;
+  return result;
+}
+
+bool TestLazyLoadFileAndWholeHeatmapOperations()
+{
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(1, 1);
+  for (int x = -20; x < 20; x++)
+  {
+    heatmap.IncrementMapCounterByAmount({ (double)x, (double)(x * 3) }, kDeathsCounterKey, 2);
+    heatmap.IncrementMapCounterByAmount({ (double)x, 5 }, kGoldObtainedCounterKey, x + 21);
+  }
+
+  char* buffer;
+  int buffer_size;
+  if (!heatmap.SerializeHeatmap(buffer, buffer_size))
+    return false;
+  ofstream file("test_lazy_heatmap.bin", ios::binary);
+  file.write(buffer, buffer_size);
+  file.close();
+  delete[] buffer;
+
+  // Counters load in the layout of the heatmap loading them
+  heatmap_service::HeatmapService lazy = heatmap_service::HeatmapService(1, 1, kMortonTileStorageLayout);
+  bool result = lazy.LoadHeatmapFileLazily("test_lazy_heatmap.bin") && SameCounterCells(lazy, heatmap, kGoldObtainedCounterKey);
+
+  // Merging, serializing and rebinning load every counter, whether it was read or not
+  heatmap_service::HeatmapService merged = heatmap_service::HeatmapService(1, 1);
+  result = result && merged.MergeHeatmap(lazy) && SameCounterCells(merged, heatmap, kDeathsCounterKey) && SameCounterCells(merged, heatmap, kGoldObtainedCounterKey) &&
+    lazy.SerializeHeatmap(buffer, buffer_size);
+  if (!result)
+  {
+    remove("test_lazy_heatmap.bin");
+    return false;
+  }
+
+  heatmap_service::HeatmapService reloaded = heatmap_service::HeatmapService(1, 1);
+  const char* const_buffer = buffer;
+  result = reloaded.DeserializeHeatmap(const_buffer, buffer_size) && SameCounterCells(reloaded, heatmap, kDeathsCounterKey) &&
+    SameCounterCells(reloaded, heatmap, kGoldObtainedCounterKey);
+  delete[] buffer;
+
+  heatmap_service::HeatmapService rebinned = heatmap_service::HeatmapService(1, 1);
+  result = result && rebinned.LoadHeatmapFileLazily("test_lazy_heatmap.bin") && heatmap.Rebin(2, 2) && rebinned.Rebin(2, 2) &&
+    SameCounterCells(rebinned, heatmap, kDeathsCounterKey) && SameCounterCells(rebinned, heatmap, kGoldObtainedCounterKey);
+  remove("test_lazy_heatmap.bin");
+
+  // Files that don't exist aren't loaded, and the heatmap keeps what it held
+  return result && !rebinned.LoadHeatmapFileLazily("test_lazy_missing.bin") && SameCounterCells(rebinned, heatmap, kGoldObtainedCounterKey);
+}
+
+bool TestCheckpointKeepsPointInTimeView()
+{
+  const string group_keys[2] = { kKillsCounterKey, kDodgesKey };
+  int group_amounts[2] = { 2, 3 };
+
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(1, 1);
+  for (int x = 0; x < 200; x++)
+  {
+    for (int y = 0; y < 50; y++)
+      heatmap.IncrementMapCounterByAmount({ (double)x, (double)y }, kDeathsCounterKey, x + y);
+  }
+  heatmap.IncrementMapCounterByAmount({ -3000, 8 }, kGoldObtainedCounterKey, 12);
+  heatmap.CreateCounterGroup("combat", group_keys, 2);
+  heatmap.IncrementCounterGroupByAmounts({ 4, 4 }, "combat", group_amounts);
+
+  // Logging carries on while the checkpoint is written, without reaching it
+  heatmap_service::HeatmapService expected(heatmap);
+  std::atomic<int> completions(0);
+  std::atomic<bool> reported(false);
+  std::future<bool> checkpoint = heatmap.CheckpointTo("test_checkpoint.bin", [&](bool written) { reported = written; completions++; });
+  for (int x = 0; x < 200; x++)
+    heatmap.IncrementMapCounterByAmount({ (double)x, 0 }, kDeathsCounterKey, 1000);
+  heatmap.IncrementMapCounterByAmount({ 1, 1 }, kKillsCounterKey, 1);
+
+  bool result = checkpoint.get() && reported && 1 == completions && 1000 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey);
+  {
+    heatmap_service::HeatmapService loaded = heatmap_service::HeatmapService(1, 1);
+    result = result && loaded.LoadHeatmapFileLazily("test_checkpoint.bin") && SameCounterCells(loaded, expected, kDeathsCounterKey) &&
+      SameCounterCells(loaded, expected, kGoldObtainedCounterKey) && !loaded.hasMapForCounter(kKillsCounterKey) &&
+      3 == loaded.getCounterGroupValueAtPosition({ 4, 4 }, "combat", kDodgesKey);
+  }
+
+  // A later checkpoint replaces the file
+  result = result && heatmap.CheckpointTo("test_checkpoint.bin").get();
+  heatmap_service::HeatmapService reloaded = heatmap_service::HeatmapService(1, 1);
+  result = result && reloaded.LoadHeatmapFileLazily("test_checkpoint.bin") && SameCounterCells(reloaded, heatmap, kDeathsCounterKey) &&
+    1 == reloaded.getCounterAtPosition({ 1, 1 }, kKillsCounterKey);
+  remove("test_checkpoint.bin");
+
+  // Checkpoints that can't be written report it, and leave nothing behind
+  std::future<bool> unwritable = heatmap.CheckpointTo("test_missing_directory/test_checkpoint.bin", [&](bool written) { completions++; });
+  return result && !unwritable.get() && 2 == completions;
+}
+
+bool TestMergeHeatmaps()
+{
+  const string group_keys[2] = { kKillsCounterKey, kDodgesKey };
+  int group_amounts[2] = { 2, 3 };
+
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(2, 2);
+  heatmap.IncrementMapCounterByAmount({ 0, 0 }, kDeathsCounterKey, 5);
+  heatmap.IncrementMapCounterByAmount({ -7, 9 }, kDeathsCounterKey, 1);
+  heatmap.CreateCounterGroup("combat", group_keys, 2);
+  heatmap.IncrementCounterGroupByAmounts({ 4, 4 }, "combat", group_amounts);
+
+  // The other heatmap keeps its counters in tiles, a counter this heatmap doesn't have yet, and the same group
+  heatmap_service::HeatmapService other = heatmap_service::HeatmapService(2, 2, kMortonTileStorageLayout);
+  other.IncrementMapCounterByAmount({ 1, 1 }, kDeathsCounterKey, 2);
+  other.IncrementMapCounterByAmount({ 100, -50 }, kDeathsCounterKey, 4);
+  other.IncrementMapCounterByAmount({ 3, 3 }, kGoldObtainedCounterKey, 7);
+  other.CreateCounterGroup("combat", group_keys, 2);
+  other.IncrementCounterGroupByAmounts({ 4, 4 }, "combat", group_amounts);
+  other.IncrementCounterGroupByAmounts({ -20, 4 }, "combat", group_amounts);
+
+  bool result = heatmap.MergeHeatmap(other) &&
+    7 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) &&
+    1 == heatmap.getCounterAtPosition({ -7, 9 }, kDeathsCounterKey) &&
+    4 == heatmap.getCounterAtPosition({ 100, -50 }, kDeathsCounterKey) &&
+    7 == heatmap.getCounterAtPosition({ 3, 3 }, kGoldObtainedCounterKey) &&
+    4 == heatmap.getCounterGroupValueAtPosition({ 4, 4 }, "combat", kKillsCounterKey) &&
+    6 == heatmap.getCounterGroupValueAtPosition({ 4, 4 }, "combat", kDodgesKey) &&
+    3 == heatmap.getCounterGroupValueAtPosition({ -20, 4 }, "combat", kDodgesKey) &&
+    // The other heatmap is left untouched
+    2 == other.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey);
+
+  // The whole area of the merged counter covers the cells of both heatmaps
+  heatmap_service::HeatmapData out_data;
+  result = result && heatmap.getAllCounterData(kDeathsCounterKey, out_data) &&
+    out_data.lower_left_coordinate.x <= -4 && out_data.lower_left_coordinate.y <= -25 &&
+    out_data.lower_left_coordinate.x + out_data.data_size.width > 50;
+  for (int x = 0; x < out_data.data_size.width; x++)
+    delete[] out_data.heatmap_data[x];
+  delete[] out_data.heatmap_data;
+  delete(out_data.counter_name);
+
+  // Merging a heatmap into itself doubles it, and the counter taken whole from the other heatmap stays apart from it
+  result = result && heatmap.MergeHeatmap(heatmap) &&
+    14 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) &&
+    14 == heatmap.getCounterAtPosition({ 3, 3 }, kGoldObtainedCounterKey) &&
+    7 == other.getCounterAtPosition({ 3, 3 }, kGoldObtainedCounterKey);
+
+  // Heatmaps of resolutions that aren't multiples of each other, or with a group of the same key holding other counters, aren't merged at all
+  heatmap_service::HeatmapService other_resolution = heatmap_service::HeatmapService(3, 3);
+  other_resolution.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  heatmap_service::HeatmapService other_group = heatmap_service::HeatmapService(2, 2);
+  other_group.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  other_group.CreateCounterGroup("combat", group_keys, 1);
+
+  return result && !heatmap.MergeHeatmap(other_resolution) && !heatmap.MergeHeatmap(other_group) &&
+    14 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey);
+}
+
+bool TestRebinSumsCells()
+{
+  const string group_keys[2] = { kKillsCounterKey, kDodgesKey };
+  bool result = true;
+  HeatmapStorageLayout layouts[2] = { kColumnStorageLayout, kMortonTileStorageLayout };
+  for (HeatmapStorageLayout layout : layouts)
+  {
+    // The same events logged at a fine resolution and then rebinned, and logged straight at the coarse one
+    heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService(0.5, 0.5, layout);
+    heatmap_service::HeatmapService expected = heatmap_service::HeatmapService(2, 1.5, layout);
+    heatmap.CreateCounterGroup("combat", group_keys, 2);
+    expected.CreateCounterGroup("combat", group_keys, 2);
+    for (int i = 0; i < 5000; i++)
+    {
+      HeatmapCoordinate coords = { (i * 37 % 400) * 0.25 - 50, (i * 91 % 300) * 0.25 - 30 };
+      int amounts[2] = { i % 3, 1 };
+      heatmap.IncrementMapCounterByAmount(coords, kDeathsCounterKey, i % 4 + 1);
+      expected.IncrementMapCounterByAmount(coords, kDeathsCounterKey, i % 4 + 1);
+      heatmap.IncrementCounterGroupByAmounts(coords, "combat", amounts);
+      expected.IncrementCounterGroupByAmounts(coords, "combat", amounts);
+    }
+
+    HeatmapCounterStats fine_stats;
+    heatmap.GetCounterStats(kDeathsCounterKey, fine_stats);
+    HeatmapService snapshot = heatmap;
+    unsigned int fine_value = heatmap.getCounterAtPosition({ -50, -30 }, kDeathsCounterKey);
+
+    // Rebinning to a resolution that isn't a multiple of the current one, or to a finer one, changes nothing
+    result = result && !heatmap.Rebin(0.75, 1.5) && !heatmap.Rebin(0.25, 0.5) && heatmap.single_unit_width() == 0.5 &&
+      heatmap.Rebin(2, 1.5) && heatmap.single_unit_width() == 2 && heatmap.single_unit_height() == 1.5;
+
+    for (int x = -27; x < 27; x++)
+    {
+      for (int y = -22; y < 22; y++)
+      {
+        HeatmapCoordinate coords = { x * 2 + 1.0, y * 1.5 + 0.75 };
+        result = result && heatmap.getCounterAtPosition(coords, kDeathsCounterKey) == expected.getCounterAtPosition(coords, kDeathsCounterKey) &&
+          heatmap.getCounterGroupValueAtPosition(coords, "combat", kKillsCounterKey) == expected.getCounterGroupValueAtPosition(coords, "combat", kKillsCounterKey) &&
+          heatmap.getCounterGroupValueAtPosition(coords, "combat", kDodgesKey) == expected.getCounterGroupValueAtPosition(coords, "combat", kDodgesKey);
+      }
+    }
+
+    // The coarse map takes less memory and covers the same bounds, while the snapshot keeps the fine counters
+    HeatmapCounterStats coarse_stats, expected_stats;
+    heatmap.GetCounterStats(kDeathsCounterKey, coarse_stats);
+    expected.GetCounterStats(kDeathsCounterKey, expected_stats);
+    result = result && coarse_stats.allocated_bytes < fine_stats.allocated_bytes && coarse_stats.nonzero_cell_count == expected_stats.nonzero_cell_count &&
+      coarse_stats.nonzero_lower_left.x == expected_stats.nonzero_lower_left.x && coarse_stats.nonzero_upper_right.y == expected_stats.nonzero_upper_right.y &&
+      snapshot.single_unit_width() == 0.5 && snapshot.getCounterAtPosition({ -50, -30 }, kDeathsCounterKey) == fine_value &&
+      heatmap.getCounterAtPosition({ -50, -30 }, kDeathsCounterKey) > fine_value;
+  }
+  return result;
+}
+
+bool TestMergeDifferentResolutions()
+{
+  heatmap_service::HeatmapService fine = heatmap_service::HeatmapService(1, 2);
+  heatmap_service::HeatmapService coarse = heatmap_service::HeatmapService(2, 1, kMortonTileStorageLayout);
+  heatmap_service::HeatmapService expected = heatmap_service::HeatmapService(2, 2);
+  for (int i = 0; i < 2000; i++)
+  {
+    HeatmapCoordinate coords = { (double)(i * 13 % 60 - 20), (double)(i * 7 % 50 - 25) };
+    (i % 2 == 0 ? fine : coarse).IncrementMapCounterByAmount(coords, kDeathsCounterKey, i % 3 + 1);
+    expected.IncrementMapCounterByAmount(coords, kDeathsCounterKey, i % 3 + 1);
+  }
+
+  // Each axis is merged at the coarser of both resolutions, so the fine heatmap coarsens along x, and the other one is rebinned on its own copy along y
+  heatmap_service::HeatmapService coarse_copy = coarse;
+  bool result = fine.MergeHeatmap(coarse) && fine.single_unit_width() == 2 && fine.single_unit_height() == 2 &&
+    coarse.single_unit_width() == 2 && coarse.single_unit_height() == 1;
+  for (int x = -10; x < 20; x++)
+  {
+    for (int y = -13; y < 13; y++)
+    {
+      HeatmapCoordinate coords = { x * 2 + 1.0, y * 2 + 1.0 };
+      result = result && fine.getCounterAtPosition(coords, kDeathsCounterKey) == expected.getCounterAtPosition(coords, kDeathsCounterKey) &&
+        coarse.getCounterAtPosition(coords, kDeathsCounterKey) == coarse_copy.getCounterAtPosition(coords, kDeathsCounterKey);
+    }
+  }
+
+  // Resolutions that aren't multiples of each other along an axis still aren't merged
+  heatmap_service::HeatmapService odd = heatmap_service::HeatmapService(2, 3);
+  odd.IncrementMapCounter({ 0, 0 }, kDeathsCounterKey);
+  return result && !fine.MergeHeatmap(odd) && fine.single_unit_height() == 2;
+}
+
+bool TestIngestCsvEvents()
+{
+  // A header, spaces around the fields, windows line endings, a blank line, a line that isn't an event and positions outside the cell range
+  string log = "x,y,counter,amount\n"
+    "1.5,2.5,deaths\n"
+    " -3.25 , 4 , gold_obtained , 10\r\n"
+    "\n"
+    "1e1,-2E-1,deaths,2\n"
+    "not,an,event\n"
+    "1e12,0,deaths\n"
+    "0,-3000000000,deaths\n"
+    "1.9,2.1,deaths";
+
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  HeatmapIngestResult ingest_result;
+  bool result = heatmap.IngestEventBuffer(log.data(), log.size(), kCsvEventFormat, ingest_result) &&
+    ingest_result.events_ingested == 4 && ingest_result.rejected_records == 4 && ingest_result.bytes_read == log.size() &&
+    2 == heatmap.getCounterAtPosition({ 1, 2 }, kDeathsCounterKey) &&
+    10 == heatmap.getCounterAtPosition({ -4, 4 }, kGoldObtainedCounterKey) &&
+    2 == heatmap.getCounterAtPosition({ 10, -1 }, kDeathsCounterKey);
+
+  // A log of several chunks is parsed by a few threads, whatever the hardware, and then by one, both matching the same events incremented one by one
+  heatmap_service::HeatmapService expected = heatmap_service::HeatmapService(3, 3);
+  string big_log;
+  for (int i = 0; i < 300000; i++)
+  {
+    double x = (i * 7919LL) % 2000 - 1000 + 0.5;
+    double y = (i * 104729LL) % 1000 - 500 + 0.25;
+    const string& key = i % 3 == 0 ? kGoldObtainedCounterKey : kDeathsCounterKey;
+    expected.IncrementMapCounterByAmount({ x, y }, key, i % 4 + 1);
+    big_log += to_string(x) + "," + to_string(y) + "," + key + "," + to_string(i % 4 + 1) + "\n";
+  }
+
+  int default_worker_count = HeatmapService::worker_thread_count();
+  int worker_counts[2] = { 3, 0 };
+  for (int k = 0; k < 2; k++)
+  {
+    HeatmapService::SetWorkerThreadCount(worker_counts[k]);
+    heatmap_service::HeatmapService ingested = heatmap_service::HeatmapService(3, 3, k == 0 ? kMortonTileStorageLayout : kColumnStorageLayout);
+    result = result && ingested.IngestEventBuffer(big_log.data(), big_log.size(), kCsvEventFormat, ingest_result) &&
+      ingest_result.events_ingested == 300000 && ingest_result.rejected_records == 0 &&
+      SameCountersInsideRect(expected, ingested, { -1010, -510 }, { 1010, 510 });
+  }
+  HeatmapService::SetWorkerThreadCount(default_worker_count);
+
+  return result;
+}
+
+bool TestIngestBinaryEventFile()
+{
+  // Header with two keys, then events of 24 bytes: x, y, key index and amount
+  string log("HMEV", 4);
+  uint32_t header[2] = { 1, 2 };
+  log.append((const char*)header, sizeof(header));
+  const string keys[2] = { kDeathsCounterKey, kKillsCounterKey };
+  for (int k = 0; k < 2; k++)
+  {
+    uint32_t key_length = (uint32_t)keys[k].size();
+    log.append((const char*)&key_length, sizeof(key_length));
+    log += keys[k];
+  }
+
+  struct { double x; double y; uint32_t counter_index; int32_t amount; } events[5] = {
+    { 0.5, 0.5, 0, 1 }, { -10.5, 3.0, 1, 5 }, { 0.25, 0.75, 0, 2 },
+    // A key that doesn't exist, and a position outside the cell range
+    { 1, 1, 7, 1 }, { 3000000000.0, 1, 0, 1 }
+  };
+  log.append((const char*)events, sizeof(events));
+  // And an event cut short
+  log.append(10, '\0');
+
+  ofstream file("test_ingest.bin", ios::binary);
+  file.write(log.data(), log.size());
+  file.close();
+
+  heatmap_service::HeatmapService heatmap = heatmap_service::HeatmapService();
+  HeatmapIngestResult ingest_result;
+  bool result = heatmap.IngestEventFile("test_ingest.bin", kBinaryEventFormat, ingest_result) &&
+    ingest_result.events_ingested == 3 && ingest_result.rejected_records == 3 &&
+    3 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey) &&
+    5 == heatmap.getCounterAtPosition({ -11, 3 }, kKillsCounterKey);
+  remove("test_ingest.bin");
+
+  // Files that don't exist, and logs that aren't binary event logs, aren't ingested
+  string csv_log = "1,1,deaths\n";
+  return result && !heatmap.IngestEventFile("test_ingest_missing.bin", kBinaryEventFormat, ingest_result) &&
+    !heatmap.IngestEventBuffer(csv_log.data(), csv_log.size(), kBinaryEventFormat, ingest_result) &&
+    3 == heatmap.getCounterAtPosition({ 0, 0 }, kDeathsCounterKey);
 }
\ No newline at end of file
@@ -10,12 +10,72 @@ bool TestRegisterReadMultiple();
 bool TestRegisterReadMultipleNonDefaultResolution();
 bool TestRegisterReadMultipleCounters();
 bool TestAllRegisteringMethods();
+bool TestTrajectoryCrossesEveryCell();
+bool TestTrajectoryRevisitPolicies();
+bool TestSplatMatchesCellIncrements();
+bool TestSplatKernelsAndInvalidSplats();
+
+bool TestGridMatchesRuntimeResolution();
+bool TestGridSharesServiceStorage();
+
+bool TestMortonLayoutMatchesColumnLayout();
+bool TestMortonLayoutSnapshotAndSerialize();
+
+bool TestCounterGroupRegisterRead();
+bool TestCounterGroupArea();
+bool TestCounterGroupSerializeAndSnapshot();
+
+bool TestSnapshotIsolatedFromWrites();
+bool TestSnapshotReadWhileLogging();
+
+bool TestEventQueueMatchesDirectLogging();
+bool TestEventQueueBackpressure();
+bool TestEventQueueSnapshotWhileLogging();
+
+bool TestGetStats();
+bool TestStatsTrackSnapshotCopies();
+bool TestCounterSummary();
+bool TestCounterSummaryAfterMergeRebinAndLoad();
+bool TestSparseRegionsPromoteAndDemote();
+
+bool TestLatencyHistograms();
+bool TestEventHookReceivesEvents();
 
 bool TestSimpleGetArea();
 bool TestGetAreaUnitSizedRect();
 bool TestGetAreaUpperLowerSwitched();
 bool TestSimpleGetEntireArea();
+bool TestGetMultipleCountersArea();
+bool TestParallelGetAreaMatchesSynchronous();
+
+bool TestQueryCacheReturnsCachedResult();
+bool TestQueryCacheInvalidation();
+
+bool TestSparseQueryTightBounds();
+bool TestSparseQueryMatchesDenseArea();
+bool TestRegionQueriesMatchMaskedCells();
+bool TestRegionQueryWholeMapAndInvalidRegions();
+
+bool TestSmoothedAreaPreservesTotal();
+bool TestSmoothedAreaUsesNeighboursOutsideRect();
+bool TestExpressionArea();
+bool TestInvalidExpressions();
+
+bool TestRenderCounterToPpmImage();
+bool TestRenderCounterToPngImage();
+bool TestRenderCounterToTilePyramid();
 
 bool TestSimpleSerializeDeserialize();
 bool TestDeserializeIntoFilledHeatmap();
-bool TestInvalidBufferForDeserialization();
\ No newline at end of file
+bool TestInvalidBufferForDeserialization();
+bool TestSectionedSerializeKeepsColumnsAndGroups();
+bool TestMalformedSectionedBuffers();
+bool TestLazyLoadOnlyReadsUsedCounters();
+bool TestLazyLoadFileAndWholeHeatmapOperations();
+bool TestCheckpointKeepsPointInTimeView();
+
+bool TestMergeHeatmaps();
+bool TestRebinSumsCells();
+bool TestMergeDifferentResolutions();
+bool TestIngestCsvEvents();
+bool TestIngestBinaryEventFile();
\ No newline at end of file
@@ -16,6 +16,7 @@ void TestSIVAll()
   cout << "TestSIVIterators: [" << (TestSIVIterators() ? "PASSED" : "FAILED") << "]" << endl;
   cout << "TestSIVInsertionAndGetting: [" << (TestSIVInsertionAndGetting() ? "PASSED" : "FAILED") << "]" << endl;
   cout << "TestSIVClearAndClean: [" << (TestSIVClearAndClean() ? "PASSED" : "FAILED") << "]" << endl;
+  cout << "TestSIVGrowAfterCopy: [" << (TestSIVGrowAfterCopy() ? "PASSED" : "FAILED") << "]" << endl;
 
   cout << endl;
 }
@@ -63,4 +64,18 @@ bool TestSIVClearAndClean() {
   vec.clean();
 
   return vec.size() == 0;
+}
+bool TestSIVGrowAfterCopy() {
+  // Copies are allocated to fit their values exactly, off center from index zero. Growing them must still keep every value
+  SignedIndexVector<int> vec;
+  for (int i = -3; i < 100; i++)
+    vec[i] = i;
+  SignedIndexVector<int> copy(vec);
+  copy[-200] = -200;
+  copy[300] = 300;
+
+  bool result = copy.size() == 501 && copy.lowest_index() == -200;
+  for (int i = -3; i < 100; i++)
+    result = result && copy[i] == i;
+  return result && copy[-200] == -200 && copy[300] == 300 && copy[150] == 0;
 }
\ No newline at end of file
@@ -9,4 +9,5 @@ bool TestSIVCreationPrefilledCreation();
 bool TestSIVCopyAssignment();
 bool TestSIVIterators();
 bool TestSIVInsertionAndGetting();
-bool TestSIVClearAndClean();
\ No newline at end of file
+bool TestSIVClearAndClean();
+bool TestSIVGrowAfterCopy();
\ No newline at end of file